@@ -0,0 +1,143 @@
+// Counts the heap allocations made while a patient list is fetched and released. The fetch is
+// simulated by parsing a public:patients frame and one frame per patient and moving the parsed
+// data into the list, like PatientDataConn does.
+//
+// The heap case uses the default memory resource for everything. The arena case parses into a
+// std::pmr::monotonic_buffer_resource owned with the list, like ViewRayClient::getPatientList.
+//
+// Usage: alloc_bench [patients]
+#include "alloc_counter.h"
+#include "bench_util.h"
+#include "patient_parser.h"
+#include "synthetic_patients.h"
+#include <chrono>
+#include <memory_resource>
+#include <unordered_map>
+#include <vector>
+
+using namespace ViewRay;
+using namespace ViewRay::Bench;
+
+namespace {
+	using PatientList = std::pmr::unordered_map<std::string, Patient>;
+
+	void fail(const char* name) {
+		std::fprintf(stderr, "%s: parsing failed\n", name);
+		std::exit(1);
+	}
+
+	void buildList(
+		const char* name,
+		const std::string& listFrame,
+		const std::vector<std::string>& frames,
+		std::pmr::memory_resource* resource,
+		PatientList& list
+	) {
+		UpdateSubscriptions skeleton(resource);
+		if (!parseUpdateSubscriptions(listFrame, skeleton)) {
+			fail(name);
+		}
+		list.reserve(skeleton.patients.size());
+		for (auto& patient : skeleton.patients) {
+			list.emplace(patient.first, std::move(patient.second));
+		}
+		for (const std::string& frame : frames) {
+			UpdateSubscriptions update(resource);
+			if (!parseUpdateSubscriptions(frame, update) || update.diagnoses.size() != 1) {
+				fail(name);
+			}
+			list.find(update.diagnoses[0].first)
+				->second.setDiagnoses(std::move(update.diagnoses[0].second));
+		}
+	}
+
+	void printRow(
+		const char* name,
+		int patients,
+		const AllocationStats& build,
+		double buildMs,
+		const AllocationStats& release,
+		double releaseMs
+	) {
+		std::printf(
+			"%-8s %14zu %12.1f %12.1f %12.3f %14zu %12.3f\n",
+			name,
+			build.allocations,
+			double(build.allocations) / patients,
+			double(build.bytes) / patients,
+			buildMs,
+			release.deallocations,
+			releaseMs
+		);
+	}
+
+	double elapsedMs(std::chrono::steady_clock::time_point start) {
+		const auto end = std::chrono::steady_clock::now();
+		return std::chrono::duration<double, std::milli>(end - start).count();
+	}
+
+	/// @param[in] useArena If true the list and the parsed data use a monotonic arena
+	void run(
+		const char* name,
+		const std::string& listFrame,
+		const std::vector<std::string>& frames,
+		int patients,
+		bool useArena
+	) {
+		struct Storage {
+			std::pmr::monotonic_buffer_resource arena;
+			PatientList list{&arena};
+		};
+
+		const AllocationStats start = allocationStats();
+		const auto buildStart = std::chrono::steady_clock::now();
+		std::unique_ptr<Storage> arenaStorage;
+		std::unique_ptr<PatientList> heapList;
+		if (useArena) {
+			arenaStorage.reset(new Storage());
+			buildList(name, listFrame, frames, &arenaStorage->arena, arenaStorage->list);
+		} else {
+			heapList.reset(new PatientList(std::pmr::get_default_resource()));
+			buildList(name, listFrame, frames, std::pmr::get_default_resource(), *heapList);
+		}
+		const double buildMs = elapsedMs(buildStart);
+		const AllocationStats built = allocationStats();
+
+		const auto releaseStart = std::chrono::steady_clock::now();
+		arenaStorage.reset();
+		heapList.reset();
+		const double releaseMs = elapsedMs(releaseStart);
+		const AllocationStats released = allocationStats();
+
+		printRow(name, patients, built - start, buildMs, released - built, releaseMs);
+	}
+}  // namespace
+
+int main(int argc, char** argv) {
+	SyntheticOptions options;
+	options.patients = intArg(argc, argv, 1, 10000);
+
+	const std::string listFrame = makePatientListFrame(options).dump();
+	std::vector<std::string> frames;
+	frames.reserve(options.patients);
+	for (int i = 0; i < options.patients; ++i) {
+		frames.push_back(makePatientFrame(i, options).dump());
+	}
+
+	std::printf("%d patients\n", options.patients);
+	std::printf(
+		"%-8s %14s %12s %12s %12s %14s %12s\n",
+		"",
+		"allocations",
+		"allocs/pat",
+		"bytes/pat",
+		"build ms",
+		"frees on drop",
+		"drop ms"
+	);
+	// Allocations made by the parser for its own state (e.g. the key buffer) are included in
+	// both cases.
+	run("heap", listFrame, frames, options.patients, false);
+	run("arena", listFrame, frames, options.patients, true);
+	return 0;
+}
@@ -0,0 +1,94 @@
+// Replaces the global operator new/delete with versions which count the calls. Link it only
+// into benchmarks which report allocations.
+#include "alloc_counter.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+namespace {
+	std::atomic<size_t> allocations{0};
+	std::atomic<size_t> deallocations{0};
+	std::atomic<size_t> allocatedBytes{0};
+	std::atomic<size_t> liveHeapBytes{0};
+
+	/// Size of a malloc chunk, including its header
+	size_t chunkSize(void* ptr) {
+#if defined(__GLIBC__)
+		return ptr != nullptr ? malloc_usable_size(ptr) + sizeof(size_t) : 0;
+#else
+		(void)ptr;
+		return 0;
+#endif
+	}
+
+	void* counted(void* ptr) {
+		liveHeapBytes.fetch_add(chunkSize(ptr), std::memory_order_relaxed);
+		return ptr;
+	}
+}  // namespace
+
+namespace ViewRay::Bench {
+	AllocationStats allocationStats() {
+		AllocationStats stats;
+		stats.allocations = allocations.load(std::memory_order_relaxed);
+		stats.deallocations = deallocations.load(std::memory_order_relaxed);
+		stats.bytes = allocatedBytes.load(std::memory_order_relaxed);
+		stats.liveHeapBytes = liveHeapBytes.load(std::memory_order_relaxed);
+		return stats;
+	}
+}  // namespace ViewRay::Bench
+
+void* operator new(std::size_t size) {
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+	if (void* ptr = std::malloc(size > 0 ? size : 1)) {
+		return counted(ptr);
+	}
+	throw std::bad_alloc();
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+	return counted(std::malloc(size > 0 ? size : 1));
+}
+
+void operator delete(void* ptr) noexcept {
+	if (ptr != nullptr) {
+		deallocations.fetch_add(1, std::memory_order_relaxed);
+		liveHeapBytes.fetch_sub(chunkSize(ptr), std::memory_order_relaxed);
+		std::free(ptr);
+	}
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+	operator delete(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept {
+	operator delete(ptr);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment) {
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+	const std::size_t align = std::size_t(alignment);
+	// aligned_alloc requires the size to be a multiple of the alignment
+	const std::size_t rounded = (std::max<std::size_t>(size, 1) + align - 1) / align * align;
+	if (void* ptr = std::aligned_alloc(align, rounded)) {
+		return counted(ptr);
+	}
+	throw std::bad_alloc();
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept {
+	operator delete(ptr);
+}
+
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept {
+	operator delete(ptr);
+}
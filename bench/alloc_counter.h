@@ -0,0 +1,32 @@
+#pragma once
+#include <cstddef>
+
+namespace ViewRay::Bench {
+	/// @brief Counters of the global operator new/delete
+	///
+	/// Only available in benchmarks linked with alloc_counter.cpp, which replaces the global
+	/// allocation functions.
+	struct AllocationStats {
+		/// Number of calls to operator new
+		size_t allocations = 0;
+		/// Number of calls to operator delete with a non-null pointer
+		size_t deallocations = 0;
+		/// Sum of the sizes passed to operator new
+		size_t bytes = 0;
+		/// Bytes of the live allocations as taken from malloc, i.e. rounded up and including
+		/// the header of each chunk. 0 if the size of an allocation cannot be queried.
+		size_t liveHeapBytes = 0;
+
+		AllocationStats operator-(const AllocationStats& other) const {
+			return {
+				allocations - other.allocations,
+				deallocations - other.deallocations,
+				bytes - other.bytes,
+				liveHeapBytes - other.liveHeapBytes
+			};
+		}
+	};
+
+	/// @brief Get the counters since the start of the program
+	AllocationStats allocationStats();
+}  // namespace ViewRay::Bench
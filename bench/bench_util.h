@@ -0,0 +1,77 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+namespace ViewRay::Bench {
+	/// @brief Run f iterations times and return the average time of one run in nanoseconds
+	/// The function is run once before measuring to warm up caches and the allocator.
+	template <typename F>
+	double measureNs(int iterations, F&& f) {
+		f();
+		const auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < iterations; ++i) {
+			f();
+		}
+		const auto end = std::chrono::steady_clock::now();
+		return std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+	}
+
+	/// @brief Print one line of benchmark results
+	/// @param[in] name Name of the measured case
+	/// @param[in] nsPerRun Average time of one run
+	/// @param[in] items Number of items (e.g. patients) processed in one run
+	/// @param[in] bytes Number of input bytes processed in one run
+	inline void report(const char* name, double nsPerRun, size_t items, size_t bytes) {
+		const double mbPerSec = bytes > 0 ? (double(bytes) / (1024.0 * 1024.0)) / (nsPerRun * 1e-9) : 0.0;
+		std::printf(
+			"%-40s %12.1f ns/item %10.1f MiB/s %12.3f ms/run\n",
+			name,
+			nsPerRun / double(items),
+			mbPerSec,
+			nsPerRun * 1e-6
+		);
+	}
+
+	/// @brief Get the value below which fraction q of the samples are (nearest rank)
+	/// @param[in] samples The samples. They are sorted in place.
+	/// @param[in] q Fraction in [0, 1] e.g. 0.99 for p99
+	inline double percentile(std::vector<double>& samples, double q) {
+		if (samples.empty()) {
+			return 0.0;
+		}
+		std::sort(samples.begin(), samples.end());
+		const size_t index = std::min(samples.size() - 1, size_t(q * double(samples.size() - 1) + 0.5));
+		return samples[index];
+	}
+
+	/// @brief Peak resident set size of the process in KiB or 0 if it is not known
+	inline long peakRssKiB() {
+#if defined(__APPLE__)
+		rusage usage;
+		return getrusage(RUSAGE_SELF, &usage) == 0 ? long(usage.ru_maxrss / 1024) : 0;
+#elif defined(__unix__)
+		rusage usage;
+		return getrusage(RUSAGE_SELF, &usage) == 0 ? long(usage.ru_maxrss) : 0;
+#else
+		return 0;
+#endif
+	}
+
+	/// @brief Read a positive integer from argv[index] or return defaultValue
+	inline int intArg(int argc, char** argv, int index, int defaultValue) {
+		if (index < argc) {
+			const int value = std::atoi(argv[index]);
+			if (value > 0) {
+				return value;
+			}
+		}
+		return defaultValue;
+	}
+}  // namespace ViewRay::Bench
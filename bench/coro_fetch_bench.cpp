@@ -0,0 +1,129 @@
+// Runs many patient list fetches concurrently from C++20 coroutines on a single thread and
+// reports the wall time, the fetches per second and the latency percentiles of a fetch. Each
+// coroutine awaits asyncFetchPatientList in a loop, so the number of coroutines is the number
+// of fetches in flight. The mock ViewRay server runs in the same process on its own thread.
+//
+// At the end a fetch is cancelled through its cancellation slot to check that it completes
+// with ViewRayClient::Cancelled instead of the list.
+//
+// Usage: coro_fetch_bench [patients] [coroutines] [fetches per coroutine] [connections] [port]
+#include "bench_util.h"
+#include "client_async.h"
+#include "mock_server_client.h"
+#include <asio/bind_cancellation_slot.hpp>
+#include <asio/bind_executor.hpp>
+#include <asio/cancellation_signal.hpp>
+#include <asio/co_spawn.hpp>
+#include <asio/detached.hpp>
+#include <asio/io_context.hpp>
+#include <asio/use_awaitable.hpp>
+#include <iostream>
+
+using namespace ViewRay;
+using namespace ViewRay::Bench;
+
+namespace {
+	asio::awaitable<void> fetchLoop(
+		ViewRayClient& client,
+		int fetches,
+		int expectedPatients,
+		std::vector<double>& latencyMs
+	) {
+		for (int i = 0; i < fetches; ++i) {
+			const auto start = std::chrono::steady_clock::now();
+			const WSAsyncResult<FetchResult> result =
+				co_await asyncFetchPatientList(client, FetchOptions(), asio::use_awaitable);
+			const auto end = std::chrono::steady_clock::now();
+			if (result.hasError()) {
+				std::cerr << result.getError().getMessage() << '\n';
+				std::exit(1);
+			}
+			if (int(result.getData().patients->size()) != expectedPatients) {
+				std::cerr << "Expected " << expectedPatients << " patients, got "
+						  << result.getData().patients->size() << '\n';
+				std::exit(1);
+			}
+			latencyMs.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+		}
+	}
+}  // namespace
+
+int main(int argc, char** argv) {
+	const int patients = intArg(argc, argv, 1, 1000);
+	const int coroutines = intArg(argc, argv, 2, 200);
+	const int fetchesPerCoroutine = intArg(argc, argv, 3, 5);
+	const int connections = intArg(argc, argv, 4, 2);
+	const int port = intArg(argc, argv, 5, 9002);
+
+	MockServerClient env(patients, 0, connections, port);
+	const EC::ErrorCode err = env.start();
+	if (err.hasError()) {
+		std::cerr << err.getMessage() << '\n';
+		return err.getStatus();
+	}
+	ViewRayClient& client = env.getClient();
+
+	asio::io_context io;
+	// Opens the pooled connections before measuring
+	asio::co_spawn(
+		io,
+		[&]() -> asio::awaitable<void> {
+			const EC::ErrorCode connectErr = co_await asyncConnect(client, asio::use_awaitable);
+			if (connectErr.hasError()) {
+				std::cerr << connectErr.getMessage() << '\n';
+				std::exit(1);
+			}
+		},
+		asio::detached
+	);
+	io.run();
+	io.restart();
+
+	std::vector<std::vector<double>> latencies(coroutines);
+	const auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < coroutines; ++i) {
+		asio::co_spawn(
+			io,
+			fetchLoop(client, fetchesPerCoroutine, patients, latencies[i]),
+			asio::detached
+		);
+	}
+	io.run();
+	const double wallMs =
+		std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	io.restart();
+
+	std::vector<double> latencyMs;
+	for (const std::vector<double>& samples : latencies) {
+		latencyMs.insert(latencyMs.end(), samples.begin(), samples.end());
+	}
+	const size_t fetches = latencyMs.size();
+	std::printf(
+		"%d coroutines on 1 thread, %zu fetches of %d patients over %d connections\n",
+		coroutines,
+		fetches,
+		patients,
+		connections
+	);
+	std::printf("wall                %10.1f ms\n", wallMs);
+	std::printf("fetches/s           %10.1f\n", double(fetches) / (wallMs * 1e-3));
+	std::printf("fetch p50           %10.2f ms\n", percentile(latencyMs, 0.5));
+	std::printf("fetch p99           %10.2f ms\n", percentile(latencyMs, 0.99));
+
+	asio::cancellation_signal cancel;
+	std::string cancelled;
+	asyncFetchPatientList(
+		client,
+		FetchOptions(),
+		asio::bind_cancellation_slot(
+			cancel.slot(),
+			asio::bind_executor(io, [&](WSAsyncResult<FetchResult> result) {
+				cancelled = result.hasError() ? result.getError().getMessage() : "not cancelled";
+			})
+		)
+	);
+	cancel.emit(asio::cancellation_type::terminal);
+	io.run();
+	std::printf("cancelled fetch     %s\n", cancelled.c_str());
+	return 0;
+}
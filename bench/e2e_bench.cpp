@@ -0,0 +1,135 @@
+// Fetches the patient list from the mock ViewRay server with ViewRayClient::getPatientList and
+// reports the wall time of a fetch, the number of messages per second, the per-patient latency
+// measured by the server and the peak resident memory. The server runs in the same process on
+// its own thread. When built with PATIENT_LIST_PERMESSAGE_DEFLATE the server compresses its
+// responses and the payload bytes are reported next to the bytes sent over the wire.
+//
+// The per-patient latency is the time between sending public:patients and sending the details
+// of a patient on the same connection, i.e. how long a patient waits to be expanded.
+//
+// Usage: e2e_bench [patients] [iterations] [latency ms] [connections] [window] [port]
+#include "bench_util.h"
+#include "client.h"
+#include "mock_server.h"
+#include <nlohmann/json.hpp>
+#include <iostream>
+
+using namespace ViewRay;
+using namespace ViewRay::Bench;
+
+namespace {
+	ViewRayClient::SharedPatientListPtr fetch(ViewRayClient& client, int expectedPatients) {
+		const WSAsyncResult<ViewRayClient::SharedPatientListPtr> result =
+			client.getPatientList().get();
+		if (result.hasError()) {
+			std::cerr << result.getError().getMessage() << '\n';
+			std::exit(1);
+		}
+		ViewRayClient::SharedPatientListPtr list = result.getData();
+		if (int(list->size()) != expectedPatients) {
+			std::cerr << "Expected " << expectedPatients << " patients, got " << list->size() << '\n';
+			std::exit(1);
+		}
+		return list;
+	}
+
+	/// Sum of all series of a counter in the registry
+	double counterTotal(const nlohmann::json& metrics, const char* name) {
+		double total = 0;
+		const auto metricIt = metrics.find(name);
+		if (metricIt != metrics.end()) {
+			for (const nlohmann::json& series : metricIt->at("series")) {
+				total += series.at("value").get<double>();
+			}
+		}
+		return total;
+	}
+}  // namespace
+
+int main(int argc, char** argv) {
+	MockServerOptions serverOptions;
+	serverOptions.data.patients = intArg(argc, argv, 1, 5000);
+	const int iterations = intArg(argc, argv, 2, 5);
+	serverOptions.latencyMs = intArg(argc, argv, 3, 0);
+	const int connections = intArg(argc, argv, 4, 2);
+	const int window = intArg(argc, argv, 5, ViewRayClient::defaultRequestWindow);
+	serverOptions.port = intArg(argc, argv, 6, serverOptions.port);
+
+	MockViewRayServer server(serverOptions);
+	const EC::ErrorCode err = server.start();
+	if (err.hasError()) {
+		std::cerr << err.getMessage() << '\n';
+		return err.getStatus();
+	}
+	const long rssBeforeClient = peakRssKiB();
+
+	std::vector<double> wallMs;
+	MockViewRayServer::Stats stats;
+	nlohmann::json metrics;
+	{
+		ViewRayClient client(server.getAddress(), connections);
+		client.setRequestWindow(window);
+		client.init();
+		// Opens the pooled connections and warms up the allocator
+		fetch(client, serverOptions.data.patients);
+		server.takeStats();
+
+		for (int i = 0; i < iterations; ++i) {
+			const auto start = std::chrono::steady_clock::now();
+			const ViewRayClient::SharedPatientListPtr list =
+				fetch(client, serverOptions.data.patients);
+			const auto end = std::chrono::steady_clock::now();
+			wallMs.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+		}
+		stats = server.takeStats();
+		// Taken while the connections are open, their series are removed when they close
+		metrics = nlohmann::json::parse(client.getMetrics().toJson());
+	}
+	server.stop();
+
+	double totalMs = 0;
+	for (const double ms : wallMs) {
+		totalMs += ms;
+	}
+	std::printf(
+		"%d patients, %d iterations, %d ms server latency, %d connections, window %d\n",
+		serverOptions.data.patients,
+		iterations,
+		serverOptions.latencyMs,
+		connections,
+		window
+	);
+	std::printf(
+		"fetch wall time    p50 %10.3f ms   min %10.3f ms   max %10.3f ms\n",
+		percentile(wallMs, 0.5),
+		percentile(wallMs, 0.0),
+		percentile(wallMs, 1.0)
+	);
+	std::printf(
+		"messages           %zu received by the client, %.0f msgs/s\n",
+		stats.responses,
+		double(stats.responses) / (totalMs * 1e-3)
+	);
+	std::printf(
+		"patient latency    p50 %10.3f ms   p99 %10.3f ms\n",
+		percentile(stats.patientLatencyMs, 0.5),
+		percentile(stats.patientLatencyMs, 0.99)
+	);
+	const double payloadBytes = counterTotal(metrics, "viewray_ws_received_bytes_total");
+	const double wireBytes = counterTotal(metrics, "viewray_ws_received_wire_bytes_total");
+	std::printf(
+		"received bytes     %.1f MiB payload, %.1f MiB on the wire (%.2fx), deflate on %.0f of "
+		"%.0f connections\n",
+		payloadBytes / (1024.0 * 1024.0),
+		wireBytes / (1024.0 * 1024.0),
+		wireBytes > 0 ? payloadBytes / wireBytes : 0.0,
+		counterTotal(metrics, "viewray_ws_connections_deflate_total"),
+		counterTotal(metrics, "viewray_ws_connections_opened_total")
+	);
+	std::printf(
+		"peak RSS           %.1f MiB (%.1f MiB before the client was started)\n",
+		double(peakRssKiB()) / 1024.0,
+		double(rssBeforeClient) / 1024.0
+	);
+	return 0;
+}
@@ -0,0 +1,146 @@
+// Bytes per patient of a resident patient list in each representation: Patient on the heap,
+// Patient in the arena of a fetch, PatientTable and CompactPatient. The list is parsed from
+// synthetic frames and the heap which stays allocated afterwards is measured, including the
+// rounding and the chunk headers of malloc where it can be queried (glibc). The compact list
+// is built twice, like the lists of two sites, to show the cost once the symbols are shared.
+//
+// The synthetic names and descriptions are all distinct, while in real lists they repeat, so
+// the compact representation saves more on recorded data.
+//
+// Usage: footprint_bench [patients] [textLength]
+#include "alloc_counter.h"
+#include "bench_util.h"
+#include "compact_patient.h"
+#include "patient_parser.h"
+#include "patient_table.h"
+#include "synthetic_patients.h"
+#include <memory>
+#include <memory_resource>
+#include <unordered_map>
+#include <vector>
+
+using namespace ViewRay;
+using namespace ViewRay::Bench;
+
+namespace {
+	using PatientList = std::pmr::unordered_map<std::string, Patient>;
+	using CompactList = std::unordered_map<std::string, CompactPatient>;
+
+	void fail(const char* name) {
+		std::fprintf(stderr, "%s failed\n", name);
+		std::exit(1);
+	}
+
+	void buildList(
+		const std::string& listFrame,
+		const std::vector<std::string>& frames,
+		std::pmr::memory_resource* resource,
+		PatientList& list
+	) {
+		UpdateSubscriptions skeleton(resource);
+		if (!parseUpdateSubscriptions(listFrame, skeleton)) {
+			fail("parsing public:patients");
+		}
+		list.reserve(skeleton.patients.size());
+		for (auto& patient : skeleton.patients) {
+			list.emplace(patient.first, std::move(patient.second));
+		}
+		for (const std::string& frame : frames) {
+			UpdateSubscriptions update(resource);
+			if (!parseUpdateSubscriptions(frame, update) || update.diagnoses.size() != 1) {
+				fail("parsing a patient");
+			}
+			list.find(update.diagnoses[0].first)
+				->second.setDiagnoses(std::move(update.diagnoses[0].second));
+		}
+	}
+
+	CompactList compact(const PatientList& list) {
+		CompactList compacted;
+		compacted.reserve(list.size());
+		for (const auto& entry : list) {
+			compacted.emplace(entry.first, CompactPatient(entry.second));
+		}
+		return compacted;
+	}
+
+	/// Print the heap which stayed allocated since before
+	void printRow(const char* name, const AllocationStats& before, int patients) {
+		const AllocationStats grown = allocationStats() - before;
+		std::printf(
+			"%-32s %12.1f %12.1f %14.1f\n",
+			name,
+			double(grown.liveHeapBytes) / patients,
+			double(grown.allocations - grown.deallocations) / patients,
+			double(grown.liveHeapBytes) / (1024.0 * 1024.0)
+		);
+	}
+}  // namespace
+
+int main(int argc, char** argv) {
+	SyntheticOptions options;
+	options.patients = intArg(argc, argv, 1, 20000);
+	options.textLength = intArg(argc, argv, 2, options.textLength);
+
+	const std::string listFrame = makePatientListFrame(options).dump();
+	std::vector<std::string> frames;
+	frames.reserve(options.patients);
+	for (int i = 0; i < options.patients; ++i) {
+		frames.push_back(makePatientFrame(i, options).dump());
+	}
+
+	std::printf(
+		"%d patients, sizeof(Patient) %zu, sizeof(CompactPatient) %zu\n",
+		options.patients,
+		sizeof(Patient),
+		sizeof(CompactPatient)
+	);
+	if (allocationStats().liveHeapBytes == 0) {
+		std::printf("The size of an allocation cannot be queried, the bytes are not known\n");
+	}
+	std::printf("%-32s %12s %12s %14s\n", "", "B/patient", "allocs/pat", "MiB");
+
+	AllocationStats before = allocationStats();
+	PatientList heapList(std::pmr::get_default_resource());
+	buildList(listFrame, frames, std::pmr::get_default_resource(), heapList);
+	printRow("Patient (heap)", before, options.patients);
+
+	{
+		before = allocationStats();
+		auto arena = std::make_unique<std::pmr::monotonic_buffer_resource>();
+		PatientList arenaList(arena.get());
+		buildList(listFrame, frames, arena.get(), arenaList);
+		printRow("Patient (arena of a fetch)", before, options.patients);
+	}
+
+	{
+		before = allocationStats();
+		const PatientTable table(heapList);
+		printRow("PatientTable", before, options.patients);
+	}
+
+	before = allocationStats();
+	const CompactList firstSite = compact(heapList);
+	printRow("CompactPatient", before, options.patients);
+
+	before = allocationStats();
+	const CompactList secondSite = compact(heapList);
+	printRow("CompactPatient, symbols shared", before, options.patients);
+
+	const SymbolTable& symbols = SymbolTable::global();
+	std::printf(
+		"%zu symbols, %.1f MiB of characters\n",
+		symbols.size(),
+		double(symbols.capacityBytes()) / (1024.0 * 1024.0)
+	);
+
+	// The compact list must convert back to exactly the parsed one
+	for (const auto& entry : heapList) {
+		const Patient restored = firstSite.at(entry.first).toPatient();
+		if (!restored.hasSameSummary(entry.second) ||
+			!restored.hasSameDiagnoses(entry.second.getDiagnoses())) {
+			fail("CompactPatient round trip");
+		}
+	}
+	return 0;
+}
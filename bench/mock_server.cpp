@@ -0,0 +1,155 @@
+#include "mock_server.h"
+#include <nlohmann/json.hpp>
+#include <algorithm>
+
+namespace ViewRay::Bench {
+	MockViewRayServer::MockViewRayServer(MockServerOptions options) :
+		options(std::move(options)) {
+		const SyntheticOptions& data = this->options.data;
+		listFrame = makePatientListFrame(data).dump();
+		patientFrames.reserve(data.patients);
+		for (int i = 0; i < data.patients; ++i) {
+			patientFrames.emplace(patientUri(i), makePatientFrame(i, data).dump());
+		}
+
+		server.clear_access_channels(websocketpp::log::alevel::all);
+		server.clear_error_channels(websocketpp::log::elevel::all);
+		server.set_message_handler([this](websocketpp::connection_hdl hdl, Server::message_ptr msg) {
+			onMessage(hdl, msg);
+		});
+		server.set_close_handler([this](websocketpp::connection_hdl hdl) {
+			std::lock_guard<std::mutex> lock(statsMutex);
+			listSentAt.erase(hdl);
+		});
+	}
+
+	MockViewRayServer::~MockViewRayServer() {
+		stop();
+	}
+
+	EC::ErrorCode MockViewRayServer::start() {
+		websocketpp::lib::error_code ec;
+		server.init_asio(ec);
+		if (ec) {
+			return EC::ErrorCode(1, "Cannot initialize the server: %s", ec.message().c_str());
+		}
+		server.set_reuse_addr(true);
+		server.listen(uint16_t(options.port), ec);
+		if (ec) {
+			return EC::ErrorCode(
+				1, "Cannot listen on port %d: %s", options.port, ec.message().c_str()
+			);
+		}
+		server.start_accept(ec);
+		if (ec) {
+			return EC::ErrorCode(1, "Cannot accept connections: %s", ec.message().c_str());
+		}
+		for (int i = 0; i < std::max(options.threads, 1); ++i) {
+			threads.emplace_back([this]() { server.run(); });
+		}
+		return EC::ErrorCode();
+	}
+
+	void MockViewRayServer::stop() {
+		if (threads.empty()) {
+			return;
+		}
+		websocketpp::lib::error_code ec;
+		server.stop_listening(ec);
+		server.stop();
+		wait();
+	}
+
+	void MockViewRayServer::wait() {
+		for (std::thread& thread : threads) {
+			if (thread.joinable()) {
+				thread.join();
+			}
+		}
+		threads.clear();
+	}
+
+	std::string MockViewRayServer::getAddress() const {
+		return "ws://localhost:" + std::to_string(options.port);
+	}
+
+	MockViewRayServer::Stats MockViewRayServer::takeStats() {
+		std::lock_guard<std::mutex> lock(statsMutex);
+		Stats result = std::move(stats);
+		stats = Stats();
+		return result;
+	}
+
+	void MockViewRayServer::onMessage(websocketpp::connection_hdl hdl, Server::message_ptr msg) {
+		{
+			std::lock_guard<std::mutex> lock(statsMutex);
+			stats.requests++;
+		}
+		const nlohmann::json request = nlohmann::json::parse(msg->get_payload(), nullptr, false);
+		if (request.is_discarded() || !request.is_object()) {
+			return;
+		}
+		const auto subscriptions = request.find("setSubscriptions");
+		if (subscriptions == request.end() || !subscriptions->is_object()) {
+			return;
+		}
+		for (auto it = subscriptions->begin(); it != subscriptions->end(); ++it) {
+			if (it.value() == "unsubscribe") {
+				continue;
+			}
+			if (it.key() == "public:patients") {
+				respond(hdl, &listFrame, false);
+				continue;
+			}
+			const auto frameIt = patientFrames.find(it.key());
+			if (frameIt != patientFrames.end()) {
+				respond(hdl, &frameIt->second, true);
+			}
+		}
+	}
+
+	void MockViewRayServer::respond(
+		websocketpp::connection_hdl hdl,
+		const std::string* frame,
+		bool isPatient
+	) {
+		if (options.latencyMs <= 0) {
+			send(hdl, frame, isPatient);
+			return;
+		}
+		server.set_timer(
+			options.latencyMs,
+			[this, hdl, frame, isPatient](const websocketpp::lib::error_code& ec) {
+				if (!ec) {
+					send(hdl, frame, isPatient);
+				}
+			}
+		);
+	}
+
+	void MockViewRayServer::send(
+		websocketpp::connection_hdl hdl,
+		const std::string* frame,
+		bool isPatient
+	) {
+		websocketpp::lib::error_code ec;
+		server.send(hdl, *frame, websocketpp::frame::opcode::text, ec);
+		if (ec) {
+			return;
+		}
+
+		const Clock::time_point now = Clock::now();
+		std::lock_guard<std::mutex> lock(statsMutex);
+		stats.responses++;
+		if (!isPatient) {
+			listSentAt[hdl] = now;
+			return;
+		}
+		const auto sentIt = listSentAt.find(hdl);
+		if (sentIt != listSentAt.end()) {
+			stats.patientLatencyMs.push_back(
+				std::chrono::duration<double, std::milli>(now - sentIt->second).count()
+			);
+		}
+	}
+}  // namespace ViewRay::Bench
@@ -0,0 +1,132 @@
+#pragma once
+#include "error_code.h"
+#include "synthetic_patients.h"
+#include <websocketpp/config/asio_no_tls.hpp>
+#include <websocketpp/server.hpp>
+#ifdef PATIENT_LIST_PERMESSAGE_DEFLATE
+#include <websocketpp/extensions/permessage_deflate/enabled.hpp>
+#endif
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace ViewRay::Bench {
+#ifdef PATIENT_LIST_PERMESSAGE_DEFLATE
+	/// @brief websocketpp server config which accepts permessage-deflate offers
+	struct DeflateServerConfig : public websocketpp::config::asio {
+		using type = DeflateServerConfig;
+		using base = websocketpp::config::asio;
+
+		using concurrency_type = base::concurrency_type;
+		using request_type = base::request_type;
+		using response_type = base::response_type;
+		using message_type = base::message_type;
+		using con_msg_manager_type = base::con_msg_manager_type;
+		using endpoint_msg_manager_type = base::endpoint_msg_manager_type;
+		using alog_type = base::alog_type;
+		using elog_type = base::elog_type;
+		using rng_type = base::rng_type;
+
+		struct transport_config : public base::transport_config {
+			using concurrency_type = type::concurrency_type;
+			using alog_type = type::alog_type;
+			using elog_type = type::elog_type;
+			using request_type = type::request_type;
+			using response_type = type::response_type;
+			using socket_type = websocketpp::transport::asio::basic_socket::endpoint;
+		};
+
+		using transport_type = websocketpp::transport::asio::endpoint<transport_config>;
+
+		struct permessage_deflate_config {};
+		using permessage_deflate_type =
+			websocketpp::extensions::permessage_deflate::enabled<permessage_deflate_config>;
+	};
+
+	/// Compresses its responses if the client offers permessage-deflate
+	using MockServerConfig = DeflateServerConfig;
+#else
+	using MockServerConfig = websocketpp::config::asio;
+#endif
+
+	struct MockServerOptions {
+		/// Number and shape of the generated patients
+		SyntheticOptions data;
+		/// Port on which the server listens
+		int port = 9002;
+		/// Delay before each response is sent in milliseconds
+		int latencyMs = 0;
+		/// Number of threads which run the server
+		int threads = 1;
+	};
+
+	/// @brief Local stand-in for the ViewRay server
+	///
+	/// Speaks the subset of the protocol used by ViewRayClient. Each
+	/// {"setSubscriptions": {<uri>: <mode>}} request is answered with the
+	/// {"updateSubscriptions": {<uri>: ...}} frame for the URI, where public:patients is the
+	/// list of all synthetic patients and each patient URI returns the diagnoses of the patient.
+	/// "subscribe" is answered like "request", no updates are pushed afterwards. "unsubscribe"
+	/// and unknown URIs are ignored. All frames are generated when the server is created.
+	class MockViewRayServer {
+	public:
+		using Server = websocketpp::server<MockServerConfig>;
+		using Clock = std::chrono::steady_clock;
+
+		/// @brief Counters collected while serving requests
+		struct Stats {
+			/// Number of received requests
+			size_t requests = 0;
+			/// Number of sent updateSubscriptions frames
+			size_t responses = 0;
+			/// For each patient response, the time between sending public:patients on the
+			/// same connection and sending the patient, in milliseconds
+			std::vector<double> patientLatencyMs;
+		};
+
+		explicit MockViewRayServer(MockServerOptions options);
+		~MockViewRayServer();
+
+		MockViewRayServer(const MockViewRayServer&) = delete;
+		MockViewRayServer& operator=(const MockViewRayServer&) = delete;
+
+		/// @brief Start listening and start the server threads
+		EC::ErrorCode start();
+
+		/// @brief Stop the server and join its threads. Open connections are dropped.
+		void stop();
+
+		/// @brief Block until the server is stopped
+		void wait();
+
+		/// @brief The address to pass to ViewRayClient
+		std::string getAddress() const;
+
+		/// @brief Return the counters collected since the last call and reset them
+		Stats takeStats();
+
+	private:
+		void onMessage(websocketpp::connection_hdl hdl, Server::message_ptr msg);
+		/// Send a frame after the configured latency
+		void respond(websocketpp::connection_hdl hdl, const std::string* frame, bool isPatient);
+		void send(websocketpp::connection_hdl hdl, const std::string* frame, bool isPatient);
+
+		MockServerOptions options;
+		std::string listFrame;
+		/// updateSubscriptions frame for each patient URI
+		std::unordered_map<std::string, std::string> patientFrames;
+		Server server;
+		std::vector<std::thread> threads;
+		/// Guards stats and listSentAt
+		std::mutex statsMutex;
+		Stats stats;
+		/// When public:patients was last sent on each connection
+		std::map<websocketpp::connection_hdl, Clock::time_point, std::owner_less<websocketpp::connection_hdl>>
+			listSentAt;
+	};
+}  // namespace ViewRay::Bench
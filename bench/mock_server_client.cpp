@@ -0,0 +1,37 @@
+#include "mock_server_client.h"
+#include "client.h"
+#include "mock_server.h"
+
+namespace ViewRay::Bench {
+	struct MockServerClient::Impl {
+		Impl(const MockServerOptions& options, int connections) :
+			server(options),
+			client(server.getAddress(), connections) {
+		}
+
+		MockViewRayServer server;
+		ViewRayClient client;
+	};
+
+	MockServerClient::MockServerClient(int patients, int latencyMs, int connections, int port) {
+		MockServerOptions options;
+		options.data.patients = patients;
+		options.latencyMs = latencyMs;
+		options.port = port;
+		impl.reset(new Impl(options, connections));
+	}
+
+	MockServerClient::~MockServerClient() = default;
+
+	EC::ErrorCode MockServerClient::start() {
+		const EC::ErrorCode err = impl->server.start();
+		if (err.hasError()) {
+			return err;
+		}
+		return impl->client.init();
+	}
+
+	ViewRayClient& MockServerClient::getClient() {
+		return impl->client;
+	}
+}  // namespace ViewRay::Bench
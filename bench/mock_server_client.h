@@ -0,0 +1,32 @@
+#pragma once
+#include "error_code.h"
+#include <memory>
+
+namespace ViewRay {
+	class ViewRayClient;
+}
+
+namespace ViewRay::Bench {
+	/// @brief The mock ViewRay server and a ViewRayClient connected to it
+	///
+	/// Hides websocketpp, so that benchmarks compiled as C++20 (e.g. the coroutine benchmark)
+	/// can use the client through client_async.h.
+	class MockServerClient {
+	public:
+		/// @param[in] patients Number of synthetic patients served
+		/// @param[in] latencyMs Delay before each response of the server
+		/// @param[in] connections Size of the connection pool of the client
+		/// @param[in] port Port on which the server listens
+		MockServerClient(int patients, int latencyMs, int connections, int port);
+		~MockServerClient();
+
+		/// @brief Start the server and initialize the client
+		EC::ErrorCode start();
+
+		ViewRayClient& getClient();
+
+	private:
+		struct Impl;
+		std::unique_ptr<Impl> impl;
+	};
+}  // namespace ViewRay::Bench
@@ -0,0 +1,28 @@
+// Runs the mock ViewRay server until the process is killed. Point patient_list at it with
+// patient_list ws://localhost:<port>
+//
+// Usage: mock_viewray_server [port] [patients] [latency ms] [diagnoses] [text length]
+#include "bench_util.h"
+#include "mock_server.h"
+#include <iostream>
+
+using namespace ViewRay::Bench;
+
+int main(int argc, char** argv) {
+	MockServerOptions options;
+	options.port = intArg(argc, argv, 1, options.port);
+	options.data.patients = intArg(argc, argv, 2, options.data.patients);
+	options.latencyMs = intArg(argc, argv, 3, 0);
+	options.data.diagnoses = intArg(argc, argv, 4, options.data.diagnoses);
+	options.data.textLength = intArg(argc, argv, 5, options.data.textLength);
+
+	MockViewRayServer server(options);
+	const EC::ErrorCode err = server.start();
+	if (err.hasError()) {
+		std::cerr << err.getMessage() << '\n';
+		return err.getStatus();
+	}
+	std::printf("Serving %d patients on %s\n", options.data.patients, server.getAddress().c_str());
+	server.wait();
+	return 0;
+}
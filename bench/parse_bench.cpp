@@ -0,0 +1,65 @@
+// Compares the single pass parser of updateSubscriptions frames with the one which builds a
+// nlohmann::json document and uses the constructors of the patient data classes.
+//
+// Usage: parse_bench [patients] [iterations]
+#include "bench_util.h"
+#include "patient_parser.h"
+#include "synthetic_patients.h"
+#include <vector>
+
+using namespace ViewRay;
+using namespace ViewRay::Bench;
+
+namespace {
+	template <typename ParseFn>
+	void runList(const char* name, const std::string& payload, int patients, int iterations, ParseFn parse) {
+		const double ns = measureNs(iterations, [&]() {
+			UpdateSubscriptions update;
+			if (!parse(payload, update) || int(update.patients.size()) != patients) {
+				std::fprintf(stderr, "%s: parsing failed\n", name);
+				std::exit(1);
+			}
+		});
+		report(name, ns, patients, payload.size());
+	}
+
+	template <typename ParseFn>
+	void runFrames(const char* name, const std::vector<std::string>& frames, size_t bytes, int iterations, ParseFn parse) {
+		const double ns = measureNs(iterations, [&]() {
+			for (const std::string& frame : frames) {
+				UpdateSubscriptions update;
+				if (!parse(frame, update) || update.diagnoses.size() != 1) {
+					std::fprintf(stderr, "%s: parsing failed\n", name);
+					std::exit(1);
+				}
+			}
+		});
+		report(name, ns, frames.size(), bytes);
+	}
+}  // namespace
+
+int main(int argc, char** argv) {
+	SyntheticOptions options;
+	options.patients = intArg(argc, argv, 1, 10000);
+	const int iterations = intArg(argc, argv, 2, 10);
+
+	const std::string list = makePatientListFrame(options).dump();
+	std::vector<std::string> frames;
+	size_t framesBytes = 0;
+	for (int i = 0; i < options.patients; ++i) {
+		frames.push_back(makePatientFrame(i, options).dump());
+		framesBytes += frames.back().size();
+	}
+
+	std::printf(
+		"%d patients, public:patients frame %zu bytes, patient frames %zu bytes\n",
+		options.patients,
+		list.size(),
+		framesBytes
+	);
+	runList("public:patients dom", list, options.patients, iterations, parseUpdateSubscriptionsDom);
+	runList("public:patients sax", list, options.patients, iterations, parseUpdateSubscriptions);
+	runFrames("patient frames dom", frames, framesBytes, iterations, parseUpdateSubscriptionsDom);
+	runFrames("patient frames sax", frames, framesBytes, iterations, parseUpdateSubscriptions);
+	return 0;
+}
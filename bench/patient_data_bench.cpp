@@ -0,0 +1,256 @@
+// Measures the patient data code on its own: nlohmann::json::parse of whole updateSubscriptions
+// frames, the Patient(const json&) constructor, Patient::diagnosesFromJson, printing the list
+// with operator<< and PatientFormatter and writing and reading it with PatientBinaryWriter and
+// PatientBinaryReader. Reports the time and the heap allocations per patient, so that parser or
+// layout changes can be compared with a baseline.
+//
+// Synthetic frames are used by default. Recorded frames can be passed in a file with one
+// updateSubscriptions frame per line. The frame which contains public:patients is used as the
+// list and all others as patient frames.
+//
+// Usage: patient_data_bench [patients] [iterations] [recorded frames file]
+#include "alloc_counter.h"
+#include "bench_util.h"
+#include "patient_binary.h"
+#include "patient_data.h"
+#include "patient_formatter.h"
+#include "synthetic_patients.h"
+#include <fstream>
+#include <sstream>
+#include <streambuf>
+#include <thread>
+#include <vector>
+
+using namespace ViewRay;
+using namespace ViewRay::Bench;
+
+namespace {
+	/// Stream buffer which counts and drops everything written to it, so that printing is
+	/// measured without the cost of growing a string
+	class CountingBuffer : public std::streambuf {
+	public:
+		size_t getCount() const {
+			return count;
+		}
+
+	protected:
+		int_type overflow(int_type c) override {
+			count++;
+			return c;
+		}
+		std::streamsize xsputn(const char*, std::streamsize n) override {
+			count += size_t(n);
+			return n;
+		}
+
+	private:
+		size_t count = 0;
+	};
+
+	struct Payloads {
+		std::string listFrame;
+		std::vector<std::string> patientFrames;
+	};
+
+	Payloads makeSynthetic(const SyntheticOptions& options) {
+		Payloads payloads;
+		payloads.listFrame = makePatientListFrame(options).dump();
+		payloads.patientFrames.reserve(options.patients);
+		for (int i = 0; i < options.patients; ++i) {
+			payloads.patientFrames.push_back(makePatientFrame(i, options).dump());
+		}
+		return payloads;
+	}
+
+	bool loadRecorded(const char* path, Payloads& payloads) {
+		std::ifstream file(path);
+		if (!file) {
+			return false;
+		}
+		std::string line;
+		while (std::getline(file, line)) {
+			if (line.empty()) {
+				continue;
+			}
+			if (payloads.listFrame.empty() && line.find("\"public:patients\"") != std::string::npos) {
+				payloads.listFrame = std::move(line);
+			} else {
+				payloads.patientFrames.push_back(std::move(line));
+			}
+		}
+		return !payloads.listFrame.empty();
+	}
+
+	/// Run f iterations times and print the time and the allocations per item
+	template <typename F>
+	void run(const char* name, int iterations, size_t items, size_t bytes, F&& f) {
+		const AllocationStats before = allocationStats();
+		const double ns = measureNs(iterations, f);
+		// measureNs runs f once more to warm up, the allocations of that run are counted too
+		const AllocationStats allocated = allocationStats() - before;
+		const double runs = double(iterations + 1);
+		std::printf(
+			"%-32s %10.1f ns/patient %8.1f MiB/s %8.1f allocs/patient %10.1f B/patient\n",
+			name,
+			ns / double(items),
+			bytes > 0 ? (double(bytes) / (1024.0 * 1024.0)) / (ns * 1e-9) : 0.0,
+			double(allocated.allocations) / runs / double(items),
+			double(allocated.bytes) / runs / double(items)
+		);
+	}
+
+	const nlohmann::json& patientsOf(const nlohmann::json& listFrame) {
+		return listFrame.at("updateSubscriptions").at("public:patients").at("value");
+	}
+
+	const nlohmann::json& diagnosesOf(const nlohmann::json& patientFrame) {
+		return patientFrame.at("updateSubscriptions").begin()->at("diagnoses");
+	}
+}  // namespace
+
+int main(int argc, char** argv) {
+	SyntheticOptions options;
+	options.patients = intArg(argc, argv, 1, 10000);
+	const int iterations = intArg(argc, argv, 2, 5);
+
+	Payloads payloads;
+	if (argc > 3) {
+		if (!loadRecorded(argv[3], payloads)) {
+			std::fprintf(stderr, "Cannot read public:patients frame from %s\n", argv[3]);
+			return 1;
+		}
+	} else {
+		payloads = makeSynthetic(options);
+	}
+
+	const nlohmann::json listJson = nlohmann::json::parse(payloads.listFrame);
+	const size_t patients = patientsOf(listJson).size();
+	std::vector<nlohmann::json> patientJsons;
+	size_t patientFramesBytes = 0;
+	patientJsons.reserve(payloads.patientFrames.size());
+	for (const std::string& frame : payloads.patientFrames) {
+		patientJsons.push_back(nlohmann::json::parse(frame));
+		patientFramesBytes += frame.size();
+	}
+	const size_t expanded = patientJsons.size();
+	if (patients == 0 || expanded == 0) {
+		std::fprintf(stderr, "No patients to measure\n");
+		return 1;
+	}
+
+	// The list used for printing, with the diagnoses of each patient
+	std::vector<Patient> list;
+	list.reserve(patients);
+	for (const nlohmann::json& json : patientsOf(listJson)) {
+		list.emplace_back(json);
+	}
+	for (size_t i = 0; i < expanded && i < list.size(); ++i) {
+		list[i].diagnosesFromJson(diagnosesOf(patientJsons[i]));
+	}
+
+	std::printf(
+		"%zu patients, %zu patient frames, public:patients %zu bytes, patient frames %zu bytes\n",
+		patients,
+		expanded,
+		payloads.listFrame.size(),
+		patientFramesBytes
+	);
+
+	run("json::parse public:patients", iterations, patients, payloads.listFrame.size(), [&]() {
+		const nlohmann::json json = nlohmann::json::parse(payloads.listFrame);
+		return json.size();
+	});
+	run("json::parse patient frames", iterations, expanded, patientFramesBytes, [&]() {
+		size_t size = 0;
+		for (const std::string& frame : payloads.patientFrames) {
+			size += nlohmann::json::parse(frame).size();
+		}
+		return size;
+	});
+	run("Patient(const json&)", iterations, patients, 0, [&]() {
+		std::vector<Patient> parsed;
+		parsed.reserve(patients);
+		for (const nlohmann::json& json : patientsOf(listJson)) {
+			parsed.emplace_back(json);
+		}
+		return parsed.size();
+	});
+	run("Patient::diagnosesFromJson", iterations, expanded, 0, [&]() {
+		Patient patient;
+		for (const nlohmann::json& json : patientJsons) {
+			patient.diagnosesFromJson(diagnosesOf(json));
+		}
+	});
+
+	CountingBuffer printed;
+	std::ostream sink(&printed);
+	for (const Patient& patient : list) {
+		sink << patient;
+	}
+	run("operator<<(Patient)", iterations, patients, printed.getCount(), [&]() {
+		for (const Patient& patient : list) {
+			sink << patient;
+		}
+	});
+
+	std::vector<const Patient*> pointers;
+	pointers.reserve(list.size());
+	for (const Patient& patient : list) {
+		pointers.push_back(&patient);
+	}
+	// Rendered on one thread and, if there are more cores, on all of them
+	std::vector<unsigned> formatThreadCounts = {1};
+	if (std::thread::hardware_concurrency() > 1) {
+		formatThreadCounts.push_back(std::thread::hardware_concurrency());
+	}
+	const std::pair<const char*, PatientFormatter::Format> formats[] = {
+		{"text", PatientFormatter::Format::Text},
+		{"jsonl", PatientFormatter::Format::JsonLines},
+		{"csv", PatientFormatter::Format::Csv}
+	};
+	for (const auto& [formatName, format] : formats) {
+		for (const unsigned formatThreads : formatThreadCounts) {
+			PatientFormatter formatter(format, formatThreads);
+			CountingBuffer formatted;
+			std::ostream formattedSink(&formatted);
+			formatter.write(formattedSink, pointers);
+			const std::string name =
+				"PatientFormatter " + std::string(formatName) + " x" + std::to_string(formatThreads);
+			run(name.c_str(), iterations, patients, formatted.getCount(), [&]() {
+				formatter.write(formattedSink, pointers);
+			});
+		}
+	}
+
+	// The IDs stand in for the URIs, which are not part of Patient
+	std::ostringstream encoded;
+	{
+		PatientBinaryWriter writer(encoded);
+		for (const Patient& patient : list) {
+			writer.write(patient.getId(), patient);
+		}
+	}
+	const std::string binary = encoded.str();
+	run("PatientBinaryWriter::write", iterations, patients, binary.size(), [&]() {
+		std::ostringstream out;
+		PatientBinaryWriter writer(out);
+		for (const Patient& patient : list) {
+			writer.write(patient.getId(), patient);
+		}
+		writer.finish();
+		return out.tellp();
+	});
+	run("PatientBinaryReader::next", iterations, patients, binary.size(), [&]() {
+		std::istringstream in(binary);
+		PatientBinaryReader reader(in);
+		std::vector<Patient> read;
+		read.reserve(patients);
+		std::string uri;
+		Patient patient;
+		while (reader.next(uri, patient)) {
+			read.push_back(std::move(patient));
+		}
+		return read.size();
+	});
+	return 0;
+}
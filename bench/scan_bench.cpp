@@ -0,0 +1,115 @@
+// Throughput of JsonScanner on a public:patients frame: the first stage alone for each kernel
+// the CPU supports, and the whole parse (scan and walk) compared with the nlohmann SAX parser.
+//
+// Usage: scan_bench [patients] [iterations] [textLength]
+#include "bench_util.h"
+#include "json_scanner.h"
+#include "patient_parser.h"
+#include "synthetic_patients.h"
+#include <nlohmann/json.hpp>
+
+using namespace ViewRay;
+using namespace ViewRay::Bench;
+
+namespace {
+	/// @brief Handler which only counts the tokens, so that the parsers are measured alone
+	class CountingSax : public nlohmann::json_sax<nlohmann::json> {
+	public:
+		bool null() override { return count(); }
+		bool boolean(bool) override { return count(); }
+		bool number_integer(number_integer_t) override { return count(); }
+		bool number_unsigned(number_unsigned_t) override { return count(); }
+		bool number_float(number_float_t, const string_t&) override { return count(); }
+		bool string(string_t&) override { return count(); }
+		bool binary(binary_t&) override { return count(); }
+		bool start_object(std::size_t) override { return count(); }
+		bool key(string_t&) override { return count(); }
+		bool end_object() override { return count(); }
+		bool start_array(std::size_t) override { return count(); }
+		bool end_array() override { return count(); }
+		bool parse_error(std::size_t, const std::string&, const nlohmann::detail::exception&) override {
+			return false;
+		}
+
+		size_t tokens = 0;
+
+	private:
+		bool count() {
+			++tokens;
+			return true;
+		}
+	};
+
+	void reportGbps(const char* name, double nsPerRun, size_t bytes) {
+		std::printf("%-40s %10.2f GB/s %12.3f ms/run\n", name, double(bytes) / nsPerRun, nsPerRun * 1e-6);
+	}
+
+	void fail(const char* name) {
+		std::fprintf(stderr, "%s: parsing failed\n", name);
+		std::exit(1);
+	}
+}  // namespace
+
+int main(int argc, char** argv) {
+	SyntheticOptions options;
+	options.patients = intArg(argc, argv, 1, 20000);
+	const int iterations = intArg(argc, argv, 2, 20);
+	options.textLength = intArg(argc, argv, 3, 32);
+
+	const std::string list = makePatientListFrame(options).dump();
+	std::printf(
+		"%d patients, public:patients frame %zu bytes, best kernel %s\n",
+		options.patients,
+		list.size(),
+		JsonScanner::getKernelName(JsonScanner::bestKernel())
+	);
+
+	size_t expectedTokens = 0;
+	{
+		CountingSax sax;
+		if (!nlohmann::json::sax_parse(list, &sax)) {
+			fail("nlohmann sax");
+		}
+		expectedTokens = sax.tokens;
+		const double ns = measureNs(iterations, [&]() {
+			CountingSax sax;
+			nlohmann::json::sax_parse(list, &sax);
+		});
+		reportGbps("nlohmann sax", ns, list.size());
+	}
+
+	for (JsonScanner::Kernel kernel :
+		 {JsonScanner::Kernel::Scalar, JsonScanner::Kernel::Sse2, JsonScanner::Kernel::Avx2}) {
+		if (!JsonScanner::isSupported(kernel)) {
+			continue;
+		}
+		const std::string kernelName = JsonScanner::getKernelName(kernel);
+		JsonScanner scanner(kernel);
+
+		const std::string scanName = "scan " + kernelName;
+		const double scanNs = measureNs(iterations, [&]() {
+			if (!scanner.scan(list)) {
+				fail(scanName.c_str());
+			}
+		});
+		reportGbps(scanName.c_str(), scanNs, list.size());
+
+		const std::string parseName = "scan+walk " + kernelName;
+		const double parseNs = measureNs(iterations, [&]() {
+			CountingSax sax;
+			if (!scanner.scan(list) || !scanner.walk(sax) || sax.tokens != expectedTokens) {
+				fail(parseName.c_str());
+			}
+		});
+		reportGbps(parseName.c_str(), parseNs, list.size());
+	}
+
+	const double ns = measureNs(iterations, [&]() {
+		UpdateSubscriptions update;
+		if (!parseUpdateSubscriptions(list, update)) {
+			fail("parseUpdateSubscriptions");
+		}
+	});
+	reportGbps("parseUpdateSubscriptions", ns, list.size());
+	return 0;
+}
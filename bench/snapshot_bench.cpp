@@ -0,0 +1,117 @@
+// Compares a cold start from a PatientSnapshot with building the list from the JSON frames:
+// parsing public:patients and the frame of each patient into a PatientTable against mapping
+// a snapshot of the same table. Also checks that the loaded table matches the saved one.
+//
+// Usage: snapshot_bench [patients] [iterations] [snapshot path]
+#include "bench_util.h"
+#include "patient_parser.h"
+#include "patient_snapshot.h"
+#include "synthetic_patients.h"
+#include <cstdio>
+#include <iostream>
+#include <sstream>
+#include <unordered_map>
+
+using namespace ViewRay;
+using namespace ViewRay::Bench;
+
+namespace {
+	/// Build the table the way a fetch does: parse the list frame and every patient frame
+	PatientTable parseFrames(
+		const std::string& listFrame,
+		const std::vector<std::string>& patientFrames
+	) {
+		UpdateSubscriptions list;
+		parseUpdateSubscriptions(listFrame, list);
+		std::unordered_map<std::string, Patient> patients;
+		patients.reserve(list.patients.size());
+		for (auto& patient : list.patients) {
+			patients.emplace(std::move(patient.first), std::move(patient.second));
+		}
+		for (const std::string& frame : patientFrames) {
+			UpdateSubscriptions update;
+			parseUpdateSubscriptions(frame, update);
+			for (auto& diagnoses : update.diagnoses) {
+				patients[diagnoses.first].setDiagnoses(std::move(diagnoses.second));
+			}
+		}
+		return PatientTable(patients);
+	}
+
+	bool sameTables(const PatientTable& a, const PatientTable& b) {
+		if (a.size() != b.size()) {
+			return false;
+		}
+		for (size_t row = 0; row < a.size(); ++row) {
+			const Patient patientA = a.toPatient(row);
+			const Patient patientB = b.toPatient(row);
+			std::ostringstream printedA;
+			std::ostringstream printedB;
+			printedA << patientA;
+			printedB << patientB;
+			const bool same = a[row].getUri() == b[row].getUri() &&
+				printedA.str() == printedB.str() &&
+				patientA.hasSameDiagnoses(patientB.getDiagnoses());
+			if (!same) {
+				return false;
+			}
+		}
+		return true;
+	}
+}  // namespace
+
+int main(int argc, char** argv) {
+	SyntheticOptions options;
+	options.patients = intArg(argc, argv, 1, 10000);
+	const int iterations = intArg(argc, argv, 2, 5);
+	const std::string path = argc > 3 ? argv[3] : "patient_snapshot_bench.bin";
+
+	const std::string listFrame = makePatientListFrame(options).dump();
+	std::vector<std::string> patientFrames;
+	patientFrames.reserve(options.patients);
+	for (int i = 0; i < options.patients; ++i) {
+		patientFrames.push_back(makePatientFrame(i, options).dump());
+	}
+
+	const PatientTable table = parseFrames(listFrame, patientFrames);
+	EC::ErrorCode err = PatientSnapshot::save(table, path);
+	if (err.hasError()) {
+		std::cerr << err.getMessage() << '\n';
+		return 1;
+	}
+	PatientTable loaded;
+	err = PatientSnapshot::load(path, loaded);
+	if (err.hasError()) {
+		std::cerr << err.getMessage() << '\n';
+		return 1;
+	}
+	if (!sameTables(table, loaded)) {
+		std::fprintf(stderr, "The loaded snapshot differs from the saved table\n");
+		return 1;
+	}
+
+	size_t frameBytes = listFrame.size();
+	for (const std::string& frame : patientFrames) {
+		frameBytes += frame.size();
+	}
+	std::printf(
+		"%d patients, %zu bytes of JSON frames, %zu distinct strings\n",
+		options.patients,
+		frameBytes,
+		table.getStrings().size()
+	);
+
+	const size_t patients = size_t(options.patients);
+	report("parse JSON frames into PatientTable", measureNs(iterations, [&]() {
+		return parseFrames(listFrame, patientFrames).size();
+	}), patients, frameBytes);
+	report("PatientSnapshot::save", measureNs(iterations, [&]() {
+		return PatientSnapshot::save(table, path).hasError();
+	}), patients, 0);
+	report("PatientSnapshot::load", measureNs(iterations, [&]() {
+		PatientTable result;
+		return PatientSnapshot::load(path, result).hasError();
+	}), patients, 0);
+	std::remove(path.c_str());
+	return 0;
+}
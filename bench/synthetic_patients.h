@@ -0,0 +1,105 @@
+#pragma once
+#include <nlohmann/json.hpp>
+#include <string>
+
+namespace ViewRay::Bench {
+	/// @brief Shape of the synthetic patient data
+	struct SyntheticOptions {
+		/// Number of patients in public:patients
+		int patients = 10000;
+		/// Diagnoses per patient
+		int diagnoses = 2;
+		/// Prescriptions per diagnose
+		int prescriptions = 2;
+		/// Plans per prescription
+		int plans = 2;
+		/// Length of the free text fields (names, labels, descriptions)
+		int textLength = 16;
+	};
+
+	/// @brief URI of the i-th synthetic patient
+	inline std::string patientUri(int i) {
+		return "public:patients/" + std::to_string(i % 2) + "_" + std::to_string(1000000 + i) +
+			   "/root";
+	}
+
+	/// @brief Deterministic text of the given length which differs for each seed
+	inline std::string syntheticText(int seed, int length) {
+		static const char alphabet[] = "abcdefghijklmnopqrstuvwxyz ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+		std::string text(length, ' ');
+		unsigned state = unsigned(seed) * 2654435761u + 1;
+		for (char& c : text) {
+			state = state * 1103515245u + 12345u;
+			c = alphabet[(state >> 16) % (sizeof(alphabet) - 1)];
+		}
+		return text;
+	}
+
+	/// @brief The entry for the i-th patient in the public:patients "value" array
+	inline nlohmann::json makePatient(int i, const SyntheticOptions& options) {
+		return {
+			{"uri", patientUri(i)},
+			{"type", "PatientSummary"},
+			{"id", std::to_string(1000000 + i)},
+			{"mrn", "MRN" + std::to_string(i)},
+			{"date_of_birth", "19" + std::to_string(40 + i % 60) + "-0" + std::to_string(1 + i % 9) + "-1" + std::to_string(i % 10)},
+			{"first_name", syntheticText(i * 3, options.textLength)},
+			{"middle_name", syntheticText(i * 3 + 1, options.textLength)},
+			{"last_name", syntheticText(i * 3 + 2, options.textLength)},
+			{"sex", i % 2 ? "M" : "F"},
+			{"fractions_total", 30},
+			{"fractions_completed", i % 31},
+			{"weight_kg", 50 + i % 50},
+			{"ready_for_treatment", i % 3 == 0},
+			{"registration_time", 1600000000 + i}
+		};
+	}
+
+	/// @brief The full {"updateSubscriptions": {"public:patients": ...}} frame
+	inline nlohmann::json makePatientListFrame(const SyntheticOptions& options) {
+		nlohmann::json patients = nlohmann::json::array();
+		for (int i = 0; i < options.patients; ++i) {
+			patients.push_back(makePatient(i, options));
+		}
+		return {
+			{"updateSubscriptions",
+			 {{"public:patients", {{"type", "PatientList"}, {"value", std::move(patients)}}}}}
+		};
+	}
+
+	/// @brief The "diagnoses" array for the i-th patient
+	inline nlohmann::json makeDiagnoses(int i, const SyntheticOptions& options) {
+		nlohmann::json diagnoses = nlohmann::json::array();
+		for (int d = 0; d < options.diagnoses; ++d) {
+			nlohmann::json prescriptions = nlohmann::json::array();
+			for (int p = 0; p < options.prescriptions; ++p) {
+				nlohmann::json plans = nlohmann::json::array();
+				for (int pl = 0; pl < options.plans; ++pl) {
+					plans.push_back({{"type", "Plan"}, {"label", "Plan " + std::to_string(pl)}});
+				}
+				prescriptions.push_back({
+					{"type", "Prescription"},
+					{"label", "Rx " + std::to_string(p)},
+					{"description", syntheticText(i + d * 7 + p, options.textLength)},
+					{"num_fractions", 5 + p},
+					{"plans", std::move(plans)}
+				});
+			}
+			diagnoses.push_back({
+				{"type", "Diagnosis"},
+				{"label", "C" + std::to_string(10 + (i + d) % 80)},
+				{"description", syntheticText(i * 5 + d, options.textLength)},
+				{"prescriptions", std::move(prescriptions)}
+			});
+		}
+		return diagnoses;
+	}
+
+	/// @brief The full {"updateSubscriptions": {<patient_uri>: ...}} frame for the i-th patient
+	inline nlohmann::json makePatientFrame(int i, const SyntheticOptions& options) {
+		return {
+			{"updateSubscriptions",
+			 {{patientUri(i), {{"type", "Patient"}, {"diagnoses", makeDiagnoses(i, options)}}}}}
+		};
+	}
+}  // namespace ViewRay::Bench
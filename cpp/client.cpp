@@ -1,18 +1,738 @@
 #include "client.h"
-#include "nlohmann/json.hpp"
+#include "client_async.h"
+#include "patient_detail_cache.h"
+#include "patient_parser.h"
+#include "patient_subscription.h"
+#include "request_encoder.h"
 #include "websocket.h"
+#include <algorithm>
+#include <deque>
+#include <optional>
+#include <unordered_set>
 
 namespace ViewRay {
+	using Clock = std::chrono::steady_clock;
 
+	/// @brief Metrics of patient list requests, registered by ViewRayClient and shared with
+	/// its connections
+	struct ClientMetrics {
+		/// @param[in] registry Where to register the metrics
+		/// @param[in] labels Added to all series, e.g. to tell apart clients which share the
+		///		registry of a WSConnectionManager
+		explicit ClientMetrics(
+			MetricsRegistry& registry,
+			const MetricsRegistry::Labels& labels = {}
+		) :
+			fetchSeconds(registry.histogram(
+				"viewray_fetch_seconds",
+				"Time from getPatientList until the list with all patient details is ready",
+				Histogram::latencyBounds(),
+				labels
+			)),
+			firstResponseSeconds(registry.histogram(
+				"viewray_fetch_first_response_seconds",
+				"Time from getPatientList until the public:patients response is received",
+				Histogram::latencyBounds(),
+				labels
+			)),
+			listRoundTripSeconds(registry.histogram(
+				"viewray_request_round_trip_seconds",
+				"Time from sending setSubscriptions until its response is received",
+				Histogram::latencyBounds(),
+				withLabels({{"resource", "patient_list"}}, labels)
+			)),
+			patientRoundTripSeconds(registry.histogram(
+				"viewray_request_round_trip_seconds",
+				"Time from sending setSubscriptions until its response is received",
+				Histogram::latencyBounds(),
+				withLabels({{"resource", "patient"}}, labels)
+			)),
+			parseSeconds(registry.histogram(
+				"viewray_message_parse_seconds",
+				"Time spent parsing a received updateSubscriptions message",
+				Histogram::exponentialBounds(1e-6, 2, 24),
+				labels
+			)),
+			fetches(
+				registry.counter("viewray_fetches_total", "Started patient list fetches", labels)
+			),
+			fetchErrors(registry.counter(
+				"viewray_fetch_errors_total", "Failed patient list fetches", labels
+			)),
+			requestsQueued(registry.gauge(
+				"viewray_requests_queued", "Patient requests waiting to be sent", labels
+			)),
+			requestsInFlight(registry.gauge(
+				"viewray_requests_in_flight", "Patient requests sent, but not answered yet", labels
+			)),
+			patientCacheHits(registry.counter(
+				"viewray_patient_cache_hits_total",
+				"Patients of fetched lists whose details were taken from the cache",
+				labels
+			)),
+			patientCacheMisses(registry.counter(
+				"viewray_patient_cache_misses_total",
+				"Patients of fetched lists whose details were requested from the server",
+				labels
+			)) {
+		}
+
+		static MetricsRegistry::Labels withLabels(
+			MetricsRegistry::Labels labels,
+			const MetricsRegistry::Labels& extra
+		) {
+			labels.insert(labels.end(), extra.begin(), extra.end());
+			return labels;
+		}
+
+		std::shared_ptr<Histogram> fetchSeconds;
+		std::shared_ptr<Histogram> firstResponseSeconds;
+		std::shared_ptr<Histogram> listRoundTripSeconds;
+		std::shared_ptr<Histogram> patientRoundTripSeconds;
+		std::shared_ptr<Histogram> parseSeconds;
+		std::shared_ptr<Counter> fetches;
+		std::shared_ptr<Counter> fetchErrors;
+		std::shared_ptr<Gauge> requestsQueued;
+		std::shared_ptr<Gauge> requestsInFlight;
+		std::shared_ptr<Counter> patientCacheHits;
+		std::shared_ptr<Counter> patientCacheMisses;
+	};
+
+	/// @brief State of a single patient list fetch
+	///
+	/// Multiple fetches can be in flight on the same pooled connection. Each one of them
+	/// builds its own patient list. ViewRayClient::getPatientList calls made while a fetch is
+	/// in flight join it and receive the same list. Fetches started by
+	/// ViewRayClient::fetchPatientList have their own callbacks and deadline and are not joined.
+	class PatientListRequest {
+	public:
+		/// @param[in] metrics Where to record the duration of the fetch
+		/// @param[in] started When the caller asked for the list
+		/// @param[in] options Callbacks and deadline. If empty the fetch can be joined.
+		PatientListRequest(
+			std::shared_ptr<ClientMetrics> metrics,
+			Clock::time_point started,
+			FetchOptions options = {}
+		) :
+			metrics(std::move(metrics)),
+			started(started),
+			options(std::move(options)),
+			done(false) {
+			this->metrics->fetches->add();
+			// The list is kept alive by its arena, so that freeing it releases everything at once
+			std::shared_ptr<Storage> storage = std::make_shared<Storage>();
+			patientList = PatientListPtr(storage, &storage->list);
+		}
+
+		/// @brief Memory resource from which the patient list is allocated
+		///
+		/// Responses for this fetch should be parsed into it, so that moving their data into
+		/// the list does not copy it. The resource is not thread safe. It must be used only by
+		/// the thread handling the responses of the connection and only before the fetch is
+		/// completed, because afterwards the list belongs to the callers.
+		std::pmr::memory_resource* getResource() const {
+			return patientList->get_allocator().resource();
+		}
+
+		/// @brief Add one more caller waiting for the result of this fetch
+		///
+		/// Can be called from any thread, also while the fetch finishes. If it has already
+		/// finished the future is ready.
+		std::future<WSAsyncResult<SharedPatientListPtr>> addWaiter() {
+			std::lock_guard<std::mutex> lock(waitersMutex);
+			promises.emplace_back();
+			std::future<WSAsyncResult<SharedPatientListPtr>> result =
+				promises.back().get_future();
+			if (listResult) {
+				promises.back().set_value(*listResult);
+			}
+			return result;
+		}
+
+		/// @brief Add a caller waiting for the result of this fetch, including the patients
+		/// which were not received. Must be called before the fetch is started.
+		std::future<WSAsyncResult<FetchResult>> addResultWaiter() {
+			resultPromises.emplace_back();
+			return resultPromises.back().get_future();
+		}
+
+		/// @brief Call a callback with the result of this fetch, including the patients which
+		/// were not received. Must be set before the fetch is started on a connection.
+		/// @param[in] callback Called on the thread which finishes the fetch, possibly while
+		///		the connection is locked
+		void setResultCallback(FetchCallback callback) {
+			resultCallback = std::move(callback);
+		}
+
+		/// @brief Complete the fetch with the public:patients response, without requesting the
+		/// diagnoses of the patients. Must be called before the fetch is started.
+		void setSkeletonOnly() {
+			skeletonOnly = true;
+		}
+
+		/// @brief Fill the patient list with the patients from public:patients response
+		/// @param[in] patients (URI, patient) pairs from the response
+		/// @return The entries of the patients which must be expanded (i.e. their diagnoses
+		///		must be requested). Duplicate URIs are returned only once. The entries stay
+		///		valid as long as the list. Empty for a fetch set with setSkeletonOnly.
+		/// @param[in] received When the response was received
+		std::vector<PatientList::value_type*> setSkeleton(
+			std::vector<std::pair<std::string, Patient>>&& patients,
+			Clock::time_point received
+		) {
+			metrics->firstResponseSeconds->observe(
+				std::chrono::duration<double>(received - started).count()
+			);
+			std::vector<PatientList::value_type*> entries;
+			entries.reserve(patients.size());
+			patientList->reserve(patients.size());
+			unexpanded.reserve(patients.size());
+			for (auto& patient : patients) {
+				const auto inserted =
+					patientList->emplace(std::move(patient.first), std::move(patient.second));
+				if (inserted.second && !skeletonOnly) {
+					unexpanded.insert(&*inserted.first);
+					entries.push_back(&*inserted.first);
+				}
+			}
+			return entries;
+		}
+
+		/// @brief Store the diagnoses for a patient in the list
+		/// @param[in] entry The entry of the patient returned by setSkeleton
+		/// @param[in] diagnoses The diagnoses of the patient
+		/// @return The patient if it was waiting for its diagnoses, otherwise nullptr
+		const Patient* expand(PatientList::value_type* entry, Patient::DiagnoseList diagnoses) {
+			if (done || unexpanded.erase(entry) == 0) {
+				return nullptr;
+			}
+			entry->second.setDiagnoses(std::move(diagnoses));
+			return &entry->second;
+		}
+
+		bool isComplete() const {
+			return unexpanded.empty();
+		}
+
+		/// @brief True if the promises are already resolved
+		bool isDone() const {
+			return done;
+		}
+
+		/// @brief Call FetchOptions::onSkeleton with the list. Does nothing once the fetch is
+		/// done.
+		void notifySkeleton() const {
+			if (options.onSkeleton && !done) {
+				options.onSkeleton(*patientList);
+			}
+		}
+
+		/// @brief Call FetchOptions::onPatient with a patient from the list. Does nothing once
+		/// the fetch is done.
+		void notifyPatient(const std::string& uri, const Patient& patient) const {
+			if (options.onPatient && !done) {
+				options.onPatient(uri, patient);
+			}
+		}
+
+		/// @brief Resolve the futures with the patient list. The patients which have not
+		/// received their diagnoses are reported as missing. Calls after the first one to
+		/// complete or fail are ignored.
+		void complete() {
+			if (done.exchange(true)) {
+				return;
+			}
+			metrics->fetchSeconds->observeSince(started);
+			resolveWaiters(WSAsyncResult<SharedPatientListPtr>(patientList));
+			if (!resultPromises.empty() || resultCallback) {
+				FetchResult result;
+				result.patients = patientList;
+				result.missing.reserve(unexpanded.size());
+				for (const PatientList::value_type* entry : unexpanded) {
+					result.missing.push_back(entry->first);
+				}
+				for (auto& promise : resultPromises) {
+					promise.set_value(WSAsyncResult<FetchResult>(result));
+				}
+				if (resultCallback) {
+					resultCallback(WSAsyncResult<FetchResult>(std::move(result)));
+				}
+			}
+		}
+
+		/// @brief Resolve the futures with an error. Calls after the first one to complete or
+		/// fail are ignored.
+		void fail(const EC::ErrorCode& error) {
+			if (done.exchange(true)) {
+				return;
+			}
+			metrics->fetchErrors->add();
+			resolveWaiters(WSAsyncResult<SharedPatientListPtr>(error));
+			for (auto& promise : resultPromises) {
+				promise.set_value(WSAsyncResult<FetchResult>(error));
+			}
+			if (resultCallback) {
+				resultCallback(WSAsyncResult<FetchResult>(error));
+			}
+		}
+
+	private:
+		void resolveWaiters(const WSAsyncResult<SharedPatientListPtr>& result) {
+			std::lock_guard<std::mutex> lock(waitersMutex);
+			listResult = result;
+			for (auto& promise : promises) {
+				promise.set_value(result);
+			}
+			promises.clear();
+		}
+
+		/// @brief Owns the arena together with the list allocated from it
+		struct Storage {
+			/// Declared first so that it outlives the list
+			std::pmr::monotonic_buffer_resource arena;
+			PatientList list{&arena};
+		};
+
+		/// Callers of addWaiter can join while the fetch runs on a connection
+		std::mutex waitersMutex;
+		std::vector<std::promise<WSAsyncResult<SharedPatientListPtr>>> promises;
+		/// Set once the fetch is finished, for the callers which join afterwards
+		std::optional<WSAsyncResult<SharedPatientListPtr>> listResult;
+		std::vector<std::promise<WSAsyncResult<FetchResult>>> resultPromises;
+		FetchCallback resultCallback;
+		/// Points inside a Storage which is shared with the callers
+		PatientListPtr patientList;
+		std::shared_ptr<ClientMetrics> metrics;
+		Clock::time_point started;
+		FetchOptions options;
+		/// Entries of the patients in the list whose responses to
+		/// {"setSubscriptions": {<patient_uri>: "request"}} we are still waiting for. Keyed by
+		/// address, so that a response does not hash its URI again.
+		std::unordered_set<const PatientList::value_type*> unexpanded;
+		/// Set when the promises are resolved. Read by the callbacks without the lock of the
+		/// connection.
+		std::atomic<bool> done;
+		/// Set for the fetches of ViewRayClient::getLazyPatientList
+		bool skeletonOnly = false;
+	};
+
+	class PatientDataConn;
+
+	/// @brief Shared state of a LazyPatientList
+	///
+	/// The patients are expanded in place in the list received by the fetch. Their diagnoses
+	/// are allocated from the arena of the list, which is used only while mutex is held. The
+	/// connections lock their own mutex before this one.
+	class LazyExpansion : public std::enable_shared_from_this<LazyExpansion> {
+	public:
+		using PatientFuture = LazyPatientList::PatientFuture;
+
+		/// @param[in] patients The list received by the fetch, which has completed
+		/// @param[in] endpoint The manager of the client. Must outlive the expansions.
+		/// @param[in] address The address of the server
+		/// @param[in] requestWindow Maximal number of patient URIs in flight on a connection
+		/// @param[in] metrics Where to record the timings of the requests
+		/// @param[in] cache Details of the patients received recently
+		LazyExpansion(
+			PatientListPtr patients,
+			WSConnectionManager& endpoint,
+			std::string address,
+			int requestWindow,
+			std::shared_ptr<ClientMetrics> metrics,
+			std::shared_ptr<PatientDetailCache> cache
+		) :
+			patients(std::move(patients)),
+			endpoint(endpoint),
+			address(std::move(address)),
+			requestWindow(requestWindow),
+			metrics(std::move(metrics)),
+			cache(std::move(cache)) {
+		}
+
+		const PatientList& getPatients() const {
+			return *patients;
+		}
+
+		PatientFuture getPatient(const std::string& uri) {
+			const auto it = patients->find(uri);
+			if (it == patients->end()) {
+				std::promise<WSAsyncResult<const Patient*>> promise;
+				promise.set_value(WSAsyncResult<const Patient*>(EC::ErrorCode(
+					ViewRayClient::PatientNotFound,
+					"Patient %s is not in the list",
+					uri.c_str()
+				)));
+				return promise.get_future().share();
+			}
+			std::vector<PatientList::value_type*> toRequest;
+			PatientFuture result;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				result = start(&*it, toRequest);
+			}
+			request(std::move(toRequest));
+			return result;
+		}
+
+		void prefetch(const std::vector<std::string>& uris) {
+			std::vector<PatientList::value_type*> toRequest;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				for (const std::string& uri : uris) {
+					const auto it = patients->find(uri);
+					if (it != patients->end()) {
+						start(&*it, toRequest);
+					}
+				}
+			}
+			request(std::move(toRequest));
+		}
+
+		bool isExpanded(const std::string& uri) const {
+			const auto it = patients->find(uri);
+			if (it == patients->end()) {
+				return false;
+			}
+			std::lock_guard<std::mutex> lock(mutex);
+			const auto expansionIt = expansions.find(&*it);
+			return expansionIt != expansions.end() && expansionIt->second.expanded;
+		}
+
+		/// @brief Store the diagnoses received for a patient. Called by the connection.
+		/// @param[in] entry The entry of the patient in the list
+		/// @param[in] diagnoses The diagnoses, copied into the arena of the list
+		void expand(PatientList::value_type* entry, const Patient::DiagnoseList& diagnoses) {
+			std::lock_guard<std::mutex> lock(mutex);
+			const auto it = expansions.find(entry);
+			if (it == expansions.end() || it->second.expanded) {
+				return;
+			}
+			entry->second.setDiagnoses(Patient::DiagnoseList(diagnoses, getResource()));
+			it->second.expanded = true;
+			it->second.promise.set_value(WSAsyncResult<const Patient*>(&entry->second));
+		}
+
+		/// @brief Fail the callers waiting for a patient, so that the next access requests it
+		/// again. Called by the connection.
+		void fail(PatientList::value_type* entry, const EC::ErrorCode& err) {
+			std::lock_guard<std::mutex> lock(mutex);
+			const auto it = expansions.find(entry);
+			if (it == expansions.end() || it->second.expanded) {
+				return;
+			}
+			it->second.promise.set_value(WSAsyncResult<const Patient*>(err));
+			expansions.erase(it);
+		}
+
+		void fail(const std::vector<PatientList::value_type*>& entries, const EC::ErrorCode& err) {
+			for (PatientList::value_type* entry : entries) {
+				fail(entry, err);
+			}
+		}
+
+	private:
+		struct Expansion {
+			std::promise<WSAsyncResult<const Patient*>> promise;
+			PatientFuture future;
+			/// Set when the diagnoses are stored in the list
+			bool expanded = false;
+		};
+
+		std::pmr::memory_resource* getResource() const {
+			return patients->get_allocator().resource();
+		}
+
+		/// Start expanding a patient unless it is already expanded or requested. A patient
+		/// found in the cache is expanded right away, otherwise it is added to toRequest.
+		/// mutex must be locked.
+		/// @return Future of the expansion
+		PatientFuture start(
+			PatientList::value_type* entry,
+			std::vector<PatientList::value_type*>& toRequest
+		) {
+			const auto inserted = expansions.try_emplace(entry);
+			Expansion& expansion = inserted.first->second;
+			if (!inserted.second) {
+				return expansion.future;
+			}
+			expansion.future = expansion.promise.get_future().share();
+			Patient::DiagnoseList cached(getResource());
+			if (cache && cache->find(entry->first, cached)) {
+				metrics->patientCacheHits->add();
+				entry->second.setDiagnoses(std::move(cached));
+				expansion.expanded = true;
+				expansion.promise.set_value(WSAsyncResult<const Patient*>(&entry->second));
+				return expansion.future;
+			}
+			if (cache) {
+				metrics->patientCacheMisses->add();
+			}
+			toRequest.push_back(entry);
+			return expansion.future;
+		}
+
+		/// Request the diagnoses of patients over a pooled connection. Defined after
+		/// PatientDataConn.
+		void request(std::vector<PatientList::value_type*> entries);
+
+		/// Shared with the copies of the fetch result, which keep the arena alive
+		PatientListPtr patients;
+		WSConnectionManager& endpoint;
+		std::string address;
+		int requestWindow;
+		std::shared_ptr<ClientMetrics> metrics;
+		std::shared_ptr<PatientDetailCache> cache;
+		/// Patients which are expanded or requested, keyed by their entry in the list
+		std::unordered_map<const PatientList::value_type*, Expansion> expansions;
+		mutable std::mutex mutex;
+	};
+
+	/// @brief Long-lived connection which serves patient list requests
+	///
+	/// The server answers with the URI of the requested resource as a key, thus responses are
+	/// not tied to a specific request. Each response is handed to all requests waiting for
+	/// its URI and each URI is requested only once while it is pending.
+	///
+	/// Patient URIs are not sent all at once. At most PatientDataConn::window of them are in
+	/// flight and the next one is sent when a response arrives.
+	///
+	/// A connection can also be dedicated to a PatientListSubscription. Then the patient list
+	/// and all patient URIs are sent in "subscribe" mode and all updates go to the subscription.
+	///
+	/// The parser builds each resource of a message according to the routes of the connection,
+	/// which map URIs to a ResourceKind. Each kind has its own handler, which receives the
+	/// parsed sub-object: the patient list, the diagnoses of a patient, or the nlohmann::json
+	/// of any other resource requested with PatientDataConn::requestResource.
+	///
+	/// The patients of a LazyPatientList are requested with PatientDataConn::expandLazily.
+	/// They share the window and the pending URIs with the fetches.
 	class PatientDataConn : public WebsocketConnectionMetadata<WSConnectionManager::Client> {
 	public:
+		using RequestPtr = std::shared_ptr<PatientListRequest>;
+		using ResourcePromise = std::promise<WSAsyncResult<nlohmann::json>>;
+
+		/// Stop sending while websocketpp has more than this many bytes waiting to be written
+		static constexpr size_t maxBufferedBytes = 64 * 1024;
+
 		PatientDataConn(int id, websocketpp::connection_hdl hdl, std::string uri) :
 			WebsocketConnectionMetadata<WSConnectionManager::Client>(id, hdl, uri),
-			patientsToExpand(0),
-			patientList(std::make_shared<PatientList>()) {
+			routes(getDefaultResourceRoutes()),
+			window(ViewRayClient::defaultRequestWindow),
+			closed(false) {
+		}
+
+		/// @brief Subscribe to the patient list and to each patient in it
+		///
+		/// All updates received on this connection will be applied to the subscription.
+		/// @param[in] endpoint The manager which owns this connection
+		/// @param[in] target Where to apply the updates
+		/// @param[in] requestWindow Maximal number of patient URIs in flight on this connection
+		/// @param[in] metrics Where to record the timings of the requests
+		EC::ErrorCode subscribe(
+			WSConnectionManager& endpoint,
+			std::shared_ptr<PatientListSubscription> target,
+			int requestWindow,
+			std::shared_ptr<ClientMetrics> metrics
+		) {
+			std::lock_guard<std::mutex> lock(mutex);
+			window = std::max(requestWindow, 1);
+			subscription = std::move(target);
+			clientMetrics = std::move(metrics);
+			return sendListRequest(endpoint, "subscribe");
+		}
+
+		/// @brief Start a fetch of the patient list which is not shared with other callers
+		/// @param[in] endpoint The manager which owns this connection
+		/// @param[in] requestWindow Maximal number of patient URIs in flight on this connection
+		/// @param[in] metrics Where to record the timings of the requests
+		/// @param[in] cache Details of the patients received recently, see
+		///		PatientDataConn::startFetch
+		/// @param[in] started When the caller asked for the list
+		/// @param[in] options Callbacks and deadline of the fetch
+		/// @return Future which will contain the patient list
+		std::future<WSAsyncResult<FetchResult>> fetchPatientList(
+			WSConnectionManager& endpoint,
+			int requestWindow,
+			std::shared_ptr<ClientMetrics> metrics,
+			std::shared_ptr<PatientDetailCache> cache,
+			Clock::time_point started,
+			FetchOptions options
+		) {
+			const std::chrono::milliseconds timeout = options.timeout;
+			RequestPtr request =
+				std::make_shared<PatientListRequest>(metrics, started, std::move(options));
+			std::future<WSAsyncResult<FetchResult>> result = request->addResultWaiter();
+			std::optional<Clock::time_point> deadline;
+			if (timeout.count() > 0) {
+				deadline = started + timeout;
+			}
+			startFetch(
+				endpoint, requestWindow, std::move(metrics), std::move(cache), request, deadline
+			);
+			return result;
+		}
+
+		/// @brief Start a fetch on this connection
+		///
+		/// Does nothing if the fetch has already been failed, e.g. because it was cancelled
+		/// while waiting for the connection.
+		/// @param[in] endpoint The manager which owns this connection
+		/// @param[in] requestWindow Maximal number of patient URIs in flight on this connection
+		/// @param[in] metrics Where to record the timings of the requests
+		/// @param[in] cache Details of the patients received recently. The patients found in it
+		///		are not requested and the received details are stored in it.
+		/// @param[in] request The fetch
+		/// @param[in] deadline If set, when to complete the fetch with the patients received
+		///		so far, see PatientDataConn::expire
+		void startFetch(
+			WSConnectionManager& endpoint,
+			int requestWindow,
+			std::shared_ptr<ClientMetrics> metrics,
+			std::shared_ptr<PatientDetailCache> cache,
+			const RequestPtr& request,
+			std::optional<Clock::time_point> deadline
+		) {
+			bool sent = false;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (request->isDone()) {
+					return;
+				}
+				window = std::max(requestWindow, 1);
+				clientMetrics = std::move(metrics);
+				patientCache = std::move(cache);
+				sent = startListRequest(endpoint, request);
+			}
+			if (sent && deadline) {
+				const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+					*deadline - Clock::now()
+				);
+				// The connection can be gone by the time the deadline passes. Then the fetch has
+				// already failed.
+				WSConnectionManager* manager = &endpoint;
+				const int connectionId = getID();
+				std::weak_ptr<PatientListRequest> weakRequest = request;
+				endpoint.schedule(int(std::max<int64_t>(remaining.count(), 0)), [=]() {
+					WSConnectionManager::Metadata::Ptr metadata = manager->getMetadata(connectionId);
+					RequestPtr expired = weakRequest.lock();
+					if (metadata && expired) {
+						static_cast<PatientDataConn*>(metadata.get())->expire(expired);
+					}
+				});
+			}
+		}
+
+		/// @brief Complete a fetch whose deadline has passed with the patients received so far
+		///
+		/// If the fetch is still waiting for public:patients it fails with
+		/// ViewRayClient::Timeout. Patient URIs which no other fetch waits for are not sent.
+		void expire(const RequestPtr& request) {
+			std::lock_guard<std::mutex> parseLock(parseMutex);
+			std::lock_guard<std::mutex> lock(mutex);
+			if (request->isDone()) {
+				return;
+			}
+			if (detach(request)) {
+				request->fail(EC::ErrorCode(
+					ViewRayClient::Timeout,
+					"Timed out waiting for the patient list"
+				));
+			} else {
+				request->complete();
+			}
+		}
+
+		/// @brief Fail a fetch with ViewRayClient::Cancelled and stop sending the patient URIs
+		/// which no other fetch waits for
+		void cancel(const RequestPtr& request) {
+			std::lock_guard<std::mutex> parseLock(parseMutex);
+			std::lock_guard<std::mutex> lock(mutex);
+			if (request->isDone()) {
+				return;
+			}
+			detach(request);
+			request->fail(EC::ErrorCode(ViewRayClient::Cancelled, "The fetch was cancelled"));
+		}
+
+		/// @brief Request the diagnoses of patients of a LazyPatientList
+		///
+		/// Patients already requested on this connection, by a fetch or by a lazy list, are not
+		/// sent again. Sending starts right away, because no response might be pending.
+		/// @param[in] endpoint The manager which owns this connection
+		/// @param[in] requestWindow Maximal number of patient URIs in flight on this connection
+		/// @param[in] metrics Where to record the timings of the requests
+		/// @param[in] cache Where to store the received details
+		/// @param[in] list Receives the diagnoses
+		/// @param[in] entries The entries of the patients in the list
+		void expandLazily(
+			WSConnectionManager& endpoint,
+			int requestWindow,
+			std::shared_ptr<ClientMetrics> metrics,
+			std::shared_ptr<PatientDetailCache> cache,
+			const std::shared_ptr<LazyExpansion>& list,
+			const std::vector<PatientList::value_type*>& entries
+		) {
+			std::lock_guard<std::mutex> lock(mutex);
+			if (closed) {
+				list->fail(
+					entries,
+					EC::ErrorCode(
+						WSConnectionManager::ConnectionNotFound,
+						"Connection closed before the request was sent: %s",
+						getError().c_str()
+					)
+				);
+				return;
+			}
+			window = std::max(requestWindow, 1);
+			clientMetrics = std::move(metrics);
+			patientCache = std::move(cache);
+			for (PatientList::value_type* entry : entries) {
+				std::vector<PatientWaiter>& waiters = patientWaiters[entry->first];
+				waiters.push_back({nullptr, entry, list});
+				if (waiters.size() == 1) {
+					enqueue(entry->first, "request");
+				}
+			}
+			sendPending(endpoint);
+		}
+
+		/// @brief Request a resource which is neither the patient list nor a patient, e.g. a plan
+		///
+		/// The URI is routed to ResourceKind::Json while its response is awaited, so the response
+		/// is built as nlohmann::json in the same pass which parses the rest of its message.
+		/// Callers requesting the same URI at the same time share the response.
+		/// @param[in] endpoint The manager which owns this connection
+		/// @param[in] uri The URI of the resource
+		/// @return Future which will contain the value of the resource
+		std::future<WSAsyncResult<nlohmann::json>> requestResource(
+			WSConnectionManager& endpoint,
+			const std::string& uri
+		) {
+			// The routes are read by the parser
+			std::lock_guard<std::mutex> parseLock(parseMutex);
+			std::lock_guard<std::mutex> lock(mutex);
+			ResourcePromise promise;
+			std::future<WSAsyncResult<nlohmann::json>> result = promise.get_future();
+			if (closed) {
+				promise.set_value(WSAsyncResult<nlohmann::json>(EC::ErrorCode(
+					WSConnectionManager::ConnectionNotFound,
+					"Connection closed before the request was sent: %s",
+					getError().c_str()
+				)));
+				return result;
+			}
+			std::vector<ResourcePromise>& waiters = resourceWaiters[uri];
+			waiters.push_back(std::move(promise));
+			if (waiters.size() == 1) {
+				routes.add(uri, ResourceRoutes::Match::Exact, ResourceKind::Json);
+				const EC::ErrorCode err = sendRequest(endpoint, uri, "request");
+				if (err.hasError()) {
+					finishResource(uri, WSAsyncResult<nlohmann::json>(err));
+				}
+			}
+			return result;
 		}
-		using PatientList = std::unordered_map<std::string, Patient>;
-		using PatientListPtr = std::shared_ptr<std::unordered_map<std::string, Patient>>;
 
 		void onMessage(
 			ClientT* client,
@@ -20,83 +740,1029 @@ namespace ViewRay {
 			typename ClientT::message_ptr msg
 		) override {
 			// This callback parses public:patients URI and recursively requests each
-			// patient URI.
-			nlohmann::json json = nlohmann::json::parse(msg->get_payload())["updateSubscriptions"];
-			auto dataIt = json.find("public:patients");
-			if (dataIt != json.end()) {
-				// Parses patient list response to:
-				// {updateSubscriptions: {"public:patients": "request"}}
-				assert((*dataIt)["type"] == std::string("PatientList"));
-				const size_t patientsCount = dataIt.value()["value"].size();
-				for (const nlohmann::json& json : dataIt.value()["value"]) {
-					const std::string& uri = json["uri"];
-					patientList->emplace(uri, Patient(json));
-				}
-				patientsToExpand = patientList->size();
-				// For some reason sending more than one URI in the same request e.g.
-				// {"setSubscriptions": {"public:patients/1_2897763/root": "request",
-				// "public:patients/0_1930886/root":"request"}} does not work and returns info only
-				// for the first entry. Thus we send them one by one.				
-				for (const nlohmann::json& json : dataIt.value()["value"]) {
-					websocketpp::lib::error_code ec;
-					const std::string& uri = json["uri"];
-					const nlohmann::json request = {{"setSubscriptions", {{uri, "request"}}}};
-					client->send(hdl, request.dump(), websocketpp::frame::opcode::text, ec);
+			// patient URI. The single pass parser is used first. If the message does not have the
+			// expected structure it is parsed again using the nlohmann::json constructors. Both
+			// parsers build each resource as its route says, see PatientDataConn::handleUpdate.
+			// Patients and diagnoses are parsed into the arena of the fetch which will receive
+			// them. The fetch is held until the parsed data is destroyed.
+			const Clock::time_point received = Clock::now();
+			std::unique_lock<std::mutex> parseLock(parseMutex);
+			RequestPtr arenaOwner;
+			std::shared_ptr<ClientMetrics> metrics;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				arenaOwner = getParseTarget();
+				metrics = clientMetrics;
+			}
+			std::pmr::memory_resource* resource =
+				arenaOwner ? arenaOwner->getResource() : std::pmr::get_default_resource();
+			UpdateSubscriptions update(resource, routes);
+			const Clock::time_point parseStarted = Clock::now();
+			bool parsed = parseUpdateSubscriptions(msg->get_payload(), update);
+			if (!parsed) {
+				update = UpdateSubscriptions(resource, routes);
+				parsed = parseUpdateSubscriptionsDom(msg->get_payload(), update);
+			}
+			if (metrics) {
+				metrics->parseSeconds->observeSince(parseStarted);
+			}
+			if (!parsed) {
+				return;
+			}
+
+			// The callbacks of the fetches are called after the lock is released, so that they
+			// can use the client
+			std::vector<std::function<void()>> notifications;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				handleUpdate(client, hdl, update, received, notifications);
+			}
+			parseLock.unlock();
+			for (const std::function<void()>& notify : notifications) {
+				notify();
+			}
+		}
+
+		void onFail(
+			ClientT* client,
+			std::shared_ptr<std::promise<WSAsyncResult<int>>> promise,
+			websocketpp::connection_hdl hdl
+		) override {
+			WebsocketConnectionMetadata<ClientT>::onFail(client, promise, hdl);
+			failPending();
+		}
+
+		void onClose(ClientT* client, websocketpp::connection_hdl hdl) override {
+			WebsocketConnectionMetadata<ClientT>::onClose(client, hdl);
+			failPending();
+		}
+
+	private:
+		/// Remove a fetch from everything waiting for responses. mutex must be locked.
+		/// @return true if the fetch was still waiting for the public:patients response
+		bool detach(const RequestPtr& request) {
+			const auto listIt = std::find(listRequests.begin(), listRequests.end(), request);
+			if (listIt != listRequests.end()) {
+				listRequests.erase(listIt);
+				return true;
+			}
+			for (auto waitersIt = patientWaiters.begin(); waitersIt != patientWaiters.end();) {
+				std::vector<PatientWaiter>& waiters = waitersIt->second;
+				waiters.erase(
+					std::remove_if(
+						waiters.begin(),
+						waiters.end(),
+						[&request](const PatientWaiter& waiter) {
+							return waiter.request == request;
+						}
+					),
+					waiters.end()
+				);
+				if (waiters.empty()) {
+					waitersIt = patientWaiters.erase(waitersIt);
+				} else {
+					++waitersIt;
 				}
+			}
+			if (request == expanding) {
+				expanding.reset();
+			}
+			return false;
+		}
+
+		/// A fetch or a lazy list waiting for the diagnoses of a patient in its list
+		struct PatientWaiter {
+			/// nullptr if the waiter is a lazy list
+			RequestPtr request;
+			/// The entry of the patient in the list of the fetch, so that the response does not
+			/// look up the URI in the list
+			PatientList::value_type* entry;
+			/// Set if the waiter is a lazy list
+			std::shared_ptr<LazyExpansion> lazyList;
+		};
+
+		/// A patient URI waiting to be sent
+		struct PendingSend {
+			std::string uri;
+			/// Subscription mode, "request", "subscribe" or "unsubscribe"
+			const char* mode;
+		};
+
+		/// Pass each resource of a parsed message to the handler of its kind and send the next
+		/// patient URIs. The callbacks of the fetches which must be called are added to
+		/// notifications. mutex must be locked.
+		void handleUpdate(
+			ClientT* client,
+			websocketpp::connection_hdl hdl,
+			UpdateSubscriptions& update,
+			Clock::time_point received,
+			std::vector<std::function<void()>>& notifications
+		) {
+			if (update.hasPatientList && listSentAt) {
+				clientMetrics->listRoundTripSeconds->observe(
+					std::chrono::duration<double>(received - *listSentAt).count()
+				);
+				listSentAt.reset();
+			}
+			for (const auto& patient : update.diagnoses) {
+				finishInFlight(patient.first, received);
+			}
+			for (auto& resource : update.resources) {
+				finishResource(
+					resource.first,
+					WSAsyncResult<nlohmann::json>(std::move(resource.second))
+				);
+			}
+			if (subscription) {
+				applyToSubscription(update);
+				sendPending(client, hdl);
+				return;
+			}
+			if (update.hasPatientList && !listRequests.empty()) {
+				handlePatientList(update.patients, received, notifications);
+			}
+			for (auto& patient : update.diagnoses) {
+				handlePatient(patient.first, patient.second, received, notifications);
+			}
+			sendPending(client, hdl);
+		}
+
+		/// Handle the response to {"setSubscriptions": {"public:patients": "request"}}. Each
+		/// fetch has sent its own request, the oldest one takes the response. mutex must be
+		/// locked.
+		void handlePatientList(
+			std::vector<std::pair<std::string, Patient>>& patients,
+			Clock::time_point received,
+			std::vector<std::function<void()>>& notifications
+		) {
+			RequestPtr request = std::move(listRequests.front());
+			listRequests.pop_front();
+			const std::vector<PatientList::value_type*> entries =
+				request->setSkeleton(std::move(patients), received);
+			notifications.push_back([request]() { request->notifySkeleton(); });
+			for (PatientList::value_type* entry : entries) {
+				// Patients received recently are expanded right away, the others are requested
+				Patient::DiagnoseList cached(request->getResource());
+				if (patientCache && patientCache->find(entry->first, cached, received)) {
+					clientMetrics->patientCacheHits->add();
+					const Patient* expanded = request->expand(entry, std::move(cached));
+					if (expanded) {
+						notifications.push_back([request, uri = entry->first, expanded]() {
+							request->notifyPatient(uri, *expanded);
+						});
+					}
+					continue;
+				}
+				if (patientCache) {
+					clientMetrics->patientCacheMisses->add();
+				}
+				std::vector<PatientWaiter>& waiters = patientWaiters[entry->first];
+				waiters.push_back({request, entry, nullptr});
+				if (waiters.size() == 1) {
+					enqueue(entry->first, "request");
+				}
+			}
+			if (request->isComplete()) {
+				completeAfter(request, notifications);
 			} else {
-				// Parses patient URI response to:
-				// {setSubscriptions: {<patient_uri>: "request"}}
-				for (auto it = json.begin(); it != json.end(); ++it) {
-					assert((*it)["type"] == std::string("Patient"));
-					const std::string& patientUri = it.key();
-					const auto patientIt = patientList->find(patientUri);
-					if (patientIt != patientList->end()) {
-						patientIt->second.diagnosesFromJson((*it)["diagnoses"]);
+				expanding = request;
+			}
+		}
+
+		/// Handle the response to {"setSubscriptions": {<patient_uri>: "request"}}. mutex must
+		/// be locked.
+		void handlePatient(
+			const std::string& uri,
+			Patient::DiagnoseList& diagnoses,
+			Clock::time_point received,
+			std::vector<std::function<void()>>& notifications
+		) {
+			auto waitersIt = patientWaiters.find(uri);
+			if (waitersIt == patientWaiters.end()) {
+				return;
+			}
+			if (patientCache) {
+				patientCache->insert(uri, diagnoses, received);
+			}
+			std::vector<PatientWaiter> waiters = std::move(waitersIt->second);
+			patientWaiters.erase(waitersIt);
+			// Requests from different fetches can wait for the same patient. Only the last one
+			// can take the diagnoses, the others need a copy.
+			for (size_t i = 0; i < waiters.size(); ++i) {
+				if (waiters[i].lazyList) {
+					waiters[i].lazyList->expand(waiters[i].entry, diagnoses);
+					continue;
+				}
+				const RequestPtr& request = waiters[i].request;
+				const Patient* expanded = i + 1 < waiters.size()
+					? request->expand(waiters[i].entry, diagnoses)
+					: request->expand(waiters[i].entry, std::move(diagnoses));
+				if (expanded) {
+					notifications.push_back([request, uri, expanded]() {
+						request->notifyPatient(uri, *expanded);
+					});
+				}
+				if (request->isComplete()) {
+					completeAfter(request, notifications);
+					if (request == expanding) {
+						expanding.reset();
 					}
-					patientsToExpand--;
 				}
+			}
+		}
+
+		/// Complete a fetch which has received all patients once the callbacks already in
+		/// notifications have been called. Completing it right away would make them see the
+		/// fetch as done and skip its last patients. mutex must be locked.
+		static void completeAfter(
+			const RequestPtr& request,
+			std::vector<std::function<void()>>& notifications
+		) {
+			notifications.push_back([request]() { request->complete(); });
+		}
+
+		/// Resolve the callers of PatientDataConn::requestResource waiting for a URI and stop
+		/// routing it to ResourceKind::Json. parseMutex and mutex must be locked.
+		void finishResource(const std::string& uri, WSAsyncResult<nlohmann::json> result) {
+			const auto waitersIt = resourceWaiters.find(uri);
+			if (waitersIt == resourceWaiters.end()) {
+				return;
+			}
+			for (ResourcePromise& promise : waitersIt->second) {
+				promise.set_value(result);
+			}
+			resourceWaiters.erase(waitersIt);
+			routes.remove(uri, ResourceRoutes::Match::Exact);
+		}
+
+		/// Get the fetch into whose arena the next message is parsed. mutex must be locked.
+		/// @return nullptr if the default memory resource must be used
+		RequestPtr getParseTarget() {
+			if (subscription) {
+				return nullptr;
+			}
+			if (!listRequests.empty()) {
+				return listRequests.front();
+			}
+			// A completed list belongs to the callers and its arena must not be used anymore
+			if (expanding && expanding->isDone()) {
+				expanding.reset();
+			}
+			return expanding;
+		}
+
+		/// Apply the content of an update to the subscription and subscribe to the new
+		/// patients. mutex must be locked.
+		void applyToSubscription(UpdateSubscriptions& update) {
+			if (update.hasPatientList) {
+				// {updateSubscriptions: {"public:patients": ...}} is pushed each time the list
+				// changes. Patients seen for the first time on this connection are subscribed,
+				// the ones which left the list are unsubscribed.
+				std::vector<std::string> added;
+				std::vector<std::string> removed;
+				subscribedUris.apply(update.patients, added, removed);
+				for (const std::string& uri : added) {
+					enqueue(uri, "subscribe");
+				}
+				for (const std::string& uri : removed) {
+					unsubscribe(uri);
+				}
+				subscription->applyPatientList(std::move(update.patients));
+			}
+			for (auto& patient : update.diagnoses) {
+				subscription->applyDiagnoses(patient.first, std::move(patient.second));
+			}
+		}
 
-				if (patientsToExpand == 0) {
-					client->close(hdl, websocketpp::close::status::normal, "");
-					promise.set_value(WSAsyncResult<PatientListPtr>(patientList));
+		/// Queue an unsubscribe for a patient URI which left the subscribed list. Its
+		/// subscription is not waited for anymore, the server need not answer it. mutex must be
+		/// locked.
+		void unsubscribe(const std::string& uri) {
+			const auto it = inFlight.find(uri);
+			if (it != inFlight.end()) {
+				clientMetrics->requestsInFlight->add(-1);
+				inFlight.erase(it);
+			}
+			enqueue(uri, "unsubscribe");
+		}
+
+		/// Send queued patient URIs until the window is full or the connection has too much
+		/// unsent data while requests are in flight. mutex must be locked.
+		void sendPending(ClientT* client, websocketpp::connection_hdl hdl) {
+			websocketpp::lib::error_code ec;
+			ClientT::connection_ptr connection = client->get_con_from_hdl(hdl, ec);
+			if (ec) {
+				return;
+			}
+			PendingSend pending;
+			while (int(inFlight.size()) < window) {
+				// Only the responses to the requests in flight resume sending. Unsubscribes are
+				// not answered, so without anything in flight the queue must not wait.
+				if (!inFlight.empty() && connection->get_buffered_amount() > maxBufferedBytes) {
+					break;
+				}
+				if (!popPending(pending)) {
+					break;
+				}
+				if (requestPatient(*connection, pending.uri, pending.mode)) {
+					markInFlight(pending);
 				}
 			}
 		}
 
-		std::future<WSAsyncResult<PatientListPtr>> getFuture() {
-			return std::move(promise.get_future());
+		/// Send queued patient URIs until the window is full from a thread which does not
+		/// handle a message of this connection, e.g. when nothing is in flight to resume
+		/// sending. mutex must be locked.
+		void sendPending(WSConnectionManager& endpoint) {
+			PendingSend pending;
+			while (int(inFlight.size()) < window && popPending(pending)) {
+				const EC::ErrorCode err = sendRequest(endpoint, pending.uri, pending.mode);
+				if (err.hasError()) {
+					failWaiters(pending.uri, err);
+				} else {
+					markInFlight(pending);
+				}
+			}
 		}
 
-	private:
-		std::promise<WSAsyncResult<PatientListPtr>> promise;
-		PatientListPtr patientList;
-		/// Counts how much responds to {"setSubscriptions": {<patient_uri>: "request"}}
-		/// we have received. We will set one per customer in patient:list. This is initialized
-		/// in the PatientDataConn::onMessage function and decremented again in it. onMessage is
-		/// called on the same thread (different than the main) which handles connections. We do
-		/// not need atomic in such case.
-		int patientsToExpand;
+		/// Take the next queued patient URI which is still wanted. mutex must be locked.
+		/// @return false if the queue is empty
+		bool popPending(PendingSend& pending) {
+			while (!sendQueue.empty()) {
+				pending = std::move(sendQueue.front());
+				sendQueue.pop_front();
+				clientMetrics->requestsQueued->add(-1);
+				// All fetches which wanted the patient have expired
+				if (std::string_view(pending.mode) == "request" &&
+					patientWaiters.find(pending.uri) == patientWaiters.end()) {
+					continue;
+				}
+				// The patient left the subscribed list before it was subscribed
+				if (std::string_view(pending.mode) == "subscribe" &&
+					!subscribedUris.contains(pending.uri)) {
+					continue;
+				}
+				return true;
+			}
+			return false;
+		}
+
+		/// Record that a patient URI was sent. Unsubscribing is not answered, so it is not in
+		/// flight. mutex must be locked.
+		void markInFlight(const PendingSend& pending) {
+			if (std::string_view(pending.mode) == "unsubscribe") {
+				return;
+			}
+			if (inFlight.emplace(pending.uri, Clock::now()).second) {
+				clientMetrics->requestsInFlight->add(1);
+			}
+		}
+
+		/// Fail everything waiting for a patient URI which could not be sent. mutex must be
+		/// locked.
+		void failWaiters(const std::string& uri, const EC::ErrorCode& err) {
+			const auto waitersIt = patientWaiters.find(uri);
+			if (waitersIt == patientWaiters.end()) {
+				return;
+			}
+			failAll(waitersIt->second, err);
+			patientWaiters.erase(waitersIt);
+		}
+
+		/// Queue a patient URI to be sent. mutex must be locked.
+		void enqueue(const std::string& uri, const char* mode) {
+			sendQueue.push_back({uri, mode});
+			clientMetrics->requestsQueued->add(1);
+		}
+
+		/// Record the round-trip time of a patient URI which has received a response. mutex
+		/// must be locked.
+		void finishInFlight(const std::string& uri, Clock::time_point received) {
+			const auto it = inFlight.find(uri);
+			if (it == inFlight.end()) {
+				return;
+			}
+			clientMetrics->patientRoundTripSeconds->observe(
+				std::chrono::duration<double>(received - it->second).count()
+			);
+			clientMetrics->requestsInFlight->add(-1);
+			inFlight.erase(it);
+		}
+
+		/// Send {"setSubscriptions": {"public:patients": <mode>}} through the manager. mutex
+		/// must be locked.
+		EC::ErrorCode sendListRequest(WSConnectionManager& endpoint, std::string_view mode) {
+			const EC::ErrorCode err = sendRequest(endpoint, "public:patients", mode);
+			if (!err.hasError() && !listSentAt) {
+				// Responses are taken in order, so the oldest request is measured
+				listSentAt = Clock::now();
+			}
+			return err;
+		}
+
+		/// Send public:patients for a new fetch, or fail it if that is not possible. mutex
+		/// must be locked.
+		/// @return true if the fetch waits for the response
+		bool startListRequest(WSConnectionManager& endpoint, RequestPtr request) {
+			if (closed) {
+				request->fail(EC::ErrorCode(
+					WSConnectionManager::ConnectionNotFound,
+					"Connection closed before the request was sent: %s",
+					getError().c_str()
+				));
+				return false;
+			}
+			const EC::ErrorCode err = sendListRequest(endpoint, "request");
+			if (err.hasError()) {
+				request->fail(err);
+				return false;
+			}
+			listRequests.push_back(std::move(request));
+			return true;
+		}
+
+		/// Send {"setSubscriptions": {<uri>: <mode>}} through the manager
+		EC::ErrorCode sendRequest(
+			WSConnectionManager& endpoint,
+			std::string_view uri,
+			std::string_view mode
+		) {
+			WSConnectionManager::Client::message_ptr message =
+				endpoint.createMessage(getHandle(), RequestEncoder::encodedSize(uri, mode));
+			if (!message) {
+				return EC::ErrorCode(
+					WSConnectionManager::ConnectionNotFound,
+					"Connection closed before the request was sent"
+				);
+			}
+			RequestEncoder::encode(uri, mode, message->get_raw_payload());
+			const EC::ErrorCode err = endpoint.send(getHandle(), message);
+			if (!err.hasError()) {
+				recordSent(message->get_payload());
+			}
+			return err;
+		}
+
+		/// Send {"setSubscriptions": {<uri>: <mode>}}. mutex must be locked.
+		/// @return true if the message was queued for sending
+		bool requestPatient(
+			ClientT::connection_type& connection,
+			const std::string& uri,
+			const char* mode
+		) {
+			// For some reason sending more than one URI in the same request e.g.
+			// {"setSubscriptions": {"public:patients/1_2897763/root": "request",
+			// "public:patients/0_1930886/root":"request"}} does not work and returns info only
+			// for the first entry. Thus we send them one by one.
+			// The request is encoded directly into the payload of the message, which is
+			// allocated with the exact size.
+			ClientT::message_ptr request = connection.get_message(
+				websocketpp::frame::opcode::text, RequestEncoder::encodedSize(uri, mode)
+			);
+			RequestEncoder::encode(uri, mode, request->get_raw_payload());
+			const websocketpp::lib::error_code ec = connection.send(request);
+			if (ec) {
+				failWaiters(
+					uri,
+					EC::ErrorCode(
+						WSConnectionManager::CannotSendMessage,
+						"Error sending message: %s",
+						ec.message().c_str()
+					)
+				);
+				return false;
+			}
+			recordSent(request->get_payload());
+			return true;
+		}
+
+		/// Fail all requests which wait for a response on this connection
+		void failPending() {
+			// The routes of the pending resources are removed
+			std::lock_guard<std::mutex> parseLock(parseMutex);
+			std::lock_guard<std::mutex> lock(mutex);
+			closed = true;
+			const EC::ErrorCode err(
+				WSConnectionManager::ConnectionNotFound,
+				"Connection lost before the patient list was received: %s",
+				getError().c_str()
+			);
+			failAll(listRequests, err);
+			expanding.reset();
+			for (auto& waiters : patientWaiters) {
+				failAll(waiters.second, err);
+			}
+			patientWaiters.clear();
+			for (auto& waiters : resourceWaiters) {
+				for (ResourcePromise& promise : waiters.second) {
+					promise.set_value(WSAsyncResult<nlohmann::json>(err));
+				}
+				routes.remove(waiters.first, ResourceRoutes::Match::Exact);
+			}
+			resourceWaiters.clear();
+			if (clientMetrics) {
+				clientMetrics->requestsQueued->add(-int64_t(sendQueue.size()));
+				clientMetrics->requestsInFlight->add(-int64_t(inFlight.size()));
+			}
+			sendQueue.clear();
+			inFlight.clear();
+			listSentAt.reset();
+		}
+
+		template <typename Requests>
+		static void failAll(Requests& requests, const EC::ErrorCode& err) {
+			for (RequestPtr& request : requests) {
+				request->fail(err);
+			}
+			requests.clear();
+		}
+
+		static void failAll(std::vector<PatientWaiter>& waiters, const EC::ErrorCode& err) {
+			for (PatientWaiter& waiter : waiters) {
+				if (waiter.lazyList) {
+					waiter.lazyList->fail(waiter.entry, err);
+				} else {
+					waiter.request->fail(err);
+				}
+			}
+			waiters.clear();
+		}
+
+		/// Fetches waiting for the response to public:patients, in the order they were sent
+		std::deque<RequestPtr> listRequests;
+		/// The last fetch which received the patient list and waits for patient details
+		RequestPtr expanding;
+		/// Requests waiting for the response to a patient URI, keyed by the URI
+		std::unordered_map<std::string, std::vector<PatientWaiter>> patientWaiters;
+		/// Callers of PatientDataConn::requestResource waiting for the response to a URI
+		std::unordered_map<std::string, std::vector<ResourcePromise>> resourceWaiters;
+		/// The kind of each resource URI. The URIs in resourceWaiters are routed to
+		/// ResourceKind::Json. Read by the parser, so changed only while parseMutex is held.
+		ResourceRoutes routes;
+		/// Patient URIs which wait to be sent
+		std::deque<PendingSend> sendQueue;
+		/// Patient URIs sent, but not answered yet, and when they were sent
+		std::unordered_map<std::string, Clock::time_point> inFlight;
+		/// When public:patients was sent, if its response has not been received yet
+		std::optional<Clock::time_point> listSentAt;
+		/// Set by the first request on this connection
+		std::shared_ptr<ClientMetrics> clientMetrics;
+		/// Details of recently received patients, shared by the connections of the client. Set
+		/// by the first fetch on this connection.
+		std::shared_ptr<PatientDetailCache> patientCache;
+		/// Maximal number of patient URIs sent, but not answered yet
+		int window;
+		/// If set, this connection is dedicated to keeping the subscription up to date
+		std::shared_ptr<PatientListSubscription> subscription;
+		/// Patient URIs subscribed on this connection
+		SubscribedUris subscribedUris;
+		/// Requests are started from the threads calling ViewRayClient::getPatientList, while
+		/// responses are handled on the decode threads and closing on the websocket threads.
+		std::mutex mutex;
+		/// Set when the connection is lost. No new requests can be started after that.
+		bool closed;
+		/// Held while a message is parsed and applied. A fetch whose deadline passes waits for
+		/// it, because its list must not be handed to the callers while the parser allocates
+		/// from its arena. Locked before mutex.
+		std::mutex parseMutex;
 	};
 
-	ViewRayClient::ViewRayClient(std::string address) :
-		address(std::move(address)) {
+	void LazyExpansion::request(std::vector<PatientList::value_type*> entries) {
+		if (entries.empty()) {
+			return;
+		}
+		// Any pooled connection can serve the patients, the list does not depend on it
+		std::shared_ptr<LazyExpansion> self = shared_from_this();
+		WSConnectionManager* manager = &endpoint;
+		endpoint.acquire<PatientDataConn>(
+			address,
+			[self, manager, entries = std::move(entries)](const WSAsyncResult<int>& connID) {
+				if (connID.hasError()) {
+					self->fail(entries, connID.getError());
+					return;
+				}
+				WSConnectionManager::Metadata::Ptr metadata = manager->getMetadata(connID.getData());
+				if (!metadata) {
+					self->fail(
+						entries,
+						EC::ErrorCode(
+							WSConnectionManager::ConnectionNotFound,
+							"Connection %d was lost before the request was sent",
+							connID.getData()
+						)
+					);
+					return;
+				}
+				static_cast<PatientDataConn*>(metadata.get())->expandLazily(
+					*manager, self->requestWindow, self->metrics, self->cache, self, entries
+				);
+			}
+		);
 	}
 
-	std::future<WSAsyncResult<ViewRayClient::PatientListPtr>> ViewRayClient::getPatientList() {
-		// TODO this opens a new connection for each request (and closes it when the list is retrieved)
-		// Not sure if this is the best approach. Maybe it's better to keep the connection open
-		// but then we have a problem with multiple calls to getPatientList.
-		std::future<WSAsyncResult<int>> connFuture = endpoint.connect<PatientDataConn>(address);
-		WSAsyncResult<int> connID = connFuture.get();
+	/// @brief Open a connection dedicated to a patient list subscription
+	///
+	/// When the connection opens the patient list is subscribed. When it is lost, a new one is
+	/// opened after a delay which grows with the number of consecutive failed attempts.
+	static void connectSubscription(
+		WSConnectionManager& endpoint,
+		const std::string& address,
+		std::shared_ptr<PatientListSubscription> subscription,
+		int window,
+		std::shared_ptr<ClientMetrics> metrics,
+		int failedAttempts
+	) {
+		using Status = WSConnectionManager::Metadata::Status;
+		WSConnectionManager* manager = &endpoint;
+		// Makes sure that only one reconnect is scheduled for this connection
+		auto reconnecting = std::make_shared<std::atomic<bool>>(false);
+		auto reconnect = [=](int attempts) {
+			if (!reconnecting->exchange(true)) {
+				manager->schedule(manager->getBackoffDelay(attempts), [=]() {
+					connectSubscription(
+						*manager, address, subscription, window, metrics, attempts + 1
+					);
+				});
+			}
+		};
+
+		std::future<WSAsyncResult<int>> connFuture = endpoint.connect<PatientDataConn>(
+			address,
+			[=](int id, Status status) mutable {
+				if (status == Status::Opened) {
+					failedAttempts = 0;
+					WSConnectionManager::Metadata::Ptr metadata = manager->getMetadata(id);
+					if (!metadata) {
+						return;
+					}
+					EC::ErrorCode err = static_cast<PatientDataConn*>(metadata.get())
+											->subscribe(*manager, subscription, window, metrics);
+					if (err.hasError()) {
+						// The close handler will open a new connection
+						manager->close(id, websocketpp::close::status::normal, "");
+					}
+				} else if (status == Status::Failed || status == Status::Closed) {
+					reconnect(failedAttempts);
+				}
+			}
+		);
+
+		// The connection can fail before it is started. Then there is no status callback.
+		if (connFuture.wait_for(std::chrono::seconds(0)) == std::future_status::ready &&
+			connFuture.get().hasError()) {
+			reconnect(failedAttempts);
+		}
+	}
+
+	/// @brief Wait for a pooled connection to the address
+	/// @param[in] deadline If set, how long to wait before failing with ViewRayClient::Timeout
+	/// @return The metadata of the connection
+	static WSAsyncResult<WSConnectionManager::Metadata::Ptr> acquireConnection(
+		WSConnectionManager& endpoint,
+		const std::string& address,
+		std::optional<Clock::time_point> deadline
+	) {
+		using Result = WSAsyncResult<WSConnectionManager::Metadata::Ptr>;
+		std::shared_future<WSAsyncResult<int>> connFuture = endpoint.acquire<PatientDataConn>(address);
+		if (deadline && connFuture.wait_until(*deadline) != std::future_status::ready) {
+			return Result(EC::ErrorCode(
+				ViewRayClient::Timeout,
+				"Timed out waiting for a connection to %s",
+				address.c_str()
+			));
+		}
+		const WSAsyncResult<int>& connID = connFuture.get();
 		if (connID.hasError()) {
-			std::promise<WSAsyncResult<PatientListPtr>> p;
-			p.set_value(WSAsyncResult<PatientListPtr>(connID.getError()));
-			return p.get_future();
+			return Result(connID.getError());
+		}
+		WSConnectionManager::Metadata::Ptr metadata = endpoint.getMetadata(connID.getData());
+		if (!metadata) {
+			return Result(EC::ErrorCode(
+				WSConnectionManager::ConnectionNotFound,
+				"Connection %d was lost before the request was sent",
+				connID.getData()
+			));
+		}
+		return Result(std::move(metadata));
+	}
+
+	/// @brief Future which is ready with an error
+	template <typename T>
+	static std::future<WSAsyncResult<T>> failedFuture(const EC::ErrorCode& err) {
+		std::promise<WSAsyncResult<T>> promise;
+		promise.set_value(WSAsyncResult<T>(err));
+		return promise.get_future();
+	}
+
+	/// @brief State of a fetch started by ViewRayClient::fetchPatientListAsync
+	///
+	/// The deadline or the cancellation can come while the fetch waits for a connection or
+	/// after it is started on one.
+	struct AsyncFetch {
+		/// Value of connectionId while the fetch waits for a connection
+		static constexpr int waiting = -1;
+		/// Value of connectionId once the fetch is aborted before it got a connection
+		static constexpr int aborted = -2;
+
+		/// Held by the connection while the fetch runs, so that a finished fetch is released
+		/// even if its FetchCancellation is kept
+		std::weak_ptr<PatientListRequest> request;
+		/// The connection which runs the fetch, or waiting or aborted. Leaves waiting exactly
+		/// once, so either the connection starts the fetch or the abort fails it.
+		std::atomic<int> connectionId{waiting};
+	};
+
+	/// @brief Stop a fetch started by ViewRayClient::fetchPatientListAsync
+	/// @param[in] cancelled If true the fetch fails with ViewRayClient::Cancelled, otherwise
+	///		its deadline has passed, see PatientDataConn::expire
+	static void abortFetch(WSConnectionManager& endpoint, AsyncFetch& fetch, bool cancelled) {
+		const std::shared_ptr<PatientListRequest> request = fetch.request.lock();
+		if (!request) {
+			return;
+		}
+		int connectionId = AsyncFetch::waiting;
+		if (fetch.connectionId.compare_exchange_strong(connectionId, AsyncFetch::aborted)) {
+			// The connection which arrives later does not start the fetch
+			request->fail(
+				cancelled ? EC::ErrorCode(ViewRayClient::Cancelled, "The fetch was cancelled")
+						  : EC::ErrorCode(
+								ViewRayClient::Timeout, "Timed out waiting for a connection"
+							)
+			);
+			return;
+		}
+		if (connectionId == AsyncFetch::aborted) {
+			return;
+		}
+		// If the connection is gone the fetch has already failed
+		WSConnectionManager::Metadata::Ptr metadata = endpoint.getMetadata(connectionId);
+		if (!metadata) {
+			return;
+		}
+		PatientDataConn* connection = static_cast<PatientDataConn*>(metadata.get());
+		if (cancelled) {
+			connection->cancel(request);
 		} else {
-			const nlohmann::json request({{"setSubscriptions", {{"public:patients", "request"}}}});
-			endpoint.send(connID.getData(), request.dump());
-			WSConnectionManager::Metadata::Ptr metadata = endpoint.getMetadata(connID.getData());
-			return static_cast<PatientDataConn*>(metadata.get())->getFuture();
+			connection->expire(request);
 		}
 	}
-}  // namespace ViewRay
\ No newline at end of file
+
+	ViewRayClient::ViewRayClient(std::string address, int connectionPoolSize) :
+		address(std::move(address)),
+		connectionPoolSize(connectionPoolSize),
+		requestWindow(defaultRequestWindow),
+		patientCache(std::make_shared<PatientDetailCache>(
+			defaultPatientCacheCapacity,
+			defaultPatientCacheTtl
+		)),
+		ownedEndpoint(new WSConnectionManager),
+		endpoint(*ownedEndpoint) {
+		metrics = std::make_shared<ClientMetrics>(endpoint.getMetrics());
+	}
+
+	ViewRayClient::ViewRayClient(
+		std::string address,
+		WSConnectionManager& endpoint,
+		const MetricsRegistry::Labels& metricLabels
+	) :
+		address(std::move(address)),
+		connectionPoolSize(0),
+		requestWindow(defaultRequestWindow),
+		patientCache(std::make_shared<PatientDetailCache>(
+			defaultPatientCacheCapacity,
+			defaultPatientCacheTtl
+		)),
+		endpoint(endpoint) {
+		metrics = std::make_shared<ClientMetrics>(endpoint.getMetrics(), metricLabels);
+	}
+
+	void ViewRayClient::setRequestWindow(int window) {
+		requestWindow = std::max(window, 1);
+	}
+
+	MetricsRegistry& ViewRayClient::getMetrics() {
+		return endpoint.getMetrics();
+	}
+
+	PatientDetailCache& ViewRayClient::getPatientCache() {
+		return *patientCache;
+	}
+
+	EC::ErrorCode ViewRayClient::init(int ioThreads, int decodeThreads) {
+		if (ownedEndpoint) {
+			endpoint.init(ioThreads, decodeThreads);
+			endpoint.setPoolSize(connectionPoolSize);
+		}
+		// Start opening the pooled connections, so that the first request finds them warm
+		endpoint.acquire<PatientDataConn>(address);
+		return EC::ErrorCode();
+	}
+
+	std::shared_ptr<PatientListSubscription> ViewRayClient::subscribePatientList() {
+		std::lock_guard<std::mutex> lock(subscriptionMutex);
+		if (!subscription) {
+			subscription = std::make_shared<PatientListSubscription>();
+			connectSubscription(endpoint, address, subscription, requestWindow, metrics, 0);
+		}
+		return subscription;
+	}
+
+	std::future<WSAsyncResult<ViewRayClient::SharedPatientListPtr>>
+	ViewRayClient::getPatientList() {
+		std::shared_ptr<PatientListRequest> request;
+		std::future<WSAsyncResult<SharedPatientListPtr>> result;
+		{
+			// Callers which come while a fetch is in flight share it, whichever pooled
+			// connection runs it
+			std::lock_guard<std::mutex> lock(sharedFetchMutex);
+			request = sharedFetch.lock();
+			if (request && !request->isDone()) {
+				return request->addWaiter();
+			}
+			request = std::make_shared<PatientListRequest>(metrics, Clock::now());
+			result = request->addWaiter();
+			sharedFetch = request;
+		}
+		const WSAsyncResult<WSConnectionManager::Metadata::Ptr> connection =
+			acquireConnection(endpoint, address, std::nullopt);
+		if (connection.hasError()) {
+			request->fail(connection.getError());
+			return result;
+		}
+		static_cast<PatientDataConn*>(connection.getData().get())
+			->startFetch(endpoint, requestWindow, metrics, patientCache, request, std::nullopt);
+		return result;
+	}
+
+	std::future<WSAsyncResult<ViewRayClient::LazyPatientList>> ViewRayClient::getLazyPatientList() {
+		auto promise = std::make_shared<std::promise<WSAsyncResult<LazyPatientList>>>();
+		std::future<WSAsyncResult<LazyPatientList>> result = promise->get_future();
+		auto request = std::make_shared<PatientListRequest>(metrics, Clock::now());
+		request->setSkeletonOnly();
+		// The list is handed over to its expansion state once the skeleton arrives
+		request->setResultCallback(
+			[promise,
+			 manager = &endpoint,
+			 address = address,
+			 window = int(requestWindow),
+			 fetchMetrics = metrics,
+			 cache = patientCache](WSAsyncResult<FetchResult> fetched) {
+				if (fetched.hasError()) {
+					promise->set_value(WSAsyncResult<LazyPatientList>(fetched.getError()));
+					return;
+				}
+				promise->set_value(WSAsyncResult<LazyPatientList>(
+					LazyPatientList(std::make_shared<LazyExpansion>(
+						fetched.getData().patients, *manager, address, window, fetchMetrics, cache
+					))
+				));
+			}
+		);
+		const WSAsyncResult<WSConnectionManager::Metadata::Ptr> connection =
+			acquireConnection(endpoint, address, std::nullopt);
+		if (connection.hasError()) {
+			request->fail(connection.getError());
+			return result;
+		}
+		static_cast<PatientDataConn*>(connection.getData().get())
+			->startFetch(endpoint, requestWindow, metrics, patientCache, request, std::nullopt);
+		return result;
+	}
+
+	std::future<WSAsyncResult<ViewRayClient::FetchResult>> ViewRayClient::fetchPatientList(
+		FetchOptions options
+	) {
+		const Clock::time_point started = Clock::now();
+		std::optional<Clock::time_point> deadline;
+		if (options.timeout.count() > 0) {
+			deadline = started + options.timeout;
+		}
+		const WSAsyncResult<WSConnectionManager::Metadata::Ptr> connection =
+			acquireConnection(endpoint, address, deadline);
+		if (connection.hasError()) {
+			metrics->fetchErrors->add();
+			return failedFuture<FetchResult>(connection.getError());
+		}
+		return static_cast<PatientDataConn*>(connection.getData().get())
+			->fetchPatientList(
+				endpoint, requestWindow, metrics, patientCache, started, std::move(options)
+			);
+	}
+
+	std::future<WSAsyncResult<nlohmann::json>> ViewRayClient::fetchResource(
+		const std::string& uri
+	) {
+		const WSAsyncResult<WSConnectionManager::Metadata::Ptr> connection =
+			acquireConnection(endpoint, address, std::nullopt);
+		if (connection.hasError()) {
+			return failedFuture<nlohmann::json>(connection.getError());
+		}
+		return static_cast<PatientDataConn*>(connection.getData().get())
+			->requestResource(endpoint, uri);
+	}
+
+	void ViewRayClient::connectAsync(std::function<void(const EC::ErrorCode& error)> callback) {
+		endpoint.acquire<PatientDataConn>(
+			address,
+			[callback = std::move(callback)](const WSAsyncResult<int>& connID) {
+				callback(connID.hasError() ? connID.getError() : EC::ErrorCode());
+			}
+		);
+	}
+
+	FetchCancellation ViewRayClient::fetchPatientListAsync(
+		FetchOptions options,
+		FetchCallback callback
+	) {
+		const Clock::time_point started = Clock::now();
+		const std::chrono::milliseconds timeout = options.timeout;
+		auto request = std::make_shared<PatientListRequest>(metrics, started, std::move(options));
+		// The request finishes while the connection is locked, so the callback is called later
+		WSConnectionManager* manager = &endpoint;
+		request->setResultCallback(
+			[manager, callback = std::move(callback)](WSAsyncResult<FetchResult> result) {
+				manager->post([callback, result = std::move(result)]() { callback(result); });
+			}
+		);
+		auto fetch = std::make_shared<AsyncFetch>();
+		fetch->request = request;
+
+		FetchCancellation cancellation;
+		cancellation.setHandler([manager, fetch]() {
+			abortFetch(*manager, *fetch, true);
+		});
+		// A single timer covers waiting for the connection and the fetch itself
+		if (timeout.count() > 0) {
+			endpoint.schedule(int(timeout.count()), [manager, fetch]() {
+				abortFetch(*manager, *fetch, false);
+			});
+		}
+
+		// The request is held by this callback until the connection is acquired and then by
+		// the connection until it finishes
+		// Does not refer to the client, which can be destroyed before a shared manager calls it
+		const int window = requestWindow;
+		std::shared_ptr<ClientMetrics> fetchMetrics = metrics;
+		std::shared_ptr<PatientDetailCache> cache = patientCache;
+		endpoint.acquire<PatientDataConn>(
+			address,
+			[manager, window, fetchMetrics, cache, fetch, request](
+				const WSAsyncResult<int>& connID
+			) {
+				if (connID.hasError()) {
+					request->fail(connID.getError());
+					return;
+				}
+				int waiting = AsyncFetch::waiting;
+				if (!fetch->connectionId.compare_exchange_strong(waiting, connID.getData())) {
+					// Aborted while waiting for the connection, the request has already failed
+					return;
+				}
+				WSConnectionManager::Metadata::Ptr metadata = manager->getMetadata(connID.getData());
+				if (!metadata) {
+					request->fail(EC::ErrorCode(
+						WSConnectionManager::ConnectionNotFound,
+						"Connection %d was lost before the request was sent",
+						connID.getData()
+					));
+					return;
+				}
+				static_cast<PatientDataConn*>(metadata.get())
+					->startFetch(*manager, window, fetchMetrics, cache, request, std::nullopt);
+			}
+		);
+		return cancellation;
+	}
+
+	LazyPatientList::LazyPatientList(std::shared_ptr<LazyExpansion> state) :
+		state(std::move(state)) {
+	}
+
+	const PatientList& LazyPatientList::getPatients() const {
+		return state->getPatients();
+	}
+
+	LazyPatientList::PatientFuture LazyPatientList::getPatient(const std::string& uri) const {
+		return state->getPatient(uri);
+	}
+
+	void LazyPatientList::prefetch(const std::vector<std::string>& uris) const {
+		state->prefetch(uris);
+	}
+
+	bool LazyPatientList::isExpanded(const std::string& uri) const {
+		return state->isExpanded(uri);
+	}
+
+	void connectAsync(ViewRayClient& client, std::function<void(const EC::ErrorCode&)> callback) {
+		client.connectAsync(std::move(callback));
+	}
+
+	FetchCancellation fetchPatientListAsync(
+		ViewRayClient& client,
+		FetchOptions options,
+		FetchCallback callback
+	) {
+		return client.fetchPatientListAsync(std::move(options), std::move(callback));
+	}
+}  // namespace ViewRay
@@ -0,0 +1,237 @@
+#include "compact_patient.h"
+#include <algorithm>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace ViewRay {
+	namespace {
+		/// Parse exactly count decimal digits
+		bool parseDigits(std::string_view text, size_t count, uint32_t& value) {
+			value = 0;
+			for (size_t i = 0; i < count; ++i) {
+				if (text[i] < '0' || text[i] > '9') {
+					return false;
+				}
+				value = value * 10 + uint32_t(text[i] - '0');
+			}
+			return true;
+		}
+
+		void appendDigits(std::string& out, uint32_t value, size_t count) {
+			char digits[4];
+			for (size_t i = count; i > 0; --i) {
+				digits[i - 1] = char('0' + value % 10);
+				value /= 10;
+			}
+			out.append(digits, count);
+		}
+	}  // namespace
+
+	PackedDate PackedDate::fromString(std::string_view text) {
+		PackedDate date;
+		if (text.empty()) {
+			return date;
+		}
+		uint32_t year = 0;
+		uint32_t month = 0;
+		uint32_t day = 0;
+		if (text.size() == 10 && text[4] == '-' && text[7] == '-' && parseDigits(text, 4, year) &&
+			parseDigits(text.substr(5), 2, month) && parseDigits(text.substr(8), 2, day) &&
+			month >= 1 && month <= 12 && day >= 1 && day <= 31) {
+			date.bits = year << 9 | month << 5 | day;
+			return date;
+		}
+		date.bits = SymbolTable::global().intern(text) | symbolFlag;
+		return date;
+	}
+
+	std::string PackedDate::toString() const {
+		if (bits & symbolFlag) {
+			return std::string(SymbolTable::global().get(bits & ~symbolFlag));
+		}
+		std::string text;
+		if (isDate()) {
+			text.reserve(10);
+			appendDigits(text, uint32_t(getYear()), 4);
+			text.push_back('-');
+			appendDigits(text, uint32_t(getMonth()), 2);
+			text.push_back('-');
+			appendDigits(text, uint32_t(getDay()), 2);
+		}
+		return text;
+	}
+
+	template <CompactStrings storage>
+	BasicCompactDiagnoses<storage>::BasicCompactDiagnoses(const Patient::DiagnoseList& diagnoses) {
+		if (diagnoses.empty()) {
+			return;
+		}
+		// Labels repeat between the plans and the prescriptions of a patient, each distinct
+		// string is stored or interned once. Maps each string to the word which refers to it.
+		std::unordered_map<std::string_view, uint32_t> stringIndices;
+		std::vector<std::string_view> strings;
+		size_t chars = 0;
+		const auto addString = [&](std::string_view str) {
+			if (stringIndices.find(str) != stringIndices.end()) {
+				return;
+			}
+			if constexpr (storage == CompactStrings::Global) {
+				stringIndices.emplace(str, SymbolTable::global().intern(str));
+			} else {
+				stringIndices.emplace(str, uint32_t(strings.size()));
+				strings.push_back(str);
+				chars += str.size();
+			}
+		};
+		size_t prescriptions = 0;
+		size_t plans = 0;
+		for (const Diagnose& diagnose : diagnoses) {
+			addString(diagnose.getDescription());
+			addString(diagnose.getLabel());
+			prescriptions += diagnose.getPrescriptions().size();
+			for (const Prescription& prescription : diagnose.getPrescriptions()) {
+				addString(prescription.getDescription());
+				addString(prescription.getLabel());
+				plans += prescription.getPlans().size();
+				for (const Plan& plan : prescription.getPlans()) {
+					addString(plan.getLabel());
+				}
+			}
+		}
+		const size_t stringEnds = headerWords + diagnoses.size() * diagnoseWords +
+			prescriptions * prescriptionWords + plans;
+		const size_t count = stringEnds + strings.size() +
+			(chars + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+		words.reset(new uint32_t[count]);
+		words[0] = uint32_t(diagnoses.size());
+		words[1] = uint32_t(prescriptions);
+		words[2] = uint32_t(plans);
+		words[3] = uint32_t(strings.size());
+
+		const auto index = [&](std::string_view str) {
+			return stringIndices.find(str)->second;
+		};
+		uint32_t* diagnoseOut = words.get() + headerWords;
+		uint32_t* prescriptionOut = diagnoseOut + diagnoses.size() * diagnoseWords;
+		uint32_t* planOut = prescriptionOut + prescriptions * prescriptionWords;
+		uint32_t prescriptionIndex = 0;
+		uint32_t planIndex = 0;
+		for (const Diagnose& diagnose : diagnoses) {
+			for (const Prescription& prescription : diagnose.getPrescriptions()) {
+				for (const Plan& plan : prescription.getPlans()) {
+					*planOut++ = index(plan.getLabel());
+				}
+				planIndex += uint32_t(prescription.getPlans().size());
+				*prescriptionOut++ = index(prescription.getDescription());
+				*prescriptionOut++ = index(prescription.getLabel());
+				*prescriptionOut++ = uint32_t(int32_t(prescription.getNumFractions()));
+				*prescriptionOut++ = planIndex;
+			}
+			prescriptionIndex += uint32_t(diagnose.getPrescriptions().size());
+			*diagnoseOut++ = index(diagnose.getDescription());
+			*diagnoseOut++ = index(diagnose.getLabel());
+			*diagnoseOut++ = prescriptionIndex;
+		}
+
+		// The padding after the characters is copied with the rest of the words
+		if (count > stringEnds) {
+			words[count - 1] = 0;
+		}
+		uint32_t* endOut = words.get() + stringEnds;
+		char* charOut = reinterpret_cast<char*>(endOut + strings.size());
+		uint32_t end = 0;
+		for (const std::string_view str : strings) {
+			if (!str.empty()) {
+				std::memcpy(charOut + end, str.data(), str.size());
+			}
+			end += uint32_t(str.size());
+			*endOut++ = end;
+		}
+	}
+
+	template <CompactStrings storage>
+	BasicCompactDiagnoses<storage>::BasicCompactDiagnoses(const BasicCompactDiagnoses& other) {
+		*this = other;
+	}
+
+	template <CompactStrings storage>
+	BasicCompactDiagnoses<storage>& BasicCompactDiagnoses<storage>::operator=(
+		const BasicCompactDiagnoses& other
+	) {
+		if (this == &other) {
+			return *this;
+		}
+		const size_t count = other.wordCount();
+		if (count == 0) {
+			words.reset();
+			return *this;
+		}
+		words.reset(new uint32_t[count]);
+		std::copy(other.words.get(), other.words.get() + count, words.get());
+		return *this;
+	}
+
+	template <CompactStrings storage>
+	void BasicCompactDiagnoses<storage>::toDiagnoses(Patient::DiagnoseList& out) const {
+		out.clear();
+		out.reserve(size());
+		for (size_t i = 0; i < size(); ++i) {
+			const DiagnoseView view = (*this)[i];
+			Diagnose& diagnose = out.emplace_back();
+			diagnose.setDescription(view.getDescription());
+			diagnose.setLabel(view.getLabel());
+			diagnose.reservePrescriptions(view.getPrescriptionCount());
+			for (size_t j = 0; j < view.getPrescriptionCount(); ++j) {
+				const PrescriptionView prescriptionView = view.getPrescription(j);
+				Prescription& prescription = diagnose.addPrescription();
+				prescription.setDescription(prescriptionView.getDescription());
+				prescription.setLabel(prescriptionView.getLabel());
+				prescription.setNumFractions(prescriptionView.getNumFractions());
+				prescription.reservePlans(prescriptionView.getPlanCount());
+				for (size_t k = 0; k < prescriptionView.getPlanCount(); ++k) {
+					prescription.addPlan(prescriptionView.getPlanLabel(k));
+				}
+			}
+		}
+	}
+
+	template class BasicCompactDiagnoses<CompactStrings::Owned>;
+	template class BasicCompactDiagnoses<CompactStrings::Global>;
+
+	CompactPatient::CompactPatient(const Patient& patient) :
+		id(patient.getId()),
+		mrn(patient.getMrn()),
+		dateOfBirth(PackedDate::fromString(patient.getDateOfBirth())),
+		firstName(SymbolTable::global().intern(patient.getFirstName())),
+		middleName(SymbolTable::global().intern(patient.getMiddleName())),
+		lastName(SymbolTable::global().intern(patient.getLastName())),
+		fractionsTotal(patient.getFractionsTotal()),
+		fractionsCompleted(patient.getFractionsCompleted()),
+		weightKg(patient.getWeightKg()),
+		registrationTime(patient.getRegistrationTime()),
+		sex(uint8_t(patient.getSex())),
+		readyForTreatment(patient.isReadyForTreatment() ? 1 : 0),
+		diagnoses(patient.getDiagnoses()) {
+	}
+
+	Patient CompactPatient::toPatient(const Patient::allocator_type& alloc) const {
+		Patient patient(alloc);
+		patient.setId(getId());
+		patient.setMrn(getMrn());
+		patient.setDateOfBirth(dateOfBirth.toString());
+		patient.setFirstName(getFirstName());
+		patient.setMiddleName(getMiddleName());
+		patient.setLastName(getLastName());
+		patient.setSex(getSex());
+		patient.setFractionsTotal(fractionsTotal);
+		patient.setFractionsCompleted(fractionsCompleted);
+		patient.setWeightKg(weightKg);
+		patient.setRegistrationTime(registrationTime);
+		patient.setReadyForTreatment(isReadyForTreatment());
+		Patient::DiagnoseList patientDiagnoses(alloc);
+		diagnoses.toDiagnoses(patientDiagnoses);
+		patient.setDiagnoses(std::move(patientDiagnoses));
+		return patient;
+	}
+}  // namespace ViewRay
@@ -0,0 +1,733 @@
+#include "json_scanner.h"
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define VIEWRAY_JSON_SCANNER_X86
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+#endif
+
+// The SIMD kernels are compiled for their instruction set regardless of the flags of the
+// build, so that a single binary can pick the kernel at runtime. MSVC does not need this.
+#if defined(__GNUC__) || defined(__clang__)
+#define VIEWRAY_TARGET(isa) __attribute__((target(isa)))
+#else
+#define VIEWRAY_TARGET(isa)
+#endif
+
+namespace ViewRay {
+	namespace {
+		constexpr size_t blockSize = 64;
+		/// Number of blocks classified by a single call of a kernel. The blocks and their
+		/// masks stay in the L1 cache until they are indexed.
+		constexpr size_t batchBlocks = 64;
+
+		/// @brief Classes of the 64 bytes of a block, one bit per byte
+		struct BlockMasks {
+			uint64_t quote;
+			uint64_t backslash;
+			/// { } [ ] : ,
+			uint64_t op;
+			/// Space, tab, line feed and carriage return
+			uint64_t whitespace;
+			/// Bytes below 0x20, which must be escaped inside strings
+			uint64_t control;
+		};
+
+		/// Classify blocks consecutive blocks of data
+		using ClassifyFn = void (*)(const uint8_t* data, size_t blocks, BlockMasks* masks);
+		/// Number of bytes at the start of data which are known to be ASCII. Can be less than
+		/// the actual number.
+		using AsciiPrefixFn = size_t (*)(const uint8_t* data, size_t size);
+
+		void classifyScalar(const uint8_t* data, size_t blocks, BlockMasks* masks) {
+			for (size_t block = 0; block < blocks; ++block) {
+				BlockMasks m = {};
+				const uint8_t* bytes = data + block * blockSize;
+				for (size_t i = 0; i < blockSize; ++i) {
+					const uint64_t bit = uint64_t(1) << i;
+					switch (bytes[i]) {
+						case '"': m.quote |= bit; break;
+						case '\\': m.backslash |= bit; break;
+						case '{':
+						case '}':
+						case '[':
+						case ']':
+						case ':':
+						case ',': m.op |= bit; break;
+						case ' ':
+						case '\t':
+						case '\n':
+						case '\r': m.whitespace |= bit; break;
+						default: break;
+					}
+					if (bytes[i] < 0x20) {
+						m.control |= bit;
+					}
+				}
+				masks[block] = m;
+			}
+		}
+
+		size_t asciiPrefixScalar(const uint8_t* data, size_t size) {
+			size_t i = 0;
+			while (i + 8 <= size) {
+				uint64_t word;
+				std::memcpy(&word, data + i, sizeof(word));
+				if ((word & 0x8080808080808080ull) != 0) {
+					break;
+				}
+				i += 8;
+			}
+			return i;
+		}
+
+#ifdef VIEWRAY_JSON_SCANNER_X86
+		VIEWRAY_TARGET("sse2")
+		void classifySse2(const uint8_t* data, size_t blocks, BlockMasks* masks) {
+			const __m128i quote = _mm_set1_epi8('"');
+			const __m128i backslash = _mm_set1_epi8('\\');
+			const __m128i lowercase = _mm_set1_epi8(0x20);
+			// '[' | 0x20 == '{' and ']' | 0x20 == '}'
+			const __m128i openBrace = _mm_set1_epi8('{');
+			const __m128i closeBrace = _mm_set1_epi8('}');
+			const __m128i colon = _mm_set1_epi8(':');
+			const __m128i comma = _mm_set1_epi8(',');
+			const __m128i space = _mm_set1_epi8(' ');
+			const __m128i tab = _mm_set1_epi8('\t');
+			const __m128i lineFeed = _mm_set1_epi8('\n');
+			const __m128i carriageReturn = _mm_set1_epi8('\r');
+			const __m128i maxControl = _mm_set1_epi8(0x1f);
+			for (size_t block = 0; block < blocks; ++block) {
+				BlockMasks m = {};
+				for (int part = 0; part < 4; ++part) {
+					const __m128i v = _mm_loadu_si128(
+						reinterpret_cast<const __m128i*>(data + block * blockSize + part * 16)
+					);
+					const __m128i folded = _mm_or_si128(v, lowercase);
+					const __m128i op = _mm_or_si128(
+						_mm_or_si128(_mm_cmpeq_epi8(folded, openBrace), _mm_cmpeq_epi8(folded, closeBrace)),
+						_mm_or_si128(_mm_cmpeq_epi8(v, colon), _mm_cmpeq_epi8(v, comma))
+					);
+					const __m128i whitespace = _mm_or_si128(
+						_mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, tab)),
+						_mm_or_si128(_mm_cmpeq_epi8(v, lineFeed), _mm_cmpeq_epi8(v, carriageReturn))
+					);
+					const __m128i control = _mm_cmpeq_epi8(_mm_max_epu8(v, maxControl), maxControl);
+					const int shift = part * 16;
+					m.quote |= uint64_t(uint16_t(_mm_movemask_epi8(_mm_cmpeq_epi8(v, quote)))) << shift;
+					m.backslash |= uint64_t(uint16_t(_mm_movemask_epi8(_mm_cmpeq_epi8(v, backslash))))
+								   << shift;
+					m.op |= uint64_t(uint16_t(_mm_movemask_epi8(op))) << shift;
+					m.whitespace |= uint64_t(uint16_t(_mm_movemask_epi8(whitespace))) << shift;
+					m.control |= uint64_t(uint16_t(_mm_movemask_epi8(control))) << shift;
+				}
+				masks[block] = m;
+			}
+		}
+
+		VIEWRAY_TARGET("sse2")
+		size_t asciiPrefixSse2(const uint8_t* data, size_t size) {
+			size_t i = 0;
+			while (i + 16 <= size) {
+				const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+				if (_mm_movemask_epi8(v) != 0) {
+					break;
+				}
+				i += 16;
+			}
+			return i;
+		}
+
+		VIEWRAY_TARGET("avx2")
+		void classifyAvx2(const uint8_t* data, size_t blocks, BlockMasks* masks) {
+			const __m256i quote = _mm256_set1_epi8('"');
+			const __m256i backslash = _mm256_set1_epi8('\\');
+			const __m256i lowercase = _mm256_set1_epi8(0x20);
+			const __m256i openBrace = _mm256_set1_epi8('{');
+			const __m256i closeBrace = _mm256_set1_epi8('}');
+			const __m256i colon = _mm256_set1_epi8(':');
+			const __m256i comma = _mm256_set1_epi8(',');
+			const __m256i space = _mm256_set1_epi8(' ');
+			const __m256i tab = _mm256_set1_epi8('\t');
+			const __m256i lineFeed = _mm256_set1_epi8('\n');
+			const __m256i carriageReturn = _mm256_set1_epi8('\r');
+			const __m256i maxControl = _mm256_set1_epi8(0x1f);
+			for (size_t block = 0; block < blocks; ++block) {
+				BlockMasks m = {};
+				for (int part = 0; part < 2; ++part) {
+					const __m256i v = _mm256_loadu_si256(
+						reinterpret_cast<const __m256i*>(data + block * blockSize + part * 32)
+					);
+					const __m256i folded = _mm256_or_si256(v, lowercase);
+					const __m256i op = _mm256_or_si256(
+						_mm256_or_si256(
+							_mm256_cmpeq_epi8(folded, openBrace),
+							_mm256_cmpeq_epi8(folded, closeBrace)
+						),
+						_mm256_or_si256(_mm256_cmpeq_epi8(v, colon), _mm256_cmpeq_epi8(v, comma))
+					);
+					const __m256i whitespace = _mm256_or_si256(
+						_mm256_or_si256(_mm256_cmpeq_epi8(v, space), _mm256_cmpeq_epi8(v, tab)),
+						_mm256_or_si256(
+							_mm256_cmpeq_epi8(v, lineFeed),
+							_mm256_cmpeq_epi8(v, carriageReturn)
+						)
+					);
+					const __m256i control =
+						_mm256_cmpeq_epi8(_mm256_max_epu8(v, maxControl), maxControl);
+					const int shift = part * 32;
+					m.quote |= uint64_t(uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, quote))))
+							   << shift;
+					m.backslash |=
+						uint64_t(uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, backslash))))
+						<< shift;
+					m.op |= uint64_t(uint32_t(_mm256_movemask_epi8(op))) << shift;
+					m.whitespace |= uint64_t(uint32_t(_mm256_movemask_epi8(whitespace))) << shift;
+					m.control |= uint64_t(uint32_t(_mm256_movemask_epi8(control))) << shift;
+				}
+				masks[block] = m;
+			}
+		}
+
+		VIEWRAY_TARGET("avx2")
+		size_t asciiPrefixAvx2(const uint8_t* data, size_t size) {
+			size_t i = 0;
+			while (i + 32 <= size) {
+				const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+				if (_mm256_movemask_epi8(v) != 0) {
+					break;
+				}
+				i += 32;
+			}
+			return i;
+		}
+
+		bool cpuHasAvx2() {
+#if defined(__GNUC__) || defined(__clang__)
+			__builtin_cpu_init();
+			return __builtin_cpu_supports("avx2");
+#elif defined(_MSC_VER)
+			int info[4];
+			__cpuid(info, 0);
+			if (info[0] < 7) {
+				return false;
+			}
+			__cpuid(info, 1);
+			// The OS must save the AVX registers (OSXSAVE and XCR0 bits 1 and 2)
+			const bool osxsave = (info[2] & (1 << 27)) != 0;
+			if (!osxsave || (_xgetbv(0) & 6) != 6) {
+				return false;
+			}
+			__cpuidex(info, 7, 0);
+			return (info[1] & (1 << 5)) != 0;
+#else
+			return false;
+#endif
+		}
+#endif
+
+		struct KernelFunctions {
+			ClassifyFn classify;
+			AsciiPrefixFn asciiPrefix;
+		};
+
+		KernelFunctions getFunctions(JsonScanner::Kernel kernel) {
+			switch (kernel) {
+#ifdef VIEWRAY_JSON_SCANNER_X86
+				case JsonScanner::Kernel::Sse2: return {classifySse2, asciiPrefixSse2};
+				case JsonScanner::Kernel::Avx2: return {classifyAvx2, asciiPrefixAvx2};
+#endif
+				default: return {classifyScalar, asciiPrefixScalar};
+			}
+		}
+
+		bool isContinuation(uint8_t byte) {
+			return (byte & 0xc0) == 0x80;
+		}
+
+		/// @brief Validate UTF-8 from pos until at least until, skipping ASCII in bulk
+		///
+		/// A sequence which starts before until is validated completely, so pos can end up
+		/// past until.
+		bool validateUtf8(
+			const uint8_t* data,
+			size_t size,
+			size_t until,
+			size_t& pos,
+			AsciiPrefixFn asciiPrefix
+		) {
+			size_t i = pos;
+			while (i < until) {
+				i += asciiPrefix(data + i, until - i);
+				// Check byte by byte until the next vector which might be all ASCII
+				const size_t stop = std::min(until, i + 16);
+				while (i < stop) {
+					const uint8_t lead = data[i];
+					if (lead < 0x80) {
+						++i;
+						continue;
+					}
+					size_t length = 0;
+					uint8_t min = 0x80;
+					uint8_t max = 0xbf;
+					if (lead >= 0xc2 && lead <= 0xdf) {
+						length = 2;
+					} else if (lead >= 0xe0 && lead <= 0xef) {
+						length = 3;
+						// Overlong encodings and UTF-16 surrogates
+						if (lead == 0xe0) {
+							min = 0xa0;
+						} else if (lead == 0xed) {
+							max = 0x9f;
+						}
+					} else if (lead >= 0xf0 && lead <= 0xf4) {
+						length = 4;
+						// Overlong encodings and code points above U+10FFFF
+						if (lead == 0xf0) {
+							min = 0x90;
+						} else if (lead == 0xf4) {
+							max = 0x8f;
+						}
+					} else {
+						return false;
+					}
+					if (size - i < length || data[i + 1] < min || data[i + 1] > max) {
+						return false;
+					}
+					for (size_t k = 2; k < length; ++k) {
+						if (!isContinuation(data[i + k])) {
+							return false;
+						}
+					}
+					i += length;
+				}
+			}
+			pos = i;
+			return true;
+		}
+
+		/// @brief The bits of the structure which carry over from one block to the next
+		struct ScanState {
+			/// 1 if the first byte of the next block is escaped by a backslash
+			uint64_t prevEscaped = 0;
+			/// All ones if the previous block ended inside a string
+			uint64_t prevInString = 0;
+			/// 1 if the previous block ended with a byte of a number or literal
+			uint64_t prevScalar = 0;
+		};
+
+		/// Bit i of the result is the XOR of bits 0..i of the input
+		uint64_t prefixXor(uint64_t bits) {
+			bits ^= bits << 1;
+			bits ^= bits << 2;
+			bits ^= bits << 4;
+			bits ^= bits << 8;
+			bits ^= bits << 16;
+			bits ^= bits << 32;
+			return bits;
+		}
+
+		int trailingZeros(uint64_t bits) {
+#if defined(_MSC_VER) && !defined(__clang__)
+			unsigned long index;
+			_BitScanForward64(&index, bits);
+			return int(index);
+#else
+			return __builtin_ctzll(bits);
+#endif
+		}
+
+		/// @brief Turn the masks of a block into positions of the index
+		/// @param[in,out] out Where to write the positions. Must have room for 64 of them.
+		/// @return false if a string contains a control character
+		bool indexBlock(const BlockMasks& m, ScanState& state, uint32_t base, uint32_t*& out) {
+			// A backslash escapes the next byte unless it is escaped itself. Runs of
+			// backslashes are resolved by adding their starts, as in simdjson.
+			const uint64_t evenBits = 0x5555555555555555ull;
+			const uint64_t backslash = m.backslash & ~state.prevEscaped;
+			const uint64_t followsEscape = (backslash << 1) | state.prevEscaped;
+			const uint64_t oddStarts = backslash & ~evenBits & ~followsEscape;
+			const uint64_t evenStarts = oddStarts + backslash;
+			state.prevEscaped = evenStarts < backslash ? 1 : 0;
+			const uint64_t escaped = (evenBits ^ (evenStarts << 1)) & followsEscape;
+
+			const uint64_t quote = m.quote & ~escaped;
+			// Set from the opening quote of a string up to, but not including, its closing quote
+			const uint64_t inString = prefixXor(quote) ^ state.prevInString;
+			state.prevInString = uint64_t(int64_t(inString) >> 63);
+			if ((m.control & inString) != 0) {
+				return false;
+			}
+
+			const uint64_t op = m.op & ~inString;
+			const uint64_t scalar = ~(m.op | m.whitespace | quote | inString);
+			const uint64_t scalarStarts = scalar & ~((scalar << 1) | state.prevScalar);
+			state.prevScalar = scalar >> 63;
+
+			uint64_t bits = op | quote | scalarStarts;
+			while (bits != 0) {
+				*out++ = base + uint32_t(trailingZeros(bits));
+				bits &= bits - 1;
+			}
+			return true;
+		}
+
+		bool isWhitespace(char c) {
+			return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+		}
+
+		bool isDigit(char c) {
+			return c >= '0' && c <= '9';
+		}
+
+		bool parseHex4(const char* p, uint32_t& value) {
+			value = 0;
+			for (int i = 0; i < 4; ++i) {
+				const char c = p[i];
+				value <<= 4;
+				if (c >= '0' && c <= '9') {
+					value |= uint32_t(c - '0');
+				} else if (c >= 'a' && c <= 'f') {
+					value |= uint32_t(c - 'a' + 10);
+				} else if (c >= 'A' && c <= 'F') {
+					value |= uint32_t(c - 'A' + 10);
+				} else {
+					return false;
+				}
+			}
+			return true;
+		}
+
+		void appendUtf8(std::string& out, uint32_t codePoint) {
+			if (codePoint < 0x80) {
+				out.push_back(char(codePoint));
+			} else if (codePoint < 0x800) {
+				out.push_back(char(0xc0 | (codePoint >> 6)));
+				out.push_back(char(0x80 | (codePoint & 0x3f)));
+			} else if (codePoint < 0x10000) {
+				out.push_back(char(0xe0 | (codePoint >> 12)));
+				out.push_back(char(0x80 | ((codePoint >> 6) & 0x3f)));
+				out.push_back(char(0x80 | (codePoint & 0x3f)));
+			} else {
+				out.push_back(char(0xf0 | (codePoint >> 18)));
+				out.push_back(char(0x80 | ((codePoint >> 12) & 0x3f)));
+				out.push_back(char(0x80 | ((codePoint >> 6) & 0x3f)));
+				out.push_back(char(0x80 | (codePoint & 0x3f)));
+			}
+		}
+	}  // namespace
+
+	JsonScanner::Kernel JsonScanner::bestKernel() {
+#ifdef VIEWRAY_JSON_SCANNER_X86
+		static const Kernel best = cpuHasAvx2() ? Kernel::Avx2 : Kernel::Sse2;
+		return best;
+#else
+		return Kernel::Scalar;
+#endif
+	}
+
+	bool JsonScanner::isSupported(Kernel kernel) {
+		switch (kernel) {
+			case Kernel::Scalar: return true;
+			case Kernel::Sse2: return bestKernel() != Kernel::Scalar;
+			case Kernel::Avx2: return bestKernel() == Kernel::Avx2;
+		}
+		return false;
+	}
+
+	const char* JsonScanner::getKernelName(Kernel kernel) {
+		switch (kernel) {
+			case Kernel::Scalar: return "scalar";
+			case Kernel::Sse2: return "sse2";
+			case Kernel::Avx2: return "avx2";
+		}
+		return "unknown";
+	}
+
+	JsonScanner::JsonScanner(Kernel kernel) :
+		kernel(kernel) {
+	}
+
+	void JsonScanner::reserve(size_t extra) {
+		if (count + extra <= capacity) {
+			return;
+		}
+		const size_t newCapacity = std::max(count + extra, capacity * 2);
+		std::unique_ptr<uint32_t[]> grown(new uint32_t[newCapacity]);
+		std::copy(positions.get(), positions.get() + count, grown.get());
+		positions = std::move(grown);
+		capacity = newCapacity;
+	}
+
+	bool JsonScanner::scan(std::string_view payload) {
+		text = payload;
+		count = 0;
+		if (payload.size() >= std::numeric_limits<uint32_t>::max()) {
+			return false;
+		}
+		const KernelFunctions functions = getFunctions(kernel);
+		const uint8_t* data = reinterpret_cast<const uint8_t*>(payload.data());
+		const size_t size = payload.size();
+		// Most JSON has far fewer structural characters than bytes
+		reserve(size / 8 + blockSize);
+
+		ScanState state;
+		BlockMasks masks[batchBlocks];
+		size_t utf8Pos = 0;
+		const size_t fullBlocks = size / blockSize;
+		for (size_t block = 0; block < fullBlocks; block += batchBlocks) {
+			const size_t blocks = std::min(batchBlocks, fullBlocks - block);
+			const size_t begin = block * blockSize;
+			if (!validateUtf8(data, size, begin + blocks * blockSize, utf8Pos, functions.asciiPrefix)) {
+				return false;
+			}
+			functions.classify(data + begin, blocks, masks);
+			reserve(blocks * blockSize);
+			uint32_t* out = positions.get() + count;
+			for (size_t i = 0; i < blocks; ++i) {
+				if (!indexBlock(masks[i], state, uint32_t(begin + i * blockSize), out)) {
+					return false;
+				}
+			}
+			count = size_t(out - positions.get());
+		}
+
+		const size_t tail = size - fullBlocks * blockSize;
+		if (tail > 0) {
+			if (!validateUtf8(data, size, size, utf8Pos, functions.asciiPrefix)) {
+				return false;
+			}
+			// Whitespace does not change the index
+			uint8_t padded[blockSize];
+			std::memset(padded, ' ', sizeof(padded));
+			std::memcpy(padded, data + fullBlocks * blockSize, tail);
+			functions.classify(padded, 1, masks);
+			reserve(blockSize);
+			uint32_t* out = positions.get() + count;
+			if (!indexBlock(masks[0], state, uint32_t(fullBlocks * blockSize), out)) {
+				return false;
+			}
+			count = size_t(out - positions.get());
+		}
+		return state.prevInString == 0;
+	}
+
+	bool JsonScanner::parseString(uint32_t open, uint32_t close, std::string& out) const {
+		const char* p = text.data() + open + 1;
+		const char* end = text.data() + close;
+		out.clear();
+		while (p < end) {
+			const char* backslash = static_cast<const char*>(std::memchr(p, '\\', size_t(end - p)));
+			if (backslash == nullptr) {
+				out.append(p, end);
+				break;
+			}
+			out.append(p, backslash);
+			// The closing quote is not escaped, so the escaped byte is before it
+			p = backslash + 1;
+			switch (*p++) {
+				case '"': out.push_back('"'); break;
+				case '\\': out.push_back('\\'); break;
+				case '/': out.push_back('/'); break;
+				case 'b': out.push_back('\b'); break;
+				case 'f': out.push_back('\f'); break;
+				case 'n': out.push_back('\n'); break;
+				case 'r': out.push_back('\r'); break;
+				case 't': out.push_back('\t'); break;
+				case 'u': {
+					uint32_t codePoint = 0;
+					if (end - p < 4 || !parseHex4(p, codePoint)) {
+						return false;
+					}
+					p += 4;
+					if (codePoint >= 0xd800 && codePoint <= 0xdbff) {
+						// A high surrogate must be followed by an escaped low surrogate
+						uint32_t low = 0;
+						if (end - p < 6 || p[0] != '\\' || p[1] != 'u' || !parseHex4(p + 2, low) ||
+							low < 0xdc00 || low > 0xdfff) {
+							return false;
+						}
+						p += 6;
+						codePoint = 0x10000 + ((codePoint - 0xd800) << 10) + (low - 0xdc00);
+					} else if (codePoint >= 0xdc00 && codePoint <= 0xdfff) {
+						return false;
+					}
+					appendUtf8(out, codePoint);
+				} break;
+				default: return false;
+			}
+		}
+		return true;
+	}
+
+	bool JsonScanner::parseAtom(uint32_t begin, uint32_t end, Sax& sax) {
+		const char* first = text.data() + begin;
+		const char* last = text.data() + end;
+		while (last > first && isWhitespace(last[-1])) {
+			--last;
+		}
+		const std::string_view atom(first, size_t(last - first));
+		if (atom == "true") {
+			return sax.boolean(true);
+		}
+		if (atom == "false") {
+			return sax.boolean(false);
+		}
+		if (atom == "null") {
+			return sax.null();
+		}
+
+		// -?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][+-]?[0-9]+)?
+		const char* p = first;
+		const bool negative = p < last && *p == '-';
+		if (negative) {
+			++p;
+		}
+		if (p == last || !isDigit(*p)) {
+			return false;
+		}
+		if (*p++ != '0') {
+			while (p < last && isDigit(*p)) {
+				++p;
+			}
+		}
+		bool isInteger = true;
+		if (p < last && *p == '.') {
+			isInteger = false;
+			if (++p == last || !isDigit(*p)) {
+				return false;
+			}
+			while (p < last && isDigit(*p)) {
+				++p;
+			}
+		}
+		if (p < last && (*p == 'e' || *p == 'E')) {
+			isInteger = false;
+			if (++p < last && (*p == '+' || *p == '-')) {
+				++p;
+			}
+			if (p == last || !isDigit(*p)) {
+				return false;
+			}
+			while (p < last && isDigit(*p)) {
+				++p;
+			}
+		}
+		if (p != last) {
+			return false;
+		}
+
+		// Integers which do not fit are passed as floating point numbers, like nlohmann does
+		if (isInteger) {
+			if (negative) {
+				int64_t value = 0;
+				if (std::from_chars(first, last, value).ec == std::errc()) {
+					return sax.number_integer(value);
+				}
+			} else {
+				uint64_t value = 0;
+				if (std::from_chars(first, last, value).ec == std::errc()) {
+					return sax.number_unsigned(value);
+				}
+			}
+		}
+		double value = 0;
+		const std::from_chars_result result = std::from_chars(first, last, value);
+		if (result.ec != std::errc() || !std::isfinite(value)) {
+			return false;
+		}
+		buffer.assign(first, last);
+		return sax.number_float(value, buffer);
+	}
+
+	bool JsonScanner::walk(Sax& sax) {
+		enum class Expect {
+			Value,
+			Key,
+			/// A comma or the end of the container
+			Next
+		};
+
+		const uint32_t* pos = positions.get();
+		size_t index = 0;
+		// true for each open object, false for each open array
+		std::vector<bool> containers;
+		Expect expect = Expect::Value;
+		for (;;) {
+			if (index == count) {
+				return false;
+			}
+			const uint32_t p = pos[index++];
+			const char c = text[p];
+			switch (expect) {
+				case Expect::Value: {
+					if (c == '{' || c == '[') {
+						const bool isObject = c == '{';
+						if (isObject ? !sax.start_object(size_t(-1)) : !sax.start_array(size_t(-1))) {
+							return false;
+						}
+						const char close = isObject ? '}' : ']';
+						if (index < count && text[pos[index]] == close) {
+							++index;
+							if (isObject ? !sax.end_object() : !sax.end_array()) {
+								return false;
+							}
+							expect = Expect::Next;
+						} else {
+							containers.push_back(isObject);
+							expect = isObject ? Expect::Key : Expect::Value;
+						}
+					} else if (c == '"') {
+						if (index == count || !parseString(p, pos[index++], buffer) ||
+							!sax.string(buffer)) {
+							return false;
+						}
+						expect = Expect::Next;
+					} else {
+						const uint32_t end = index < count ? pos[index] : uint32_t(text.size());
+						if (!parseAtom(p, end, sax)) {
+							return false;
+						}
+						expect = Expect::Next;
+					}
+				} break;
+				case Expect::Key: {
+					if (c != '"' || index == count || !parseString(p, pos[index++], buffer) ||
+						!sax.key(buffer)) {
+						return false;
+					}
+					if (index == count || text[pos[index++]] != ':') {
+						return false;
+					}
+					expect = Expect::Value;
+				} break;
+				case Expect::Next: {
+					const bool inObject = containers.back();
+					if (c == ',') {
+						expect = inObject ? Expect::Key : Expect::Value;
+					} else if (c == (inObject ? '}' : ']')) {
+						containers.pop_back();
+						if (inObject ? !sax.end_object() : !sax.end_array()) {
+							return false;
+						}
+						expect = Expect::Next;
+					} else {
+						return false;
+					}
+				} break;
+			}
+			// The root value is complete
+			if (expect == Expect::Next && containers.empty()) {
+				return index == count;
+			}
+		}
+	}
+}  // namespace ViewRay
@@ -1,32 +1,211 @@
 #include "error_code.h"
 #include <nlohmann/json.hpp>
+#include <algorithm>
 #include <chrono>
+#include <cstdlib>
 #include <string>
+#include <thread>
+#include <vector>
 #include "websocket.h"
 #include "client.h"
+#include "multi_site_client.h"
+#include "patient_formatter.h"
+#include "snapshot_cache.h"
+
+namespace {
+	EC::ErrorCode printList(
+		ViewRay::PatientFormatter& formatter,
+		const ViewRay::ViewRayClient::PatientList& list
+	) {
+		std::vector<const ViewRay::Patient*> patients;
+		patients.reserve(list.size());
+		for (const auto& entry : list) {
+			patients.push_back(&entry.second);
+		}
+		return formatter.write(std::cout, patients);
+	}
+
+	/// Fetch from all sites and print the patients of each site in the order of the sites
+	int printSites(
+		ViewRay::PatientFormatter& formatter,
+		std::vector<ViewRay::MultiSiteClient::Site> sites,
+		std::chrono::milliseconds timeout,
+		bool printMetrics
+	) {
+		ViewRay::MultiSiteClient client(std::move(sites));
+		EC::ErrorCode err = client.init();
+		if (err.hasError()) {
+			std::cout << err.getMessage() << '\n';
+			return err.getStatus();
+		}
+		ViewRay::MultiSiteClient::Options options;
+		options.timeout = timeout;
+		const ViewRay::MultiSiteClient::MultiSiteResult result =
+			client.fetchPatientLists(std::move(options)).get();
+
+		std::vector<std::vector<const ViewRay::Patient*>> bySite(result.sites.size());
+		for (const auto& entry : result.patients) {
+			bySite[entry.first.site].push_back(entry.second);
+		}
+		int status = 0;
+		std::vector<const ViewRay::Patient*> patients;
+		patients.reserve(result.patients.size());
+		for (size_t site = 0; site < result.sites.size(); ++site) {
+			const ViewRay::MultiSiteClient::SiteResult& siteResult = result.sites[site];
+			const std::string& name = client.getSites()[site].name;
+			if (siteResult.error.hasError()) {
+				std::cerr << name << ": " << siteResult.error.getMessage() << '\n';
+				status = siteResult.error.getStatus();
+			} else if (!siteResult.result.isComplete()) {
+				std::cerr << name << ": the diagnoses of " << siteResult.result.missing.size()
+						  << " patients were not received in time\n";
+			}
+			patients.insert(patients.end(), bySite[site].begin(), bySite[site].end());
+		}
+		err = formatter.write(std::cout, patients);
+		if (printMetrics) {
+			std::cerr << client.getMetrics().toPrometheus();
+		}
+		if (err.hasError()) {
+			std::cerr << err.getMessage() << '\n';
+			return err.getStatus();
+		}
+		return status;
+	}
+}  // namespace
+
+int main(int argc, char** argv) {
+	// The address of the server can be passed as an argument e.g. to use the mock server from
+	// bench/. With --metrics the metrics of the client are printed to stderr at the end.
+	// With --cache <path> the list saved by the previous run is printed right away and the
+	// file is refreshed from the server. With --format text|jsonl|csv the list is printed in
+	// the given format. With --timeout <ms> the list is printed after at most this time, even
+	// if the diagnoses of some patients have not been received. With one or more
+	// --site <name>=<address> the lists of all sites are fetched concurrently and printed one
+	// site after the other. With --lazy only the fields of the list are printed, without
+	// requesting the diagnoses of each patient.
+	//
+	// The list is printed in large blocks, which std::cout can write directly when it is not
+	// synchronized with stdio.
+	std::ios::sync_with_stdio(false);
+	std::string address = "ws://apply.viewray.com:4645";
+	std::string cachePath;
+	bool printMetrics = false;
+	bool lazy = false;
+	std::chrono::milliseconds timeout{0};
+	ViewRay::PatientFormatter::Format format = ViewRay::PatientFormatter::Format::Text;
+	std::vector<ViewRay::MultiSiteClient::Site> sites;
+	for (int i = 1; i < argc; ++i) {
+		const std::string arg = argv[i];
+		if (arg == "--metrics") {
+			printMetrics = true;
+		} else if (arg == "--lazy") {
+			lazy = true;
+		} else if (arg == "--cache" && i + 1 < argc) {
+			cachePath = argv[++i];
+		} else if (arg == "--timeout" && i + 1 < argc) {
+			timeout = std::chrono::milliseconds(std::atoi(argv[++i]));
+		} else if (arg == "--site" && i + 1 < argc) {
+			const std::string site = argv[++i];
+			const size_t separator = site.find('=');
+			if (separator == std::string::npos) {
+				std::cout << "Expected --site <name>=<address>, got " << site << '\n';
+				return 1;
+			}
+			sites.push_back({site.substr(0, separator), site.substr(separator + 1)});
+		} else if (arg == "--format" && i + 1 < argc) {
+			const EC::ErrorCode err = ViewRay::PatientFormatter::parseFormat(argv[++i], format);
+			if (err.hasError()) {
+				std::cout << err.getMessage() << '\n';
+				return err.getStatus();
+			}
+		} else {
+			address = arg;
+		}
+	}
+	ViewRay::PatientFormatter formatter(format, std::max(1u, std::thread::hardware_concurrency()));
+	if (!sites.empty()) {
+		return printSites(formatter, std::move(sites), timeout, printMetrics);
+	}
 
-int main() {
 	// Init the client
-	ViewRay::ViewRayClient wsClient("ws://apply.viewray.com:4645");
+	ViewRay::ViewRayClient wsClient(address);
 	EC::ErrorCode err = wsClient.init();
 	if (err.hasError()) {
 		std::cout << err.getMessage() << '\n';
 		return err.getStatus();
 	}
+
+	if (!cachePath.empty()) {
+		ViewRay::SnapshotCache cache(wsClient, cachePath);
+		const auto cached = cache.load();
+		auto refreshed = cache.revalidate();
+		if (!cached.hasError()) {
+			err = formatter.write(std::cout, *cached.getData());
+			if (refreshed.get().hasError()) {
+				std::cerr << "Cannot refresh " << cachePath << ": "
+						  << refreshed.get().getError().getMessage() << '\n';
+			}
+		} else {
+			const auto& fetched = refreshed.get();
+			if (fetched.hasError()) {
+				std::cout << fetched.getError().getMessage() << '\n';
+				return fetched.getError().getStatus();
+			}
+			err = formatter.write(std::cout, *fetched.getData());
+		}
+		if (printMetrics) {
+			std::cerr << wsClient.getMetrics().toPrometheus();
+		}
+		if (err.hasError()) {
+			std::cerr << err.getMessage() << '\n';
+			return err.getStatus();
+		}
+		return 0;
+	}
+
+	if (lazy) {
+		const auto listResult = wsClient.getLazyPatientList().get();
+		if (listResult.hasError()) {
+			std::cout << listResult.getError().getMessage() << '\n';
+			return listResult.getError().getStatus();
+		}
+		err = printList(formatter, listResult.getData().getPatients());
+		if (printMetrics) {
+			std::cerr << wsClient.getMetrics().toPrometheus();
+		}
+		if (err.hasError()) {
+			std::cerr << err.getMessage() << '\n';
+			return err.getStatus();
+		}
+		return 0;
+	}
+
 	// Async Request the patient list
-	auto promise = wsClient.getPatientList();
-	ViewRay::WSAsyncResult<ViewRay::ViewRayClient::PatientListPtr> wsResult = promise.get();
+	ViewRay::ViewRayClient::FetchOptions options;
+	options.timeout = timeout;
+	auto promise = wsClient.fetchPatientList(std::move(options));
+	ViewRay::WSAsyncResult<ViewRay::ViewRayClient::FetchResult> wsResult = promise.get();
 	if (wsResult.hasError()) {
 		std::cout << wsResult.getError().getMessage() << '\n';
 		return wsResult.getError().getStatus();
 	}
 	// Wait for the patient list to be retrieved
-	ViewRay::ViewRayClient::PatientListPtr patients = wsResult.getData();
+	const ViewRay::ViewRayClient::FetchResult fetched = wsResult.getData();
+	ViewRay::ViewRayClient::PatientListPtr patients = fetched.patients;
+	if (!fetched.isComplete()) {
+		std::cerr << "The diagnoses of " << fetched.missing.size()
+				  << " patients were not received in time\n";
+	}
 
 	// Print the list
-	for (auto patientsIt = patients->begin(); patientsIt != patients->end(); ++patientsIt) {
-		std::cout << patientsIt->second;
-		std::cout << "\n============================================\n";
+	err = printList(formatter, *patients);
+	if (err.hasError()) {
+		std::cerr << err.getMessage() << '\n';
+		return err.getStatus();
+	}
+	if (printMetrics) {
+		std::cerr << wsClient.getMetrics().toPrometheus();
 	}
 	return 0;
-}
\ No newline at end of file
+}
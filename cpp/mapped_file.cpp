@@ -0,0 +1,129 @@
+#include "mapped_file.h"
+#include <cerrno>
+#include <cstring>
+#include <utility>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace ViewRay {
+	MappedFile::~MappedFile() {
+		close();
+	}
+
+	MappedFile::MappedFile(MappedFile&& other) noexcept {
+		*this = std::move(other);
+	}
+
+	MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+		if (this != &other) {
+			close();
+			std::swap(data, other.data);
+			std::swap(size, other.size);
+#ifdef _WIN32
+			std::swap(file, other.file);
+			std::swap(mapping, other.mapping);
+#endif
+		}
+		return *this;
+	}
+
+#ifdef _WIN32
+	EC::ErrorCode MappedFile::open(const std::string& path) {
+		close();
+		file = CreateFileA(
+			path.c_str(),
+			GENERIC_READ,
+			FILE_SHARE_READ | FILE_SHARE_DELETE,
+			nullptr,
+			OPEN_EXISTING,
+			FILE_ATTRIBUTE_NORMAL,
+			nullptr
+		);
+		if (file == INVALID_HANDLE_VALUE) {
+			file = nullptr;
+			return EC::ErrorCode(1, "Cannot open %s: error %lu", path.c_str(), GetLastError());
+		}
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+			close();
+			return EC::ErrorCode(1, "Cannot map %s: the file is empty", path.c_str());
+		}
+		mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mapping == nullptr) {
+			const DWORD err = GetLastError();
+			close();
+			return EC::ErrorCode(1, "Cannot map %s: error %lu", path.c_str(), err);
+		}
+		data = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+		if (data == nullptr) {
+			const DWORD err = GetLastError();
+			close();
+			return EC::ErrorCode(1, "Cannot map %s: error %lu", path.c_str(), err);
+		}
+		size = size_t(fileSize.QuadPart);
+		return EC::ErrorCode();
+	}
+
+	void MappedFile::close() {
+		if (data != nullptr) {
+			UnmapViewOfFile(data);
+		}
+		if (mapping != nullptr) {
+			CloseHandle(mapping);
+		}
+		if (file != nullptr) {
+			CloseHandle(file);
+		}
+		data = nullptr;
+		size = 0;
+		mapping = nullptr;
+		file = nullptr;
+	}
+#else
+	EC::ErrorCode MappedFile::open(const std::string& path) {
+		close();
+		const int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0) {
+			return EC::ErrorCode(1, "Cannot open %s: %s", path.c_str(), std::strerror(errno));
+		}
+		struct stat info;
+		if (fstat(fd, &info) != 0) {
+			const int err = errno;
+			::close(fd);
+			return EC::ErrorCode(1, "Cannot stat %s: %s", path.c_str(), std::strerror(err));
+		}
+		if (info.st_size == 0) {
+			::close(fd);
+			return EC::ErrorCode(1, "Cannot map %s: the file is empty", path.c_str());
+		}
+		void* mapped = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+		const int err = errno;
+		// The mapping keeps the file alive
+		::close(fd);
+		if (mapped == MAP_FAILED) {
+			return EC::ErrorCode(1, "Cannot map %s: %s", path.c_str(), std::strerror(err));
+		}
+		data = static_cast<const char*>(mapped);
+		size = size_t(info.st_size);
+		return EC::ErrorCode();
+	}
+
+	void MappedFile::close() {
+		if (data != nullptr) {
+			munmap(const_cast<char*>(data), size);
+		}
+		data = nullptr;
+		size = 0;
+	}
+#endif
+}  // namespace ViewRay
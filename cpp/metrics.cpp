@@ -0,0 +1,309 @@
+#include "metrics.h"
+#include <nlohmann/json.hpp>
+#include <algorithm>
+#include <cstdio>
+
+namespace ViewRay {
+	namespace {
+		std::string formatNumber(double value) {
+			char buffer[32];
+			std::snprintf(buffer, sizeof(buffer), "%.9g", value);
+			return buffer;
+		}
+
+		/// Escape a label value as required by the Prometheus text format
+		void appendEscaped(std::string& out, const std::string& value) {
+			for (const char c : value) {
+				switch (c) {
+					case '\\': out += "\\\\"; break;
+					case '"': out += "\\\""; break;
+					case '\n': out += "\\n"; break;
+					default: out += c; break;
+				}
+			}
+		}
+
+		/// Append {name="value",...} including the extra label if it is not null
+		void appendLabels(
+			std::string& out,
+			const MetricsRegistry::Labels& labels,
+			const char* extraName = nullptr,
+			const std::string& extraValue = ""
+		) {
+			if (labels.empty() && extraName == nullptr) {
+				return;
+			}
+			out += '{';
+			bool first = true;
+			for (const auto& label : labels) {
+				if (!first) {
+					out += ',';
+				}
+				first = false;
+				out += label.first;
+				out += "=\"";
+				appendEscaped(out, label.second);
+				out += '"';
+			}
+			if (extraName != nullptr) {
+				if (!first) {
+					out += ',';
+				}
+				out += extraName;
+				out += "=\"";
+				out += extraValue;
+				out += '"';
+			}
+			out += '}';
+		}
+
+		void appendSample(
+			std::string& out,
+			const std::string& name,
+			const char* suffix,
+			const MetricsRegistry::Labels& labels,
+			const std::string& value,
+			const char* extraName = nullptr,
+			const std::string& extraValue = ""
+		) {
+			out += name;
+			out += suffix;
+			appendLabels(out, labels, extraName, extraValue);
+			out += ' ';
+			out += value;
+			out += '\n';
+		}
+	}  // namespace
+
+	Histogram::Histogram(std::vector<double> bounds) :
+		bounds(std::move(bounds)),
+		counts(new std::atomic<uint64_t>[this->bounds.size() + 1]),
+		sum(0) {
+		for (size_t i = 0; i <= this->bounds.size(); ++i) {
+			counts[i].store(0, std::memory_order_relaxed);
+		}
+	}
+
+	std::vector<double> Histogram::exponentialBounds(double start, double factor, int count) {
+		std::vector<double> result;
+		result.reserve(std::max(count, 0));
+		double bound = start;
+		for (int i = 0; i < count; ++i) {
+			result.push_back(bound);
+			bound *= factor;
+		}
+		return result;
+	}
+
+	std::vector<double> Histogram::latencyBounds() {
+		return exponentialBounds(1e-5, 2, 23);
+	}
+
+	void Histogram::observe(double value) {
+		const size_t bucket = std::lower_bound(bounds.begin(), bounds.end(), value) - bounds.begin();
+		counts[bucket].fetch_add(1, std::memory_order_relaxed);
+		double expected = sum.load(std::memory_order_relaxed);
+		while (!sum.compare_exchange_weak(expected, expected + value, std::memory_order_relaxed)) {
+		}
+	}
+
+	Histogram::Snapshot Histogram::snapshot() const {
+		Snapshot result;
+		result.bounds = bounds;
+		result.counts.resize(bounds.size() + 1);
+		for (size_t i = 0; i <= bounds.size(); ++i) {
+			result.counts[i] = counts[i].load(std::memory_order_relaxed);
+			result.count += result.counts[i];
+		}
+		result.sum = sum.load(std::memory_order_relaxed);
+		return result;
+	}
+
+	MetricsRegistry::MetricsRegistry() :
+		current(std::make_shared<const EntryList>()) {
+	}
+
+	template <typename T, typename Make>
+	std::shared_ptr<T> MetricsRegistry::getOrAdd(
+		const std::string& name,
+		const std::string& help,
+		const Labels& labels,
+		Make&& make
+	) {
+		std::lock_guard<std::mutex> lock(writeMutex);
+		// Insert after the last entry with the same name
+		size_t insertAt = current->size();
+		for (size_t i = 0; i < current->size(); ++i) {
+			const Entry& entry = (*current)[i];
+			if (entry.name != name) {
+				continue;
+			}
+			if (entry.labels == labels) {
+				const std::shared_ptr<T>* existing = std::get_if<std::shared_ptr<T>>(&entry.metric);
+				if (existing != nullptr) {
+					return *existing;
+				}
+			}
+			insertAt = i + 1;
+		}
+
+		std::shared_ptr<T> metric = make();
+		auto next = std::make_shared<EntryList>(*current);
+		next->insert(next->begin() + insertAt, Entry{name, help, labels, metric});
+		std::atomic_store(&current, Snapshot(std::move(next)));
+		return metric;
+	}
+
+	std::shared_ptr<Counter> MetricsRegistry::counter(
+		const std::string& name,
+		const std::string& help,
+		const Labels& labels
+	) {
+		return getOrAdd<Counter>(name, help, labels, []() { return std::make_shared<Counter>(); });
+	}
+
+	std::shared_ptr<Gauge> MetricsRegistry::gauge(
+		const std::string& name,
+		const std::string& help,
+		const Labels& labels
+	) {
+		return getOrAdd<Gauge>(name, help, labels, []() { return std::make_shared<Gauge>(); });
+	}
+
+	std::shared_ptr<Histogram> MetricsRegistry::histogram(
+		const std::string& name,
+		const std::string& help,
+		std::vector<double> bounds,
+		const Labels& labels
+	) {
+		return getOrAdd<Histogram>(name, help, labels, [&bounds]() {
+			return std::make_shared<Histogram>(std::move(bounds));
+		});
+	}
+
+	void MetricsRegistry::removeLabeled(const std::string& label, const std::string& value) {
+		std::lock_guard<std::mutex> lock(writeMutex);
+		const std::pair<std::string, std::string> needle(label, value);
+		auto next = std::make_shared<EntryList>();
+		next->reserve(current->size());
+		for (const Entry& entry : *current) {
+			if (std::find(entry.labels.begin(), entry.labels.end(), needle) == entry.labels.end()) {
+				next->push_back(entry);
+			}
+		}
+		if (next->size() != current->size()) {
+			std::atomic_store(&current, Snapshot(std::move(next)));
+		}
+	}
+
+	std::string MetricsRegistry::toJson() const {
+		const Snapshot entries = snapshot();
+		nlohmann::json result = nlohmann::json::object();
+		for (const Entry& entry : *entries) {
+			nlohmann::json& family = result[entry.name];
+			nlohmann::json series = {{"labels", nlohmann::json::object()}};
+			for (const auto& label : entry.labels) {
+				series["labels"][label.first] = label.second;
+			}
+			if (const auto* counter = std::get_if<std::shared_ptr<Counter>>(&entry.metric)) {
+				family["type"] = "counter";
+				series["value"] = (*counter)->get();
+			} else if (const auto* gauge = std::get_if<std::shared_ptr<Gauge>>(&entry.metric)) {
+				family["type"] = "gauge";
+				series["value"] = (*gauge)->get();
+			} else {
+				family["type"] = "histogram";
+				const Histogram::Snapshot histogram =
+					std::get<std::shared_ptr<Histogram>>(entry.metric)->snapshot();
+				series["count"] = histogram.count;
+				series["sum"] = histogram.sum;
+				nlohmann::json buckets = nlohmann::json::array();
+				uint64_t cumulative = 0;
+				for (size_t i = 0; i < histogram.bounds.size(); ++i) {
+					cumulative += histogram.counts[i];
+					buckets.push_back({{"le", histogram.bounds[i]}, {"count", cumulative}});
+				}
+				buckets.push_back({{"le", "+Inf"}, {"count", histogram.count}});
+				series["buckets"] = std::move(buckets);
+			}
+			if (!family.contains("help")) {
+				family["help"] = entry.help;
+			}
+			family["series"].push_back(std::move(series));
+		}
+		return result.dump();
+	}
+
+	std::string MetricsRegistry::toPrometheus() const {
+		const Snapshot entries = snapshot();
+		std::string out;
+		const std::string* previousName = nullptr;
+		for (const Entry& entry : *entries) {
+			const auto* counter = std::get_if<std::shared_ptr<Counter>>(&entry.metric);
+			const auto* gauge = std::get_if<std::shared_ptr<Gauge>>(&entry.metric);
+			if (previousName == nullptr || *previousName != entry.name) {
+				previousName = &entry.name;
+				out += "# HELP " + entry.name + ' ' + entry.help + '\n';
+				out += "# TYPE " + entry.name + ' ';
+				out += counter ? "counter\n" : gauge ? "gauge\n" : "histogram\n";
+			}
+			if (counter) {
+				appendSample(out, entry.name, "", entry.labels, std::to_string((*counter)->get()));
+			} else if (gauge) {
+				appendSample(out, entry.name, "", entry.labels, std::to_string((*gauge)->get()));
+			} else {
+				const Histogram::Snapshot histogram =
+					std::get<std::shared_ptr<Histogram>>(entry.metric)->snapshot();
+				uint64_t cumulative = 0;
+				for (size_t i = 0; i < histogram.bounds.size(); ++i) {
+					cumulative += histogram.counts[i];
+					appendSample(
+						out,
+						entry.name,
+						"_bucket",
+						entry.labels,
+						std::to_string(cumulative),
+						"le",
+						formatNumber(histogram.bounds[i])
+					);
+				}
+				const std::string count = std::to_string(histogram.count);
+				appendSample(out, entry.name, "_bucket", entry.labels, count, "le", "+Inf");
+				appendSample(out, entry.name, "_sum", entry.labels, formatNumber(histogram.sum));
+				appendSample(out, entry.name, "_count", entry.labels, count);
+			}
+		}
+		return out;
+	}
+
+	ConnectionMetrics::ConnectionMetrics(MetricsRegistry& registry, int id, const std::string& uri) {
+		const MetricsRegistry::Labels labels = {{"connection", std::to_string(id)}, {"uri", uri}};
+		bytesReceived = registry.counter(
+			"viewray_ws_received_bytes_total", "Payload bytes received on the connection", labels
+		);
+		bytesSent = registry.counter(
+			"viewray_ws_sent_bytes_total", "Payload bytes sent on the connection", labels
+		);
+		wireBytesReceived = registry.counter(
+			"viewray_ws_received_wire_bytes_total",
+			"Payload bytes received on the connection, compressed if permessage-deflate is used",
+			labels
+		);
+		wireBytesSent = registry.counter(
+			"viewray_ws_sent_wire_bytes_total",
+			"Payload bytes sent on the connection, compressed if permessage-deflate is used",
+			labels
+		);
+		messagesReceived = registry.counter(
+			"viewray_ws_received_messages_total", "Messages received on the connection", labels
+		);
+		messagesSent = registry.counter(
+			"viewray_ws_sent_messages_total", "Messages sent on the connection", labels
+		);
+		decodeQueueDepth = registry.gauge(
+			"viewray_ws_decode_queue_depth",
+			"Received messages of the connection waiting for a decode thread",
+			labels
+		);
+	}
+}  // namespace ViewRay
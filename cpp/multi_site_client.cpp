@@ -0,0 +1,111 @@
+#include "multi_site_client.h"
+#include <mutex>
+
+namespace ViewRay {
+	namespace {
+		/// @brief Collects the results of the sites of a single fetch
+		struct MultiSiteFetch {
+			explicit MultiSiteFetch(size_t siteCount) :
+				remaining(siteCount) {
+				result.sites.resize(siteCount);
+			}
+
+			/// @brief Store the result of a site and merge its patients
+			///
+			/// Called on the thread which finished the site, while other sites can still be
+			/// fetched. The last site resolves the promise.
+			void add(size_t site, WSAsyncResult<FetchResult> siteResult) {
+				std::lock_guard<std::mutex> lock(mutex);
+				MultiSiteClient::SiteResult& target = result.sites[site];
+				if (siteResult.hasError()) {
+					target.error = siteResult.getError();
+				} else {
+					target.result = siteResult.getData();
+					const PatientList& patients = *target.result.patients;
+					result.patients.reserve(result.patients.size() + patients.size());
+					for (const auto& entry : patients) {
+						result.patients.emplace(
+							MultiSiteClient::PatientKey{site, entry.first},
+							&entry.second
+						);
+					}
+				}
+				if (--remaining == 0) {
+					promise.set_value(std::move(result));
+				}
+			}
+
+			std::mutex mutex;
+			MultiSiteClient::MultiSiteResult result;
+			std::promise<MultiSiteClient::MultiSiteResult> promise;
+			size_t remaining;
+		};
+	}  // namespace
+
+	bool MultiSiteClient::MultiSiteResult::isComplete() const {
+		for (const SiteResult& site : sites) {
+			if (site.error.hasError() || !site.result.isComplete()) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	MultiSiteClient::MultiSiteClient(std::vector<Site> sites, int connectionPoolSize) :
+		sites(std::move(sites)),
+		connectionPoolSize(connectionPoolSize) {
+		clients.reserve(this->sites.size());
+		for (const Site& site : this->sites) {
+			clients.emplace_back(
+				new ViewRayClient(site.address, endpoint, {{"site", site.name}})
+			);
+		}
+	}
+
+	EC::ErrorCode MultiSiteClient::init(int ioThreads, int decodeThreads) {
+		endpoint.init(ioThreads, decodeThreads);
+		endpoint.setPoolSize(connectionPoolSize);
+		for (const std::unique_ptr<ViewRayClient>& client : clients) {
+			const EC::ErrorCode err = client->init();
+			if (err.hasError()) {
+				return err;
+			}
+		}
+		return EC::ErrorCode();
+	}
+
+	std::future<MultiSiteClient::MultiSiteResult> MultiSiteClient::fetchPatientLists(
+		Options options
+	) {
+		auto fetch = std::make_shared<MultiSiteFetch>(clients.size());
+		std::future<MultiSiteResult> result = fetch->promise.get_future();
+		if (clients.empty()) {
+			fetch->promise.set_value(MultiSiteResult());
+			return result;
+		}
+		// None of the calls waits for a connection, so all sites are in flight at once
+		for (size_t site = 0; site < clients.size(); ++site) {
+			FetchOptions siteOptions;
+			siteOptions.timeout = options.timeout;
+			if (options.onPatient) {
+				siteOptions.onPatient = [site, onPatient = options.onPatient](
+					const std::string& uri,
+					const Patient& patient
+				) {
+					onPatient(site, uri, patient);
+				};
+			}
+			clients[site]->fetchPatientListAsync(
+				std::move(siteOptions),
+				[site, fetch](WSAsyncResult<FetchResult> siteResult) {
+					fetch->add(site, std::move(siteResult));
+				}
+			);
+		}
+		return result;
+	}
+
+	MetricsRegistry& MultiSiteClient::getMetrics() {
+		return endpoint.getMetrics();
+	}
+}  // namespace ViewRay
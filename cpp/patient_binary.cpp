@@ -0,0 +1,327 @@
+#include "patient_binary.h"
+#include <cstring>
+#include <istream>
+#include <limits>
+#include <ostream>
+#include <utility>
+
+namespace ViewRay {
+	namespace {
+		constexpr char magic[4] = {'V', 'R', 'P', 'B'};
+		/// Records larger than this are treated as corrupted instead of allocating for them
+		constexpr uint64_t maxRecordSize = 64 * 1024 * 1024;
+		/// The buffer of PatientBinaryWriter is written to the stream when it grows past this
+		constexpr size_t flushThreshold = 64 * 1024;
+
+		uint64_t zigzag(int value) {
+			const uint32_t bits = uint32_t(value);
+			return uint64_t((bits << 1) ^ uint32_t(-int32_t(bits >> 31)));
+		}
+
+		int unzigzag(uint64_t value) {
+			const uint32_t bits = uint32_t(value);
+			return int32_t((bits >> 1) ^ uint32_t(-int32_t(bits & 1)));
+		}
+
+		void writeString(std::string& out, std::string_view str) {
+			PatientBinaryCodec::writeVarint(out, str.size());
+			out.append(str.data(), str.size());
+		}
+
+		/// Reads the fields of a record body. Once a read fails all following reads fail too,
+		/// so the result needs to be checked only at the end.
+		class BodyReader {
+		public:
+			explicit BodyReader(std::string_view body) :
+				pos(body.data()),
+				end(body.data() + body.size()) {
+			}
+
+			uint64_t varint() {
+				uint64_t value = 0;
+				if (ok && !PatientBinaryCodec::readVarint(pos, end, value)) {
+					ok = false;
+				}
+				return value;
+			}
+
+			int integer() {
+				const uint64_t value = varint();
+				if (value > std::numeric_limits<uint32_t>::max()) {
+					ok = false;
+				}
+				return unzigzag(value);
+			}
+
+			bool boolean() {
+				if (!ok || pos == end || uint8_t(*pos) > 1) {
+					ok = false;
+					return false;
+				}
+				return *pos++ != 0;
+			}
+
+			/// The string is a view of the body, empty if reading fails
+			std::string_view string() {
+				const uint64_t size = varint();
+				if (!ok || size > uint64_t(end - pos)) {
+					ok = false;
+					return std::string_view();
+				}
+				const std::string_view str(pos, size_t(size));
+				pos += size;
+				return str;
+			}
+
+			/// Read the number of elements of a list where each element takes at least
+			/// minSize bytes. Fails if there are not enough bytes left for all of them.
+			size_t count(size_t minSize) {
+				const uint64_t value = varint();
+				if (!ok || value > uint64_t(end - pos) / minSize) {
+					ok = false;
+					return 0;
+				}
+				return size_t(value);
+			}
+
+			bool finished() const {
+				return ok && pos == end;
+			}
+
+			bool good() const {
+				return ok;
+			}
+
+		private:
+			const char* pos;
+			const char* end;
+			bool ok = true;
+		};
+	}  // namespace
+
+	void PatientBinaryCodec::writeVarint(std::string& out, uint64_t value) {
+		while (value >= 0x80) {
+			out.push_back(char(uint8_t(value) | 0x80));
+			value >>= 7;
+		}
+		out.push_back(char(value));
+	}
+
+	bool PatientBinaryCodec::readVarint(const char*& pos, const char* end, uint64_t& value) {
+		value = 0;
+		for (int shift = 0; shift < 64 && pos != end; shift += 7) {
+			const uint8_t byte = uint8_t(*pos++);
+			value |= uint64_t(byte & 0x7f) << shift;
+			if ((byte & 0x80) == 0) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void PatientBinaryCodec::encode(
+		std::string& out,
+		std::string_view uri,
+		const Patient& patient
+	) {
+		// The length of the body is not known until it is written. Reserve the largest varint
+		// the length can take and move the body back if it turns out to be shorter.
+		constexpr size_t maxLengthSize = 10;
+		const size_t lengthPos = out.size();
+		out.append(maxLengthSize, '\0');
+		encodeBody(out, uri, patient);
+		uint64_t bodySize = out.size() - lengthPos - maxLengthSize;
+		char length[maxLengthSize];
+		size_t lengthSize = 0;
+		while (bodySize >= 0x80) {
+			length[lengthSize++] = char(uint8_t(bodySize) | 0x80);
+			bodySize >>= 7;
+		}
+		length[lengthSize++] = char(bodySize);
+		out.replace(lengthPos, maxLengthSize, length, lengthSize);
+	}
+
+	void PatientBinaryCodec::encodeBody(
+		std::string& out,
+		std::string_view uri,
+		const Patient& patient
+	) {
+		writeString(out, uri);
+		writeString(out, patient.getId());
+		writeString(out, patient.getMrn());
+		writeString(out, patient.getDateOfBirth());
+		writeString(out, patient.getFirstName());
+		writeString(out, patient.getMiddleName());
+		writeString(out, patient.getLastName());
+		writeVarint(out, uint64_t(patient.getSex()));
+		writeVarint(out, zigzag(patient.getFractionsTotal()));
+		writeVarint(out, zigzag(patient.getFractionsCompleted()));
+		writeVarint(out, zigzag(patient.getWeightKg()));
+		writeVarint(out, zigzag(patient.getRegistrationTime()));
+		out.push_back(char(patient.isReadyForTreatment()));
+		writeVarint(out, patient.getDiagnoses().size());
+		for (const Diagnose& diagnose : patient.getDiagnoses()) {
+			writeString(out, diagnose.getDescription());
+			writeString(out, diagnose.getLabel());
+			writeVarint(out, diagnose.getPrescriptions().size());
+			for (const Prescription& prescription : diagnose.getPrescriptions()) {
+				writeString(out, prescription.getDescription());
+				writeString(out, prescription.getLabel());
+				writeVarint(out, zigzag(prescription.getNumFractions()));
+				writeVarint(out, prescription.getPlans().size());
+				for (const Plan& plan : prescription.getPlans()) {
+					writeString(out, plan.getLabel());
+				}
+			}
+		}
+	}
+
+	bool PatientBinaryCodec::decode(std::string_view body, std::string& uri, Patient& patient) {
+		BodyReader reader(body);
+		uri = reader.string();
+		patient.setId(reader.string());
+		patient.setMrn(reader.string());
+		patient.setDateOfBirth(reader.string());
+		patient.setFirstName(reader.string());
+		patient.setMiddleName(reader.string());
+		patient.setLastName(reader.string());
+		const uint64_t sex = reader.varint();
+		if (sex > uint64_t(Patient::Sex::Unknown)) {
+			return false;
+		}
+		patient.setSex(Patient::Sex(sex));
+		patient.setFractionsTotal(reader.integer());
+		patient.setFractionsCompleted(reader.integer());
+		patient.setWeightKg(reader.integer());
+		patient.setRegistrationTime(reader.integer());
+		patient.setReadyForTreatment(reader.boolean());
+
+		// The smallest diagnose is two empty strings and an empty list, one byte each. The
+		// smallest prescription has a number more and a plan is at least an empty string.
+		const size_t count = reader.count(3);
+		Patient::DiagnoseList diagnoses(patient.get_allocator());
+		diagnoses.reserve(count);
+		for (size_t i = 0; i < count && reader.good(); ++i) {
+			Diagnose& diagnose = diagnoses.emplace_back();
+			diagnose.setDescription(reader.string());
+			diagnose.setLabel(reader.string());
+			const size_t prescriptions = reader.count(4);
+			diagnose.reservePrescriptions(prescriptions);
+			for (size_t j = 0; j < prescriptions && reader.good(); ++j) {
+				Prescription& prescription = diagnose.addPrescription();
+				prescription.setDescription(reader.string());
+				prescription.setLabel(reader.string());
+				prescription.setNumFractions(reader.integer());
+				const size_t plans = reader.count(1);
+				prescription.reservePlans(plans);
+				for (size_t k = 0; k < plans && reader.good(); ++k) {
+					prescription.addPlan(reader.string());
+				}
+			}
+		}
+		patient.setDiagnoses(std::move(diagnoses));
+		return reader.finished();
+	}
+
+	PatientBinaryWriter::PatientBinaryWriter(std::ostream& out) :
+		out(out) {
+		buffer.reserve(flushThreshold + flushThreshold / 2);
+		buffer.append(magic, sizeof(magic));
+		buffer.push_back(char(version));
+	}
+
+	PatientBinaryWriter::~PatientBinaryWriter() {
+		if (!finished) {
+			finish();
+		}
+	}
+
+	void PatientBinaryWriter::write(std::string_view uri, const Patient& patient) {
+		PatientBinaryCodec::encode(buffer, uri, patient);
+		if (buffer.size() >= flushThreshold) {
+			flush();
+		}
+	}
+
+	bool PatientBinaryWriter::finish() {
+		if (!finished) {
+			finished = true;
+			// Empty record
+			PatientBinaryCodec::writeVarint(buffer, 0);
+			flush();
+			out.flush();
+		}
+		return bool(out);
+	}
+
+	void PatientBinaryWriter::flush() {
+		out.write(buffer.data(), std::streamsize(buffer.size()));
+		buffer.clear();
+	}
+
+	PatientBinaryReader::PatientBinaryReader(std::istream& in) :
+		in(in) {
+		char header[sizeof(magic) + 1];
+		if (!in.read(header, sizeof(header)) || std::memcmp(header, magic, sizeof(magic)) != 0) {
+			error = EC::ErrorCode(InvalidHeader, "The stream does not contain patients");
+			done = true;
+		} else if (uint8_t(header[sizeof(magic)]) != PatientBinaryWriter::version) {
+			error = EC::ErrorCode(
+				UnsupportedVersion,
+				"Unsupported version of the patient stream: %d",
+				int(uint8_t(header[sizeof(magic)]))
+			);
+			done = true;
+		}
+	}
+
+	bool PatientBinaryReader::next(std::string& uri, Patient& patient) {
+		if (done) {
+			return false;
+		}
+		uint64_t size = 0;
+		int shift = 0;
+		for (;;) {
+			const int byte = in.get();
+			if (byte == std::char_traits<char>::eof()) {
+				error = EC::ErrorCode(Truncated, "The patient stream ends before its end marker");
+				done = true;
+				return false;
+			}
+			size |= uint64_t(byte & 0x7f) << shift;
+			if ((byte & 0x80) == 0) {
+				break;
+			}
+			shift += 7;
+			if (shift >= 64) {
+				size = std::numeric_limits<uint64_t>::max();
+				break;
+			}
+		}
+		if (size == 0) {
+			done = true;
+			return false;
+		}
+		if (size > maxRecordSize) {
+			error = EC::ErrorCode(
+				InvalidRecord,
+				"Patient record is too large: %llu bytes",
+				static_cast<unsigned long long>(size)
+			);
+			done = true;
+			return false;
+		}
+		body.resize(size_t(size));
+		if (!in.read(body.data(), std::streamsize(size))) {
+			error = EC::ErrorCode(Truncated, "The patient stream ends inside a record");
+			done = true;
+			return false;
+		}
+		if (!PatientBinaryCodec::decode(body, uri, patient)) {
+			error = EC::ErrorCode(InvalidRecord, "Malformed patient record");
+			done = true;
+			return false;
+		}
+		return true;
+	}
+}  // namespace ViewRay
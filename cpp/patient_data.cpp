@@ -1,11 +1,94 @@
 #include "patient_data.h"
 #include <nlohmann/json.hpp>
+#include <cstdint>
+#include <limits>
 
 namespace ViewRay {
 
-	Plan::Plan(const nlohmann::json& plan) :
-		label(plan["label"]) {
-		assert(plan["type"] == std::string("Plan"));
+	namespace {
+		// Missing fields and fields of another type keep their default value, the same as in
+		// parseUpdateSubscriptions, so both parsers accept the same frames
+
+		/// Copy a string field into memory from the given allocator
+		/// @return Empty string if the field is missing or is not a string
+		std::pmr::string stringField(
+			const nlohmann::json& json,
+			const char* key,
+			const PatientAllocator& alloc
+		) {
+			const auto it = json.find(key);
+			if (it == json.end() || !it->is_string()) {
+				return std::pmr::string(alloc);
+			}
+			return std::pmr::string(it->get_ref<const std::string&>(), alloc);
+		}
+
+		/// @return 0 if the field is missing, is not a number or does not fit into an int.
+		///		Fractions are truncated.
+		int intField(const nlohmann::json& json, const char* key) {
+			constexpr int min = std::numeric_limits<int>::min();
+			constexpr int max = std::numeric_limits<int>::max();
+			const auto it = json.find(key);
+			if (it == json.end()) {
+				return 0;
+			}
+			if (it->is_number_unsigned()) {
+				const uint64_t value = it->get<uint64_t>();
+				return value <= uint64_t(max) ? int(value) : 0;
+			}
+			if (it->is_number_integer()) {
+				const int64_t value = it->get<int64_t>();
+				return value >= min && value <= max ? int(value) : 0;
+			}
+			if (it->is_number_float()) {
+				// Also false for NaN
+				const double value = it->get<double>();
+				return value > double(min) - 1.0 && value < double(max) + 1.0 ? int(value) : 0;
+			}
+			return 0;
+		}
+
+		/// @return false if the field is missing or is not a boolean
+		bool boolField(const nlohmann::json& json, const char* key) {
+			const auto it = json.find(key);
+			return it != json.end() && it->is_boolean() && it->get<bool>();
+		}
+
+		/// Construct an item of a list for each object in an array field. Items which are not
+		/// objects are skipped and a missing field gives an empty list.
+		template <typename T>
+		void arrayField(const nlohmann::json& json, const char* key, std::pmr::vector<T>& out) {
+			const auto it = json.find(key);
+			if (it == json.end() || !it->is_array()) {
+				return;
+			}
+			out.reserve(it->size());
+			for (const nlohmann::json& item : *it) {
+				if (item.is_object()) {
+					out.emplace_back(item);
+				}
+			}
+		}
+	}  // namespace
+
+	Plan::Plan(const allocator_type& alloc) :
+		label(alloc) {
+	}
+
+	Plan::Plan(const nlohmann::json& plan, const allocator_type& alloc) :
+		label(stringField(plan, "label", alloc)) {
+	}
+
+	Plan::Plan(const Plan& other, const allocator_type& alloc) :
+		label(other.label, alloc) {
+	}
+
+	Plan::Plan(Plan&& other, const allocator_type& alloc) :
+		label(std::move(other.label), alloc) {
+	}
+
+	bool Plan::operator==(const Plan& other) const {
+		return label == other.label;
 	}
 
 	std::ostream& operator<<(std::ostream& os, const Plan& plan) {
@@ -13,15 +96,37 @@ namespace ViewRay {
 		return os;
 	}
 
-	Prescription::Prescription(const nlohmann::json& prescriptiopn) :
-		description(prescriptiopn["description"]),
-		label(prescriptiopn["label"]),
-		numFractions(prescriptiopn["num_fractions"]) {
-		assert(prescriptiopn["type"] == std::string("Prescription"));
-		plans.reserve(prescriptiopn["plans"].size());
-		for (const nlohmann::json& json : prescriptiopn["plans"]) {
-			plans.emplace_back(json);
-		}
+	Prescription::Prescription(const allocator_type& alloc) :
+		description(alloc),
+		label(alloc),
+		plans(alloc) {
+	}
+
+	Prescription::Prescription(const nlohmann::json& prescriptiopn, const allocator_type& alloc) :
+		description(stringField(prescriptiopn, "description", alloc)),
+		label(stringField(prescriptiopn, "label", alloc)),
+		numFractions(intField(prescriptiopn, "num_fractions")),
+		plans(alloc) {
+		arrayField(prescriptiopn, "plans", plans);
+	}
+
+	Prescription::Prescription(const Prescription& other, const allocator_type& alloc) :
+		description(other.description, alloc),
+		label(other.label, alloc),
+		numFractions(other.numFractions),
+		plans(other.plans, alloc) {
+	}
+
+	Prescription::Prescription(Prescription&& other, const allocator_type& alloc) :
+		description(std::move(other.description), alloc),
+		label(std::move(other.label), alloc),
+		numFractions(other.numFractions),
+		plans(std::move(other.plans), alloc) {
+	}
+
+	bool Prescription::operator==(const Prescription& other) const {
+		return numFractions == other.numFractions && label == other.label &&
+			   description == other.description && plans == other.plans;
 	}
 
 	std::ostream& operator<<(std::ostream& os, const Prescription& prescription) {
@@ -36,14 +141,34 @@ namespace ViewRay {
 		return os;
 	}
 
-	Diagnose::Diagnose(const nlohmann::json& diagnose) :
-		description(diagnose["description"]),
-		label(diagnose["label"]) {
-		assert(diagnose["type"] == std::string("Diagnosis"));
-		prescriptions.reserve(diagnose["prescriptions"].size());
-		for (const nlohmann::json& json : diagnose["prescriptions"]) {
-			prescriptions.emplace_back(json);
-		}
+	Diagnose::Diagnose(const allocator_type& alloc) :
+		description(alloc),
+		label(alloc),
+		prescriptions(alloc) {
+	}
+
+	Diagnose::Diagnose(const nlohmann::json& diagnose, const allocator_type& alloc) :
+		description(stringField(diagnose, "description", alloc)),
+		label(stringField(diagnose, "label", alloc)),
+		prescriptions(alloc) {
+		arrayField(diagnose, "prescriptions", prescriptions);
+	}
+
+	Diagnose::Diagnose(const Diagnose& other, const allocator_type& alloc) :
+		description(other.description, alloc),
+		label(other.label, alloc),
+		prescriptions(other.prescriptions, alloc) {
+	}
+
+	Diagnose::Diagnose(Diagnose&& other, const allocator_type& alloc) :
+		description(std::move(other.description), alloc),
+		label(std::move(other.label), alloc),
+		prescriptions(std::move(other.prescriptions), alloc) {
+	}
+
+	bool Diagnose::operator==(const Diagnose& other) const {
+		return label == other.label && description == other.description &&
+			   prescriptions == other.prescriptions;
 	}
 
 	std::ostream& operator<<(std::ostream& os, const Diagnose& diagnose) {
@@ -57,28 +182,103 @@ namespace ViewRay {
 		return os;
 	}
 
-	Patient::Patient(const nlohmann::json& data) {
-		id = data["id"];
-		mrn = data["mrn"];
-		dateOfBirth = data["date_of_birth"];
-		firstName = data["first_name"];
-		middleName = data["middle_name"];
-		lastName = data["last_name"];
-		sex = data["sex"] == "M" ? Sex::Male : Sex::Female;
-		fractionsTotal = data["fractions_total"];
-		fractionsCompleted = data["fractions_completed"];
-		weigthKg = data["weight_kg"];
-		readyForTreatment = data["ready_for_treatment"];
-		registrationTime = data["registration_time"];
+	Patient::Patient(const allocator_type& alloc) :
+		id(alloc),
+		mrn(alloc),
+		dateOfBirth(alloc),
+		firstName(alloc),
+		middleName(alloc),
+		lastName(alloc),
+		diagnoses(alloc) {
+	}
+
+	Patient::Patient(const nlohmann::json& data, const allocator_type& alloc) :
+		id(stringField(data, "id", alloc)),
+		mrn(stringField(data, "mrn", alloc)),
+		dateOfBirth(stringField(data, "date_of_birth", alloc)),
+		firstName(stringField(data, "first_name", alloc)),
+		middleName(stringField(data, "middle_name", alloc)),
+		lastName(stringField(data, "last_name", alloc)),
+		sex(sexFromString(stringField(data, "sex", alloc))),
+		fractionsTotal(intField(data, "fractions_total")),
+		fractionsCompleted(intField(data, "fractions_completed")),
+		weigthKg(intField(data, "weight_kg")),
+		registrationTime(intField(data, "registration_time")),
+		readyForTreatment(boolField(data, "ready_for_treatment")),
+		diagnoses(alloc) {
+	}
+
+	Patient::Patient(Patient&& other, const allocator_type& alloc) :
+		id(std::move(other.id), alloc),
+		mrn(std::move(other.mrn), alloc),
+		dateOfBirth(std::move(other.dateOfBirth), alloc),
+		firstName(std::move(other.firstName), alloc),
+		middleName(std::move(other.middleName), alloc),
+		lastName(std::move(other.lastName), alloc),
+		sex(other.sex),
+		fractionsTotal(other.fractionsTotal),
+		fractionsCompleted(other.fractionsCompleted),
+		weigthKg(other.weigthKg),
+		registrationTime(other.registrationTime),
+		readyForTreatment(other.readyForTreatment),
+		diagnoses(std::move(other.diagnoses), alloc) {
+	}
+
+	Patient::Sex Patient::sexFromString(std::string_view value) {
+		if (value == "M") {
+			return Sex::Male;
+		}
+		if (value == "F") {
+			return Sex::Female;
+		}
+		return Sex::Unknown;
 	}
 
 	void Patient::diagnosesFromJson(const nlohmann::json& diagnosesJson) {
 		diagnoses.clear();
+		if (!diagnosesJson.is_array()) {
+			return;
+		}
 		diagnoses.reserve(diagnosesJson.size());
 		for (const auto& diagnose : diagnosesJson) {
-			diagnoses.emplace_back(diagnose);
+			if (diagnose.is_object()) {
+				diagnoses.emplace_back(diagnose);
+			}
 		}
 	}
+
+	void Patient::setDiagnoses(DiagnoseList newDiagnoses) {
+		diagnoses = std::move(newDiagnoses);
+	}
+
+	bool Patient::hasSameDiagnoses(const DiagnoseList& other) const {
+		return diagnoses == other;
+	}
+
+	bool Patient::hasSameSummary(const Patient& other) const {
+		return id == other.id && mrn == other.mrn && dateOfBirth == other.dateOfBirth &&
+			   firstName == other.firstName && middleName == other.middleName &&
+			   lastName == other.lastName && sex == other.sex &&
+			   fractionsTotal == other.fractionsTotal &&
+			   fractionsCompleted == other.fractionsCompleted && weigthKg == other.weigthKg &&
+			   registrationTime == other.registrationTime &&
+			   readyForTreatment == other.readyForTreatment;
+	}
+
+	void Patient::assignSummary(Patient&& other) {
+		id = std::move(other.id);
+		mrn = std::move(other.mrn);
+		dateOfBirth = std::move(other.dateOfBirth);
+		firstName = std::move(other.firstName);
+		middleName = std::move(other.middleName);
+		lastName = std::move(other.lastName);
+		sex = other.sex;
+		fractionsTotal = other.fractionsTotal;
+		fractionsCompleted = other.fractionsCompleted;
+		weigthKg = other.weigthKg;
+		registrationTime = other.registrationTime;
+		readyForTreatment = other.readyForTreatment;
+	}
  
 	std::ostream& operator<<(std::ostream& os, const Patient& patient) {
 		os << "Patient ID: " << patient.id << '\n';
@@ -87,7 +287,13 @@ namespace ViewRay {
 		os << "First Name: " << patient.firstName << '\n';
 		os << "Middle Name: " << patient.middleName << '\n';
 		os << "Last Name: " << patient.lastName << '\n';
-		os << "Sex: " << (patient.sex == Patient::Sex::Male ? "Male" : "Female") << '\n';
+		os << "Sex: ";
+		switch (patient.sex) {
+			case Patient::Sex::Male: os << "Male"; break;
+			case Patient::Sex::Female: os << "Female"; break;
+			default: os << "Unknown"; break;
+		}
+		os << '\n';
 		os << "Fractions Total: " << patient.fractionsTotal << '\n';
 		os << "Fractions Completed: " << patient.fractionsCompleted << '\n';
 		os << "Weight: " << patient.weigthKg << '\n';
@@ -0,0 +1,100 @@
+#include "patient_detail_cache.h"
+
+namespace ViewRay {
+	PatientDetailCache::PatientDetailCache(size_t capacity, std::chrono::milliseconds ttl) :
+		capacity(capacity),
+		ttl(ttl) {
+	}
+
+	bool PatientDetailCache::find(
+		const std::string& uri,
+		Patient::DiagnoseList& diagnoses,
+		Clock::time_point now
+	) {
+		std::lock_guard<std::mutex> lock(mutex);
+		const auto it = entries.find(uri);
+		if (it == entries.end()) {
+			return false;
+		}
+		if (it->second.expires <= now) {
+			erase(it);
+			return false;
+		}
+		lru.splice(lru.begin(), lru, it->second.lruPosition);
+		it->second.diagnoses.toDiagnoses(diagnoses);
+		return true;
+	}
+
+	void PatientDetailCache::insert(
+		const std::string& uri,
+		const Patient::DiagnoseList& diagnoses,
+		Clock::time_point now
+	) {
+		if (!isEnabled()) {
+			return;
+		}
+		// Built before locking, so that lookups do not wait for the copy
+		CompactDiagnoses compact(diagnoses);
+		std::lock_guard<std::mutex> lock(mutex);
+		if (capacity == 0 || ttl.count() <= 0) {
+			return;
+		}
+		auto it = entries.find(uri);
+		if (it == entries.end()) {
+			it = entries.emplace(uri, Entry{CompactDiagnoses(), {}, {}}).first;
+			lru.push_front(&it->first);
+			it->second.lruPosition = lru.begin();
+		} else {
+			lru.splice(lru.begin(), lru, it->second.lruPosition);
+		}
+		it->second.diagnoses = std::move(compact);
+		it->second.expires = now + ttl;
+		evict();
+	}
+
+	void PatientDetailCache::invalidate(const std::string& uri) {
+		std::lock_guard<std::mutex> lock(mutex);
+		const auto it = entries.find(uri);
+		if (it != entries.end()) {
+			erase(it);
+		}
+	}
+
+	void PatientDetailCache::clear() {
+		std::lock_guard<std::mutex> lock(mutex);
+		lru.clear();
+		entries.clear();
+	}
+
+	void PatientDetailCache::configure(size_t capacity, std::chrono::milliseconds ttl) {
+		std::lock_guard<std::mutex> lock(mutex);
+		this->capacity = capacity;
+		this->ttl = ttl;
+		if (ttl.count() <= 0) {
+			lru.clear();
+			entries.clear();
+		}
+		evict();
+	}
+
+	bool PatientDetailCache::isEnabled() const {
+		std::lock_guard<std::mutex> lock(mutex);
+		return capacity > 0 && ttl.count() > 0;
+	}
+
+	size_t PatientDetailCache::size() const {
+		std::lock_guard<std::mutex> lock(mutex);
+		return entries.size();
+	}
+
+	void PatientDetailCache::erase(std::unordered_map<std::string, Entry>::iterator it) {
+		lru.erase(it->second.lruPosition);
+		entries.erase(it);
+	}
+
+	void PatientDetailCache::evict() {
+		while (entries.size() > capacity) {
+			erase(entries.find(*lru.back()));
+		}
+	}
+}  // namespace ViewRay
@@ -0,0 +1,338 @@
+#include "patient_formatter.h"
+#include <algorithm>
+#include <charconv>
+#include <future>
+#include <ostream>
+
+namespace ViewRay {
+	namespace {
+		void appendInt(std::string& out, int value) {
+			char digits[16];
+			const auto result = std::to_chars(std::begin(digits), std::end(digits), value);
+			out.append(digits, result.ptr);
+		}
+
+		void appendJsonString(std::string& out, std::string_view str) {
+			static constexpr char hex[] = "0123456789abcdef";
+			out.push_back('"');
+			for (const char c : str) {
+				switch (c) {
+					case '"': out.append("\\\""); break;
+					case '\\': out.append("\\\\"); break;
+					case '\n': out.append("\\n"); break;
+					case '\r': out.append("\\r"); break;
+					case '\t': out.append("\\t"); break;
+					default:
+						if (uint8_t(c) < 0x20) {
+							out.append("\\u00");
+							out.push_back(hex[uint8_t(c) >> 4]);
+							out.push_back(hex[uint8_t(c) & 0xf]);
+						} else {
+							out.push_back(c);
+						}
+				}
+			}
+			out.push_back('"');
+		}
+
+		void appendCsvField(std::string& out, std::string_view str) {
+			if (str.find_first_of(",\"\r\n") == std::string_view::npos) {
+				out.append(str);
+				return;
+			}
+			out.push_back('"');
+			for (const char c : str) {
+				if (c == '"') {
+					out.push_back('"');
+				}
+				out.push_back(c);
+			}
+			out.push_back('"');
+		}
+
+		std::string_view sexName(Patient::Sex sex) {
+			switch (sex) {
+				case Patient::Sex::Male: return "Male";
+				case Patient::Sex::Female: return "Female";
+				default: return "Unknown";
+			}
+		}
+
+		/// The value of the "sex" field of the server
+		std::string_view sexCode(Patient::Sex sex) {
+			switch (sex) {
+				case Patient::Sex::Male: return "M";
+				case Patient::Sex::Female: return "F";
+				default: return "";
+			}
+		}
+
+		// The rows are Patient or PatientTable::PatientView, whose items have the same getters
+
+		/// Same output as operator<<(std::ostream&, const Patient&) and the separator
+		template <typename Row>
+		void renderText(std::string& out, const Row& patient) {
+			out.append("Patient ID: ").append(patient.getId());
+			out.append("\nMRN: ").append(patient.getMrn());
+			out.append("\nDate of birth: ").append(patient.getDateOfBirth());
+			out.append("\nFirst Name: ").append(patient.getFirstName());
+			out.append("\nMiddle Name: ").append(patient.getMiddleName());
+			out.append("\nLast Name: ").append(patient.getLastName());
+			out.append("\nSex: ").append(sexName(patient.getSex()));
+			out.append("\nFractions Total: ");
+			appendInt(out, patient.getFractionsTotal());
+			out.append("\nFractions Completed: ");
+			appendInt(out, patient.getFractionsCompleted());
+			out.append("\nWeight: ");
+			appendInt(out, patient.getWeightKg());
+			out.append("\nReady for treatment: ");
+			out.append(patient.isReadyForTreatment() ? "True" : "False");
+			out.append("\nRegistration Time: ");
+			appendInt(out, patient.getRegistrationTime());
+			out.append("\nDiagnoses:[");
+			for (const auto& diagnose : patient.getDiagnoses()) {
+				out.append("Label: ").append(diagnose.getLabel());
+				out.append(", Description: ").append(diagnose.getDescription());
+				out.append(", Prescriptions:[");
+				for (const auto& prescription : diagnose.getPrescriptions()) {
+					out.append("Description: ").append(prescription.getDescription());
+					out.append(", Label: ").append(prescription.getLabel());
+					out.append(", Num Fractions: ");
+					appendInt(out, prescription.getNumFractions());
+					out.append(", Plans:[");
+					for (const auto& plan : prescription.getPlans()) {
+						out.append(plan.getLabel()).push_back(' ');
+					}
+					out.append("]\n");
+				}
+				out.append("]\n");
+			}
+			out.append("]\n\n============================================\n");
+		}
+
+		template <typename Row>
+		void renderJson(std::string& out, const Row& patient) {
+			out.append("{\"id\":");
+			appendJsonString(out, patient.getId());
+			out.append(",\"mrn\":");
+			appendJsonString(out, patient.getMrn());
+			out.append(",\"date_of_birth\":");
+			appendJsonString(out, patient.getDateOfBirth());
+			out.append(",\"first_name\":");
+			appendJsonString(out, patient.getFirstName());
+			out.append(",\"middle_name\":");
+			appendJsonString(out, patient.getMiddleName());
+			out.append(",\"last_name\":");
+			appendJsonString(out, patient.getLastName());
+			out.append(",\"sex\":");
+			const std::string_view sex = sexCode(patient.getSex());
+			if (sex.empty()) {
+				out.append("null");
+			} else {
+				appendJsonString(out, sex);
+			}
+			out.append(",\"fractions_total\":");
+			appendInt(out, patient.getFractionsTotal());
+			out.append(",\"fractions_completed\":");
+			appendInt(out, patient.getFractionsCompleted());
+			out.append(",\"weight_kg\":");
+			appendInt(out, patient.getWeightKg());
+			out.append(",\"registration_time\":");
+			appendInt(out, patient.getRegistrationTime());
+			out.append(",\"ready_for_treatment\":");
+			out.append(patient.isReadyForTreatment() ? "true" : "false");
+			out.append(",\"diagnoses\":[");
+			bool firstDiagnose = true;
+			for (const auto& diagnose : patient.getDiagnoses()) {
+				out.append(firstDiagnose ? "{\"label\":" : ",{\"label\":");
+				firstDiagnose = false;
+				appendJsonString(out, diagnose.getLabel());
+				out.append(",\"description\":");
+				appendJsonString(out, diagnose.getDescription());
+				out.append(",\"prescriptions\":[");
+				bool firstPrescription = true;
+				for (const auto& prescription : diagnose.getPrescriptions()) {
+					out.append(firstPrescription ? "{\"label\":" : ",{\"label\":");
+					firstPrescription = false;
+					appendJsonString(out, prescription.getLabel());
+					out.append(",\"description\":");
+					appendJsonString(out, prescription.getDescription());
+					out.append(",\"num_fractions\":");
+					appendInt(out, prescription.getNumFractions());
+					out.append(",\"plans\":[");
+					bool firstPlan = true;
+					for (const auto& plan : prescription.getPlans()) {
+						out.append(firstPlan ? "{\"label\":" : ",{\"label\":");
+						firstPlan = false;
+						appendJsonString(out, plan.getLabel());
+						out.push_back('}');
+					}
+					out.append("]}");
+				}
+				out.append("]}");
+			}
+			out.append("]}\n");
+		}
+
+		template <typename Row>
+		void renderCsv(std::string& out, const Row& patient) {
+			appendCsvField(out, patient.getId());
+			out.push_back(',');
+			appendCsvField(out, patient.getMrn());
+			out.push_back(',');
+			appendCsvField(out, patient.getDateOfBirth());
+			out.push_back(',');
+			appendCsvField(out, patient.getFirstName());
+			out.push_back(',');
+			appendCsvField(out, patient.getMiddleName());
+			out.push_back(',');
+			appendCsvField(out, patient.getLastName());
+			out.push_back(',');
+			out.append(sexCode(patient.getSex()));
+			out.push_back(',');
+			appendInt(out, patient.getFractionsTotal());
+			out.push_back(',');
+			appendInt(out, patient.getFractionsCompleted());
+			out.push_back(',');
+			appendInt(out, patient.getWeightKg());
+			out.push_back(',');
+			appendInt(out, patient.getRegistrationTime());
+			out.append(patient.isReadyForTreatment() ? ",true," : ",false,");
+			// The labels form a single field, which is quoted if any of them needs it
+			const auto& diagnoses = patient.getDiagnoses();
+			const bool quote = std::any_of(diagnoses.begin(), diagnoses.end(), [](const auto& d) {
+				return d.getLabel().find_first_of(",\"\r\n") != std::string_view::npos;
+			});
+			if (quote) {
+				out.push_back('"');
+			}
+			for (size_t i = 0; i < diagnoses.size(); ++i) {
+				if (i > 0) {
+					out.push_back(';');
+				}
+				for (const char c : diagnoses[i].getLabel()) {
+					if (c == '"') {
+						out.push_back('"');
+					}
+					out.push_back(c);
+				}
+			}
+			out.append(quote ? "\"\r\n" : "\r\n");
+		}
+	}  // namespace
+
+	EC::ErrorCode PatientFormatter::parseFormat(std::string_view name, Format& format) {
+		if (name == "text") {
+			format = Format::Text;
+		} else if (name == "jsonl") {
+			format = Format::JsonLines;
+		} else if (name == "csv") {
+			format = Format::Csv;
+		} else {
+			return EC::ErrorCode(
+				UnknownFormat,
+				"Unknown output format %.*s. Expected text, jsonl or csv",
+				int(name.size()),
+				name.data()
+			);
+		}
+		return EC::ErrorCode();
+	}
+
+	PatientFormatter::PatientFormatter(Format format, unsigned threads) :
+		format(format),
+		threads(threads == 0 ? 1 : threads) {
+	}
+
+	void PatientFormatter::renderHeader(std::string& out) const {
+		if (format == Format::Csv) {
+			out.append(
+				"id,mrn,date_of_birth,first_name,middle_name,last_name,sex,fractions_total,"
+				"fractions_completed,weight_kg,registration_time,ready_for_treatment,diagnoses\r\n"
+			);
+		}
+	}
+
+	void PatientFormatter::render(std::string& out, const Patient& patient) const {
+		renderRow(out, patient);
+	}
+
+	void PatientFormatter::render(
+		std::string& out,
+		const PatientTable::PatientView& patient
+	) const {
+		renderRow(out, patient);
+	}
+
+	template <typename Row>
+	void PatientFormatter::renderRow(std::string& out, const Row& patient) const {
+		switch (format) {
+			case Format::Text: renderText(out, patient); break;
+			case Format::JsonLines: renderJson(out, patient); break;
+			case Format::Csv: renderCsv(out, patient); break;
+		}
+	}
+
+	EC::ErrorCode PatientFormatter::write(
+		std::ostream& out,
+		const std::vector<const Patient*>& patients
+	) {
+		return writeRows(out, patients.size(), [&patients](size_t i) -> const Patient& {
+			return *patients[i];
+		});
+	}
+
+	EC::ErrorCode PatientFormatter::write(std::ostream& out, const PatientTable& table) {
+		return writeRows(out, table.size(), [&table](size_t i) {
+			return table[i];
+		});
+	}
+
+	template <typename GetRow>
+	EC::ErrorCode PatientFormatter::writeRows(std::ostream& out, size_t count, GetRow getRow) {
+		const size_t chunks = (count + chunkSize - 1) / chunkSize;
+		const size_t batchSize = std::min<size_t>(threads, chunks);
+		buffers.resize(std::max<size_t>(batchSize, 1));
+
+		auto renderChunk = [&](size_t chunk, std::string& buffer) {
+			const size_t begin = chunk * chunkSize;
+			const size_t end = std::min(begin + chunkSize, count);
+			for (size_t i = begin; i < end; ++i) {
+				renderRow(buffer, getRow(i));
+			}
+		};
+
+		buffers[0].clear();
+		renderHeader(buffers[0]);
+		// Each batch renders one chunk per thread and then writes the chunks in order. The
+		// header is written together with the first chunk.
+		for (size_t batch = 0; batch < chunks; batch += batchSize) {
+			const size_t batchChunks = std::min(batchSize, chunks - batch);
+			std::vector<std::future<void>> rendered;
+			rendered.reserve(batchChunks - 1);
+			for (size_t i = 1; i < batchChunks; ++i) {
+				std::string& buffer = buffers[i];
+				buffer.clear();
+				rendered.push_back(
+					std::async(std::launch::async, renderChunk, batch + i, std::ref(buffer))
+				);
+			}
+			renderChunk(batch, buffers[0]);
+			for (std::future<void>& f : rendered) {
+				f.get();
+			}
+			for (size_t i = 0; i < batchChunks; ++i) {
+				out.write(buffers[i].data(), std::streamsize(buffers[i].size()));
+			}
+			buffers[0].clear();
+		}
+		if (chunks == 0) {
+			out.write(buffers[0].data(), std::streamsize(buffers[0].size()));
+		}
+		out.flush();
+		if (!out) {
+			return EC::ErrorCode(CannotWrite, "Cannot write the patient list");
+		}
+		return EC::ErrorCode();
+	}
+}  // namespace ViewRay
@@ -0,0 +1,457 @@
+#include "patient_parser.h"
+#include "json_scanner.h"
+#include <nlohmann/json.hpp>
+#include <limits>
+#include <optional>
+#include <tuple>
+
+namespace ViewRay {
+	const ResourceRoutes& getDefaultResourceRoutes() {
+		static const ResourceRoutes routes = []() {
+			ResourceRoutes defaults;
+			defaults.add(
+				"public:patients", ResourceRoutes::Match::Exact, ResourceKind::PatientList
+			);
+			defaults.add("", ResourceRoutes::Match::Prefix, ResourceKind::Patient);
+			return defaults;
+		}();
+		return routes;
+	}
+
+	/// @brief SAX handler which fills UpdateSubscriptions while nlohmann tokenizes the payload
+	///
+	/// Keeps a stack with the kind of each opened object/array. The kind of a new object/array
+	/// depends on its parent and on the key under which it is stored. The kind of each resource
+	/// is looked up in the routes of UpdateSubscriptions. Resources routed to
+	/// ResourceKind::Json are passed to the nlohmann DOM builder, everything else which is not
+	/// part of the patient data is skipped.
+	class UpdateSubscriptionsSax : public nlohmann::json_sax<nlohmann::json> {
+	public:
+		explicit UpdateSubscriptionsSax(UpdateSubscriptions& out) :
+			out(out) {
+			// Enough for the deepest frame (root/update/resource/diagnoses/.../plan) and the
+			// longest key, so that they are allocated once per frame
+			stack.reserve(16);
+			currentKey.reserve(32);
+		}
+
+		bool null() override {
+			return top() != Scope::Json || jsonBuilder->null();
+		}
+
+		bool boolean(bool val) override {
+			if (top() == Scope::Json) {
+				return jsonBuilder->boolean(val);
+			}
+			if (top() == Scope::ListPatient && currentKey == "ready_for_treatment") {
+				currentPatient().readyForTreatment = val;
+			}
+			return true;
+		}
+
+		// Numbers which do not fit into an int are ignored like fields of another type, the
+		// same as in the nlohmann::json constructors of the patient data
+
+		bool number_integer(number_integer_t val) override {
+			if (top() == Scope::Json) {
+				return jsonBuilder->number_integer(val);
+			}
+			if (val < std::numeric_limits<int>::min() || val > std::numeric_limits<int>::max()) {
+				return true;
+			}
+			return number(int(val));
+		}
+
+		bool number_unsigned(number_unsigned_t val) override {
+			if (top() == Scope::Json) {
+				return jsonBuilder->number_unsigned(val);
+			}
+			if (val > number_unsigned_t(std::numeric_limits<int>::max())) {
+				return true;
+			}
+			return number(int(val));
+		}
+
+		bool number_float(number_float_t val, const string_t& text) override {
+			if (top() == Scope::Json) {
+				return jsonBuilder->number_float(val, text);
+			}
+			// Fractions are truncated. Also false for NaN.
+			if (!(val > double(std::numeric_limits<int>::min()) - 1.0 &&
+				  val < double(std::numeric_limits<int>::max()) + 1.0)) {
+				return true;
+			}
+			return number(int(val));
+		}
+
+		bool string(string_t& val) override {
+			switch (top()) {
+				case Scope::Json: {
+					return jsonBuilder->string(val);
+				}
+				case Scope::List: {
+					return currentKey != "type" || val == "PatientList";
+				}
+				case Scope::Resource: {
+					return currentKey != "type" || val == "Patient";
+				}
+				case Scope::ListPatient: {
+					Patient& patient = currentPatient();
+					if (currentKey == "uri") {
+						out.patients.back().first = val;
+					} else if (currentKey == "id") {
+						patient.id = val;
+					} else if (currentKey == "mrn") {
+						patient.mrn = val;
+					} else if (currentKey == "date_of_birth") {
+						patient.dateOfBirth = val;
+					} else if (currentKey == "first_name") {
+						patient.firstName = val;
+					} else if (currentKey == "middle_name") {
+						patient.middleName = val;
+					} else if (currentKey == "last_name") {
+						patient.lastName = val;
+					} else if (currentKey == "sex") {
+						patient.sex = Patient::sexFromString(val);
+					}
+				} break;
+				case Scope::Diagnose: {
+					Diagnose& diagnose = currentDiagnose();
+					if (currentKey == "description") {
+						diagnose.description = val;
+					} else if (currentKey == "label") {
+						diagnose.label = val;
+					} else if (currentKey == "type") {
+						return val == "Diagnosis";
+					}
+				} break;
+				case Scope::Prescription: {
+					Prescription& prescription = currentPrescription();
+					if (currentKey == "description") {
+						prescription.description = val;
+					} else if (currentKey == "label") {
+						prescription.label = val;
+					} else if (currentKey == "type") {
+						return val == "Prescription";
+					}
+				} break;
+				case Scope::Plan: {
+					if (currentKey == "label") {
+						currentPrescription().plans.back().label = val;
+					} else if (currentKey == "type") {
+						return val == "Plan";
+					}
+				} break;
+				default: break;
+			}
+			return true;
+		}
+
+		bool binary(binary_t&) override {
+			return true;
+		}
+
+		bool start_object(std::size_t elements) override {
+			const Scope parent = top();
+			if (parent == Scope::Json || (parent == Scope::Update && startJson())) {
+				stack.push_back(Scope::Json);
+				return jsonBuilder->start_object(elements);
+			}
+			Scope scope = Scope::Skip;
+			switch (parent) {
+				case Scope::None: {
+					scope = Scope::Root;
+				} break;
+				case Scope::Root: {
+					if (currentKey == "updateSubscriptions") {
+						scope = Scope::Update;
+					}
+				} break;
+				case Scope::Update: {
+					const ResourceKind* kind = out.routes->find(currentKey);
+					if (kind && *kind == ResourceKind::PatientList) {
+						out.hasPatientList = true;
+						scope = Scope::List;
+					} else if (kind && *kind == ResourceKind::Patient) {
+						out.diagnoses.emplace_back(currentKey, Patient::DiagnoseList(out.resource));
+						scope = Scope::Resource;
+					}
+				} break;
+				case Scope::ListValue: {
+					out.patients.emplace_back(
+						std::piecewise_construct,
+						std::forward_as_tuple(),
+						std::forward_as_tuple(PatientAllocator(out.resource))
+					);
+					scope = Scope::ListPatient;
+				} break;
+				case Scope::Diagnoses: {
+					out.diagnoses.back().second.emplace_back();
+					scope = Scope::Diagnose;
+				} break;
+				case Scope::Prescriptions: {
+					currentDiagnose().prescriptions.emplace_back();
+					scope = Scope::Prescription;
+				} break;
+				case Scope::Plans: {
+					currentPrescription().plans.emplace_back();
+					scope = Scope::Plan;
+				} break;
+				default: break;
+			}
+			stack.push_back(scope);
+			return true;
+		}
+
+		bool key(string_t& val) override {
+			currentKey = val;
+			return top() != Scope::Json || jsonBuilder->key(val);
+		}
+
+		bool end_object() override {
+			if (top() == Scope::Json) {
+				stack.pop_back();
+				return jsonBuilder->end_object() && finishJson();
+			}
+			stack.pop_back();
+			return true;
+		}
+
+		bool start_array(std::size_t elements) override {
+			const Scope parent = top();
+			if (parent == Scope::Json || (parent == Scope::Update && startJson())) {
+				stack.push_back(Scope::Json);
+				return jsonBuilder->start_array(elements);
+			}
+			Scope scope = Scope::Skip;
+			if (parent == Scope::List && currentKey == "value") {
+				scope = Scope::ListValue;
+				if (elements != std::size_t(-1)) {
+					out.patients.reserve(elements);
+				}
+			} else if (parent == Scope::Resource && currentKey == "diagnoses") {
+				scope = Scope::Diagnoses;
+			} else if (parent == Scope::Diagnose && currentKey == "prescriptions") {
+				scope = Scope::Prescriptions;
+			} else if (parent == Scope::Prescription && currentKey == "plans") {
+				scope = Scope::Plans;
+			}
+			stack.push_back(scope);
+			return true;
+		}
+
+		bool end_array() override {
+			if (top() == Scope::Json) {
+				stack.pop_back();
+				return jsonBuilder->end_array() && finishJson();
+			}
+			stack.pop_back();
+			return true;
+		}
+
+		bool parse_error(std::size_t, const std::string&, const nlohmann::detail::exception&)
+			override {
+			return false;
+		}
+
+	private:
+		enum class Scope {
+			/// Outside of the root object
+			None,
+			/// The root object
+			Root,
+			/// The value of updateSubscriptions
+			Update,
+			/// The public:patients resource
+			List,
+			/// The array of patients of public:patients
+			ListValue,
+			/// A patient inside public:patients
+			ListPatient,
+			/// A patient resource keyed by the patient URI
+			Resource,
+			Diagnoses,
+			Diagnose,
+			Prescriptions,
+			Prescription,
+			Plans,
+			Plan,
+			/// A resource routed to ResourceKind::Json and all of its children
+			Json,
+			/// Anything which is not patient data and all of its children
+			Skip
+		};
+
+		Scope top() const {
+			return stack.empty() ? Scope::None : stack.back();
+		}
+
+		bool number(int val) {
+			if (top() == Scope::ListPatient) {
+				Patient& patient = currentPatient();
+				if (currentKey == "fractions_total") {
+					patient.fractionsTotal = val;
+				} else if (currentKey == "fractions_completed") {
+					patient.fractionsCompleted = val;
+				} else if (currentKey == "weight_kg") {
+					patient.weigthKg = val;
+				} else if (currentKey == "registration_time") {
+					patient.registrationTime = val;
+				}
+			} else if (top() == Scope::Prescription && currentKey == "num_fractions") {
+				currentPrescription().numFractions = val;
+			}
+			return true;
+		}
+
+		/// Start building the resource keyed by currentKey if it is routed to ResourceKind::Json
+		/// @return true if the resource is built
+		bool startJson() {
+			const ResourceKind* kind = out.routes->find(currentKey);
+			if (!kind || *kind != ResourceKind::Json) {
+				return false;
+			}
+			jsonUri = currentKey;
+			jsonValue = nlohmann::json();
+			jsonBuilder.emplace(jsonValue, false);
+			return true;
+		}
+
+		/// Move the built resource to the output once its root is closed
+		bool finishJson() {
+			if (top() != Scope::Json) {
+				// The builder refers to the value, so it is destroyed first
+				jsonBuilder.reset();
+				out.resources.emplace_back(std::move(jsonUri), std::move(jsonValue));
+			}
+			return true;
+		}
+
+		Patient& currentPatient() {
+			return out.patients.back().second;
+		}
+
+		Diagnose& currentDiagnose() {
+			return out.diagnoses.back().second.back();
+		}
+
+		Prescription& currentPrescription() {
+			return currentDiagnose().prescriptions.back();
+		}
+
+		UpdateSubscriptions& out;
+		std::vector<Scope> stack;
+		/// The last key which was read. Reused to avoid allocating for each key.
+		std::string currentKey;
+		/// Builds the ResourceKind::Json resource which is being parsed into jsonValue
+		std::optional<nlohmann::detail::json_sax_dom_parser<nlohmann::json>> jsonBuilder;
+		nlohmann::json jsonValue;
+		std::string jsonUri;
+	};
+
+	bool parseUpdateSubscriptions(std::string_view payload, UpdateSubscriptions& out) {
+		// One scanner per decode thread, so that its index is allocated only once
+		thread_local JsonScanner scanner;
+		UpdateSubscriptionsSax sax(out);
+		return scanner.scan(payload) && scanner.walk(sax);
+	}
+
+	namespace {
+		/// Check the "type" field of an object like UpdateSubscriptionsSax: if it is a string,
+		/// it must be the expected type
+		bool hasType(const nlohmann::json& json, const char* type) {
+			const auto it = json.find("type");
+			return it == json.end() || !it->is_string() ||
+				it->get_ref<const std::string&>() == type;
+		}
+
+		/// The objects of an array field. Empty if the field is missing or is not an array.
+		std::vector<const nlohmann::json*> objectsOf(const nlohmann::json& json, const char* key) {
+			std::vector<const nlohmann::json*> objects;
+			const auto it = json.find(key);
+			if (it != json.end() && it->is_array()) {
+				for (const nlohmann::json& item : *it) {
+					if (item.is_object()) {
+						objects.push_back(&item);
+					}
+				}
+			}
+			return objects;
+		}
+
+		/// Check the types of the diagnoses of a patient resource and of their children
+		bool hasDiagnoseTypes(const nlohmann::json& resource) {
+			for (const nlohmann::json* diagnose : objectsOf(resource, "diagnoses")) {
+				if (!hasType(*diagnose, "Diagnosis")) {
+					return false;
+				}
+				for (const nlohmann::json* prescription : objectsOf(*diagnose, "prescriptions")) {
+					if (!hasType(*prescription, "Prescription")) {
+						return false;
+					}
+					for (const nlohmann::json* plan : objectsOf(*prescription, "plans")) {
+						if (!hasType(*plan, "Plan")) {
+							return false;
+						}
+					}
+				}
+			}
+			return true;
+		}
+	}  // namespace
+
+	bool parseUpdateSubscriptionsDom(std::string_view payload, UpdateSubscriptions& out) {
+		const nlohmann::json json = nlohmann::json::parse(payload, nullptr, false);
+		if (json.is_discarded() || !json.is_object()) {
+			return false;
+		}
+		const auto updateIt = json.find("updateSubscriptions");
+		if (updateIt == json.end() || !updateIt->is_object()) {
+			return false;
+		}
+
+		for (auto it = updateIt->begin(); it != updateIt->end(); ++it) {
+			const nlohmann::json& resource = it.value();
+			const ResourceKind* kind = out.routes->find(it.key());
+			if (!kind || *kind == ResourceKind::Skip) {
+				continue;
+			}
+			if (*kind == ResourceKind::Json) {
+				if (resource.is_object() || resource.is_array()) {
+					out.resources.emplace_back(it.key(), resource);
+				}
+				continue;
+			}
+			if (!resource.is_object()) {
+				continue;
+			}
+			if (*kind == ResourceKind::PatientList) {
+				if (!hasType(resource, "PatientList")) {
+					return false;
+				}
+				out.hasPatientList = true;
+				const std::vector<const nlohmann::json*> patients = objectsOf(resource, "value");
+				out.patients.reserve(out.patients.size() + patients.size());
+				for (const nlohmann::json* patient : patients) {
+					const auto uriIt = patient->find("uri");
+					out.patients.emplace_back(
+						uriIt != patient->end() && uriIt->is_string()
+							? uriIt->get<std::string>()
+							: std::string(),
+						Patient(*patient, PatientAllocator(out.resource))
+					);
+				}
+			} else {
+				if (!hasType(resource, "Patient") || !hasDiagnoseTypes(resource)) {
+					return false;
+				}
+				Patient::DiagnoseList diagnoses(out.resource);
+				for (const nlohmann::json* diagnose : objectsOf(resource, "diagnoses")) {
+					diagnoses.emplace_back(*diagnose);
+				}
+				out.diagnoses.emplace_back(it.key(), std::move(diagnoses));
+			}
+		}
+		return true;
+	}
+}  // namespace ViewRay
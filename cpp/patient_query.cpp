@@ -0,0 +1,321 @@
+#include "patient_query.h"
+#include <algorithm>
+#include <cassert>
+#include <numeric>
+
+namespace ViewRay {
+	template <typename Key>
+	void PatientIndex::SortedRows<Key>::assign(std::vector<std::pair<Key, uint32_t>>&& entries) {
+		std::sort(entries.begin(), entries.end());
+		keys.resize(entries.size());
+		rows.resize(entries.size());
+		for (size_t i = 0; i < entries.size(); ++i) {
+			keys[i] = entries[i].first;
+			rows[i] = entries[i].second;
+		}
+	}
+
+	template <typename Key>
+	RowRange PatientIndex::SortedRows<Key>::range(Key from, Key to) const {
+		if (!(from < to)) {
+			return RowRange();
+		}
+		const size_t first = size_t(std::lower_bound(keys.begin(), keys.end(), from) - keys.begin());
+		const size_t last = size_t(std::lower_bound(keys.begin(), keys.end(), to) - keys.begin());
+		return RowRange(rows.data() + first, rows.data() + last);
+	}
+
+	template <typename Key>
+	RowRange PatientIndex::SortedRows<Key>::equal(Key key) const {
+		const auto found = std::equal_range(keys.begin(), keys.end(), key);
+		const size_t first = size_t(found.first - keys.begin());
+		const size_t last = size_t(found.second - keys.begin());
+		return RowRange(rows.data() + first, rows.data() + last);
+	}
+
+	PatientIndex::PatientIndex(const PatientTable& table) :
+		table(table) {
+		const uint32_t count = uint32_t(table.size());
+		std::vector<std::pair<PatientTable::StringID, uint32_t>> mrns;
+		std::vector<std::pair<PatientTable::StringID, uint32_t>> labels;
+		std::vector<std::pair<uint8_t, uint32_t>> ready;
+		std::vector<std::pair<int32_t, uint32_t>> registration;
+		mrns.reserve(count);
+		ready.reserve(count);
+		registration.reserve(count);
+		const std::vector<uint8_t>& readyColumn = table.getReadyForTreatmentColumn();
+		const std::vector<int32_t>& registrationColumn = table.getRegistrationTimeColumn();
+		for (uint32_t row = 0; row < count; ++row) {
+			const PatientTable::PatientView patient = table[row];
+			mrns.emplace_back(patient.getMrnID(), row);
+			ready.emplace_back(readyColumn[row], row);
+			registration.emplace_back(registrationColumn[row], row);
+
+			// A patient is listed once for each distinct label
+			const size_t labelsStart = labels.size();
+			for (const PatientTable::DiagnoseView diagnose : patient.getDiagnoses()) {
+				labels.emplace_back(diagnose.getLabelID(), row);
+			}
+			std::sort(labels.begin() + labelsStart, labels.end());
+			labels.erase(std::unique(labels.begin() + labelsStart, labels.end()), labels.end());
+		}
+		byMrn.assign(std::move(mrns));
+		byDiagnoseLabel.assign(std::move(labels));
+		byReadyForTreatment.assign(std::move(ready));
+		byRegistrationTime.assign(std::move(registration));
+	}
+
+	RowRange PatientIndex::findByMrn(std::string_view mrn) const {
+		const PatientTable::StringID id = table.getStrings().find(mrn);
+		return id == StringArena::npos ? RowRange() : byMrn.equal(id);
+	}
+
+	RowRange PatientIndex::findByDiagnoseLabel(std::string_view label) const {
+		const PatientTable::StringID id = table.getStrings().find(label);
+		return id == StringArena::npos ? RowRange() : byDiagnoseLabel.equal(id);
+	}
+
+	RowRange PatientIndex::findByReadyForTreatment(bool ready) const {
+		return byReadyForTreatment.equal(ready ? 1 : 0);
+	}
+
+	RowRange PatientIndex::findByRegistrationTime(int from, int to) const {
+		return byRegistrationTime.range(from, to);
+	}
+
+	PatientQuery::PatientQuery(const PatientTable& table, const PatientIndex* index) :
+		table(table),
+		index(index) {
+		assert(index == nullptr || &index->getTable() == &table);
+	}
+
+	PatientQuery& PatientQuery::readyForTreatment(bool value) {
+		filterReady = true;
+		ready = value;
+		return *this;
+	}
+
+	PatientQuery& PatientQuery::sex(Patient::Sex value) {
+		filterSex = true;
+		sexValue = value;
+		return *this;
+	}
+
+	PatientQuery& PatientQuery::fractionsRemaining(int min, int max) {
+		filterFractions = true;
+		minFractionsRemaining = min;
+		maxFractionsRemaining = max;
+		return *this;
+	}
+
+	PatientQuery& PatientQuery::registeredBetween(int from, int to) {
+		filterRegistration = true;
+		registeredFrom = from;
+		registeredTo = to;
+		return *this;
+	}
+
+	PatientQuery& PatientQuery::hasDiagnose(std::string label) {
+		diagnoseLabels.push_back(std::move(label));
+		return *this;
+	}
+
+	PatientQuery& PatientQuery::mrn(std::string value) {
+		filterMrn = true;
+		mrnValue = std::move(value);
+		return *this;
+	}
+
+	PatientQuery& PatientQuery::where(Predicate predicate) {
+		predicates.push_back(std::move(predicate));
+		return *this;
+	}
+
+	PatientQuery& PatientQuery::orderBy(SortKey key, bool descendingOrder) {
+		sortKey = key;
+		descending = descendingOrder;
+		return *this;
+	}
+
+	PatientQuery& PatientQuery::limit(size_t count) {
+		maxResults = count;
+		return *this;
+	}
+
+	PatientQuery::ResolvedIDs PatientQuery::resolve() const {
+		ResolvedIDs ids;
+		const StringArena& strings = table.getStrings();
+		if (filterMrn) {
+			ids.mrn = strings.find(mrnValue);
+			ids.possible = ids.mrn != StringArena::npos;
+		}
+		for (const std::string& label : diagnoseLabels) {
+			const PatientTable::StringID id = strings.find(label);
+			ids.possible = ids.possible && id != StringArena::npos;
+			ids.diagnoseLabels.push_back(id);
+		}
+		return ids;
+	}
+
+	std::vector<uint32_t> PatientQuery::candidates() const {
+		std::vector<uint32_t> result;
+		if (index != nullptr) {
+			// Take the rows from the smallest index range. The other predicates are checked later.
+			bool found = false;
+			RowRange best;
+			const auto consider = [&](RowRange range) {
+				if (!found || range.size() < best.size()) {
+					best = range;
+					found = true;
+				}
+			};
+			if (filterMrn) {
+				consider(index->findByMrn(mrnValue));
+			}
+			for (const std::string& label : diagnoseLabels) {
+				consider(index->findByDiagnoseLabel(label));
+			}
+			if (filterRegistration) {
+				consider(index->findByRegistrationTime(registeredFrom, registeredTo));
+			}
+			if (filterReady) {
+				consider(index->findByReadyForTreatment(ready));
+			}
+			if (found) {
+				result.assign(best.begin(), best.end());
+				return result;
+			}
+		}
+
+		result.resize(table.size());
+		std::iota(result.begin(), result.end(), 0);
+		return result;
+	}
+
+	bool PatientQuery::matches(uint32_t row, const ResolvedIDs& ids) const {
+		if (filterReady && (table.getReadyForTreatmentColumn()[row] != 0) != ready) {
+			return false;
+		}
+		if (filterSex && Patient::Sex(table.getSexColumn()[row]) != sexValue) {
+			return false;
+		}
+		if (filterRegistration) {
+			const int time = table.getRegistrationTimeColumn()[row];
+			if (time < registeredFrom || time >= registeredTo) {
+				return false;
+			}
+		}
+		if (filterFractions) {
+			const int remaining =
+				table.getFractionsTotalColumn()[row] - table.getFractionsCompletedColumn()[row];
+			if (remaining < minFractionsRemaining || remaining > maxFractionsRemaining) {
+				return false;
+			}
+		}
+
+		const PatientTable::PatientView patient = table[row];
+		if (filterMrn && patient.getMrnID() != ids.mrn) {
+			return false;
+		}
+		if (!ids.diagnoseLabels.empty()) {
+			const PatientTable::Range<PatientTable::DiagnoseView> diagnoses = patient.getDiagnoses();
+			for (const PatientTable::StringID label : ids.diagnoseLabels) {
+				const bool hasLabel = std::any_of(
+					diagnoses.begin(),
+					diagnoses.end(),
+					[label](const PatientTable::DiagnoseView& d) { return d.getLabelID() == label; }
+				);
+				if (!hasLabel) {
+					return false;
+				}
+			}
+		}
+		for (const Predicate& predicate : predicates) {
+			if (!predicate(patient)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	std::vector<uint32_t> PatientQuery::filter() const {
+		const ResolvedIDs ids = resolve();
+		if (!ids.possible) {
+			return std::vector<uint32_t>();
+		}
+		std::vector<uint32_t> rows = candidates();
+		rows.erase(
+			std::remove_if(
+				rows.begin(), rows.end(), [&](uint32_t row) { return !matches(row, ids); }
+			),
+			rows.end()
+		);
+		return rows;
+	}
+
+	bool PatientQuery::before(uint32_t a, uint32_t b) const {
+		const auto compare = [&](const auto& x, const auto& y) {
+			if (x == y) {
+				return a < b;
+			}
+			return descending ? y < x : x < y;
+		};
+		switch (sortKey) {
+			case SortKey::RegistrationTime: {
+				const std::vector<int32_t>& column = table.getRegistrationTimeColumn();
+				return compare(column[a], column[b]);
+			}
+			case SortKey::FractionsRemaining: {
+				return compare(table[a].getFractionsRemaining(), table[b].getFractionsRemaining());
+			}
+			case SortKey::FractionsTotal: {
+				const std::vector<int32_t>& column = table.getFractionsTotalColumn();
+				return compare(column[a], column[b]);
+			}
+			case SortKey::FractionsCompleted: {
+				const std::vector<int32_t>& column = table.getFractionsCompletedColumn();
+				return compare(column[a], column[b]);
+			}
+			case SortKey::WeightKg: {
+				const std::vector<int32_t>& column = table.getWeightKgColumn();
+				return compare(column[a], column[b]);
+			}
+			case SortKey::LastName: {
+				return compare(table[a].getLastName(), table[b].getLastName());
+			}
+			case SortKey::Mrn: {
+				return compare(table[a].getMrn(), table[b].getMrn());
+			}
+			case SortKey::Row:
+			default: {
+				return descending ? b < a : a < b;
+			}
+		}
+	}
+
+	std::vector<uint32_t> PatientQuery::rows() const {
+		std::vector<uint32_t> rows = filter();
+		const auto less = [this](uint32_t a, uint32_t b) { return before(a, b); };
+		if (maxResults < rows.size()) {
+			std::partial_sort(rows.begin(), rows.begin() + maxResults, rows.end(), less);
+			rows.resize(maxResults);
+		} else if (!std::is_sorted(rows.begin(), rows.end(), less)) {
+			std::sort(rows.begin(), rows.end(), less);
+		}
+		return rows;
+	}
+
+	std::vector<PatientTable::PatientView> PatientQuery::views() const {
+		const std::vector<uint32_t> matching = rows();
+		std::vector<PatientTable::PatientView> result;
+		result.reserve(matching.size());
+		for (const uint32_t row : matching) {
+			result.push_back(table[row]);
+		}
+		return result;
+	}
+
+	size_t PatientQuery::count() const {
+		return filter().size();
+	}
+}  // namespace ViewRay
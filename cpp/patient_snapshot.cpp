@@ -0,0 +1,298 @@
+#include "patient_snapshot.h"
+#include "mapped_file.h"
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <type_traits>
+
+namespace ViewRay {
+	namespace {
+		constexpr char magic[8] = {'V', 'R', 'P', 'L', 'S', 'N', 'A', 'P'};
+		/// Reads differently if the file was written on a machine with other byte order
+		constexpr uint32_t byteOrderMark = 0x01020304;
+		constexpr size_t sectionAlignment = 8;
+
+		/// The header as it is stored in the file
+		struct FileHeader {
+			char magic[8];
+			uint32_t version;
+			uint32_t byteOrder;
+			int64_t createdAt;
+			uint32_t patients;
+			uint32_t diagnoses;
+			uint32_t prescriptions;
+			uint32_t plans;
+			uint32_t strings;
+			uint32_t reserved;
+			/// Number of characters in all strings
+			uint64_t stringBytes;
+			/// Size of the whole file, used to detect truncated files
+			uint64_t fileSize;
+		};
+		static_assert(sizeof(FileHeader) == 64, "The header must not have padding");
+
+		/// Writes sections aligned to sectionAlignment
+		class SectionWriter {
+		public:
+			explicit SectionWriter(std::ofstream& out) :
+				out(out),
+				position(0) {
+			}
+
+			void write(const void* data, size_t size) {
+				out.write(static_cast<const char*>(data), std::streamsize(size));
+				position += size;
+			}
+
+			/// Pad with zeros to the start of the next section
+			void align() {
+				static constexpr char zeros[sectionAlignment] = {};
+				const size_t padding =
+					(sectionAlignment - position % sectionAlignment) % sectionAlignment;
+				write(zeros, padding);
+			}
+
+			uint64_t getPosition() const {
+				return position;
+			}
+
+		private:
+			std::ofstream& out;
+			uint64_t position;
+		};
+
+		/// Reads sections aligned to sectionAlignment with bounds checks
+		class SectionReader {
+		public:
+			SectionReader(const char* data, size_t size, size_t position) :
+				data(data),
+				size(size),
+				position(position) {
+			}
+
+			/// @brief Get a pointer to the next section
+			/// @return nullptr if the file is too short
+			const char* take(uint64_t bytes) {
+				position = (position + sectionAlignment - 1) / sectionAlignment * sectionAlignment;
+				if (position > size || bytes > size - position) {
+					return nullptr;
+				}
+				const char* section = data + position;
+				position += size_t(bytes);
+				return section;
+			}
+
+		private:
+			const char* data;
+			size_t size;
+			size_t position;
+		};
+	}  // namespace
+
+	template <typename Table, typename F>
+	void PatientSnapshot::visitColumns(Table& table, const Info& counts, F&& f) {
+		const uint64_t patients = counts.patients;
+		const uint64_t diagnoses = counts.diagnoses;
+		const uint64_t prescriptions = counts.prescriptions;
+		const uint64_t plans = counts.plans;
+
+		f(table.uri, patients, ColumnKind::Strings, 0);
+		f(table.id, patients, ColumnKind::Strings, 0);
+		f(table.mrn, patients, ColumnKind::Strings, 0);
+		f(table.dateOfBirth, patients, ColumnKind::Strings, 0);
+		f(table.firstName, patients, ColumnKind::Strings, 0);
+		f(table.middleName, patients, ColumnKind::Strings, 0);
+		f(table.lastName, patients, ColumnKind::Strings, 0);
+		f(table.sex, patients, ColumnKind::Bounded, uint64_t(Patient::Sex::Unknown));
+		f(table.readyForTreatment, patients, ColumnKind::Bounded, 1);
+		f(table.fractionsTotal, patients, ColumnKind::Values, 0);
+		f(table.fractionsCompleted, patients, ColumnKind::Values, 0);
+		f(table.weightKg, patients, ColumnKind::Values, 0);
+		f(table.registrationTime, patients, ColumnKind::Values, 0);
+		f(table.diagnoseOffsets, patients + 1, ColumnKind::Offsets, diagnoses);
+
+		f(table.diagnoseDescription, diagnoses, ColumnKind::Strings, 0);
+		f(table.diagnoseLabel, diagnoses, ColumnKind::Strings, 0);
+		f(table.prescriptionOffsets, diagnoses + 1, ColumnKind::Offsets, prescriptions);
+
+		f(table.prescriptionDescription, prescriptions, ColumnKind::Strings, 0);
+		f(table.prescriptionLabel, prescriptions, ColumnKind::Strings, 0);
+		f(table.prescriptionNumFractions, prescriptions, ColumnKind::Values, 0);
+		f(table.planOffsets, prescriptions + 1, ColumnKind::Offsets, plans);
+
+		f(table.planLabel, plans, ColumnKind::Strings, 0);
+	}
+
+	EC::ErrorCode PatientSnapshot::save(const PatientTable& table, const std::string& path) {
+		const StringArena& strings = table.getStrings();
+		FileHeader header = {};
+		std::memcpy(header.magic, magic, sizeof(magic));
+		header.version = version;
+		header.byteOrder = byteOrderMark;
+		header.createdAt = int64_t(std::time(nullptr));
+		header.patients = uint32_t(table.size());
+		header.diagnoses = uint32_t(table.diagnoseLabel.size());
+		header.prescriptions = uint32_t(table.prescriptionLabel.size());
+		header.plans = uint32_t(table.planLabel.size());
+		header.strings = uint32_t(strings.size());
+
+		const std::string temporaryPath = path + ".tmp";
+		std::ofstream out(temporaryPath, std::ios::binary | std::ios::trunc);
+		if (!out) {
+			return EC::ErrorCode(CannotWrite, "Cannot create %s", temporaryPath.c_str());
+		}
+
+		SectionWriter writer(out);
+		// The header is written again at the end, when the sizes are known
+		writer.write(&header, sizeof(header));
+
+		// End offset of each string, the first string starts at 0
+		writer.align();
+		uint64_t end = 0;
+		writer.write(&end, sizeof(end));
+		for (StringArena::ID i = 0; i < strings.size(); ++i) {
+			end += strings.get(i).size();
+			writer.write(&end, sizeof(end));
+		}
+		writer.align();
+		for (StringArena::ID i = 0; i < strings.size(); ++i) {
+			const std::string_view str = strings.get(i);
+			writer.write(str.data(), str.size());
+		}
+		header.stringBytes = end;
+
+		Info counts;
+		counts.patients = header.patients;
+		counts.diagnoses = header.diagnoses;
+		counts.prescriptions = header.prescriptions;
+		counts.plans = header.plans;
+		visitColumns(table, counts, [&writer](const auto& column, uint64_t, ColumnKind, uint64_t) {
+			writer.align();
+			writer.write(column.data(), column.size() * sizeof(column[0]));
+		});
+
+		header.fileSize = writer.getPosition();
+		out.seekp(0);
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		out.close();
+		if (!out) {
+			std::remove(temporaryPath.c_str());
+			return EC::ErrorCode(CannotWrite, "Cannot write %s", temporaryPath.c_str());
+		}
+
+		std::error_code ec;
+		std::filesystem::rename(temporaryPath, path, ec);
+		if (ec) {
+			std::remove(temporaryPath.c_str());
+			return EC::ErrorCode(
+				CannotWrite, "Cannot replace %s: %s", path.c_str(), ec.message().c_str()
+			);
+		}
+		return EC::ErrorCode();
+	}
+
+	EC::ErrorCode PatientSnapshot::load(const std::string& path, PatientTable& table, Info* info) {
+		auto file = std::make_shared<MappedFile>();
+		EC::ErrorCode err = file->open(path);
+		if (err.hasError()) {
+			return err;
+		}
+
+		FileHeader header;
+		if (file->getSize() < sizeof(header)) {
+			return EC::ErrorCode(InvalidSnapshot, "%s is too short", path.c_str());
+		}
+		std::memcpy(&header, file->getData(), sizeof(header));
+		if (std::memcmp(header.magic, magic, sizeof(magic)) != 0) {
+			return EC::ErrorCode(InvalidSnapshot, "%s is not a patient snapshot", path.c_str());
+		}
+		if (header.version != version || header.byteOrder != byteOrderMark) {
+			return EC::ErrorCode(
+				InvalidSnapshot,
+				"%s has version %u, expected %u on this machine",
+				path.c_str(),
+				unsigned(header.version),
+				unsigned(version)
+			);
+		}
+		if (header.fileSize != file->getSize()) {
+			return EC::ErrorCode(InvalidSnapshot, "%s is truncated", path.c_str());
+		}
+
+		SectionReader reader(file->getData(), file->getSize(), sizeof(header));
+		const uint64_t stringCount = header.strings;
+		const char* offsetsSection = reader.take((stringCount + 1) * sizeof(uint64_t));
+		const char* characters = offsetsSection ? reader.take(header.stringBytes) : nullptr;
+		if (characters == nullptr) {
+			return EC::ErrorCode(InvalidSnapshot, "%s is truncated", path.c_str());
+		}
+
+		PatientTable loaded;
+		loaded.strings.reserve(stringCount);
+		uint64_t start = 0;
+		std::memcpy(&start, offsetsSection, sizeof(start));
+		bool valid = start == 0;
+		for (uint64_t i = 0; valid && i < stringCount; ++i) {
+			uint64_t end;
+			std::memcpy(&end, offsetsSection + (i + 1) * sizeof(uint64_t), sizeof(end));
+			if (end < start || end > header.stringBytes) {
+				valid = false;
+				break;
+			}
+			loaded.strings.addView(std::string_view(characters + start, size_t(end - start)));
+			start = end;
+		}
+
+		Info counts;
+		counts.createdAt = header.createdAt;
+		counts.patients = header.patients;
+		counts.diagnoses = header.diagnoses;
+		counts.prescriptions = header.prescriptions;
+		counts.plans = header.plans;
+		counts.strings = header.strings;
+		visitColumns(
+			loaded,
+			counts,
+			[&](auto& column, uint64_t size, ColumnKind kind, uint64_t limit) {
+				using T = typename std::decay_t<decltype(column)>::value_type;
+				const char* section = valid ? reader.take(size * sizeof(T)) : nullptr;
+				if (section == nullptr) {
+					valid = false;
+					return;
+				}
+				column.resize(size_t(size));
+				// An empty column may have no data to copy to
+				if (size > 0) {
+					std::memcpy(column.data(), section, size_t(size) * sizeof(T));
+				}
+				// Make sure that the views never read outside of the other columns
+				if (kind == ColumnKind::Strings) {
+					for (const T id : column) {
+						valid = valid && uint64_t(id) < stringCount;
+					}
+				} else if (kind == ColumnKind::Bounded) {
+					for (const T value : column) {
+						valid = valid && uint64_t(value) <= limit;
+					}
+				} else if (kind == ColumnKind::Offsets) {
+					valid = valid && column.front() == 0 && uint64_t(column.back()) == limit;
+					for (size_t i = 1; valid && i < column.size(); ++i) {
+						valid = column[i - 1] <= column[i];
+					}
+				}
+			}
+		);
+		if (!valid) {
+			return EC::ErrorCode(InvalidSnapshot, "%s is corrupted", path.c_str());
+		}
+
+		loaded.strings.keepAlive(std::move(file));
+		table = std::move(loaded);
+		if (info != nullptr) {
+			*info = counts;
+		}
+		return EC::ErrorCode();
+	}
+}  // namespace ViewRay
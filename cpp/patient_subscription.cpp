@@ -0,0 +1,125 @@
+#include "patient_subscription.h"
+#include <algorithm>
+#include <unordered_set>
+
+namespace ViewRay {
+	PatientListSubscription::PatientListSubscription() :
+		nextListenerID(0),
+		synced(false) {
+	}
+
+	int PatientListSubscription::addListener(Listener listener) {
+		std::lock_guard<std::mutex> lock(mutex);
+		const int id = nextListenerID++;
+		listeners.emplace_back(id, std::move(listener));
+		return id;
+	}
+
+	void PatientListSubscription::removeListener(int id) {
+		std::lock_guard<std::mutex> lock(mutex);
+		listeners.erase(
+			std::remove_if(
+				listeners.begin(),
+				listeners.end(),
+				[id](const std::pair<int, Listener>& listener) { return listener.first == id; }
+			),
+			listeners.end()
+		);
+	}
+
+	bool PatientListSubscription::isSynced() const {
+		std::lock_guard<std::mutex> lock(mutex);
+		return synced;
+	}
+
+	void PatientListSubscription::applyPatientList(
+		std::vector<std::pair<std::string, Patient>>&& update
+	) {
+		std::lock_guard<std::mutex> updateLock(updateMutex);
+		std::unique_lock<std::mutex> lock(mutex);
+		synced = true;
+
+		std::vector<Change> changes;
+		std::unordered_set<std::string> present;
+		present.reserve(update.size());
+		for (auto& entry : update) {
+			if (!present.insert(entry.first).second) {
+				continue;
+			}
+			auto patientIt = patients.find(entry.first);
+			if (patientIt == patients.end()) {
+				patientIt = patients.emplace(std::move(entry.first), std::move(entry.second)).first;
+				changes.push_back({ChangeType::Added, &patientIt->first, &patientIt->second});
+			} else if (!patientIt->second.hasSameSummary(entry.second)) {
+				patientIt->second.assignSummary(std::move(entry.second));
+				changes.push_back({ChangeType::Updated, &patientIt->first, &patientIt->second});
+			}
+		}
+
+		// Removed patients are kept alive until the listeners are notified
+		std::vector<std::pair<std::string, Patient>> removed;
+		for (auto patientIt = patients.begin(); patientIt != patients.end();) {
+			if (present.count(patientIt->first) == 0) {
+				removed.emplace_back(patientIt->first, std::move(patientIt->second));
+				patientIt = patients.erase(patientIt);
+			} else {
+				++patientIt;
+			}
+		}
+		for (const auto& patient : removed) {
+			changes.push_back({ChangeType::Removed, &patient.first, &patient.second});
+		}
+
+		if (!changes.empty()) {
+			notify(lock, changes);
+		}
+	}
+
+	void PatientListSubscription::applyDiagnoses(
+		const std::string& uri,
+		Patient::DiagnoseList&& diagnoses
+	) {
+		std::lock_guard<std::mutex> updateLock(updateMutex);
+		std::unique_lock<std::mutex> lock(mutex);
+		auto patientIt = patients.find(uri);
+		if (patientIt == patients.end() || patientIt->second.hasSameDiagnoses(diagnoses)) {
+			return;
+		}
+		patientIt->second.setDiagnoses(std::move(diagnoses));
+		notify(lock, {{ChangeType::Updated, &patientIt->first, &patientIt->second}});
+	}
+
+	void SubscribedUris::apply(
+		const std::vector<std::pair<std::string, Patient>>& update,
+		std::vector<std::string>& added,
+		std::vector<std::string>& removed
+	) {
+		std::unordered_set<std::string_view> present;
+		present.reserve(update.size());
+		for (const auto& patient : update) {
+			present.insert(patient.first);
+			if (uris.insert(patient.first).second) {
+				added.push_back(patient.first);
+			}
+		}
+		for (auto uriIt = uris.begin(); uriIt != uris.end();) {
+			if (present.count(*uriIt) == 0) {
+				removed.push_back(std::move(uris.extract(uriIt++).value()));
+			} else {
+				++uriIt;
+			}
+		}
+	}
+
+	void PatientListSubscription::notify(
+		std::unique_lock<std::mutex>& lock,
+		const std::vector<Change>& changes
+	) {
+		// Copied, so that the listeners can add and remove listeners
+		const std::vector<std::pair<int, Listener>> current = listeners;
+		lock.unlock();
+		for (const auto& listener : current) {
+			listener.second(changes);
+		}
+	}
+}  // namespace ViewRay
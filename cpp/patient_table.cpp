@@ -0,0 +1,193 @@
+#include "patient_table.h"
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+namespace ViewRay {
+	StringArena::ID StringArena::intern(std::string_view str) {
+		const auto it = index.find(str);
+		if (it != index.end()) {
+			return it->second;
+		}
+
+		if (chunks.empty() || lastChunkSize - chunkUsed < str.size()) {
+			lastChunkSize = std::max(chunkSize, str.size());
+			chunks.emplace_back(new char[lastChunkSize]);
+			totalBytes += lastChunkSize;
+			chunkUsed = 0;
+		}
+		char* dst = chunks.back().get() + chunkUsed;
+		if (!str.empty()) {
+			std::memcpy(dst, str.data(), str.size());
+		}
+		chunkUsed += str.size();
+
+		const ID id = ID(strings.size());
+		const std::string_view stored(dst, str.size());
+		strings.push_back(stored);
+		index.emplace(stored, id);
+		return id;
+	}
+
+	StringArena::ID StringArena::addView(std::string_view str) {
+		const ID id = ID(strings.size());
+		strings.push_back(str);
+		index.emplace(str, id);
+		return id;
+	}
+
+	void StringArena::keepAlive(std::shared_ptr<const void> owner) {
+		owners.push_back(std::move(owner));
+	}
+
+	void StringArena::reserve(size_t count) {
+		strings.reserve(count);
+		index.reserve(count);
+	}
+
+	size_t StringArena::capacityBytes() const {
+		return totalBytes;
+	}
+
+	PatientTable::PatientTable() :
+		diagnoseOffsets{0},
+		prescriptionOffsets{0},
+		planOffsets{0} {
+	}
+
+	PatientTable::PatientTable(PatientTable&& other) :
+		PatientTable() {
+		// A defaulted move would leave the offsets of the other table without the 0 which
+		// ends the children of its last row, swapping leaves it an empty table instead
+		swap(other);
+	}
+
+	PatientTable& PatientTable::operator=(PatientTable&& other) {
+		if (this != &other) {
+			PatientTable moved(std::move(other));
+			swap(moved);
+		}
+		return *this;
+	}
+
+	void PatientTable::swap(PatientTable& other) noexcept {
+		using std::swap;
+		swap(strings, other.strings);
+		swap(uri, other.uri);
+		swap(id, other.id);
+		swap(mrn, other.mrn);
+		swap(dateOfBirth, other.dateOfBirth);
+		swap(firstName, other.firstName);
+		swap(middleName, other.middleName);
+		swap(lastName, other.lastName);
+		swap(sex, other.sex);
+		swap(readyForTreatment, other.readyForTreatment);
+		swap(fractionsTotal, other.fractionsTotal);
+		swap(fractionsCompleted, other.fractionsCompleted);
+		swap(weightKg, other.weightKg);
+		swap(registrationTime, other.registrationTime);
+		swap(diagnoseOffsets, other.diagnoseOffsets);
+		swap(diagnoseDescription, other.diagnoseDescription);
+		swap(diagnoseLabel, other.diagnoseLabel);
+		swap(prescriptionOffsets, other.prescriptionOffsets);
+		swap(prescriptionDescription, other.prescriptionDescription);
+		swap(prescriptionLabel, other.prescriptionLabel);
+		swap(prescriptionNumFractions, other.prescriptionNumFractions);
+		swap(planOffsets, other.planOffsets);
+		swap(planLabel, other.planLabel);
+	}
+
+	void PatientTable::reserve(size_t count) {
+		uri.reserve(count);
+		id.reserve(count);
+		mrn.reserve(count);
+		dateOfBirth.reserve(count);
+		firstName.reserve(count);
+		middleName.reserve(count);
+		lastName.reserve(count);
+		sex.reserve(count);
+		readyForTreatment.reserve(count);
+		fractionsTotal.reserve(count);
+		fractionsCompleted.reserve(count);
+		weightKg.reserve(count);
+		registrationTime.reserve(count);
+		diagnoseOffsets.reserve(count + 1);
+	}
+
+	uint32_t PatientTable::add(std::string_view patientUri, const Patient& patient) {
+		const uint32_t row = uint32_t(size());
+		uri.push_back(strings.intern(patientUri));
+		id.push_back(strings.intern(patient.getId()));
+		mrn.push_back(strings.intern(patient.getMrn()));
+		dateOfBirth.push_back(strings.intern(patient.getDateOfBirth()));
+		firstName.push_back(strings.intern(patient.getFirstName()));
+		middleName.push_back(strings.intern(patient.getMiddleName()));
+		lastName.push_back(strings.intern(patient.getLastName()));
+		sex.push_back(uint8_t(patient.getSex()));
+		readyForTreatment.push_back(patient.isReadyForTreatment() ? 1 : 0);
+		fractionsTotal.push_back(patient.getFractionsTotal());
+		fractionsCompleted.push_back(patient.getFractionsCompleted());
+		weightKg.push_back(patient.getWeightKg());
+		registrationTime.push_back(patient.getRegistrationTime());
+
+		for (const Diagnose& diagnose : patient.getDiagnoses()) {
+			diagnoseDescription.push_back(strings.intern(diagnose.getDescription()));
+			diagnoseLabel.push_back(strings.intern(diagnose.getLabel()));
+			for (const Prescription& prescription : diagnose.getPrescriptions()) {
+				prescriptionDescription.push_back(strings.intern(prescription.getDescription()));
+				prescriptionLabel.push_back(strings.intern(prescription.getLabel()));
+				prescriptionNumFractions.push_back(prescription.getNumFractions());
+				for (const Plan& plan : prescription.getPlans()) {
+					planLabel.push_back(strings.intern(plan.getLabel()));
+				}
+				planOffsets.push_back(uint32_t(planLabel.size()));
+			}
+			prescriptionOffsets.push_back(uint32_t(prescriptionLabel.size()));
+		}
+		diagnoseOffsets.push_back(uint32_t(diagnoseLabel.size()));
+		return row;
+	}
+
+	Patient PatientTable::toPatient(size_t row, const Patient::allocator_type& alloc) const {
+		const PatientView view = (*this)[row];
+		Patient patient(alloc);
+		patient.setId(view.getId());
+		patient.setMrn(view.getMrn());
+		patient.setDateOfBirth(view.getDateOfBirth());
+		patient.setFirstName(view.getFirstName());
+		patient.setMiddleName(view.getMiddleName());
+		patient.setLastName(view.getLastName());
+		patient.setSex(view.getSex());
+		patient.setFractionsTotal(view.getFractionsTotal());
+		patient.setFractionsCompleted(view.getFractionsCompleted());
+		patient.setWeightKg(view.getWeightKg());
+		patient.setRegistrationTime(view.getRegistrationTime());
+		patient.setReadyForTreatment(view.isReadyForTreatment());
+
+		const Range<DiagnoseView> diagnoseViews = view.getDiagnoses();
+		Patient::DiagnoseList diagnoses(alloc);
+		diagnoses.reserve(diagnoseViews.size());
+		for (const DiagnoseView diagnoseView : diagnoseViews) {
+			Diagnose& diagnose = diagnoses.emplace_back();
+			diagnose.setDescription(diagnoseView.getDescription());
+			diagnose.setLabel(diagnoseView.getLabel());
+
+			const Range<PrescriptionView> prescriptions = diagnoseView.getPrescriptions();
+			diagnose.reservePrescriptions(prescriptions.size());
+			for (const PrescriptionView prescriptionView : prescriptions) {
+				Prescription& prescription = diagnose.addPrescription();
+				prescription.setDescription(prescriptionView.getDescription());
+				prescription.setLabel(prescriptionView.getLabel());
+				prescription.setNumFractions(prescriptionView.getNumFractions());
+
+				const Range<PlanView> plans = prescriptionView.getPlans();
+				prescription.reservePlans(plans.size());
+				for (const PlanView planView : plans) {
+					prescription.addPlan(planView.getLabel());
+				}
+			}
+		}
+		patient.setDiagnoses(std::move(diagnoses));
+		return patient;
+	}
+}  // namespace ViewRay
@@ -0,0 +1,81 @@
+#include "request_encoder.h"
+
+namespace ViewRay {
+	namespace {
+		constexpr std::string_view requestPrefix = "{\"setSubscriptions\":{\"";
+		constexpr std::string_view requestSeparator = "\":\"";
+		constexpr std::string_view requestSuffix = "\"}}";
+
+		/// Escape sequence for c if it cannot appear as is in a JSON string, nullptr otherwise.
+		/// Control characters without a short escape use \u00XX which is written separately.
+		const char* shortEscape(char c) {
+			switch (c) {
+				case '"': return "\\\"";
+				case '\\': return "\\\\";
+				case '\b': return "\\b";
+				case '\f': return "\\f";
+				case '\n': return "\\n";
+				case '\r': return "\\r";
+				case '\t': return "\\t";
+				default: return nullptr;
+			}
+		}
+
+		bool needsEscape(char c) {
+			return c == '"' || c == '\\' || static_cast<unsigned char>(c) < 0x20;
+		}
+
+		size_t escapedSize(std::string_view str) {
+			size_t size = str.size();
+			for (const char c : str) {
+				if (needsEscape(c)) {
+					// Short escapes are 2 characters, \u00XX is 6
+					size += shortEscape(c) != nullptr ? 1 : 5;
+				}
+			}
+			return size;
+		}
+
+		void appendEscaped(std::string_view str, std::string& out) {
+			size_t start = 0;
+			for (size_t i = 0; i < str.size(); ++i) {
+				const char c = str[i];
+				if (!needsEscape(c)) {
+					continue;
+				}
+				out.append(str.data() + start, i - start);
+				if (const char* escape = shortEscape(c)) {
+					out.append(escape);
+				} else {
+					static constexpr char hex[] = "0123456789abcdef";
+					const unsigned char code = static_cast<unsigned char>(c);
+					out.append("\\u00");
+					out.push_back(hex[code >> 4]);
+					out.push_back(hex[code & 0xF]);
+				}
+				start = i + 1;
+			}
+			out.append(str.data() + start, str.size() - start);
+		}
+	}  // namespace
+
+	size_t RequestEncoder::encodedSize(std::string_view uri, std::string_view mode) {
+		return requestPrefix.size() + escapedSize(uri) + requestSeparator.size() +
+			   escapedSize(mode) + requestSuffix.size();
+	}
+
+	void RequestEncoder::encode(std::string_view uri, std::string_view mode, std::string& out) {
+		out.append(requestPrefix);
+		appendEscaped(uri, out);
+		out.append(requestSeparator);
+		appendEscaped(mode, out);
+		out.append(requestSuffix);
+	}
+
+	std::string RequestEncoder::encode(std::string_view uri, std::string_view mode) {
+		std::string out;
+		out.reserve(encodedSize(uri, mode));
+		encode(uri, mode, out);
+		return out;
+	}
+}  // namespace ViewRay
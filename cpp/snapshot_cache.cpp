@@ -0,0 +1,52 @@
+#include "snapshot_cache.h"
+
+namespace ViewRay {
+	SnapshotCache::SnapshotCache(ViewRayClient& client, std::string path) :
+		client(client),
+		path(std::move(path)) {
+	}
+
+	SnapshotCache::~SnapshotCache() {
+		if (revalidation.valid()) {
+			revalidation.wait();
+		}
+	}
+
+	WSAsyncResult<SnapshotCache::TablePtr> SnapshotCache::load() {
+		auto table = std::make_shared<PatientTable>();
+		const EC::ErrorCode err = PatientSnapshot::load(path, *table, &info);
+		if (err.hasError()) {
+			return WSAsyncResult<TablePtr>(err);
+		}
+		TablePtr loaded = std::move(table);
+		std::atomic_store(&current, loaded);
+		return WSAsyncResult<TablePtr>(std::move(loaded));
+	}
+
+	std::shared_future<WSAsyncResult<SnapshotCache::TablePtr>> SnapshotCache::revalidate() {
+		const bool pending = revalidation.valid() &&
+			revalidation.wait_for(std::chrono::seconds(0)) != std::future_status::ready;
+		if (pending) {
+			return revalidation;
+		}
+		revalidation = std::async(std::launch::async, [this]() {
+			const WSAsyncResult<ViewRayClient::SharedPatientListPtr> fetched =
+				client.getPatientList().get();
+			if (fetched.hasError()) {
+				return WSAsyncResult<TablePtr>(fetched.getError());
+			}
+			TablePtr table = std::make_shared<const PatientTable>(*fetched.getData());
+			std::atomic_store(&current, table);
+			const EC::ErrorCode err = PatientSnapshot::save(*table, path);
+			if (err.hasError()) {
+				return WSAsyncResult<TablePtr>(err);
+			}
+			return WSAsyncResult<TablePtr>(std::move(table));
+		}).share();
+		return revalidation;
+	}
+
+	SnapshotCache::TablePtr SnapshotCache::getCurrent() const {
+		return std::atomic_load(&current);
+	}
+}  // namespace ViewRay
@@ -0,0 +1,58 @@
+#include "symbol_table.h"
+#include <mutex>
+#include <stdexcept>
+
+namespace ViewRay {
+	SymbolTable::SymbolTable() :
+		segments(new std::atomic<std::string_view*>[maxSegments]()),
+		ownedSegments(new std::unique_ptr<std::string_view[]>[maxSegments]) {
+		intern(std::string_view());
+	}
+
+	SymbolTable& SymbolTable::global() {
+		// Never destroyed, so that compact patients in other static objects can be read until
+		// the end of the program
+		static SymbolTable* table = new SymbolTable();
+		return *table;
+	}
+
+	SymbolTable::Symbol SymbolTable::intern(std::string_view str) {
+		{
+			// Most strings are already stored, those are found without blocking the readers
+			std::shared_lock<std::shared_mutex> lock(mutex);
+			const StringArena::ID id = arena.find(str);
+			if (id != StringArena::npos) {
+				return id;
+			}
+		}
+		std::unique_lock<std::shared_mutex> lock(mutex);
+		const size_t count = arena.size();
+		const Symbol symbol = arena.intern(str);
+		if (symbol < count) {
+			// Interned by another thread after the shared lock was released
+			return symbol;
+		}
+		if ((symbol >> segmentBits) >= maxSegments) {
+			throw std::length_error("SymbolTable is full");
+		}
+		std::unique_ptr<std::string_view[]>& segment = ownedSegments[symbol >> segmentBits];
+		if (!segment) {
+			segment.reset(new std::string_view[segmentSize]);
+			segments[symbol >> segmentBits].store(segment.get(), std::memory_order_release);
+		}
+		// The symbol reaches the readers through their own synchronization, which orders this
+		// store before their reads
+		segment[symbol & (segmentSize - 1)] = arena.get(symbol);
+		return symbol;
+	}
+
+	size_t SymbolTable::size() const {
+		std::shared_lock<std::shared_mutex> lock(mutex);
+		return arena.size();
+	}
+
+	size_t SymbolTable::capacityBytes() const {
+		std::shared_lock<std::shared_mutex> lock(mutex);
+		return arena.capacityBytes();
+	}
+}  // namespace ViewRay
@@ -1,23 +1,92 @@
 #include "websocket.h"
+#include <algorithm>
 
 namespace ViewRay {
 	WSConnectionManager::WSConnectionManager() :
-		nextMetadataID(0) {
+		handshakeSeconds(metricsRegistry.histogram(
+			"viewray_ws_handshake_seconds",
+			"Time from starting a connection until the websocket handshake completes",
+			Histogram::latencyBounds()
+		)),
+		connectionsOpened(metricsRegistry.counter(
+			"viewray_ws_connections_opened_total", "Connections which were opened"
+		)),
+		connectionsDeflate(metricsRegistry.counter(
+			"viewray_ws_connections_deflate_total",
+			"Opened connections on which the server accepted permessage-deflate"
+		)),
+		connectionsFailed(metricsRegistry.counter(
+			"viewray_ws_connections_failed_total", "Connections which failed to open"
+		)),
+		connectionsClosed(metricsRegistry.counter(
+			"viewray_ws_connections_closed_total", "Opened connections which were closed"
+		)),
+		connectionsOpen(metricsRegistry.gauge(
+			"viewray_ws_connections_open", "Connections which are currently open"
+		)),
+		nextTimerID(0),
+		nextMetadataID(0),
+		poolSize(1),
+		initialBackoffMs(100),
+		maxBackoffMs(30000),
+		stopping(false) {
 	}
 
-	void WSConnectionManager::init() {
+	void WSConnectionManager::init(int ioThreads, int decodeThreads) {
 		endpoint.clear_access_channels(websocketpp::log::alevel::all);
 		endpoint.clear_error_channels(websocketpp::log::elevel::all);
 
 		endpoint.init_asio();
 		endpoint.start_perpetual();
 
-		thread.reset(new websocketpp::lib::thread(&Client::run, &endpoint));
+		if (decodeThreads > 0) {
+			decodePool.reset(new asio::thread_pool(decodeThreads));
+		}
+
+		for (int i = 0; i < std::max(ioThreads, 1); ++i) {
+			threads.emplace_back(new websocketpp::lib::thread(&Client::run, &endpoint));
+		}
+	}
+
+	int WSConnectionManager::defaultDecodeThreads() {
+		return std::max(int(std::thread::hardware_concurrency()), 1);
 	}
 
 	WSConnectionManager ::~WSConnectionManager() {
+		std::vector<Client::timer_ptr> timers;
+		std::vector<AcquireCallback> waiters;
+		{
+			std::lock_guard<std::mutex> lock(poolMutex);
+			stopping = true;
+			for (const auto& timer : scheduledTimers) {
+				timers.push_back(timer.second);
+			}
+			for (auto& pool : pools) {
+				for (PooledConnection& conn : pool.second.connections) {
+					if (conn.reconnectTimer) {
+						timers.push_back(conn.reconnectTimer);
+					}
+					waiters.insert(waiters.end(), conn.waiters.begin(), conn.waiters.end());
+					conn.waiters.clear();
+				}
+			}
+		}
+		const WSAsyncResult<int> stopped(
+			EC::ErrorCode(CannotConnect, "The connection manager is being destroyed")
+		);
+		for (const AcquireCallback& waiter : waiters) {
+			waiter(stopped);
+		}
+		// Pending reconnect timers would keep the websocket threads running. Timers are not
+		// thread safe, so they are cancelled by a handler of the websocket client.
+		asio::post(endpoint.get_io_service(), [timers]() {
+			for (const Client::timer_ptr& timer : timers) {
+				timer->cancel();
+			}
+		});
+
 		websocketpp::lib::error_code ec;
-		for (auto it : metadata) {
+		for (const auto& it : *metadata.snapshot()) {
 			if (it.second->getStatus() == Metadata::Status::Opened) {
 				endpoint.close(
 					it.second->getHandle(), websocketpp::close::status::going_away, "", ec
@@ -25,8 +94,15 @@ namespace ViewRay {
 			}
 		}
 		endpoint.stop_perpetual();
-		if (thread->joinable()) {
-			thread->join();
+		for (auto& thread : threads) {
+			if (thread->joinable()) {
+				thread->join();
+			}
+		}
+		// Messages handed to the decode threads use the endpoint, finish them before it is
+		// destroyed.
+		if (decodePool) {
+			decodePool->join();
 		}
 	}
 
@@ -35,13 +111,13 @@ namespace ViewRay {
 		websocketpp::close::status::value code,
 		const std::string& reason
 	) {
-		auto metadataIt = metadata.find(id);
-		if (metadataIt == metadata.end()) {
+		const Metadata::Ptr connection = metadata.find(id);
+		if (!connection) {
 			return EC::ErrorCode(ConnectionNotFound, "No connection found with id: %d", id);
 		}
 
 		websocketpp::lib::error_code ec;
-		endpoint.close(metadataIt->second->getHandle(), code, reason, ec);
+		endpoint.close(connection->getHandle(), code, reason, ec);
 		if (ec) {
 			return EC::ErrorCode(CannotCloseConnection, "Error initiating close: %s", ec.message());
 		}
@@ -66,19 +142,18 @@ namespace ViewRay {
 	EC::ErrorCode WSConnectionManager::send(int id, const std::string& message) {
 		websocketpp::lib::error_code ec;
 
-		auto metadataIt = metadata.find(id);
-		if (metadataIt == metadata.end()) {
+		const Metadata::Ptr connection = metadata.find(id);
+		if (!connection) {
 			return EC::ErrorCode(ConnectionNotFound, "No connection found with id: %d", id);
 		}
 
-		endpoint.send(
-			metadataIt->second->getHandle(), message, websocketpp::frame::opcode::text, ec
-		);
+		endpoint.send(connection->getHandle(), message, websocketpp::frame::opcode::text, ec);
 		if (ec) {
 			return EC::ErrorCode(
 				CannotSendMessage, "Error sending message: %s", ec.message().c_str()
 			);
 		}
+		connection->recordSent(message);
 
 		return EC::ErrorCode();
 	}
@@ -98,7 +173,254 @@ namespace ViewRay {
 		return EC::ErrorCode();
 	}
 
+	WSConnectionManager::Client::message_ptr WSConnectionManager::createMessage(
+		websocketpp::connection_hdl handle,
+		size_t size
+	) {
+		websocketpp::lib::error_code ec;
+		Client::connection_ptr connection = endpoint.get_con_from_hdl(handle, ec);
+		if (ec) {
+			return nullptr;
+		}
+		return connection->get_message(websocketpp::frame::opcode::text, size);
+	}
+
+	EC::ErrorCode WSConnectionManager::send(
+		websocketpp::connection_hdl handle,
+		Client::message_ptr message
+	) {
+		websocketpp::lib::error_code ec;
+		endpoint.send(handle, message, ec);
+		if (ec) {
+			return EC::ErrorCode(
+				CannotSendMessage, "Error sending message: %s", ec.message().c_str()
+			);
+		}
+
+		return EC::ErrorCode();
+	}
+
+	MetricsRegistry& WSConnectionManager::getMetrics() {
+		return metricsRegistry;
+	}
+
 	WSConnectionManager::Metadata::Ptr WSConnectionManager::getMetadata(int id) {
-		return metadata[id];
+		return metadata.find(id);
+	}
+
+	void WSConnectionManager::schedule(int delayMs, std::function<void()> function) {
+		std::lock_guard<std::mutex> lock(poolMutex);
+		if (stopping) {
+			return;
+		}
+		// Timers are not thread safe, so a timer is forgotten by its own handler, which runs
+		// after the lock is released even if the delay is 0
+		const uint64_t id = nextTimerID++;
+		scheduledTimers.emplace(
+			id,
+			endpoint.set_timer(
+				delayMs,
+				[this, id, function = std::move(function)](const websocketpp::lib::error_code& ec) {
+					{
+						std::lock_guard<std::mutex> lock(poolMutex);
+						scheduledTimers.erase(id);
+					}
+					if (!ec) {
+						function();
+					}
+				}
+			)
+		);
+	}
+
+	void WSConnectionManager::post(std::function<void()> function) {
+		asio::post(endpoint.get_io_service(), std::move(function));
+	}
+
+	int WSConnectionManager::getBackoffDelay(int failedAttempts) const {
+		const int shift = std::min(failedAttempts, 16);
+		return std::min(initialBackoffMs << shift, maxBackoffMs);
+	}
+
+	void WSConnectionManager::setPoolSize(int size) {
+		std::lock_guard<std::mutex> lock(poolMutex);
+		poolSize = std::max(size, 1);
+	}
+
+	void WSConnectionManager::startPooledConnect(
+		const std::string& uri,
+		ConnectionPool& pool,
+		int index
+	) {
+		PooledConnection& conn = pool.connections[index];
+		conn.state = PooledState::Connecting;
+		conn.reconnectTimer.reset();
+		conn.ready = pool.connect(uri, [this, uri, index](int id, Metadata::Status status) {
+			onPooledStatus(uri, index, id, status);
+		}).share();
+
+		// The status callback is called before the connection future is set and it waits for
+		// poolMutex, which is held by the caller. Thus if the future is already set the
+		// connection failed before it was started and there will be no status callback.
+		const bool failedEarly =
+			conn.ready.wait_for(std::chrono::seconds(0)) == std::future_status::ready &&
+			conn.ready.get().hasError();
+		if (failedEarly) {
+			scheduleReconnect(uri, pool, index);
+		}
+	}
+
+	int WSConnectionManager::findPooledConnection(ConnectionPool& pool) {
+		const size_t count = pool.connections.size();
+		int connecting = -1;
+		for (size_t i = 0; i < count; ++i) {
+			const size_t index = (pool.next + i) % count;
+			const PooledConnection& conn = pool.connections[index];
+			if (conn.state == PooledState::Opened) {
+				pool.next = (index + 1) % count;
+				return int(index);
+			}
+			if (conn.state == PooledState::Connecting && connecting == -1) {
+				connecting = int(index);
+			}
+		}
+		return connecting;
+	}
+
+	std::shared_future<WSAsyncResult<int>> WSConnectionManager::pickPooledConnection(
+		const std::string& uri,
+		ConnectionPool& pool
+	) {
+		const int index = findPooledConnection(pool);
+		if (index != -1) {
+			return pool.connections[index].ready;
+		}
+
+		std::promise<WSAsyncResult<int>> promise;
+		promise.set_value(WSAsyncResult<int>(EC::ErrorCode(
+			CannotConnect, "All connections to %s are lost. Reconnecting.", uri.c_str()
+		)));
+		return promise.get_future().share();
+	}
+
+	bool WSConnectionManager::pickPooledConnection(
+		const std::string& uri,
+		ConnectionPool& pool,
+		const AcquireCallback& callback,
+		WSAsyncResult<int>& result
+	) {
+		const int index = findPooledConnection(pool);
+		if (index == -1) {
+			result = WSAsyncResult<int>(EC::ErrorCode(
+				CannotConnect, "All connections to %s are lost. Reconnecting.", uri.c_str()
+			));
+			return true;
+		}
+		PooledConnection& conn = pool.connections[index];
+		// The status callback marks the connection opened before its future is set, so the
+		// ID is taken from the slot instead of the future
+		if (conn.state == PooledState::Opened) {
+			result = WSAsyncResult<int>(conn.id);
+			return true;
+		}
+		conn.waiters.push_back(callback);
+		return false;
+	}
+
+	void WSConnectionManager::scheduleReconnect(
+		const std::string& uri,
+		ConnectionPool& pool,
+		int index
+	) {
+		PooledConnection& conn = pool.connections[index];
+		conn.state = PooledState::Backoff;
+		const int delayMs = getBackoffDelay(conn.failedAttempts);
+		conn.failedAttempts++;
+		conn.reconnectTimer = endpoint.set_timer(
+			delayMs,
+			[this, uri, index](const websocketpp::lib::error_code& ec) {
+				if (ec) {
+					return;
+				}
+				std::lock_guard<std::mutex> lock(poolMutex);
+				auto poolIt = pools.find(uri);
+				if (!stopping && poolIt != pools.end()) {
+					startPooledConnect(poolIt->first, poolIt->second, index);
+				}
+			}
+		);
+	}
+
+	void WSConnectionManager::onPooledStatus(
+		const std::string& uri,
+		int index,
+		int id,
+		Metadata::Status status
+	) {
+		std::vector<AcquireCallback> waiters;
+		WSAsyncResult<int> result;
+		{
+			std::lock_guard<std::mutex> lock(poolMutex);
+			auto poolIt = pools.find(uri);
+			if (stopping || poolIt == pools.end()) {
+				return;
+			}
+
+			ConnectionPool& pool = poolIt->second;
+			PooledConnection& conn = pool.connections[index];
+			switch (status) {
+				case Metadata::Status::Opened: {
+					conn.state = PooledState::Opened;
+					conn.failedAttempts = 0;
+					conn.id = id;
+					waiters.swap(conn.waiters);
+					result = WSAsyncResult<int>(id);
+				} break;
+				case Metadata::Status::Failed:
+				case Metadata::Status::Closed: {
+					waiters.swap(conn.waiters);
+					scheduleReconnect(poolIt->first, pool, index);
+					// The waiters of a failed connection move to another one if possible
+					if (!waiters.empty() &&
+						!pickPooledConnection(poolIt->first, pool, waiters.front(), result)) {
+						PooledConnection& next = pool.connections[findPooledConnection(pool)];
+						next.waiters.insert(next.waiters.end(), waiters.begin() + 1, waiters.end());
+						waiters.clear();
+					}
+				} break;
+				default: break;
+			}
+		}
+		for (const AcquireCallback& waiter : waiters) {
+			waiter(result);
+		}
+	}
+
+	void WSConnectionManager::recordStatus(
+		int id,
+		Metadata::Status status,
+		std::chrono::steady_clock::time_point started
+	) {
+		switch (status) {
+			case Metadata::Status::Opened: {
+				handshakeSeconds->observeSince(started);
+				connectionsOpened->add();
+				connectionsOpen->add(1);
+				const Metadata::Ptr opened = metadata.find(id);
+				if (opened && opened->isDeflateNegotiated()) {
+					connectionsDeflate->add();
+				}
+			} break;
+			case Metadata::Status::Failed: {
+				connectionsFailed->add();
+				metricsRegistry.removeLabeled("connection", std::to_string(id));
+			} break;
+			case Metadata::Status::Closed: {
+				connectionsClosed->add();
+				connectionsOpen->add(-1);
+				metricsRegistry.removeLabeled("connection", std::to_string(id));
+			} break;
+			default: break;
+		}
 	}
 }  // namespace ViewRay
\ No newline at end of file
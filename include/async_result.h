@@ -0,0 +1,51 @@
+#pragma once
+#include "error_code.h"
+#include <utility>
+#include <variant>
+
+namespace ViewRay {
+	/// @brief Wraps a result from async request.
+	///
+	/// This is supposed to be used as the value type of future/promise.
+	/// It can hold one of two things an error or the value of type T
+	/// @tparam T The type of the value which this can hold
+	template <typename T>
+	class WSAsyncResult {
+	public:
+		WSAsyncResult() = default;
+		/// @brief Initialize with value
+		/// @param[t] t The value to be stored
+		explicit WSAsyncResult(T t) :
+			data(std::move(t)) {
+		}
+		/// @brief Initialize with error
+		/// @param[in] err The error to store
+		explicit WSAsyncResult(EC::ErrorCode err) :
+			data(std::move(err)) {
+		}
+
+		/// @brief Check if there is an error.
+		/// @return true if this holds an error
+		bool hasError() const {
+			return std::holds_alternative<EC::ErrorCode>(data);
+		}
+		/// @brief Retrieve the data.
+		///
+		/// This is safe to be called only if WSAsyncResult::hasError returns false
+		/// @return The data
+		T getData() const {
+			return std::get<T>(data);
+		}
+
+		/// @brief Retrieve the error
+		///
+		/// This is safe to be called only if WSAsyncResult::hasError returns true
+		/// @return The error
+		const EC::ErrorCode& getError() const {
+			return std::get<EC::ErrorCode>(data);
+		}
+
+	private:
+		std::variant<T, EC::ErrorCode> data;
+	};
+}  // namespace ViewRay
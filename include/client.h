@@ -1,35 +1,200 @@
 #pragma once
 #include "patient_data.h"
+#include "patient_list_fetch.h"
+#include "patient_subscription.h"
 #include "websocket.h"
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory_resource>
 #include <unordered_map>
+#include <vector>
 
 namespace ViewRay {
+	struct ClientMetrics;
+	class PatientDetailCache;
+	class PatientListRequest;
 
 	/// @brief Class used to retrieve data from ViewRay server
 	class ViewRayClient {
 	public:
-		using PatientListPtr = std::shared_ptr<std::unordered_map<std::string, Patient>>;
-		using PatientList = std::unordered_map<std::string, Patient>;
+		using PatientList = ViewRay::PatientList;
+		using PatientListPtr = ViewRay::PatientListPtr;
+		using SharedPatientListPtr = ViewRay::SharedPatientListPtr;
+		using FetchOptions = ViewRay::FetchOptions;
+		using FetchResult = ViewRay::FetchResult;
+		using LazyPatientList = ViewRay::LazyPatientList;
+
+		/// Default number of patient detail requests in flight on a connection
+		static constexpr int defaultRequestWindow = 32;
+		/// Default number of patients whose details are cached, see getPatientCache
+		static constexpr size_t defaultPatientCacheCapacity = 100000;
+		/// Default time for which cached patient details are used, see getPatientCache
+		static constexpr std::chrono::milliseconds defaultPatientCacheTtl{2000};
+
+		/// Errors of the client itself. Follow the errors of WSConnectionManager, so that the
+		/// status of an error tells where it comes from.
+		enum ErrorCode {
+			/// The deadline of a fetch passed before the patient list was received
+			Timeout = WSConnectionManager::CannotSendMessage + 1,
+			/// The fetch was cancelled with FetchCancellation::cancel
+			Cancelled,
+			/// The URI passed to LazyPatientList::getPatient is not in the list
+			PatientNotFound
+		};
 
 		/// @brief Initialize the client without establishing a connection
 		/// Call ViewRayClient::init to establish a connection. It must be called
 		/// before any requests are made.
 		/// @param[in] address The address of the server
-		ViewRayClient(std::string address);
+		/// @param[in] connectionPoolSize How many connections to keep open to the server.
+		///		Concurrent requests are spread over them.
+		explicit ViewRayClient(std::string address, int connectionPoolSize = 2);
+
+		/// @brief Initialize a client which uses the connections and threads of a manager
+		/// shared with other clients, e.g. clients of different servers
+		///
+		/// The manager must be initialized and its pool size set by its owner. The arguments
+		/// of ViewRayClient::init are ignored.
+		/// @param[in] address The address of the server
+		/// @param[in] endpoint The shared manager. Must outlive the client.
+		/// @param[in] metricLabels Added to the metrics of the client, so that the clients
+		///		sharing the registry of the manager can be told apart
+		ViewRayClient(
+			std::string address,
+			WSConnectionManager& endpoint,
+			const MetricsRegistry::Labels& metricLabels = {}
+		);
 
-		EC::ErrorCode init() {
-			endpoint.init();
-			return EC::ErrorCode();
-		}
+		/// @brief Start the websocket threads and start opening the pooled connections
+		///
+		/// A client with a shared manager only starts opening its pooled connections.
+		/// @param[in] ioThreads Number of threads which run the websocket client
+		/// @param[in] decodeThreads Number of threads which parse the received messages. If 0
+		///		messages are parsed on the websocket threads.
+		EC::ErrorCode init(
+			int ioThreads = 1,
+			int decodeThreads = WSConnectionManager::defaultDecodeThreads()
+		);
 
 		/// @brief Async call to retrieve a patient list
+		///
+		/// The request is sent over a pooled connection which stays open after the list is
+		/// retrieved. Waits only if no pooled connection has been opened yet. Calls made while
+		/// a list is being fetched do not start another fetch, they receive the same list
+		/// (single flight). Patients whose details are in the cache are not requested, see
+		/// getPatientCache.
+		/// @return Future which will contain the patient list. It is read only, because it can
+		///		be shared with other callers. Copy it to change it.
+		std::future<WSAsyncResult<SharedPatientListPtr>> getPatientList();
+
+		/// @brief Async call to retrieve the patient list without the diagnoses of the patients
+		///
+		/// The future is ready as soon as the public:patients response is received. The
+		/// diagnoses of a patient are requested only when it is accessed or prefetched through
+		/// the returned list, see LazyPatientList. Not shared with other callers.
+		/// @return Future which will contain the patient list
+		std::future<WSAsyncResult<LazyPatientList>> getLazyPatientList();
+
+		/// @brief Async call to retrieve a patient list, delivering it as it arrives
+		///
+		/// Unlike ViewRayClient::getPatientList the fetch is not shared with other callers.
+		/// The patients are passed to the callbacks of options as soon as they are received.
+		/// If the deadline passes after the public:patients response, the future receives the
+		/// list with the patients received so far. If it passes before that, the future
+		/// receives ViewRayClient::Timeout.
+		/// @param[in] options Callbacks and deadline of the fetch
 		/// @return Future which will contain the patient list
-		std::future<WSAsyncResult<PatientListPtr>> getPatientList();
+		std::future<WSAsyncResult<FetchResult>> fetchPatientList(FetchOptions options);
+
+		/// @brief Wait for a pooled connection without blocking
+		///
+		/// The callback is called on the calling thread if a pooled connection is already
+		/// opened, otherwise on a websocket thread once one opens or all of them fail.
+		/// @param[in] callback Receives the error if no connection could be opened
+		void connectAsync(std::function<void(const EC::ErrorCode& error)> callback);
+
+		/// @brief Fetch the patient list without blocking the calling thread
+		///
+		/// Same as ViewRayClient::fetchPatientList, but waiting for the connection does not
+		/// block and the result is passed to a callback. Thus a single thread can start any
+		/// number of fetches. The callback is called once on a websocket thread, never while
+		/// a lock of the client is held. See client_async.h for the asio completion token
+		/// interface, which also supports C++20 coroutines.
+		/// @param[in] options Callbacks and deadline of the fetch
+		/// @param[in] callback Receives the patient list or the error. If the fetch is cancelled
+		///		before it finishes the error is ViewRayClient::Cancelled.
+		/// @return Can be used to cancel the fetch
+		FetchCancellation fetchPatientListAsync(FetchOptions options, FetchCallback callback);
+
+		/// @brief Async call to retrieve a resource other than the patient list and the
+		/// patients, e.g. a plan or a prescription
+		///
+		/// The request is sent over a pooled connection, next to the patient list requests. The
+		/// response is built as nlohmann::json while its message is parsed, without parsing it
+		/// again. Waits only if no pooled connection has been opened yet.
+		/// @param[in] uri The URI of the resource. Must not be the URI of the patient list or of
+		///		a patient which is being fetched, because its response would not reach the fetch.
+		/// @return Future which will contain the value of the resource
+		std::future<WSAsyncResult<nlohmann::json>> fetchResource(const std::string& uri);
+
+		/// @brief Keep the patient list and the details of each patient subscribed
+		///
+		/// Opens a connection dedicated to the subscription. The server pushes updates for the
+		/// patient list and for each patient in it. They are applied in place to the resident
+		/// list of the returned subscription and its listeners are notified with the changed
+		/// patients only. If the connection is lost a new one is opened in the background.
+		/// All calls return the same subscription.
+		/// @return The subscription holding the resident patient list
+		std::shared_ptr<PatientListSubscription> subscribePatientList();
+
+		/// @brief Set how many patient detail requests can be in flight on a connection
+		///
+		/// Each patient in the list is expanded with a separate request. Instead of sending all
+		/// of them at once, at most window requests are waiting for response and a new one is
+		/// sent when a response arrives. Applies to requests started after the call.
+		/// @param[in] window Maximal number of requests in flight. Must be at least 1.
+		void setRequestWindow(int window);
+
+		/// @brief Details of the patients received recently, keyed by patient URI
+		///
+		/// The fetches of the patient list take the details of the patients from the cache
+		/// while they are fresh, so repeated fetches request only the patients whose entries
+		/// have expired. Use PatientDetailCache::invalidate to request a patient again, and
+		/// PatientDetailCache::configure to change the limits or disable the cache. Shared by
+		/// all fetches of the client, but not by the subscription, which always receives the
+		/// updates of the server.
+		PatientDetailCache& getPatientCache();
+
+		/// @brief Metrics of the client and its connections
+		///
+		/// Besides the metrics of WSConnectionManager::getMetrics it has the duration of
+		/// patient list fetches, the time until the first response of a fetch, the round-trip
+		/// time of each setSubscriptions request, the time spent parsing each message and the
+		/// number of queued and in flight patient requests. Can be exported with
+		/// MetricsRegistry::toJson or MetricsRegistry::toPrometheus from any thread.
+		MetricsRegistry& getMetrics();
 
 	private:
 		/// Address of the server
 		std::string address;
+		/// Number of connections kept open to the server
+		int connectionPoolSize;
+		/// Maximal number of patient detail requests in flight on a connection
+		std::atomic<int> requestWindow;
+		/// Created by the first call to subscribePatientList
+		std::shared_ptr<PatientListSubscription> subscription;
+		std::mutex subscriptionMutex;
+		/// Metrics of the requests, shared with the connections
+		std::shared_ptr<ClientMetrics> metrics;
+		/// The fetch started by getPatientList which is in flight, if any
+		std::weak_ptr<PatientListRequest> sharedFetch;
+		std::mutex sharedFetchMutex;
+		/// Shared with the connections
+		std::shared_ptr<PatientDetailCache> patientCache;
+		/// Set if the manager is not shared with other clients
+		std::unique_ptr<WSConnectionManager> ownedEndpoint;
 		/// Websocket manager which manages the connection to the server
-		WSConnectionManager endpoint;
+		WSConnectionManager& endpoint;
 	};
 };	// namespace ViewRay
\ No newline at end of file
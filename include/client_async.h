@@ -0,0 +1,144 @@
+#pragma once
+#include "async_result.h"
+#include "error_code.h"
+#include "patient_list_fetch.h"
+#include <asio/associated_cancellation_slot.hpp>
+#include <asio/associated_executor.hpp>
+#include <asio/async_result.hpp>
+#include <asio/cancellation_type.hpp>
+#include <asio/executor_work_guard.hpp>
+#include <asio/post.hpp>
+#include <functional>
+#include <memory>
+#include <utility>
+
+// asio completion token interface of ViewRayClient
+//
+// The functions accept any asio completion token: a callback, asio::use_future, or with C++20
+// asio::use_awaitable, so that fetches can be awaited in coroutines:
+//
+//	WSAsyncResult<FetchResult> result =
+//		co_await asyncFetchPatientList(client, FetchOptions(), asio::use_awaitable);
+//
+// The completion handler is called on its associated executor. Thus many coroutines on a
+// single io_context can fetch concurrently without blocking it. Cancelling through the
+// associated cancellation slot (e.g. asio::experimental::awaitable_operators or
+// asio::bind_cancellation_slot) fails the fetch with ViewRayClient::Cancelled.
+//
+// This header does not include websocketpp, which cannot be compiled as C++20. Code using
+// coroutines can get a ViewRayClient& from a translation unit compiled as C++17.
+namespace ViewRay {
+	class ViewRayClient;
+
+	/// @brief Same as ViewRayClient::connectAsync, usable without the definition of the client
+	void connectAsync(ViewRayClient& client, std::function<void(const EC::ErrorCode&)> callback);
+
+	/// @brief Same as ViewRayClient::fetchPatientListAsync, usable without the definition of
+	/// the client
+	FetchCancellation fetchPatientListAsync(
+		ViewRayClient& client,
+		FetchOptions options,
+		FetchCallback callback
+	);
+
+	namespace Detail {
+		/// @brief Passes the result of a client call to an asio completion handler
+		///
+		/// Keeps the executor of the handler busy until the result arrives and calls the handler
+		/// on that executor. The client calls the returned function on a websocket thread.
+		template <typename Result, typename Handler>
+		class AsyncCompletion :
+			public std::enable_shared_from_this<AsyncCompletion<Result, Handler>> {
+		public:
+			explicit AsyncCompletion(Handler handler) :
+				handler(std::move(handler)),
+				work(asio::make_work_guard(asio::get_associated_executor(this->handler))),
+				slot(asio::get_associated_cancellation_slot(this->handler)) {
+			}
+
+			/// @brief Route the cancellation requests of the handler to a function
+			template <typename Cancel>
+			void onCancel(Cancel cancel) {
+				if (slot.is_connected()) {
+					slot.assign([cancel = std::move(cancel)](asio::cancellation_type type) {
+						if (type != asio::cancellation_type::none) {
+							cancel();
+						}
+					});
+				}
+			}
+
+			/// @brief Function which completes the operation with its argument
+			std::function<void(Result)> completion() {
+				std::shared_ptr<AsyncCompletion> self = this->shared_from_this();
+				return [self](Result result) {
+					auto finish = [self, result = std::move(result)]() mutable {
+						// The slot must not refer to the operation once the handler is called
+						if (self->slot.is_connected()) {
+							self->slot.clear();
+						}
+						self->work.reset();
+						std::move(self->handler)(std::move(result));
+					};
+					asio::post(self->work.get_executor(), std::move(finish));
+				};
+			}
+
+		private:
+			Handler handler;
+			asio::executor_work_guard<asio::associated_executor_t<Handler>> work;
+			asio::cancellation_slot slot;
+		};
+	}  // namespace Detail
+
+	/// @brief Wait for a pooled connection of the client
+	///
+	/// Completes with an empty error once a pooled connection is opened, or with the error if
+	/// all of them fail. Cancellation is not supported.
+	/// @param[in] client The client, which must be initialized
+	/// @param[in] token Completion token with signature void(EC::ErrorCode)
+	template <typename CompletionToken>
+	auto asyncConnect(ViewRayClient& client, CompletionToken&& token) {
+		return asio::async_initiate<CompletionToken, void(EC::ErrorCode)>(
+			[&client](auto handler) {
+				using Handler = decltype(handler);
+				using State = Detail::AsyncCompletion<EC::ErrorCode, Handler>;
+				auto state = std::make_shared<State>(std::move(handler));
+				std::function<void(EC::ErrorCode)> complete = state->completion();
+				connectAsync(client, [complete](const EC::ErrorCode& error) { complete(error); });
+			},
+			token
+		);
+	}
+
+	/// @brief Fetch the patient list without blocking
+	///
+	/// Sends the public:patients request and a request for each patient over a pooled
+	/// connection, see ViewRayClient::fetchPatientListAsync.
+	/// @param[in] client The client, which must be initialized
+	/// @param[in] options Callbacks and deadline of the fetch
+	/// @param[in] token Completion token with signature void(WSAsyncResult<FetchResult>)
+	template <typename CompletionToken>
+	auto asyncFetchPatientList(
+		ViewRayClient& client,
+		FetchOptions options,
+		CompletionToken&& token
+	) {
+		return asio::async_initiate<CompletionToken, void(WSAsyncResult<FetchResult>)>(
+			[&client](auto handler, FetchOptions options) {
+				using Handler = decltype(handler);
+				using State = Detail::AsyncCompletion<WSAsyncResult<FetchResult>, Handler>;
+				auto state = std::make_shared<State>(std::move(handler));
+				// The slot is connected before the fetch starts, so that it is never changed
+				// while the completion can run
+				const FetchCancellation requested;
+				state->onCancel([requested]() { requested.cancel(); });
+				const FetchCancellation fetch =
+					fetchPatientListAsync(client, std::move(options), state->completion());
+				requested.setHandler([fetch]() { fetch.cancel(); });
+			},
+			token,
+			std::move(options)
+		);
+	}
+}  // namespace ViewRay
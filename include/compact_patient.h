@@ -0,0 +1,381 @@
+#pragma once
+#include "patient_data.h"
+#include "symbol_table.h"
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace ViewRay {
+	/// @brief Date of birth in 4 bytes
+	///
+	/// Dates in the YYYY-MM-DD form of the server are packed as year, month and day. Any other
+	/// text is kept as a symbol of SymbolTable::global, so the text always converts back to
+	/// exactly what was received.
+	class PackedDate {
+	public:
+		/// The empty date
+		PackedDate() = default;
+
+		/// @brief Pack the text of a date
+		static PackedDate fromString(std::string_view text);
+
+		/// @brief Check if the text was a YYYY-MM-DD date, i.e. if getYear, getMonth and
+		/// getDay are valid
+		bool isDate() const {
+			return bits != 0 && (bits & symbolFlag) == 0;
+		}
+
+		bool empty() const {
+			return bits == 0;
+		}
+
+		int getYear() const {
+			return int(bits >> 9);
+		}
+		/// 1 to 12
+		int getMonth() const {
+			return int((bits >> 5) & 0xF);
+		}
+		/// 1 to 31
+		int getDay() const {
+			return int(bits & 0x1F);
+		}
+
+		/// @brief The text which was packed
+		std::string toString() const;
+
+		bool operator==(const PackedDate& other) const {
+			return bits == other.bits;
+		}
+		bool operator!=(const PackedDate& other) const {
+			return bits != other.bits;
+		}
+
+	private:
+		/// Set if the other bits are a symbol
+		static constexpr uint32_t symbolFlag = 1u << 31;
+
+		/// year << 9 | month << 5 | day, or a symbol with symbolFlag. 0 is the empty text.
+		uint32_t bits = 0;
+	};
+
+	/// @brief String of up to N - 1 characters stored in place, e.g. a patient ID or MRN
+	///
+	/// Unlike std::string the object is exactly N bytes and short strings never allocate.
+	/// Longer strings are kept as a symbol of SymbolTable::global.
+	/// @tparam N Size of the object in bytes
+	template <size_t N>
+	class InlineString {
+		static_assert(N > sizeof(SymbolTable::Symbol) && N <= 256);
+
+	public:
+		InlineString() = default;
+
+		explicit InlineString(std::string_view str) {
+			if (str.size() <= capacity) {
+				std::memcpy(chars, str.data(), str.size());
+				length = uint8_t(str.size());
+			} else {
+				const SymbolTable::Symbol symbol = SymbolTable::global().intern(str);
+				std::memcpy(chars, &symbol, sizeof(symbol));
+				length = symbolTag;
+			}
+		}
+
+		/// @brief The string. Valid as long as this object, if the string is stored in place.
+		std::string_view get() const {
+			if (length != symbolTag) {
+				return std::string_view(chars, length);
+			}
+			SymbolTable::Symbol symbol;
+			std::memcpy(&symbol, chars, sizeof(symbol));
+			return SymbolTable::global().get(symbol);
+		}
+
+	private:
+		static constexpr size_t capacity = N - 1;
+		/// Value of length when chars holds a symbol
+		static constexpr uint8_t symbolTag = 0xFF;
+
+		char chars[N - 1] = {};
+		uint8_t length = 0;
+	};
+
+	/// @brief Where BasicCompactDiagnoses keeps its strings
+	enum class CompactStrings {
+		/// In the allocation of the diagnoses, so all memory is freed with them
+		Owned,
+		/// As symbols of SymbolTable::global, shared with all other objects but never freed
+		Global
+	};
+
+	/// @brief The diagnoses of a patient with their prescriptions and plans, in one allocation
+	///
+	/// The items are stored as 32 bit words: the four counts, then each diagnose as
+	/// (description, label, end of its prescriptions), each prescription as (description,
+	/// label, number of fractions, end of its plans) and each plan as its label. The end of
+	/// the children of an item is the index of the first child of the next item, like the
+	/// offsets of PatientTable.
+	///
+	/// With CompactStrings::Owned the strings are indices of the strings of the object, which
+	/// follow the items as the end of each string and then the characters. Equal strings
+	/// within the object are stored once. With CompactStrings::Global the strings are
+	/// symbols of SymbolTable::global, which stores labels repeated across patients once.
+	/// @tparam storage Where the strings are kept
+	template <CompactStrings storage>
+	class BasicCompactDiagnoses {
+	public:
+		class PrescriptionView {
+		public:
+			PrescriptionView(const BasicCompactDiagnoses* diagnoses, uint32_t index) :
+				diagnoses(diagnoses),
+				index(index) {
+			}
+			std::string_view getDescription() const {
+				return diagnoses->string(diagnoses->prescriptionWord(index, 0));
+			}
+			std::string_view getLabel() const {
+				return diagnoses->string(diagnoses->prescriptionWord(index, 1));
+			}
+			int getNumFractions() const {
+				return int32_t(diagnoses->prescriptionWord(index, 2));
+			}
+			size_t getPlanCount() const {
+				return diagnoses->planEnd(index) - diagnoses->planBegin(index);
+			}
+			std::string_view getPlanLabel(size_t i) const {
+				const size_t plan = diagnoses->planBegin(index) + i;
+				return diagnoses->string(diagnoses->planWord(plan));
+			}
+
+		private:
+			const BasicCompactDiagnoses* diagnoses;
+			uint32_t index;
+		};
+
+		class DiagnoseView {
+		public:
+			DiagnoseView(const BasicCompactDiagnoses* diagnoses, uint32_t index) :
+				diagnoses(diagnoses),
+				index(index) {
+			}
+			std::string_view getDescription() const {
+				return diagnoses->string(diagnoses->diagnoseWord(index, 0));
+			}
+			std::string_view getLabel() const {
+				return diagnoses->string(diagnoses->diagnoseWord(index, 1));
+			}
+			size_t getPrescriptionCount() const {
+				return diagnoses->prescriptionEnd(index) - diagnoses->prescriptionBegin(index);
+			}
+			PrescriptionView getPrescription(size_t i) const {
+				return PrescriptionView(
+					diagnoses, uint32_t(diagnoses->prescriptionBegin(index) + i)
+				);
+			}
+
+		private:
+			const BasicCompactDiagnoses* diagnoses;
+			uint32_t index;
+		};
+
+		BasicCompactDiagnoses() = default;
+		explicit BasicCompactDiagnoses(const Patient::DiagnoseList& diagnoses);
+		BasicCompactDiagnoses(const BasicCompactDiagnoses& other);
+		BasicCompactDiagnoses& operator=(const BasicCompactDiagnoses& other);
+		BasicCompactDiagnoses(BasicCompactDiagnoses&&) = default;
+		BasicCompactDiagnoses& operator=(BasicCompactDiagnoses&&) = default;
+
+		/// @brief Number of diagnoses
+		size_t size() const {
+			return words ? words[0] : 0;
+		}
+
+		bool empty() const {
+			return size() == 0;
+		}
+
+		/// @brief The diagnose at an index. The view and its strings are valid as long as the
+		/// object is not changed or destroyed.
+		DiagnoseView operator[](size_t i) const {
+			return DiagnoseView(this, uint32_t(i));
+		}
+
+		/// @brief Replace the contents of a list with the diagnoses
+		/// @param[out] out The list. Its allocator is used for the diagnoses.
+		void toDiagnoses(Patient::DiagnoseList& out) const;
+
+		/// @brief Number of bytes allocated by this object, including its strings unless they
+		/// are in SymbolTable::global
+		size_t getHeapBytes() const {
+			return wordCount() * sizeof(uint32_t);
+		}
+
+	private:
+		static constexpr size_t headerWords = 4;
+		static constexpr size_t diagnoseWords = 3;
+		static constexpr size_t prescriptionWords = 4;
+
+		size_t prescriptionCount() const {
+			return words ? words[1] : 0;
+		}
+		size_t planCount() const {
+			return words ? words[2] : 0;
+		}
+		size_t stringCount() const {
+			return words ? words[3] : 0;
+		}
+		/// Index of the word with the end of the first string. With CompactStrings::Global the
+		/// object has no strings and this is the number of words.
+		size_t stringEndsWord() const {
+			return headerWords + size() * diagnoseWords + prescriptionCount() * prescriptionWords +
+				planCount();
+		}
+		size_t charCount() const {
+			return stringCount() == 0 ? 0 : words[stringEndsWord() + stringCount() - 1];
+		}
+		size_t wordCount() const {
+			if (!words) {
+				return 0;
+			}
+			return stringEndsWord() + stringCount() +
+				(charCount() + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+		}
+
+		uint32_t diagnoseWord(size_t diagnose, size_t field) const {
+			return words[headerWords + diagnose * diagnoseWords + field];
+		}
+		uint32_t prescriptionWord(size_t prescription, size_t field) const {
+			return words[headerWords + size() * diagnoseWords +
+						 prescription * prescriptionWords + field];
+		}
+		uint32_t planWord(size_t plan) const {
+			return words[headerWords + size() * diagnoseWords +
+						 prescriptionCount() * prescriptionWords + plan];
+		}
+		std::string_view string(uint32_t index) const {
+			if constexpr (storage == CompactStrings::Global) {
+				return SymbolTable::global().get(index);
+			}
+			const uint32_t* ends = words.get() + stringEndsWord();
+			const uint32_t begin = index == 0 ? 0 : ends[index - 1];
+			const char* chars = reinterpret_cast<const char*>(ends + stringCount());
+			return std::string_view(chars + begin, ends[index] - begin);
+		}
+		size_t prescriptionBegin(size_t diagnose) const {
+			return diagnose == 0 ? 0 : diagnoseWord(diagnose - 1, 2);
+		}
+		size_t prescriptionEnd(size_t diagnose) const {
+			return diagnoseWord(diagnose, 2);
+		}
+		size_t planBegin(size_t prescription) const {
+			return prescription == 0 ? 0 : prescriptionWord(prescription - 1, 3);
+		}
+		size_t planEnd(size_t prescription) const {
+			return prescriptionWord(prescription, 3);
+		}
+
+		/// nullptr if there are no diagnoses
+		std::unique_ptr<uint32_t[]> words;
+	};
+
+	/// Owns its strings, e.g. for caches whose entries must free all of their memory
+	using CompactDiagnoses = BasicCompactDiagnoses<CompactStrings::Owned>;
+	/// Shares its strings with all patients, for lists which stay resident
+	using SharedCompactDiagnoses = BasicCompactDiagnoses<CompactStrings::Global>;
+
+	/// @brief Patient in a fraction of the memory of Patient, meant for patients kept resident
+	/// for a long time, e.g. across sites
+	///
+	/// The ID and the MRN are stored in place, the date of birth is packed into 4 bytes and
+	/// the names, labels and descriptions are symbols of SymbolTable::global, which stores
+	/// each distinct string once for all patients of all sites. The symbols are never freed,
+	/// so this is meant for lists which stay resident, not for short lived copies. The
+	/// diagnoses take a single allocation, see SharedCompactDiagnoses. Converts to and from
+	/// Patient without losing anything.
+	/// bench/footprint_bench reports the bytes per patient of each representation.
+	class CompactPatient {
+	public:
+		using Symbol = SymbolTable::Symbol;
+		using Id = InlineString<16>;
+
+		CompactPatient() = default;
+		explicit CompactPatient(const Patient& patient);
+
+		/// @brief Create a Patient with the same data
+		/// @param[in] alloc Allocator for the strings and the diagnoses of the patient
+		Patient toPatient(const Patient::allocator_type& alloc = {}) const;
+
+		std::string_view getId() const {
+			return id.get();
+		}
+		std::string_view getMrn() const {
+			return mrn.get();
+		}
+		PackedDate getDateOfBirth() const {
+			return dateOfBirth;
+		}
+		std::string_view getFirstName() const {
+			return SymbolTable::global().get(firstName);
+		}
+		std::string_view getMiddleName() const {
+			return SymbolTable::global().get(middleName);
+		}
+		std::string_view getLastName() const {
+			return SymbolTable::global().get(lastName);
+		}
+		Patient::Sex getSex() const {
+			return Patient::Sex(sex);
+		}
+		int getFractionsTotal() const {
+			return fractionsTotal;
+		}
+		int getFractionsCompleted() const {
+			return fractionsCompleted;
+		}
+		/// @brief Number of fractions which are not delivered yet
+		int getFractionsRemaining() const {
+			return fractionsTotal - fractionsCompleted;
+		}
+		int getWeightKg() const {
+			return weightKg;
+		}
+		int getRegistrationTime() const {
+			return registrationTime;
+		}
+		bool isReadyForTreatment() const {
+			return readyForTreatment != 0;
+		}
+		const SharedCompactDiagnoses& getDiagnoses() const {
+			return diagnoses;
+		}
+
+		void setDiagnoses(SharedCompactDiagnoses newDiagnoses) {
+			diagnoses = std::move(newDiagnoses);
+		}
+
+		/// @brief Number of bytes allocated by this object, besides sizeof(CompactPatient).
+		/// The strings in SymbolTable::global are not counted, because they are shared.
+		size_t getHeapBytes() const {
+			return diagnoses.getHeapBytes();
+		}
+
+	private:
+		Id id;
+		Id mrn;
+		PackedDate dateOfBirth;
+		Symbol firstName = SymbolTable::empty;
+		Symbol middleName = SymbolTable::empty;
+		Symbol lastName = SymbolTable::empty;
+		int32_t fractionsTotal = 0;
+		int32_t fractionsCompleted = 0;
+		int32_t weightKg = 0;
+		int32_t registrationTime = 0;
+		/// Patient::Sex
+		uint8_t sex = uint8_t(Patient::Sex::Unknown);
+		uint8_t readyForTreatment = 0;
+		SharedCompactDiagnoses diagnoses;
+	};
+}  // namespace ViewRay
@@ -0,0 +1,90 @@
+#pragma once
+#include <nlohmann/json.hpp>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace ViewRay {
+	/// @brief Finds the structure of a JSON text in bulk and replays it to a SAX handler
+	///
+	/// JsonScanner::scan is the first stage. It classifies the text 64 bytes at a time with
+	/// SIMD compares and turns the result into bit masks: quotes, backslashes, the structural
+	/// characters {}[]:, and whitespace. Escaped quotes and everything inside strings are
+	/// removed from the masks with bit arithmetic instead of a branch per byte. The result is
+	/// the index of the structural characters, of both quotes of each string and of the
+	/// first byte of each number, true, false and null. The text is also checked to be valid
+	/// UTF-8, skipping the ASCII parts a whole vector at a time.
+	///
+	/// JsonScanner::walk is the second stage. It follows the index to check the grammar and
+	/// calls the handler, copying each string in one piece since its end is already known.
+	///
+	/// The kernel of the first stage is chosen at runtime from what the CPU supports: AVX2,
+	/// SSE2 or plain C++ on other CPUs. All of them produce the same index.
+	class JsonScanner {
+	public:
+		using Sax = nlohmann::json_sax<nlohmann::json>;
+
+		enum class Kernel {
+			Scalar,
+			Sse2,
+			Avx2
+		};
+
+		/// @brief The fastest kernel the CPU supports
+		static Kernel bestKernel();
+
+		/// @brief Check if the CPU can run a kernel
+		static bool isSupported(Kernel kernel);
+
+		static const char* getKernelName(Kernel kernel);
+
+		/// @param[in] kernel The kernel used by JsonScanner::scan. Must be supported by the CPU.
+		explicit JsonScanner(Kernel kernel = bestKernel());
+
+		/// @brief Index the structure of a JSON text
+		///
+		/// The index is kept until the next scan. The text must outlive the calls to
+		/// JsonScanner::walk.
+		/// @param[in] payload The JSON text. Must be smaller than 4 GiB.
+		/// @return false if the text is not valid UTF-8, a string is not terminated or
+		///		contains a control character
+		bool scan(std::string_view payload);
+
+		/// @brief Parse the last scanned text, calling the handler for each token
+		///
+		/// The sizes passed to start_object and start_array are always unknown (-1).
+		/// @param[in] sax The handler. Parsing stops when it returns false.
+		/// @return false if the text is not valid JSON or the handler stopped the parsing
+		bool walk(Sax& sax);
+
+		/// @brief Number of entries in the index
+		size_t getStructuralCount() const {
+			return count;
+		}
+
+		/// @brief Positions of the indexed bytes, in increasing order
+		const uint32_t* getStructurals() const {
+			return positions.get();
+		}
+
+		Kernel getKernel() const {
+			return kernel;
+		}
+
+	private:
+		/// Make room for at least extra more positions
+		void reserve(size_t extra);
+
+		bool parseString(uint32_t open, uint32_t close, std::string& out) const;
+		bool parseAtom(uint32_t begin, uint32_t end, Sax& sax);
+
+		Kernel kernel;
+		std::string_view text;
+		std::unique_ptr<uint32_t[]> positions;
+		size_t count = 0;
+		size_t capacity = 0;
+		/// Passed to the handler for strings, keys and numbers. Reused to avoid allocating.
+		std::string buffer;
+	};
+}  // namespace ViewRay
@@ -0,0 +1,49 @@
+#pragma once
+#include "error_code.h"
+#include <cstddef>
+#include <string>
+
+namespace ViewRay {
+	/// @brief Read-only memory mapping of a whole file
+	///
+	/// The mapping is released when the object is destroyed. Pages are loaded by the OS when
+	/// they are first touched, so opening a large file is cheap.
+	class MappedFile {
+	public:
+		MappedFile() = default;
+		~MappedFile();
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+		MappedFile(MappedFile&& other) noexcept;
+		MappedFile& operator=(MappedFile&& other) noexcept;
+
+		/// @brief Map the file at path, releasing the previous mapping if any
+		/// @param[in] path Path to an existing, non-empty file
+		EC::ErrorCode open(const std::string& path);
+
+		/// @brief Release the mapping
+		void close();
+
+		const char* getData() const {
+			return data;
+		}
+
+		size_t getSize() const {
+			return size;
+		}
+
+		bool isOpen() const {
+			return data != nullptr;
+		}
+
+	private:
+		const char* data = nullptr;
+		size_t size = 0;
+#ifdef _WIN32
+		/// Handles of the file and of the mapping object
+		void* file = nullptr;
+		void* mapping = nullptr;
+#endif
+	};
+}  // namespace ViewRay
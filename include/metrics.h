@@ -0,0 +1,216 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace ViewRay {
+	/// @brief Monotonically increasing value e.g. number of received bytes
+	class Counter {
+	public:
+		void add(uint64_t value = 1) {
+			count.fetch_add(value, std::memory_order_relaxed);
+		}
+
+		uint64_t get() const {
+			return count.load(std::memory_order_relaxed);
+		}
+
+	private:
+		std::atomic<uint64_t> count{0};
+	};
+
+	/// @brief Value which can go up and down e.g. the length of a queue
+	class Gauge {
+	public:
+		void add(int64_t value) {
+			current.fetch_add(value, std::memory_order_relaxed);
+		}
+
+		void set(int64_t value) {
+			current.store(value, std::memory_order_relaxed);
+		}
+
+		int64_t get() const {
+			return current.load(std::memory_order_relaxed);
+		}
+
+	private:
+		std::atomic<int64_t> current{0};
+	};
+
+	/// @brief Distribution of observed values over fixed buckets
+	///
+	/// Each bucket counts the observations which are less or equal to its upper bound and
+	/// greater than the bound of the previous bucket. The last bucket has no upper bound.
+	/// Observing is lock-free and can be done from any thread.
+	class Histogram {
+	public:
+		/// @brief Snapshot of the histogram
+		struct Snapshot {
+			/// Upper bounds of all buckets but the last one
+			std::vector<double> bounds;
+			/// Number of observations in each bucket. Has one more element than bounds.
+			std::vector<uint64_t> counts;
+			/// Sum of all observations
+			double sum = 0;
+			/// Number of observations
+			uint64_t count = 0;
+		};
+
+		/// @param[in] bounds Upper bounds of the buckets in increasing order
+		explicit Histogram(std::vector<double> bounds);
+
+		/// @brief Bounds start, start * factor, start * factor^2 ... with count elements
+		static std::vector<double> exponentialBounds(double start, double factor, int count);
+
+		/// @brief Bounds for durations in seconds from 10 microseconds to about 40 seconds
+		static std::vector<double> latencyBounds();
+
+		void observe(double value);
+
+		/// @brief Observe the time from start until now in seconds
+		void observeSince(std::chrono::steady_clock::time_point start) {
+			observe(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+		}
+
+		/// @brief Read the current state
+		///
+		/// The buckets are read one by one while other threads can observe values. Thus the
+		/// result might not contain some of the concurrent observations, but count is always
+		/// the sum of the bucket counts.
+		Snapshot snapshot() const;
+
+	private:
+		std::vector<double> bounds;
+		std::unique_ptr<std::atomic<uint64_t>[]> counts;
+		std::atomic<double> sum;
+	};
+
+	/// @brief Named metrics which can be exported while they are being updated
+	///
+	/// Metrics are identified by a name and a set of labels, following the Prometheus data
+	/// model. All series with the same name must be of the same type. Counter, gauge and
+	/// histogram objects are created once and updated directly by their owners, so recording
+	/// a value does not touch the registry and never waits.
+	/// Snapshots read the metrics with relaxed atomic loads and can be taken from any thread
+	/// while the websocket threads keep running.
+	///
+	/// The list of metrics is copied on write, like ConnectionRegistry. Readers load the
+	/// current list and never wait for writers. Metrics are added and removed only when
+	/// connections are opened and closed.
+	class MetricsRegistry {
+	public:
+		using Labels = std::vector<std::pair<std::string, std::string>>;
+
+		MetricsRegistry();
+
+		MetricsRegistry(const MetricsRegistry&) = delete;
+		MetricsRegistry& operator=(const MetricsRegistry&) = delete;
+
+		/// @brief Get the counter with the given name and labels, creating it if needed
+		/// @param[in] name Name of the metric. It is shared by all label sets.
+		/// @param[in] help Description of the metric. Only the first one for a name is used.
+		/// @param[in] labels Labels which distinguish this series from the others with the
+		///		same name
+		std::shared_ptr<Counter> counter(
+			const std::string& name,
+			const std::string& help,
+			const Labels& labels = {}
+		);
+
+		/// @brief Get the gauge with the given name and labels, creating it if needed
+		std::shared_ptr<Gauge> gauge(
+			const std::string& name,
+			const std::string& help,
+			const Labels& labels = {}
+		);
+
+		/// @brief Get the histogram with the given name and labels, creating it if needed
+		/// @param[in] bounds Upper bounds of the buckets. Ignored if the histogram exists.
+		std::shared_ptr<Histogram> histogram(
+			const std::string& name,
+			const std::string& help,
+			std::vector<double> bounds,
+			const Labels& labels = {}
+		);
+
+		/// @brief Stop exporting all metrics which have the given label
+		///
+		/// The metric objects stay valid for their owners, they are only dropped from the
+		/// snapshots.
+		void removeLabeled(const std::string& label, const std::string& value);
+
+		/// @brief Snapshot all metrics as JSON
+		///
+		/// {<name>: {"type": "counter"|"gauge"|"histogram", "help": <help>, "series": [...]}}
+		/// Each series has "labels" and "value" or for histograms "count", "sum" and "buckets"
+		/// with the cumulative count for each upper bound "le".
+		std::string toJson() const;
+
+		/// @brief Snapshot all metrics in the Prometheus text exposition format
+		std::string toPrometheus() const;
+
+	private:
+		struct Entry {
+			std::string name;
+			std::string help;
+			Labels labels;
+			std::variant<
+				std::shared_ptr<Counter>,
+				std::shared_ptr<Gauge>,
+				std::shared_ptr<Histogram>>
+				metric;
+		};
+
+		using EntryList = std::vector<Entry>;
+		using Snapshot = std::shared_ptr<const EntryList>;
+
+		/// Find the metric with the given name and labels or add the one created by make.
+		/// Entries with the same name are kept next to each other.
+		template <typename T, typename Make>
+		std::shared_ptr<T> getOrAdd(
+			const std::string& name,
+			const std::string& help,
+			const Labels& labels,
+			Make&& make
+		);
+
+		Snapshot snapshot() const {
+			return std::atomic_load(&current);
+		}
+
+		Snapshot current;
+		/// Serializes the writers. Readers do not use it.
+		std::mutex writeMutex;
+	};
+
+	/// @brief Metrics of a single websocket connection
+	///
+	/// Created by WSConnectionManager for each connection. The series are labeled with the id
+	/// of the connection and are removed from the registry when the connection is closed.
+	struct ConnectionMetrics {
+		using Ptr = std::shared_ptr<ConnectionMetrics>;
+
+		ConnectionMetrics(MetricsRegistry& registry, int id, const std::string& uri);
+
+		/// Payload bytes of the received messages
+		std::shared_ptr<Counter> bytesReceived;
+		/// Payload bytes of the sent messages
+		std::shared_ptr<Counter> bytesSent;
+		/// Bytes of the received payloads as they were sent over the wire, i.e. compressed if
+		/// permessage-deflate is used for them. Equal to bytesReceived otherwise.
+		std::shared_ptr<Counter> wireBytesReceived;
+		/// Bytes of the sent payloads as they were sent over the wire
+		std::shared_ptr<Counter> wireBytesSent;
+		std::shared_ptr<Counter> messagesReceived;
+		std::shared_ptr<Counter> messagesSent;
+		/// Received messages waiting for a decode thread
+		std::shared_ptr<Gauge> decodeQueueDepth;
+	};
+}  // namespace ViewRay
@@ -0,0 +1,127 @@
+#pragma once
+#include "client.h"
+#include "patient_list_fetch.h"
+#include "websocket.h"
+#include <chrono>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace ViewRay {
+	/// @brief Fetches the patient lists of several ViewRay servers (sites) at once
+	///
+	/// There is a ViewRayClient for each site and all of them share a single
+	/// WSConnectionManager, i.e. its websocket and decode threads and its metrics registry.
+	/// A fetch starts the fetches of all sites without waiting for any of them, so the sites
+	/// are fetched concurrently. The list of each site is merged into the common result as
+	/// soon as it arrives, while the other sites are still being fetched.
+	class MultiSiteClient {
+	public:
+		struct Site {
+			/// Unique name of the site. Used as the "site" label of its metrics.
+			std::string name;
+			/// The address of the server of the site
+			std::string address;
+		};
+
+		/// @brief Identifies a patient among all sites
+		struct PatientKey {
+			/// Index of the site in the list given to the constructor
+			size_t site;
+			/// The URI of the patient. Points to the key of the patient in the list of its site.
+			std::string_view uri;
+
+			bool operator==(const PatientKey& other) const {
+				return site == other.site && uri == other.uri;
+			}
+		};
+
+		struct PatientKeyHash {
+			size_t operator()(const PatientKey& key) const {
+				const size_t uriHash = std::hash<std::string_view>()(key.uri);
+				return uriHash ^ (key.site * 0x9e3779b97f4a7c15ull);
+			}
+		};
+
+		/// Patients of all sites. They point into the lists of the sites.
+		using PatientMap = std::unordered_map<PatientKey, const Patient*, PatientKeyHash>;
+
+		/// @brief The outcome of the fetch for a single site
+		struct SiteResult {
+			/// Empty if the list of the site was received
+			EC::ErrorCode error;
+			/// The list of the site and the patients whose diagnoses were not received in time.
+			/// Owns the patients in MultiSiteResult::patients.
+			FetchResult result;
+		};
+
+		/// @brief Patient lists of all sites
+		///
+		/// A site which fails does not fail the others, its error is in its SiteResult.
+		struct MultiSiteResult {
+			/// One entry for each site, in the order of the sites given to the constructor
+			std::vector<SiteResult> sites;
+			/// All patients of the sites which were received
+			PatientMap patients;
+
+			/// @brief True if all sites were received with all diagnoses
+			bool isComplete() const;
+		};
+
+		/// @brief Options of MultiSiteClient::fetchPatientLists
+		struct Options {
+			/// Called for each patient as soon as its diagnoses are received. Called on the
+			/// threads handling the messages of the site, concurrently for different sites.
+			std::function<void(size_t site, const std::string& uri, const Patient& patient)>
+				onPatient;
+			/// If not zero, each site is completed after this time with the patients received
+			/// so far, see ViewRayClient::fetchPatientList
+			std::chrono::milliseconds timeout{0};
+		};
+
+		/// @brief Create the clients without establishing connections
+		/// @param[in] sites The servers to fetch from. The names must be unique.
+		/// @param[in] connectionPoolSize How many connections to keep open to each server
+		explicit MultiSiteClient(std::vector<Site> sites, int connectionPoolSize = 2);
+
+		/// @brief Start the shared websocket threads and start opening the pooled connections
+		/// of all sites
+		/// @param[in] ioThreads Number of threads which run the websocket client
+		/// @param[in] decodeThreads Number of threads which parse the received messages of all
+		///		sites. If 0 messages are parsed on the websocket threads.
+		EC::ErrorCode init(
+			int ioThreads = 1,
+			int decodeThreads = WSConnectionManager::defaultDecodeThreads()
+		);
+
+		/// @brief Fetch the patient lists of all sites concurrently
+		/// @param[in] options Callback and deadline of the fetch
+		/// @return Future which will contain the lists of all sites once each of them is
+		///		received or failed
+		std::future<MultiSiteResult> fetchPatientLists(Options options);
+
+		const std::vector<Site>& getSites() const {
+			return sites;
+		}
+
+		/// @brief The client of a single site
+		ViewRayClient& getClient(size_t site) {
+			return *clients[site];
+		}
+
+		/// @brief Metrics of the shared manager and of all clients. The metrics of the clients
+		/// are labeled with the name of their site.
+		MetricsRegistry& getMetrics();
+
+	private:
+		std::vector<Site> sites;
+		int connectionPoolSize;
+		/// Declared before the clients, which must not outlive it
+		WSConnectionManager endpoint;
+		std::vector<std::unique_ptr<ViewRayClient>> clients;
+	};
+}  // namespace ViewRay
@@ -0,0 +1,115 @@
+#pragma once
+#include "error_code.h"
+#include "patient_data.h"
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <string_view>
+
+namespace ViewRay {
+	/// @brief Compact binary encoding of a Patient and all of its diagnoses
+	///
+	/// A record is the length of its body followed by the body. The body contains the URI of the
+	/// patient and the fields in the order they are declared in Patient, Diagnose, Prescription
+	/// and Plan. Strings are the length followed by the characters. Unsigned numbers are LEB128
+	/// varints, signed numbers are zigzag encoded varints and booleans are a single byte. Each
+	/// list is the number of elements followed by the elements.
+	///
+	/// Records do not depend on each other, so they can be written and read one at a time, see
+	/// PatientBinaryWriter and PatientBinaryReader.
+	class PatientBinaryCodec {
+	public:
+		/// @brief Append the record for a patient
+		/// @param[out] out The record is appended to it
+		/// @param[in] uri The URI of the patient
+		/// @param[in] patient The patient
+		static void encode(std::string& out, std::string_view uri, const Patient& patient);
+
+		/// @brief Decode the body of a record, i.e. without its length
+		/// @param[in] body The body of the record
+		/// @param[out] uri Receives the URI of the patient
+		/// @param[out] patient Receives the patient. Its allocator is used for all its data.
+		/// @return false if the body is malformed. The outputs are unspecified in that case.
+		static bool decode(std::string_view body, std::string& uri, Patient& patient);
+
+		/// @brief Append an unsigned LEB128 varint
+		static void writeVarint(std::string& out, uint64_t value);
+
+		/// @brief Read an unsigned LEB128 varint and advance pos past it
+		/// @return false if the varint is truncated or longer than 64 bits
+		static bool readVarint(const char*& pos, const char* end, uint64_t& value);
+
+	private:
+		static void encodeBody(std::string& out, std::string_view uri, const Patient& patient);
+	};
+
+	/// @brief Writes patients to a stream in the PatientBinaryCodec encoding
+	///
+	/// The stream starts with a header: the magic string "VRPB" and the format version. Records
+	/// are buffered and written in large blocks. The stream ends with an empty record, which is
+	/// written by PatientBinaryWriter::finish.
+	class PatientBinaryWriter {
+	public:
+		/// Version of the format. Streams with other versions are rejected.
+		static constexpr uint8_t version = 1;
+
+		/// @param[in] out The stream to write to. Must outlive the writer. The header is
+		///		written right away.
+		explicit PatientBinaryWriter(std::ostream& out);
+
+		/// @brief Calls PatientBinaryWriter::finish if it was not called
+		~PatientBinaryWriter();
+
+		PatientBinaryWriter(const PatientBinaryWriter&) = delete;
+		PatientBinaryWriter& operator=(const PatientBinaryWriter&) = delete;
+
+		/// @brief Add a patient to the stream
+		void write(std::string_view uri, const Patient& patient);
+
+		/// @brief Write the end of the stream and flush it
+		/// @return false if writing to the stream failed
+		bool finish();
+
+	private:
+		void flush();
+
+		std::ostream& out;
+		std::string buffer;
+		bool finished = false;
+	};
+
+	/// @brief Reads patients written by PatientBinaryWriter one at a time
+	class PatientBinaryReader {
+	public:
+		enum ErrorCode {
+			Success = 0,
+			InvalidHeader,
+			UnsupportedVersion,
+			InvalidRecord,
+			Truncated
+		};
+
+		/// @param[in] in The stream to read from. Must outlive the reader. The header is read
+		///		right away.
+		explicit PatientBinaryReader(std::istream& in);
+
+		/// @brief Read the next patient
+		/// @param[out] uri Receives the URI of the patient
+		/// @param[out] patient Receives the patient. Its allocator is used for all its data.
+		/// @return false at the end of the stream or if there is an error, see
+		///		PatientBinaryReader::getError
+		bool next(std::string& uri, Patient& patient);
+
+		/// @brief The error which stopped the reader, if any
+		const EC::ErrorCode& getError() const {
+			return error;
+		}
+
+	private:
+		std::istream& in;
+		/// Body of the current record. Reused to avoid an allocation per patient.
+		std::string body;
+		EC::ErrorCode error;
+		bool done = false;
+	};
+}  // namespace ViewRay
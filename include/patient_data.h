@@ -1,82 +1,323 @@
 #pragma once
 #include <nlohmann/json.hpp>
 #include <iostream>
+#include <memory_resource>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace ViewRay {
+	class UpdateSubscriptionsSax;
+
+	/// Allocator used by the patient data classes. All strings and vectors of an object and of
+	/// its children are allocated from the same memory resource. This allows a whole patient
+	/// list to be placed in a single arena (e.g. std::pmr::monotonic_buffer_resource).
+	using PatientAllocator = std::pmr::polymorphic_allocator<char>;
+
 	class Plan {
 	public:
+		using allocator_type = PatientAllocator;
+
 		Plan() = default;
-		explicit Plan(const nlohmann::json& plan);
+		explicit Plan(const allocator_type& alloc);
+		explicit Plan(const nlohmann::json& plan, const allocator_type& alloc = {});
+		Plan(const Plan&) = default;
+		Plan(Plan&&) = default;
+		Plan(const Plan& other, const allocator_type& alloc);
+		Plan(Plan&& other, const allocator_type& alloc);
+		Plan& operator=(const Plan&) = default;
+		Plan& operator=(Plan&&) = default;
+		allocator_type get_allocator() const {
+			return label.get_allocator();
+		}
+		std::string_view getLabel() const {
+			return label;
+		}
+		void setLabel(std::string_view value) {
+			label = value;
+		}
 		friend std::ostream& operator<<(std::ostream& os, const Plan& plan);
+		bool operator==(const Plan& other) const;
+		bool operator!=(const Plan& other) const {
+			return !(*this == other);
+		}
+		friend class UpdateSubscriptionsSax;
 
 	private:
-		std::string label;
+		std::pmr::string label;
 	};
 
 	class Prescription {
 	public:
+		using allocator_type = PatientAllocator;
+
 		Prescription() = default;
-		explicit Prescription(const nlohmann::json& data);
+		explicit Prescription(const allocator_type& alloc);
+		explicit Prescription(const nlohmann::json& data, const allocator_type& alloc = {});
+		Prescription(const Prescription&) = default;
+		Prescription(Prescription&&) = default;
+		Prescription(const Prescription& other, const allocator_type& alloc);
+		Prescription(Prescription&& other, const allocator_type& alloc);
+		Prescription& operator=(const Prescription&) = default;
+		Prescription& operator=(Prescription&&) = default;
+		allocator_type get_allocator() const {
+			return label.get_allocator();
+		}
+		std::string_view getDescription() const {
+			return description;
+		}
+		std::string_view getLabel() const {
+			return label;
+		}
+		int getNumFractions() const {
+			return numFractions;
+		}
+		const std::pmr::vector<Plan>& getPlans() const {
+			return plans;
+		}
+		void setDescription(std::string_view value) {
+			description = value;
+		}
+		void setLabel(std::string_view value) {
+			label = value;
+		}
+		void setNumFractions(int value) {
+			numFractions = value;
+		}
+		/// @brief Reserve space for the given number of plans
+		void reservePlans(size_t count) {
+			plans.reserve(count);
+		}
+		/// @brief Append a plan, allocated like the prescription
+		void addPlan(std::string_view planLabel) {
+			plans.emplace_back().setLabel(planLabel);
+		}
 		friend std::ostream& operator<<(std::ostream& os, const Prescription& prescription);
+		bool operator==(const Prescription& other) const;
+		bool operator!=(const Prescription& other) const {
+			return !(*this == other);
+		}
+		friend class UpdateSubscriptionsSax;
 
 	private:
-		std::string description;
-		std::string label;
-		int numFractions;
-		std::vector<Plan> plans;
+		std::pmr::string description;
+		std::pmr::string label;
+		int numFractions = 0;
+		std::pmr::vector<Plan> plans;
 	};
 
 	class Diagnose {
 	public:
+		using allocator_type = PatientAllocator;
+
 		Diagnose() = default;
-		explicit Diagnose(const nlohmann::json& data);
+		explicit Diagnose(const allocator_type& alloc);
+		explicit Diagnose(const nlohmann::json& data, const allocator_type& alloc = {});
+		Diagnose(const Diagnose&) = default;
+		Diagnose(Diagnose&&) = default;
+		Diagnose(const Diagnose& other, const allocator_type& alloc);
+		Diagnose(Diagnose&& other, const allocator_type& alloc);
+		Diagnose& operator=(const Diagnose&) = default;
+		Diagnose& operator=(Diagnose&&) = default;
+		allocator_type get_allocator() const {
+			return label.get_allocator();
+		}
+		std::string_view getDescription() const {
+			return description;
+		}
+		std::string_view getLabel() const {
+			return label;
+		}
+		const std::pmr::vector<Prescription>& getPrescriptions() const {
+			return prescriptions;
+		}
+		void setDescription(std::string_view value) {
+			description = value;
+		}
+		void setLabel(std::string_view value) {
+			label = value;
+		}
+		/// @brief Reserve space for the given number of prescriptions
+		void reservePrescriptions(size_t count) {
+			prescriptions.reserve(count);
+		}
+		/// @brief Append an empty prescription, allocated like the diagnose
+		/// @return The new prescription, valid until the next one is added
+		Prescription& addPrescription() {
+			return prescriptions.emplace_back();
+		}
 
 		friend std::ostream& operator<<(std::ostream& os, const Diagnose& diagnose);
+		bool operator==(const Diagnose& other) const;
+		bool operator!=(const Diagnose& other) const {
+			return !(*this == other);
+		}
+		friend class UpdateSubscriptionsSax;
 
 	private:
-		std::string description;
-		std::string label;
-		std::vector<Prescription> prescriptions;
+		std::pmr::string description;
+		std::pmr::string label;
+		std::pmr::vector<Prescription> prescriptions;
 	};
 
 	class Patient {
 	public:
+		/// Values are stored in PatientTable and in PatientSnapshot, new values must be added
+		/// at the end
 		enum class Sex {
 			Male,
-			Female
+			Female,
+			/// Anything other than "M" or "F", including a missing value
+			Unknown
 		};
+		using allocator_type = PatientAllocator;
+		using DiagnoseList = std::pmr::vector<Diagnose>;
+
 		Patient() = default;
-		explicit Patient(const nlohmann::json& data);
+		explicit Patient(const allocator_type& alloc);
+		/// @brief Read a patient of public:patients. Missing fields and fields of another type
+		/// keep their default value, "diagnoses" and "type" are not read.
+		explicit Patient(const nlohmann::json& data, const allocator_type& alloc = {});
+
+		/// @brief Convert the "sex" field of the server to Sex
+		static Sex sexFromString(std::string_view value);
 
 		/// @brief Parses a JSON and stores the diagnoses for a patient
-		/// @param diagnoses JSON representing the diagnoses
+		/// @param diagnoses JSON representing the diagnoses. Items which are not objects are
+		///		skipped, anything but an array gives no diagnoses.
 		void diagnosesFromJson(const nlohmann::json& diagnoses);
 
+		/// @brief Replace the diagnoses for a patient
+		/// @param diagnoses The new diagnoses
+		void setDiagnoses(DiagnoseList diagnoses);
+
+		/// @brief Check if the diagnoses of the patient are equal to the given ones
+		bool hasSameDiagnoses(const DiagnoseList& other) const;
+
+		/// @brief Check if all fields except the diagnoses are equal
+		bool hasSameSummary(const Patient& other) const;
+
+		/// @brief Take all fields except the diagnoses from another patient
+		/// @param other Patient from which to take the fields. Its diagnoses are not used.
+		void assignSummary(Patient&& other);
+
 		Patient(const Patient&) = delete;
 		Patient& operator=(const Patient&) = delete;
 
 		Patient(Patient&&) = default;
 		Patient& operator=(Patient&&) = default;
+		/// @brief Move a patient into memory from another allocator
+		/// If the allocators are not equal the data is copied.
+		Patient(Patient&& other, const allocator_type& alloc);
+
+		allocator_type get_allocator() const {
+			return id.get_allocator();
+		}
+
+		std::string_view getId() const {
+			return id;
+		}
+		std::string_view getMrn() const {
+			return mrn;
+		}
+		std::string_view getDateOfBirth() const {
+			return dateOfBirth;
+		}
+		std::string_view getFirstName() const {
+			return firstName;
+		}
+		std::string_view getMiddleName() const {
+			return middleName;
+		}
+		std::string_view getLastName() const {
+			return lastName;
+		}
+		Sex getSex() const {
+			return sex;
+		}
+		int getFractionsTotal() const {
+			return fractionsTotal;
+		}
+		int getFractionsCompleted() const {
+			return fractionsCompleted;
+		}
+		/// @brief Number of fractions which are not delivered yet
+		int getFractionsRemaining() const {
+			return fractionsTotal - fractionsCompleted;
+		}
+		int getWeightKg() const {
+			return weigthKg;
+		}
+		int getRegistrationTime() const {
+			return registrationTime;
+		}
+		bool isReadyForTreatment() const {
+			return readyForTreatment;
+		}
+		const DiagnoseList& getDiagnoses() const {
+			return diagnoses;
+		}
+
+		/// @name Setters
+		/// Used to build a patient from other representations, e.g. PatientTable or
+		/// PatientBinaryCodec. The diagnoses are set with Patient::setDiagnoses.
+		/// @{
+		void setId(std::string_view value) {
+			id = value;
+		}
+		void setMrn(std::string_view value) {
+			mrn = value;
+		}
+		void setDateOfBirth(std::string_view value) {
+			dateOfBirth = value;
+		}
+		void setFirstName(std::string_view value) {
+			firstName = value;
+		}
+		void setMiddleName(std::string_view value) {
+			middleName = value;
+		}
+		void setLastName(std::string_view value) {
+			lastName = value;
+		}
+		void setSex(Sex value) {
+			sex = value;
+		}
+		void setFractionsTotal(int value) {
+			fractionsTotal = value;
+		}
+		void setFractionsCompleted(int value) {
+			fractionsCompleted = value;
+		}
+		void setWeightKg(int value) {
+			weigthKg = value;
+		}
+		void setRegistrationTime(int value) {
+			registrationTime = value;
+		}
+		void setReadyForTreatment(bool value) {
+			readyForTreatment = value;
+		}
+		/// @}
 
 		/// Can be used to print a patient info on the console
 		/// @todo Improve on the readability of the output. Needs a way to indent nested objects.
 		friend std::ostream& operator<<(std::ostream& os, const Patient& dt);
+		friend class UpdateSubscriptionsSax;
 
 	private:
-		std::string id;
-		std::string mrn;
-		std::string dateOfBirth;
-		std::string firstName;
-		std::string middleName;
-		std::string lastName;
-		Sex sex;
-		int fractionsTotal;
-		int fractionsCompleted;
-		int weigthKg;
-		int registrationTime;
-		bool readyForTreatment;
-		std::vector<Diagnose> diagnoses;
+		std::pmr::string id;
+		std::pmr::string mrn;
+		std::pmr::string dateOfBirth;
+		std::pmr::string firstName;
+		std::pmr::string middleName;
+		std::pmr::string lastName;
+		Sex sex = Sex::Unknown;
+		int fractionsTotal = 0;
+		int fractionsCompleted = 0;
+		int weigthKg = 0;
+		int registrationTime = 0;
+		bool readyForTreatment = false;
+		DiagnoseList diagnoses;
 	};
 }  // namespace ViewRay
\ No newline at end of file
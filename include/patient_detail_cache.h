@@ -0,0 +1,95 @@
+#pragma once
+#include "compact_patient.h"
+#include "patient_data.h"
+#include <chrono>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace ViewRay {
+	/// @brief Recently received patient details (diagnoses), keyed by patient URI
+	///
+	/// Lets a patient list fetch skip the requests of the patients whose details were received
+	/// shortly before. An entry is used for at most the time to live after it was stored and
+	/// the least recently used entries are evicted once the capacity is reached. Entries can
+	/// also be invalidated explicitly, e.g. when a patient is known to have changed.
+	///
+	/// The diagnoses are copied in and out, because the lists of the fetches are allocated
+	/// from arenas which belong to their callers. They are kept as CompactDiagnoses, which own
+	/// their strings, so evicted and invalidated entries free all of their memory. All
+	/// functions are thread safe.
+	class PatientDetailCache {
+	public:
+		using Clock = std::chrono::steady_clock;
+
+		/// @param[in] capacity Maximal number of patients. 0 disables the cache.
+		/// @param[in] ttl How long after it is stored an entry can be used. 0 disables the
+		///		cache.
+		PatientDetailCache(size_t capacity, std::chrono::milliseconds ttl);
+
+		PatientDetailCache(const PatientDetailCache&) = delete;
+		PatientDetailCache& operator=(const PatientDetailCache&) = delete;
+
+		/// @brief Copy the diagnoses of a patient if its entry has not expired
+		/// @param[in] uri The URI of the patient
+		/// @param[out] diagnoses Receives a copy, allocated with its own allocator
+		/// @param[in] now The current time
+		/// @return false if there is no entry or it has expired
+		bool find(
+			const std::string& uri,
+			Patient::DiagnoseList& diagnoses,
+			Clock::time_point now = Clock::now()
+		);
+
+		/// @brief Store the diagnoses of a patient, replacing its previous entry
+		/// @param[in] uri The URI of the patient
+		/// @param[in] diagnoses The diagnoses just received from the server
+		/// @param[in] now When they were received
+		void insert(
+			const std::string& uri,
+			const Patient::DiagnoseList& diagnoses,
+			Clock::time_point now = Clock::now()
+		);
+
+		/// @brief Remove the entry of a patient, so that its details are requested again
+		void invalidate(const std::string& uri);
+
+		/// @brief Remove all entries
+		void clear();
+
+		/// @brief Change the limits. Entries beyond the new capacity are evicted and entries
+		/// already stored keep their expiration time.
+		/// @param[in] capacity Maximal number of patients. 0 disables the cache.
+		/// @param[in] ttl How long after it is stored an entry can be used. 0 disables the
+		///		cache.
+		void configure(size_t capacity, std::chrono::milliseconds ttl);
+
+		bool isEnabled() const;
+
+		/// @brief Number of stored entries, including the expired ones not removed yet
+		size_t size() const;
+
+	private:
+		struct Entry {
+			CompactDiagnoses diagnoses;
+			Clock::time_point expires;
+			/// Position in lru
+			std::list<const std::string*>::iterator lruPosition;
+		};
+
+		/// Remove an entry. mutex must be locked.
+		void erase(std::unordered_map<std::string, Entry>::iterator it);
+
+		/// Evict the least recently used entries until there are at most capacity. mutex must be
+		/// locked.
+		void evict();
+
+		mutable std::mutex mutex;
+		std::unordered_map<std::string, Entry> entries;
+		/// Keys of entries, most recently used first. The keys of an unordered_map do not move.
+		std::list<const std::string*> lru;
+		size_t capacity;
+		std::chrono::milliseconds ttl;
+	};
+}  // namespace ViewRay
@@ -0,0 +1,82 @@
+#pragma once
+#include "error_code.h"
+#include "patient_data.h"
+#include "patient_table.h"
+#include <iosfwd>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace ViewRay {
+	/// @brief Renders patients as text, JSON lines or CSV into large buffers
+	///
+	/// Printing a patient with operator<< writes each field separately to the stream, which is
+	/// slow for large lists, especially when the stream is std::cout. PatientFormatter appends
+	/// whole patients to a string and writes the string to the stream in blocks of many
+	/// patients, so that the stream makes a few large writes. The blocks can be rendered on
+	/// several threads and are still written in the order of the patients.
+	class PatientFormatter {
+	public:
+		enum class Format {
+			/// The output of operator<< followed by a separator line
+			Text,
+			/// One JSON object per line, with the field names used by the server
+			JsonLines,
+			/// RFC 4180 CSV with a header row. The diagnoses are the labels separated by ';'.
+			Csv
+		};
+
+		enum ErrorCode {
+			Success = 0,
+			UnknownFormat,
+			CannotWrite
+		};
+
+		/// @brief Get the format with the given name: "text", "jsonl" or "csv"
+		/// @param[in] name The name of the format
+		/// @param[out] format Receives the format. Unchanged if there is an error.
+		static EC::ErrorCode parseFormat(std::string_view name, Format& format);
+
+		/// @param[in] format How to render the patients
+		/// @param[in] threads Maximal number of threads used to render a list. The calling
+		///		thread is one of them.
+		explicit PatientFormatter(Format format, unsigned threads = 1);
+
+		/// @brief Append the text which precedes the patients, e.g. the header row of CSV
+		void renderHeader(std::string& out) const;
+
+		/// @brief Append a single patient
+		void render(std::string& out, const Patient& patient) const;
+
+		/// @brief Append a single row of a PatientTable, the same as the equal Patient
+		void render(std::string& out, const PatientTable::PatientView& patient) const;
+
+		/// @brief Render the header and all patients and write them to a stream
+		/// @param[in] out The stream to write to
+		/// @param[in] patients The patients in the order they are written
+		EC::ErrorCode write(std::ostream& out, const std::vector<const Patient*>& patients);
+
+		/// @brief Render the header and all rows of a table and write them to a stream
+		///
+		/// The rows are rendered from the table, without creating a Patient for each of them.
+		/// @param[in] out The stream to write to
+		/// @param[in] table The patients in the order they are written
+		EC::ErrorCode write(std::ostream& out, const PatientTable& table);
+
+	private:
+		template <typename Row>
+		void renderRow(std::string& out, const Row& patient) const;
+
+		/// Render the rows [0, count) in chunks, getRow(i) returns row i
+		template <typename GetRow>
+		EC::ErrorCode writeRows(std::ostream& out, size_t count, GetRow getRow);
+
+		/// Number of patients rendered in a single buffer
+		static constexpr size_t chunkSize = 1024;
+
+		Format format;
+		unsigned threads;
+		/// One buffer for each thread. Kept between calls to avoid growing them every time.
+		std::vector<std::string> buffers;
+	};
+}  // namespace ViewRay
@@ -0,0 +1,157 @@
+#pragma once
+#include "async_result.h"
+#include "patient_data.h"
+#include <chrono>
+#include <functional>
+#include <future>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace ViewRay {
+	/// Patients keyed by their URI. The map nodes and all patient data of a fetched list are
+	/// allocated from a single arena, which is released with the last PatientListPtr.
+	using PatientList = std::pmr::unordered_map<std::string, Patient>;
+	using PatientListPtr = std::shared_ptr<PatientList>;
+	/// A list which can be shared by several callers, see ViewRayClient::getPatientList. It is
+	/// read only, so that a caller cannot change the patients the others see.
+	using SharedPatientListPtr = std::shared_ptr<const PatientList>;
+
+	/// @brief Callbacks and deadline of a fetch started with ViewRayClient::fetchPatientList
+	///
+	/// The callbacks are called on the thread which handles the messages of the connection,
+	/// one at a time and without holding any lock of the client. They must not block for
+	/// long, because the next message of the connection waits for them. A callback which
+	/// has started before the deadline can still be running after the future is ready.
+	struct FetchOptions {
+		/// Called once when the public:patients response is received. The patients do not
+		/// have their diagnoses yet.
+		std::function<void(const PatientList& patients)> onSkeleton;
+		/// Called for each patient as soon as its diagnoses are received
+		std::function<void(const std::string& uri, const Patient& patient)> onPatient;
+		/// If not zero, the fetch is completed after this time even if some patients have not
+		/// received their diagnoses. Includes the time waiting for a connection.
+		std::chrono::milliseconds timeout{0};
+	};
+
+	/// @brief Patient list which can lack the diagnoses of some patients
+	struct FetchResult {
+		PatientListPtr patients;
+		/// URIs of the patients whose diagnoses were not received before the deadline. They
+		/// are in the list without diagnoses.
+		std::vector<std::string> missing;
+
+		bool isComplete() const {
+			return missing.empty();
+		}
+	};
+
+	class LazyExpansion;
+
+	/// @brief Patient list whose patients receive their diagnoses only when they are needed
+	///
+	/// Returned by ViewRayClient::getLazyPatientList as soon as the public:patients response is
+	/// received, so a view which shows only the fields of the list costs a single round-trip.
+	/// The diagnoses of a patient are requested the first time it is accessed with
+	/// LazyPatientList::getPatient, or ahead of time with LazyPatientList::prefetch. Each patient
+	/// is requested at most once and the patient detail cache of the client is checked first.
+	///
+	/// Entries are never added to or removed from the list, only the diagnoses of a patient are
+	/// filled in once. Thus the list can be read from any thread, but the diagnoses of a patient
+	/// only after its future is ready. Copies share the same list. Patients can be expanded only
+	/// while the client which fetched the list exists.
+	class LazyPatientList {
+	public:
+		/// Receives the patient with its diagnoses
+		using PatientFuture = std::shared_future<WSAsyncResult<const Patient*>>;
+
+		explicit LazyPatientList(std::shared_ptr<LazyExpansion> state);
+
+		/// @brief The patients with the fields of public:patients. The diagnoses of a patient
+		/// are empty until its future from LazyPatientList::getPatient is ready.
+		const PatientList& getPatients() const;
+
+		/// @brief Get a patient with its diagnoses, requesting them on first access
+		///
+		/// Calls for the same patient share the request. If the request fails, the next call
+		/// requests the patient again.
+		/// @param[in] uri The URI of the patient
+		/// @return Future which will contain the patient. Fails with
+		///		ViewRayClient::PatientNotFound if the URI is not in the list.
+		PatientFuture getPatient(const std::string& uri) const;
+
+		/// @brief Start requesting the diagnoses of patients which are likely to be accessed,
+		/// e.g. the rows a view is about to show
+		///
+		/// Does not wait for them. URIs which are not in the list or are already expanded or
+		/// requested are ignored.
+		void prefetch(const std::vector<std::string>& uris) const;
+
+		/// @brief Check if the diagnoses of a patient have been received
+		bool isExpanded(const std::string& uri) const;
+
+	private:
+		std::shared_ptr<LazyExpansion> state;
+	};
+
+	/// Receives the result of ViewRayClient::fetchPatientListAsync
+	using FetchCallback = std::function<void(WSAsyncResult<FetchResult>)>;
+
+	/// @brief Cancels a fetch started with ViewRayClient::fetchPatientListAsync
+	///
+	/// Copies refer to the same fetch. Cancelling can be done from any thread, any number of
+	/// times and also after the fetch has finished, in which case it does nothing.
+	class FetchCancellation {
+	public:
+		FetchCancellation() :
+			state(std::make_shared<State>()) {
+		}
+
+		/// @brief Fail the fetch with ViewRayClient::Cancelled unless it has already finished
+		void cancel() const {
+			std::function<void()> handler;
+			{
+				std::lock_guard<std::mutex> lock(state->mutex);
+				if (state->cancelled) {
+					return;
+				}
+				state->cancelled = true;
+				handler = std::move(state->handler);
+			}
+			if (handler) {
+				handler();
+			}
+		}
+
+		bool isCancelled() const {
+			std::lock_guard<std::mutex> lock(state->mutex);
+			return state->cancelled;
+		}
+
+		/// @brief Set what cancel does. Used by the client which runs the fetch.
+		///
+		/// If the fetch is already cancelled the handler is called right away.
+		void setHandler(std::function<void()> handler) const {
+			{
+				std::lock_guard<std::mutex> lock(state->mutex);
+				if (!state->cancelled) {
+					state->handler = std::move(handler);
+					return;
+				}
+			}
+			handler();
+		}
+
+	private:
+		struct State {
+			std::mutex mutex;
+			std::function<void()> handler;
+			bool cancelled = false;
+		};
+
+		std::shared_ptr<State> state;
+	};
+}  // namespace ViewRay
@@ -0,0 +1,87 @@
+#pragma once
+#include "patient_data.h"
+#include "uri_router.h"
+#include <nlohmann/json.hpp>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace ViewRay {
+	/// @brief What the parsers build from a resource of an updateSubscriptions frame
+	enum class ResourceKind {
+		/// The resource is not parsed
+		Skip,
+		/// The patient list, parsed into UpdateSubscriptions::patients
+		PatientList,
+		/// A patient, whose diagnoses are parsed into UpdateSubscriptions::diagnoses
+		Patient,
+		/// Any other resource, e.g. a plan or a prescription, parsed into
+		/// UpdateSubscriptions::resources
+		Json
+	};
+
+	/// Tells the parsers the kind of each resource by its URI
+	using ResourceRoutes = UriRouter<ResourceKind>;
+
+	/// @brief Routes of the resources requested for a patient list: public:patients is the
+	/// list and every other URI is a patient
+	const ResourceRoutes& getDefaultResourceRoutes();
+
+	/// @brief The data carried by a single {"updateSubscriptions": {...}} frame
+	struct UpdateSubscriptions {
+		UpdateSubscriptions() = default;
+		/// @param[in] resource Memory resource used for all patients and diagnoses in the frame
+		/// @param[in] routes The kind of each resource. Must outlive the parsing.
+		explicit UpdateSubscriptions(
+			std::pmr::memory_resource* resource,
+			const ResourceRoutes& routes = getDefaultResourceRoutes()
+		) :
+			resource(resource),
+			routes(&routes) {
+		}
+
+		/// Memory resource used for the parsed patients and diagnoses. The vectors below are
+		/// temporary and use the default allocator.
+		std::pmr::memory_resource* resource = std::pmr::get_default_resource();
+		/// Decides how each resource of the frame is parsed. Resources without a route are
+		/// skipped.
+		const ResourceRoutes* routes = &getDefaultResourceRoutes();
+		/// True if the frame contains the public:patients resource
+		bool hasPatientList = false;
+		/// Patients from public:patients as (URI, patient) pairs in the order they were received.
+		/// The patients do not have diagnoses.
+		std::vector<std::pair<std::string, Patient>> patients;
+		/// Diagnoses from each patient resource as (patient URI, diagnoses) pairs
+		std::vector<std::pair<std::string, Patient::DiagnoseList>> diagnoses;
+		/// Objects and arrays of the resources routed to ResourceKind::Json as (URI, value)
+		/// pairs. Built while the frame is parsed, without parsing them again.
+		std::vector<std::pair<std::string, nlohmann::json>> resources;
+	};
+
+	/// @brief Parse an updateSubscriptions frame in a single pass
+	///
+	/// The frame is never converted to nlohmann::json. Patient, Diagnose, Prescription and Plan
+	/// are filled directly while the payload is tokenized. Only the resources routed to
+	/// ResourceKind::Json are built as nlohmann::json, in the same pass. The payload is indexed
+	/// with SIMD by JsonScanner before its tokens are read.
+	///
+	/// Missing fields, fields of another type and numbers which do not fit into an int keep
+	/// the default value of the patient data, array items which are not objects are skipped. A "type" string which is not the type
+	/// of the object, e.g. "Plan" for a plan, fails the frame.
+	/// @param[in] payload The text of the frame
+	/// @param[in,out] out Gives the routes of the resources and receives the parsed data.
+	///		Might be partially filled if parsing fails.
+	/// @return false if the payload is not valid JSON or does not have the expected structure
+	bool parseUpdateSubscriptions(std::string_view payload, UpdateSubscriptions& out);
+
+	/// @brief Parse an updateSubscriptions frame by building the whole JSON document
+	///
+	/// Uses the nlohmann::json constructors of the patient data classes. Slower than
+	/// parseUpdateSubscriptions. Accepts and rejects the same frames and gives the same result.
+	/// @param[in] payload The text of the frame
+	/// @param[in,out] out Gives the routes of the resources and receives the parsed data
+	/// @return false if the payload is not valid JSON or does not have the expected structure
+	bool parseUpdateSubscriptionsDom(std::string_view payload, UpdateSubscriptions& out);
+}  // namespace ViewRay
@@ -0,0 +1,206 @@
+#pragma once
+#include "patient_table.h"
+#include <climits>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace ViewRay {
+	/// @brief Contiguous sequence of rows of a PatientTable returned by PatientIndex
+	class RowRange {
+	public:
+		RowRange() = default;
+		RowRange(const uint32_t* first, const uint32_t* last) :
+			first(first),
+			last(last) {
+		}
+		const uint32_t* begin() const {
+			return first;
+		}
+		const uint32_t* end() const {
+			return last;
+		}
+		size_t size() const {
+			return size_t(last - first);
+		}
+		bool empty() const {
+			return first == last;
+		}
+
+	private:
+		const uint32_t* first = nullptr;
+		const uint32_t* last = nullptr;
+	};
+
+	/// @brief Secondary indexes over a PatientTable
+	///
+	/// Used by PatientQuery to avoid scanning the whole table for selective predicates. The
+	/// index must be built after the table is filled. Rows added to the table afterwards are
+	/// not indexed. The table must outlive the index.
+	class PatientIndex {
+	public:
+		explicit PatientIndex(const PatientTable& table);
+
+		/// @brief The table for which the index was built
+		const PatientTable& getTable() const {
+			return table;
+		}
+
+		/// @brief Rows of the patients with the given MRN in increasing order
+		RowRange findByMrn(std::string_view mrn) const;
+
+		/// @brief Rows of the patients with at least one diagnose with the given label in
+		/// increasing order
+		RowRange findByDiagnoseLabel(std::string_view label) const;
+
+		/// @brief Rows of the patients which are (not) ready for treatment in increasing order
+		RowRange findByReadyForTreatment(bool ready) const;
+
+		/// @brief Rows of the patients registered in [from, to) ordered by registration time
+		RowRange findByRegistrationTime(int from, int to) const;
+
+	private:
+		/// Rows sorted by a key. The rows for equal keys are in increasing order.
+		template <typename Key>
+		struct SortedRows {
+			std::vector<Key> keys;
+			std::vector<uint32_t> rows;
+
+			/// Sort (key, row) pairs and store them
+			void assign(std::vector<std::pair<Key, uint32_t>>&& entries);
+			/// Rows with key in [from, to)
+			RowRange range(Key from, Key to) const;
+			/// Rows with the given key
+			RowRange equal(Key key) const;
+		};
+
+		const PatientTable& table;
+		SortedRows<PatientTable::StringID> byMrn;
+		SortedRows<PatientTable::StringID> byDiagnoseLabel;
+		SortedRows<uint8_t> byReadyForTreatment;
+		SortedRows<int32_t> byRegistrationTime;
+	};
+
+	/// @brief Filters and sorts the patients in a PatientTable
+	///
+	/// Predicates are combined with AND. Setting the same predicate twice replaces it, except
+	/// for PatientQuery::hasDiagnose and PatientQuery::where which add one more condition.
+	/// If a PatientIndex is given the most selective indexed predicate is used to find the
+	/// candidate rows, the rest are checked on the columns of the table.
+	/// @code
+	///	PatientTable table(*patientList);
+	///	PatientIndex index(table);
+	///	std::vector<uint32_t> rows = PatientQuery(table, &index)
+	///		.readyForTreatment()
+	///		.hasDiagnose("Prostate")
+	///		.orderBy(PatientQuery::SortKey::FractionsRemaining, true)
+	///		.limit(10)
+	///		.rows();
+	/// @endcode
+	class PatientQuery {
+	public:
+		enum class SortKey {
+			/// Order in which the patients were added to the table
+			Row,
+			RegistrationTime,
+			FractionsRemaining,
+			FractionsTotal,
+			FractionsCompleted,
+			WeightKg,
+			LastName,
+			Mrn
+		};
+
+		using Predicate = std::function<bool(const PatientTable::PatientView& patient)>;
+
+		/// @param[in] table The patients to query. Must outlive the query.
+		/// @param[in] index Optional index over table. Must outlive the query.
+		explicit PatientQuery(const PatientTable& table, const PatientIndex* index = nullptr);
+
+		/// @brief Keep only patients which are (not) ready for treatment
+		PatientQuery& readyForTreatment(bool ready = true);
+
+		/// @brief Keep only patients of the given sex
+		PatientQuery& sex(Patient::Sex sex);
+
+		/// @brief Keep only patients for which fractions total - fractions completed is
+		/// in [min, max]
+		PatientQuery& fractionsRemaining(int min, int max = INT_MAX);
+
+		/// @brief Keep only patients with registration time in [from, to)
+		PatientQuery& registeredBetween(int from, int to);
+
+		/// @brief Keep only patients with at least one diagnose with the given label
+		PatientQuery& hasDiagnose(std::string label);
+
+		/// @brief Keep only patients with the given MRN
+		PatientQuery& mrn(std::string mrn);
+
+		/// @brief Keep only patients for which predicate returns true
+		/// Custom predicates are checked after all others.
+		PatientQuery& where(Predicate predicate);
+
+		/// @brief Sort the result. By default the result is in row order.
+		/// Patients with equal keys are kept in row order.
+		PatientQuery& orderBy(SortKey key, bool descending = false);
+
+		/// @brief Return at most count patients
+		/// Combined with PatientQuery::orderBy it returns the top count patients without sorting
+		/// the whole result.
+		PatientQuery& limit(size_t count);
+
+		/// @brief Run the query
+		/// @return The rows of the matching patients
+		std::vector<uint32_t> rows() const;
+
+		/// @brief Run the query
+		/// @return Views of the matching patients
+		std::vector<PatientTable::PatientView> views() const;
+
+		/// @brief Count the matching patients ignoring the limit
+		size_t count() const;
+
+	private:
+		/// String predicates resolved to IDs in the string arena of the table
+		struct ResolvedIDs {
+			/// False if some of the strings is not in the table, thus nothing can match
+			bool possible = true;
+			PatientTable::StringID mrn = StringArena::npos;
+			std::vector<PatientTable::StringID> diagnoseLabels;
+		};
+
+		ResolvedIDs resolve() const;
+		/// Rows which must be checked. Uses the index if there is one.
+		std::vector<uint32_t> candidates() const;
+		bool matches(uint32_t row, const ResolvedIDs& ids) const;
+		/// Collect the matching rows without sorting and limiting them
+		std::vector<uint32_t> filter() const;
+		/// True if row a must be before row b
+		bool before(uint32_t a, uint32_t b) const;
+
+		const PatientTable& table;
+		const PatientIndex* index;
+
+		bool filterReady = false;
+		bool ready = true;
+		bool filterSex = false;
+		Patient::Sex sexValue = Patient::Sex::Female;
+		bool filterFractions = false;
+		int minFractionsRemaining = 0;
+		int maxFractionsRemaining = INT_MAX;
+		bool filterRegistration = false;
+		int registeredFrom = 0;
+		int registeredTo = 0;
+		bool filterMrn = false;
+		std::string mrnValue;
+		std::vector<std::string> diagnoseLabels;
+		std::vector<Predicate> predicates;
+
+		SortKey sortKey = SortKey::Row;
+		bool descending = false;
+		size_t maxResults = SIZE_MAX;
+	};
+}  // namespace ViewRay
@@ -0,0 +1,82 @@
+#pragma once
+#include "error_code.h"
+#include "patient_table.h"
+#include <cstdint>
+#include <string>
+
+namespace ViewRay {
+	/// @brief Saves a PatientTable to a file which can be memory mapped and loads it back
+	///
+	/// The file starts with a fixed size header: a magic string, the format version, a marker
+	/// of the byte order, the time it was written and the number of patients, diagnoses,
+	/// prescriptions, plans and strings. It is followed by the string table (end offsets of
+	/// the strings and then all characters) and the columns of the table, in the order they
+	/// are declared in PatientTable. Each section starts at a multiple of 8 bytes. Numbers are
+	/// stored in the byte order of the machine which wrote the file.
+	///
+	/// Loading maps the file and does not copy the characters of the strings. The table refers
+	/// to them directly and keeps the mapping alive. Only the numeric columns are copied.
+	class PatientSnapshot {
+	public:
+		enum ErrorCode {
+			Success = 0,
+			/// The file cannot be opened or mapped. Returned by MappedFile::open.
+			CannotOpen = 1,
+			CannotWrite,
+			InvalidSnapshot
+		};
+
+		/// Version of the file format. Files with other versions are rejected.
+		static constexpr uint32_t version = 1;
+
+		/// @brief Information stored in the header of a snapshot
+		struct Info {
+			/// Seconds since the Unix epoch when the snapshot was written
+			int64_t createdAt = 0;
+			uint32_t patients = 0;
+			uint32_t diagnoses = 0;
+			uint32_t prescriptions = 0;
+			uint32_t plans = 0;
+			uint32_t strings = 0;
+		};
+
+		/// @brief Write the table to a file
+		///
+		/// The data is written to a temporary file next to path, which is then renamed. Thus
+		/// readers never see a partially written snapshot.
+		/// @param[in] table The table to save
+		/// @param[in] path Where to save it
+		static EC::ErrorCode save(const PatientTable& table, const std::string& path);
+
+		/// @brief Map a snapshot written by PatientSnapshot::save
+		///
+		/// The file is fully validated, so a corrupted or truncated file results in an error
+		/// and never in reads outside of the file.
+		/// @param[in] path The file to load
+		/// @param[out] table Receives the patients. Unchanged if there is an error.
+		/// @param[out] info If not null receives the header of the snapshot
+		static EC::ErrorCode load(
+			const std::string& path,
+			PatientTable& table,
+			Info* info = nullptr
+		);
+
+	private:
+		enum class ColumnKind {
+			/// Plain numbers
+			Values,
+			/// Numbers which must not be greater than a maximum, e.g. Patient::Sex
+			Bounded,
+			/// IDs of strings in PatientTable::strings
+			Strings,
+			/// Offsets into the columns of the next level
+			Offsets
+		};
+
+		/// Call f(column, size, kind, limit) for each column of the table in file order.
+		/// The sizes are computed from counts. limit is the size of the next level for offset
+		/// columns, the maximum for bounded columns and 0 for the others.
+		template <typename Table, typename F>
+		static void visitColumns(Table& table, const Info& counts, F&& f);
+	};
+}  // namespace ViewRay
@@ -0,0 +1,124 @@
+#pragma once
+#include "patient_data.h"
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace ViewRay {
+	/// @brief Resident patient list kept up to date by updates pushed from the server
+	///
+	/// The list is changed in place. Registered listeners are notified only about the patients
+	/// which were added, removed or changed by an update.
+	class PatientListSubscription {
+	public:
+		using PatientList = std::unordered_map<std::string, Patient>;
+
+		enum class ChangeType {
+			Added,
+			Updated,
+			Removed
+		};
+
+		/// @brief Describes a single changed patient
+		///
+		/// The pointers are valid only during the call to the listener.
+		struct Change {
+			ChangeType type;
+			/// URI of the patient
+			const std::string* uri;
+			/// The patient after the change. For removed patients this is the last known state.
+			const Patient* patient;
+		};
+
+		/// Function called with all changes caused by a single update. It is called on the
+		/// thread which processes the update, after the list is unlocked, so it can call
+		/// PatientListSubscription::read, addListener and removeListener. The next update waits
+		/// until all listeners have returned. A listener removed while an update is notified
+		/// can still be called with that update.
+		using Listener = std::function<void(const std::vector<Change>& changes)>;
+
+		PatientListSubscription();
+
+		PatientListSubscription(const PatientListSubscription&) = delete;
+		PatientListSubscription& operator=(const PatientListSubscription&) = delete;
+
+		/// @brief Register a function to be called when patients change
+		/// @return ID which can be used to remove the listener
+		int addListener(Listener listener);
+
+		/// @brief Remove a listener registered with PatientListSubscription::addListener
+		void removeListener(int id);
+
+		/// @brief Access the resident patient list
+		/// Updates are blocked while f runs.
+		/// @param[in] f Function called with a const reference to the patient list
+		template <typename F>
+		void read(F&& f) const {
+			std::lock_guard<std::mutex> lock(mutex);
+			f(static_cast<const PatientList&>(patients));
+		}
+
+		/// @brief Check if the list has been received at least once
+		bool isSynced() const;
+
+		/// @brief Replace the patient list with the content of a public:patients update
+		///
+		/// Patients not in the update are removed. The diagnoses of the patients which are
+		/// already in the list are kept.
+		/// @param[in] update (URI, patient) pairs from the update
+		void applyPatientList(std::vector<std::pair<std::string, Patient>>&& update);
+
+		/// @brief Replace the diagnoses of a patient with the content of a patient update
+		/// @param[in] uri URI of the patient. Updates for unknown patients are ignored.
+		/// @param[in] diagnoses The new diagnoses
+		void applyDiagnoses(const std::string& uri, Patient::DiagnoseList&& diagnoses);
+
+	private:
+		/// Call all listeners. updateMutex must be locked.
+		/// @param[in] lock Holds mutex, which is unlocked before the listeners are called
+		void notify(std::unique_lock<std::mutex>& lock, const std::vector<Change>& changes);
+
+		PatientList patients;
+		std::vector<std::pair<int, Listener>> listeners;
+		/// Updates come from the thread processing messages, while the list is read from others
+		mutable std::mutex mutex;
+		/// Held by an update until its listeners have returned, so that the changes passed to
+		/// them stay valid. Locked before mutex.
+		std::mutex updateMutex;
+		int nextListenerID;
+		bool synced;
+	};
+
+	/// @brief The patient URIs subscribed on the connection of a PatientListSubscription
+	///
+	/// public:patients is pushed again each time the list changes. The patients which joined
+	/// the list must be subscribed and the ones which left it unsubscribed, so that the server
+	/// stops pushing their updates. Not thread safe.
+	class SubscribedUris {
+	public:
+		/// @brief Make the set equal to the URIs of a public:patients update
+		/// @param[in] update (URI, patient) pairs from the update
+		/// @param[out] added Receives the URIs which were not in the set
+		/// @param[out] removed Receives the URIs which are not in the update
+		void apply(
+			const std::vector<std::pair<std::string, Patient>>& update,
+			std::vector<std::string>& added,
+			std::vector<std::string>& removed
+		);
+
+		bool contains(const std::string& uri) const {
+			return uris.count(uri) != 0;
+		}
+
+		size_t size() const {
+			return uris.size();
+		}
+
+	private:
+		std::unordered_set<std::string> uris;
+	};
+}  // namespace ViewRay
@@ -0,0 +1,483 @@
+#pragma once
+#include "patient_data.h"
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace ViewRay {
+	/// @brief Stores each distinct string once and refers to it by a small integer
+	///
+	/// The characters are kept in large chunks which are never reallocated, so the views
+	/// returned by StringArena::get stay valid for the lifetime of the arena. Strings can also
+	/// live outside of the arena, e.g. in a memory mapped PatientSnapshot, see
+	/// StringArena::addView.
+	class StringArena {
+	public:
+		using ID = uint32_t;
+
+		StringArena() = default;
+		StringArena(const StringArena&) = delete;
+		StringArena& operator=(const StringArena&) = delete;
+		StringArena(StringArena&&) = default;
+		StringArena& operator=(StringArena&&) = default;
+
+		/// @brief Store the string if it is not already stored
+		/// @return The ID of the string. Equal strings always have the same ID.
+		ID intern(std::string_view str);
+
+		/// Returned by StringArena::find if the string is not stored
+		static constexpr ID npos = ID(-1);
+
+		/// @brief Add a string without copying its characters
+		///
+		/// Unlike StringArena::intern the string always gets a new ID, which is equal to the
+		/// number of strings added before it. If an equal string is already stored,
+		/// StringArena::find keeps returning the ID of the first one.
+		/// @param[in] str The string. Its characters must outlive the arena, e.g. by passing
+		///		their owner to StringArena::keepAlive.
+		/// @return The ID of the string
+		ID addView(std::string_view str);
+
+		/// @brief Keep an object alive for as long as the arena is alive
+		/// Used for the owners of the strings passed to StringArena::addView.
+		void keepAlive(std::shared_ptr<const void> owner);
+
+		/// @brief Reserve space for the given number of strings
+		void reserve(size_t count);
+
+		/// @brief Get the ID of a stored string without storing it
+		/// @return The ID of the string or StringArena::npos if it is not stored
+		ID find(std::string_view str) const {
+			const auto it = index.find(str);
+			return it == index.end() ? npos : it->second;
+		}
+
+		/// @brief Get the string with the given ID
+		std::string_view get(ID id) const {
+			return strings[id];
+		}
+
+		/// @brief Number of distinct strings
+		size_t size() const {
+			return strings.size();
+		}
+
+		/// @brief Number of bytes used for characters, including unused space in the chunks
+		size_t capacityBytes() const;
+
+	private:
+		/// Size of a chunk. Longer strings get a chunk of their own.
+		static constexpr size_t chunkSize = 64 * 1024;
+
+		std::vector<std::unique_ptr<char[]>> chunks;
+		/// Used bytes in the last chunk
+		size_t chunkUsed = 0;
+		/// Size of the last chunk
+		size_t lastChunkSize = 0;
+		/// Sum of the sizes of all chunks
+		size_t totalBytes = 0;
+		std::vector<std::string_view> strings;
+		std::unordered_map<std::string_view, ID> index;
+		/// Owners of the strings added with StringArena::addView
+		std::vector<std::shared_ptr<const void>> owners;
+	};
+
+	/// @brief Column oriented store for a patient list
+	///
+	/// Each numeric field of Patient is kept in its own contiguous column, so scanning and
+	/// filtering touches only the fields which are used. All strings are interned in a single
+	/// StringArena. Diagnoses, prescriptions and plans of all patients are flattened into
+	/// columns of their own and each level refers to its children with an offset array: the
+	/// children of item i are in [offsets[i], offsets[i + 1]).
+	///
+	/// Rows are accessed through lightweight views (PatientTable::PatientView and friends)
+	/// which mirror the fields of Patient, Diagnose, Prescription and Plan.
+	class PatientTable {
+	public:
+		friend class PatientSnapshot;
+
+		using StringID = StringArena::ID;
+
+		/// @brief Random access iterator which creates a view for each index
+		template <typename View>
+		class Iterator {
+		public:
+			using iterator_category = std::random_access_iterator_tag;
+			using value_type = View;
+			using difference_type = std::ptrdiff_t;
+			using pointer = void;
+			using reference = View;
+
+			Iterator() = default;
+			Iterator(const PatientTable* table, uint32_t index) :
+				table(table),
+				index(index) {
+			}
+
+			View operator*() const {
+				return View(table, index);
+			}
+			View operator[](difference_type n) const {
+				return View(table, uint32_t(index + n));
+			}
+			Iterator& operator++() {
+				++index;
+				return *this;
+			}
+			Iterator operator++(int) {
+				Iterator old = *this;
+				++index;
+				return old;
+			}
+			Iterator& operator--() {
+				--index;
+				return *this;
+			}
+			Iterator operator--(int) {
+				Iterator old = *this;
+				--index;
+				return old;
+			}
+			Iterator& operator+=(difference_type n) {
+				index = uint32_t(index + n);
+				return *this;
+			}
+			Iterator& operator-=(difference_type n) {
+				index = uint32_t(index - n);
+				return *this;
+			}
+			friend Iterator operator+(Iterator it, difference_type n) {
+				return it += n;
+			}
+			friend Iterator operator+(difference_type n, Iterator it) {
+				return it += n;
+			}
+			friend Iterator operator-(Iterator it, difference_type n) {
+				return it -= n;
+			}
+			friend difference_type operator-(const Iterator& a, const Iterator& b) {
+				return difference_type(a.index) - difference_type(b.index);
+			}
+			friend bool operator==(const Iterator& a, const Iterator& b) {
+				return a.index == b.index;
+			}
+			friend bool operator!=(const Iterator& a, const Iterator& b) {
+				return a.index != b.index;
+			}
+			friend bool operator<(const Iterator& a, const Iterator& b) {
+				return a.index < b.index;
+			}
+			friend bool operator>(const Iterator& a, const Iterator& b) {
+				return a.index > b.index;
+			}
+			friend bool operator<=(const Iterator& a, const Iterator& b) {
+				return a.index <= b.index;
+			}
+			friend bool operator>=(const Iterator& a, const Iterator& b) {
+				return a.index >= b.index;
+			}
+
+		private:
+			const PatientTable* table = nullptr;
+			uint32_t index = 0;
+		};
+
+		/// @brief A contiguous range of items of the same level (e.g. the diagnoses of a patient)
+		template <typename View>
+		class Range {
+		public:
+			Range(const PatientTable* table, uint32_t first, uint32_t last) :
+				table(table),
+				first(first),
+				last(last) {
+			}
+			Iterator<View> begin() const {
+				return Iterator<View>(table, first);
+			}
+			Iterator<View> end() const {
+				return Iterator<View>(table, last);
+			}
+			size_t size() const {
+				return last - first;
+			}
+			bool empty() const {
+				return first == last;
+			}
+			View operator[](size_t i) const {
+				return View(table, uint32_t(first + i));
+			}
+
+		private:
+			const PatientTable* table;
+			uint32_t first;
+			uint32_t last;
+		};
+
+		class PlanView {
+		public:
+			PlanView(const PatientTable* table, uint32_t index) :
+				table(table),
+				index(index) {
+			}
+			std::string_view getLabel() const {
+				return table->strings.get(table->planLabel[index]);
+			}
+
+		private:
+			const PatientTable* table;
+			uint32_t index;
+		};
+
+		class PrescriptionView {
+		public:
+			PrescriptionView(const PatientTable* table, uint32_t index) :
+				table(table),
+				index(index) {
+			}
+			std::string_view getDescription() const {
+				return table->strings.get(table->prescriptionDescription[index]);
+			}
+			std::string_view getLabel() const {
+				return table->strings.get(table->prescriptionLabel[index]);
+			}
+			int getNumFractions() const {
+				return table->prescriptionNumFractions[index];
+			}
+			Range<PlanView> getPlans() const {
+				return Range<PlanView>(table, table->planOffsets[index], table->planOffsets[index + 1]);
+			}
+
+		private:
+			const PatientTable* table;
+			uint32_t index;
+		};
+
+		class DiagnoseView {
+		public:
+			DiagnoseView(const PatientTable* table, uint32_t index) :
+				table(table),
+				index(index) {
+			}
+			std::string_view getDescription() const {
+				return table->strings.get(table->diagnoseDescription[index]);
+			}
+			std::string_view getLabel() const {
+				return table->strings.get(table->diagnoseLabel[index]);
+			}
+			/// @brief ID of the label inside PatientTable::getStrings. Equal labels have equal IDs.
+			StringID getLabelID() const {
+				return table->diagnoseLabel[index];
+			}
+			Range<PrescriptionView> getPrescriptions() const {
+				return Range<PrescriptionView>(
+					table,
+					table->prescriptionOffsets[index],
+					table->prescriptionOffsets[index + 1]
+				);
+			}
+
+		private:
+			const PatientTable* table;
+			uint32_t index;
+		};
+
+		class PatientView {
+		public:
+			PatientView(const PatientTable* table, uint32_t row) :
+				table(table),
+				row(row) {
+			}
+			/// @brief Index of the patient inside the table
+			uint32_t getRow() const {
+				return row;
+			}
+			std::string_view getUri() const {
+				return table->strings.get(table->uri[row]);
+			}
+			std::string_view getId() const {
+				return table->strings.get(table->id[row]);
+			}
+			std::string_view getMrn() const {
+				return table->strings.get(table->mrn[row]);
+			}
+			/// @brief ID of the MRN inside PatientTable::getStrings
+			StringID getMrnID() const {
+				return table->mrn[row];
+			}
+			std::string_view getDateOfBirth() const {
+				return table->strings.get(table->dateOfBirth[row]);
+			}
+			std::string_view getFirstName() const {
+				return table->strings.get(table->firstName[row]);
+			}
+			std::string_view getMiddleName() const {
+				return table->strings.get(table->middleName[row]);
+			}
+			std::string_view getLastName() const {
+				return table->strings.get(table->lastName[row]);
+			}
+			Patient::Sex getSex() const {
+				return Patient::Sex(table->sex[row]);
+			}
+			int getFractionsTotal() const {
+				return table->fractionsTotal[row];
+			}
+			int getFractionsCompleted() const {
+				return table->fractionsCompleted[row];
+			}
+			/// @brief Number of fractions which are not delivered yet
+			int getFractionsRemaining() const {
+				return table->fractionsTotal[row] - table->fractionsCompleted[row];
+			}
+			int getWeightKg() const {
+				return table->weightKg[row];
+			}
+			int getRegistrationTime() const {
+				return table->registrationTime[row];
+			}
+			bool isReadyForTreatment() const {
+				return table->readyForTreatment[row] != 0;
+			}
+			Range<DiagnoseView> getDiagnoses() const {
+				return Range<DiagnoseView>(
+					table, table->diagnoseOffsets[row], table->diagnoseOffsets[row + 1]
+				);
+			}
+
+		private:
+			const PatientTable* table;
+			uint32_t row;
+		};
+
+		PatientTable();
+
+		/// @brief Build a table from a patient list
+		/// @param[in] patients Map with patients keyed by their URI, e.g.
+		///		ViewRayClient::PatientList or PatientListSubscription::PatientList
+		template <typename PatientMap>
+		explicit PatientTable(const PatientMap& patients) :
+			PatientTable() {
+			reserve(patients.size());
+			for (const auto& it : patients) {
+				add(it.first, it.second);
+			}
+		}
+
+		PatientTable(const PatientTable&) = delete;
+		PatientTable& operator=(const PatientTable&) = delete;
+		/// @brief Take the patients of another table, which is left empty and usable
+		PatientTable(PatientTable&& other);
+		/// @brief Take the patients of another table, which is left empty and usable
+		PatientTable& operator=(PatientTable&& other);
+
+		/// @brief Exchange the contents of two tables
+		void swap(PatientTable& other) noexcept;
+
+		/// @brief Reserve space in the patient columns
+		/// @param[in] patients Expected number of patients
+		void reserve(size_t patients);
+
+		/// @brief Append a patient with all of its diagnoses
+		/// @param[in] patientUri The URI of the patient
+		/// @param[in] patient The patient data
+		/// @return The row of the new patient
+		uint32_t add(std::string_view patientUri, const Patient& patient);
+
+		/// @brief Number of patients
+		size_t size() const {
+			return uri.size();
+		}
+
+		bool empty() const {
+			return uri.empty();
+		}
+
+		PatientView operator[](size_t row) const {
+			return PatientView(this, uint32_t(row));
+		}
+
+		Iterator<PatientView> begin() const {
+			return Iterator<PatientView>(this, 0);
+		}
+
+		Iterator<PatientView> end() const {
+			return Iterator<PatientView>(this, uint32_t(size()));
+		}
+
+		/// @brief Create a Patient with the data in a row
+		/// Can be used by code which still works with Patient.
+		/// @param[in] row The row of the patient
+		/// @param[in] alloc Allocator for the strings and the diagnoses of the patient
+		Patient toPatient(size_t row, const Patient::allocator_type& alloc = {}) const;
+
+		/// @brief The arena with all strings in the table
+		const StringArena& getStrings() const {
+			return strings;
+		}
+
+		/// @name Columns
+		/// Direct access to the numeric columns, indexed by row
+		/// @{
+		const std::vector<int32_t>& getFractionsTotalColumn() const {
+			return fractionsTotal;
+		}
+		const std::vector<int32_t>& getFractionsCompletedColumn() const {
+			return fractionsCompleted;
+		}
+		const std::vector<int32_t>& getWeightKgColumn() const {
+			return weightKg;
+		}
+		const std::vector<int32_t>& getRegistrationTimeColumn() const {
+			return registrationTime;
+		}
+		/// Values are 0 or 1
+		const std::vector<uint8_t>& getReadyForTreatmentColumn() const {
+			return readyForTreatment;
+		}
+		/// Values are Patient::Sex
+		const std::vector<uint8_t>& getSexColumn() const {
+			return sex;
+		}
+		/// @}
+
+	private:
+		StringArena strings;
+
+		// Patient columns, indexed by row
+		std::vector<StringID> uri;
+		std::vector<StringID> id;
+		std::vector<StringID> mrn;
+		std::vector<StringID> dateOfBirth;
+		std::vector<StringID> firstName;
+		std::vector<StringID> middleName;
+		std::vector<StringID> lastName;
+		std::vector<uint8_t> sex;
+		std::vector<uint8_t> readyForTreatment;
+		std::vector<int32_t> fractionsTotal;
+		std::vector<int32_t> fractionsCompleted;
+		std::vector<int32_t> weightKg;
+		std::vector<int32_t> registrationTime;
+		/// Size is number of patients + 1
+		std::vector<uint32_t> diagnoseOffsets;
+
+		// Diagnose columns
+		std::vector<StringID> diagnoseDescription;
+		std::vector<StringID> diagnoseLabel;
+		/// Size is number of diagnoses + 1
+		std::vector<uint32_t> prescriptionOffsets;
+
+		// Prescription columns
+		std::vector<StringID> prescriptionDescription;
+		std::vector<StringID> prescriptionLabel;
+		std::vector<int32_t> prescriptionNumFractions;
+		/// Size is number of prescriptions + 1
+		std::vector<uint32_t> planOffsets;
+
+		// Plan columns
+		std::vector<StringID> planLabel;
+	};
+}  // namespace ViewRay
@@ -0,0 +1,30 @@
+#pragma once
+#include <string>
+#include <string_view>
+
+namespace ViewRay {
+	/// @brief Encodes {"setSubscriptions": {<uri>: <mode>}} requests without building JSON
+	///
+	/// All requests sent to the server have the same shape and differ only in the URI and the
+	/// subscription mode. The encoder computes the exact size of the request, so that the
+	/// caller can allocate the output (e.g. the payload of a websocket message) once and then
+	/// writes the request directly into it.
+	class RequestEncoder {
+	public:
+		/// @brief Number of bytes written by RequestEncoder::encode
+		/// @param[in] uri The URI of the requested resource
+		/// @param[in] mode The subscription mode e.g. "request" or "subscribe"
+		static size_t encodedSize(std::string_view uri, std::string_view mode);
+
+		/// @brief Append {"setSubscriptions":{"<uri>":"<mode>"}} to out
+		///
+		/// The URI and the mode are escaped as JSON strings.
+		/// @param[in] uri The URI of the requested resource
+		/// @param[in] mode The subscription mode e.g. "request" or "subscribe"
+		/// @param[out] out The string to which the request is appended
+		static void encode(std::string_view uri, std::string_view mode, std::string& out);
+
+		/// @brief Return {"setSubscriptions":{"<uri>":"<mode>"}} in a new string
+		static std::string encode(std::string_view uri, std::string_view mode);
+	};
+}  // namespace ViewRay
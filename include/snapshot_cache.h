@@ -0,0 +1,60 @@
+#pragma once
+#include "client.h"
+#include "patient_snapshot.h"
+#include "patient_table.h"
+#include <future>
+#include <memory>
+#include <string>
+
+namespace ViewRay {
+	/// @brief Patient list kept in an on-disk PatientSnapshot and refreshed from the server
+	///
+	/// On startup SnapshotCache::load maps the snapshot written by a previous run, so the list
+	/// can be shown without waiting for the public:patients request and the request for each
+	/// patient. SnapshotCache::revalidate fetches the list from the server in the background,
+	/// replaces the snapshot on disk and makes the fresh list current.
+	class SnapshotCache {
+	public:
+		using TablePtr = std::shared_ptr<const PatientTable>;
+
+		/// @param[in] client Used to fetch the list. Must outlive the cache.
+		/// @param[in] path Where the snapshot is stored
+		SnapshotCache(ViewRayClient& client, std::string path);
+
+		/// @brief Wait for a pending revalidation
+		~SnapshotCache();
+
+		SnapshotCache(const SnapshotCache&) = delete;
+		SnapshotCache& operator=(const SnapshotCache&) = delete;
+
+		/// @brief Map the snapshot from disk and make it current
+		/// @return The list from the snapshot or an error if there is no valid snapshot
+		WSAsyncResult<TablePtr> load();
+
+		/// @brief (Async) Fetch the list from the server, save it and make it current
+		///
+		/// The list in the snapshot stays current until the fetch completes. If the snapshot
+		/// cannot be saved the fresh list is still made current, but the result is the error.
+		/// If a revalidation is already in progress its future is returned. Must be called
+		/// from a single thread.
+		/// @return Future which will contain the fetched list
+		std::shared_future<WSAsyncResult<TablePtr>> revalidate();
+
+		/// @brief The latest list: the fetched one if a revalidation has completed, otherwise
+		/// the loaded one. Null if there is neither.
+		TablePtr getCurrent() const;
+
+		/// @brief Header of the loaded snapshot. Valid after a successful SnapshotCache::load.
+		const PatientSnapshot::Info& getInfo() const {
+			return info;
+		}
+
+	private:
+		ViewRayClient& client;
+		std::string path;
+		PatientSnapshot::Info info;
+		/// Replaced by the revalidation thread while others can read it
+		TablePtr current;
+		std::shared_future<WSAsyncResult<TablePtr>> revalidation;
+	};
+}  // namespace ViewRay
@@ -0,0 +1,64 @@
+#pragma once
+#include "patient_table.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <shared_mutex>
+#include <string_view>
+
+namespace ViewRay {
+	/// @brief Thread safe StringArena shared by all compact patients of the process
+	///
+	/// Labels, descriptions and names repeat across the patients of a list and across the
+	/// lists of different sites. Interned once, each of them costs a 4 byte symbol per use
+	/// instead of a string with its own allocation.
+	///
+	/// Symbols are never removed, so the table grows with the number of distinct strings, not
+	/// with the number of patients. Reading a symbol does not lock, so views can be read from
+	/// many threads (e.g. by PatientFormatter) while other threads intern new strings.
+	class SymbolTable {
+	public:
+		using Symbol = uint32_t;
+
+		/// The symbol of the empty string
+		static constexpr Symbol empty = 0;
+
+		SymbolTable();
+		SymbolTable(const SymbolTable&) = delete;
+		SymbolTable& operator=(const SymbolTable&) = delete;
+
+		/// @brief The table used by CompactPatient and SharedCompactDiagnoses
+		static SymbolTable& global();
+
+		/// @brief Store the string if it is not already stored
+		/// @return The symbol of the string. Equal strings always have the same symbol.
+		Symbol intern(std::string_view str);
+
+		/// @brief Get the string of a symbol returned by SymbolTable::intern
+		/// @return View which stays valid for the lifetime of the table
+		std::string_view get(Symbol symbol) const {
+			return segments[symbol >> segmentBits].load(std::memory_order_acquire)
+				[symbol & (segmentSize - 1)];
+		}
+
+		/// @brief Number of distinct strings
+		size_t size() const;
+
+		/// @brief Number of bytes used for characters, including unused space in the chunks
+		size_t capacityBytes() const;
+
+	private:
+		static constexpr uint32_t segmentBits = 12;
+		static constexpr uint32_t segmentSize = 1u << segmentBits;
+		/// Limits the table to 2^26 symbols
+		static constexpr uint32_t maxSegments = 1u << 14;
+
+		/// Owns the characters and finds the symbol of a string. Guarded by mutex.
+		StringArena arena;
+		mutable std::shared_mutex mutex;
+		/// Copies of the views of arena, readable without the lock. Segments are allocated as
+		/// needed and never move.
+		std::unique_ptr<std::atomic<std::string_view*>[]> segments;
+		std::unique_ptr<std::unique_ptr<std::string_view[]>[]> ownedSegments;
+	};
+}  // namespace ViewRay
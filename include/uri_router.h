@@ -0,0 +1,204 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace ViewRay {
+	/// @brief Maps resource URIs to values, e.g. handlers, by exact URI or by URI prefix
+	///
+	/// The routes are compiled into a radix trie stored in flat arrays: each node has the
+	/// bytes it consumes and a sorted range of child edges keyed by the next byte. Matching
+	/// reads each byte of the URI at most once and does not allocate, so it is cheaper than
+	/// hashing a long URI and does not depend on the number of routes.
+	///
+	/// An exact route wins over prefix routes and a longer prefix wins over a shorter one. The
+	/// empty prefix matches every URI and can be used as a fallback.
+	///
+	/// Adding or removing a route recompiles the trie. The router is meant to be changed
+	/// rarely and can be read from several threads while it is not changed.
+	/// @tparam T The type of the values. Must be copyable.
+	template <typename T>
+	class UriRouter {
+	public:
+		enum class Match {
+			/// The route matches only its own URI
+			Exact,
+			/// The route matches every URI which starts with its URI
+			Prefix
+		};
+
+		/// @brief Add a route or replace the value of an existing one
+		void add(std::string_view uri, Match match, T value) {
+			const auto it = findRoute(uri, match);
+			if (it != routes.end()) {
+				it->value = std::move(value);
+				return;
+			}
+			routes.push_back({std::string(uri), match, std::move(value)});
+			compile();
+		}
+
+		/// @brief Remove a route if it exists
+		void remove(std::string_view uri, Match match) {
+			const auto it = findRoute(uri, match);
+			if (it != routes.end()) {
+				routes.erase(it);
+				compile();
+			}
+		}
+
+		/// @brief Check if a route is registered, regardless of the routes it can shadow
+		bool contains(std::string_view uri, Match match) const {
+			return findRoute(uri, match) != routes.end();
+		}
+
+		/// @brief Find the value of the most specific route which matches a URI
+		/// @return nullptr if no route matches. The pointer is valid until the routes change.
+		const T* find(std::string_view uri) const {
+			if (nodes.empty()) {
+				return nullptr;
+			}
+			const T* best = nullptr;
+			size_t pos = 0;
+			const Node* node = &nodes[0];
+			for (;;) {
+				const std::string_view label(labels.data() + node->labelBegin, node->labelLength);
+				if (uri.substr(pos, label.size()) != label) {
+					return best;
+				}
+				pos += label.size();
+				if (pos == uri.size() && node->exact != noRoute) {
+					return &routes[node->exact].value;
+				}
+				if (node->prefix != noRoute) {
+					best = &routes[node->prefix].value;
+				}
+				if (pos == uri.size()) {
+					return best;
+				}
+				const Edge* first = edges.data() + node->firstEdge;
+				const Edge* last = first + node->edgeCount;
+				const uint8_t next = uint8_t(uri[pos]);
+				const Edge* edge = std::lower_bound(
+					first, last, next, [](const Edge& e, uint8_t byte) { return e.byte < byte; }
+				);
+				if (edge == last || edge->byte != next) {
+					return best;
+				}
+				node = &nodes[edge->node];
+			}
+		}
+
+		bool empty() const {
+			return routes.empty();
+		}
+
+	private:
+		static constexpr uint32_t noRoute = uint32_t(-1);
+
+		struct Route {
+			std::string uri;
+			Match match;
+			T value;
+		};
+
+		struct Node {
+			/// The bytes consumed by this node are labels[labelBegin, labelBegin + labelLength)
+			uint32_t labelBegin;
+			uint32_t labelLength;
+			/// The children are edges[firstEdge, firstEdge + edgeCount), sorted by byte
+			uint32_t firstEdge;
+			uint32_t edgeCount;
+			/// Index in routes of the exact and the prefix route ending at this node
+			uint32_t exact;
+			uint32_t prefix;
+		};
+
+		struct Edge {
+			/// Compared as unsigned, like std::string orders the URIs
+			uint8_t byte;
+			uint32_t node;
+		};
+
+		typename std::vector<Route>::iterator findRoute(std::string_view uri, Match match) {
+			return std::find_if(routes.begin(), routes.end(), [&](const Route& route) {
+				return route.match == match && route.uri == uri;
+			});
+		}
+
+		typename std::vector<Route>::const_iterator findRoute(std::string_view uri, Match match)
+			const {
+			return std::find_if(routes.begin(), routes.end(), [&](const Route& route) {
+				return route.match == match && route.uri == uri;
+			});
+		}
+
+		void compile() {
+			nodes.clear();
+			edges.clear();
+			labels.clear();
+			if (routes.empty()) {
+				return;
+			}
+			std::vector<uint32_t> order(routes.size());
+			for (uint32_t i = 0; i < order.size(); ++i) {
+				order[i] = i;
+			}
+			std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+				return routes[a].uri < routes[b].uri;
+			});
+			build(order, 0, order.size(), 0);
+		}
+
+		/// Build the node for the routes order[begin, end), which share their first depth bytes
+		/// and are sorted by URI
+		/// @return Index of the node
+		uint32_t build(const std::vector<uint32_t>& order, size_t begin, size_t end, size_t depth) {
+			// The first and the last URI of a sorted range have the longest common prefix of
+			// the range
+			const std::string& first = routes[order[begin]].uri;
+			const std::string& last = routes[order[end - 1]].uri;
+			size_t common = depth;
+			while (common < first.size() && common < last.size() && first[common] == last[common]) {
+				++common;
+			}
+
+			const uint32_t index = uint32_t(nodes.size());
+			const uint32_t labelLength = uint32_t(common - depth);
+			nodes.push_back({uint32_t(labels.size()), labelLength, 0, 0, noRoute, noRoute});
+			labels.append(first, depth, common - depth);
+
+			// Shorter URIs sort first, so the routes ending here come before the children
+			size_t i = begin;
+			for (; i < end && routes[order[i]].uri.size() == common; ++i) {
+				const Route& route = routes[order[i]];
+				(route.match == Match::Exact ? nodes[index].exact : nodes[index].prefix) = order[i];
+			}
+
+			std::vector<Edge> children;
+			while (i < end) {
+				const uint8_t byte = uint8_t(routes[order[i]].uri[common]);
+				size_t groupEnd = i + 1;
+				while (groupEnd < end && uint8_t(routes[order[groupEnd]].uri[common]) == byte) {
+					++groupEnd;
+				}
+				children.push_back({byte, build(order, i, groupEnd, common)});
+				i = groupEnd;
+			}
+			// Appended after the subtrees, so that the edges of each node are contiguous
+			nodes[index].firstEdge = uint32_t(edges.size());
+			nodes[index].edgeCount = uint32_t(children.size());
+			edges.insert(edges.end(), children.begin(), children.end());
+			return index;
+		}
+
+		std::vector<Route> routes;
+		std::vector<Node> nodes;
+		std::vector<Edge> edges;
+		/// The bytes of all nodes, concatenated
+		std::string labels;
+	};
+}  // namespace ViewRay
@@ -1,59 +1,23 @@
 #pragma once
+#include "async_result.h"
 #include "error_code.h"
+#include "metrics.h"
 #include <websocketpp/client.hpp>
 #include <websocketpp/common/memory.hpp>
 #include <websocketpp/common/thread.hpp>
-#include <websocketpp/config/asio_no_tls_client.hpp>
+#include "websocket_config.h"
+#include <asio/strand.hpp>
+#include <asio/thread_pool.hpp>
+#include <atomic>
+#include <functional>
 #include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <unordered_map>
-#include <variant>
+#include <vector>
 
 namespace ViewRay {
-	/// @brief Wraps a result from async request.
-	///
-	/// This is supposed to be used as the value type of future/promise.
-	/// It can hold one of two things an error or the value of type T
-	/// @tparam T The type of the value which this can hold
-	template <typename T>
-	class WSAsyncResult {
-	public:
-		WSAsyncResult() = default;
-		/// @brief Initialize with value
-		/// @param[t] t The value to be stored
-		explicit WSAsyncResult(T t) :
-			data(std::move(t)) {
-		}
-		/// @brief Initialize with error
-		/// @param[in] err The error to store
-		explicit WSAsyncResult(EC::ErrorCode err) :
-			data(std::move(err)) {
-		}
-
-		/// @brief Check if there is an error.
-		/// @return true if this holds an error
-		bool hasError() const {
-			return std::holds_alternative<EC::ErrorCode>(data);
-		}
-		/// @brief Retrieve the data.
-		///
-		/// This is safe to be called only if WSAsyncResult::hasError returns false
-		/// @return The data
-		T getData() const {
-			return std::get<T>(data);
-		}
-
-		/// @brief Retrieve the error
-		///
-		/// This is safe to be called only if WSAsyncResult::hasError returns true
-		/// @return The error
-		const EC::ErrorCode& getError() const {
-			return std::get<EC::ErrorCode>(data);
-		}
-
-	private:
-		std::variant<T, EC::ErrorCode> data;
-	};
-
 	/// @brief Represents a websocket connection managed by WebsocketEndpoint
 	///
 	/// This class wraps websocketpp (https://github.com/zaphoyd/websocketpp) functionality
@@ -77,6 +41,12 @@ namespace ViewRay {
 			Failed
 		};
 
+		/// @brief Function called each time the status of the connection changes
+		/// It receives the id of the connection and the new status. It is called on one of the
+		/// threads which run the websocket client, before the promise passed to onOpen/onFail
+		/// is set.
+		using StatusCallback = std::function<void(int, Status)>;
+
 		/// @brief Store metadata (state) for the connection represented by hdl param
 		/// @param id The id inside the WebsocketEndpoint which created this connection
 		/// @param hdl Handle to the actual connection
@@ -89,6 +59,8 @@ namespace ViewRay {
 			status(Status::Connecting) {
 		}
 
+		virtual ~WebsocketConnectionMetadata() = default;
+
 		/// @brief Retrieve a string representation of the last error which happed with the
 		/// connection
 		const std::string& getError() const {
@@ -100,6 +72,17 @@ namespace ViewRay {
 			return server;
 		}
 
+		/// @brief Extensions accepted by the server, e.g. "permessage-deflate". Empty if the
+		/// server accepted none.
+		const std::string& getExtensions() const {
+			return extensions;
+		}
+
+		/// @brief True if the messages of the connection can be compressed
+		bool isDeflateNegotiated() const {
+			return extensions.find("permessage-deflate") != std::string::npos;
+		}
+
 		/// @brief Get the other end of the connection
 		const std::string& getUri() const {
 			return uri;
@@ -109,6 +92,12 @@ namespace ViewRay {
 			return status;
 		}
 
+		/// @brief Set a function which will be notified when the connection opens, fails or closes
+		/// This must be called before the connection is started.
+		void setStatusCallback(StatusCallback callback) {
+			statusCallback = std::move(callback);
+		}
+
 		/// @brief Retrieve the id of the connection inside WebsocketEndpoint which created it
 		int getID() const {
 			return id;
@@ -119,6 +108,38 @@ namespace ViewRay {
 			return connectionHandle;
 		}
 
+		/// @brief Set the metrics of this connection
+		/// This must be called before the connection is started.
+		void setMetrics(ConnectionMetrics::Ptr connectionMetrics) {
+			metrics = std::move(connectionMetrics);
+		}
+
+		/// @brief Metrics of this connection. Null if the connection is not created by
+		/// WSConnectionManager.
+		const ConnectionMetrics::Ptr& getMetrics() const {
+			return metrics;
+		}
+
+		/// @brief Account for a message sent on this connection
+		/// Must be called right after sending the message, on the thread which sent it.
+		/// @param[in] payload The raw payload of the message
+		void recordSent(const std::string& payload) {
+			const size_t bytes = payload.size();
+			const size_t compressed = deflateBytes ? deflateBytes->takeSent() : 0;
+			if (metrics) {
+				metrics->messagesSent->add();
+				metrics->bytesSent->add(bytes);
+				metrics->wireBytesSent->add(compressed > 0 ? compressed : bytes);
+			}
+		}
+
+		/// @brief Compressed size of the message passed to the message handler
+		/// Must be called from the message handler.
+		/// @return 0 if the message was not compressed
+		size_t takeDeflateBytesReceived() {
+			return deflateBytes ? deflateBytes->takeReceived() : 0;
+		}
+
 		/// @brief Callback called when a connection is opened
 		/// @param[in] client The websocket client used by WebsocketEndpoint which spawned the
 		/// connection
@@ -137,7 +158,9 @@ namespace ViewRay {
 
 			typename Client::connection_ptr con = client->get_con_from_hdl(hdl);
 			server = con->get_response_header("Server");
-			std::cout << "Connection to: " << server << " opened\n";
+			extensions = con->get_response_header("Sec-WebSocket-Extensions");
+			deflateBytes = DeflateBytes::takeHandedOver();
+			notifyStatus();
 			promise->set_value(WSAsyncResult<int>(id));
 		}
 
@@ -150,16 +173,19 @@ namespace ViewRay {
 		///		be able to know when it was opened. The value of the promise will be set with the
 		/// error 		which has occurred.
 		/// @param[in] hdl Handle representing the connection
-		void onFail(
+		virtual void onFail(
 			Client* client,
 			std::shared_ptr<std::promise<WSAsyncResult<int>>> promise,
 			websocketpp::connection_hdl hdl
 		) {
 			status = Status::Failed;
+			// Not opened, so bytes handed over by its extension must not reach another one
+			DeflateBytes::takeHandedOver();
 
 			typename Client::connection_ptr connection = client->get_con_from_hdl(hdl);
 			server = connection->get_response_header("Server");
 			error = connection->get_ec().message();
+			notifyStatus();
 			promise->set_value(WSAsyncResult<int>(EC::ErrorCode("%s", error.c_str())));
 		}
 
@@ -167,7 +193,7 @@ namespace ViewRay {
 		/// @param[in] client The websocket client used by WebsocketEndpoint which spawned the
 		/// connection
 		/// @param[in] hdl Handle representing the connection
-		void onClose(Client* client, websocketpp::connection_hdl hdl) {
+		virtual void onClose(Client* client, websocketpp::connection_hdl hdl) {
 			status = Status::Closed;
 
 			typename Client::connection_ptr connection = client->get_con_from_hdl(hdl);
@@ -176,7 +202,7 @@ namespace ViewRay {
 			  << websocketpp::close::status::get_string(connection->get_remote_close_code())
 			  << "), close reason: " << connection->get_remote_close_reason();
 			error = s.str();
-			std::cout << "Connection to: " << server << " closed\n";
+			notifyStatus();
 		}
 
 		virtual void onMessage(
@@ -186,14 +212,82 @@ namespace ViewRay {
 		) = 0;
 
 	private:
+		void notifyStatus() {
+			if (statusCallback) {
+				statusCallback(id, status);
+			}
+		}
+
 		std::string error;
 		std::string server;
+		/// Sec-WebSocket-Extensions header of the handshake response
+		std::string extensions;
 		std::string uri;
 		websocketpp::connection_hdl connectionHandle;
-		Status status;
+		StatusCallback statusCallback;
+		ConnectionMetrics::Ptr metrics;
+		/// Compressed bytes counted by the permessage-deflate extension of the connection.
+		/// Null if permessage-deflate was not negotiated.
+		DeflateBytes::Ptr deflateBytes;
+		/// Written by the websocket threads, but the connection pool and the manager
+		/// read it from the threads which issue requests.
+		std::atomic<Status> status;
 		int id;
 	};
 
+	/// @brief Map from connection id to connection metadata which is safe to use from any thread
+	///
+	/// Readers load an immutable snapshot of the map and never wait for writers. Writers copy
+	/// the current snapshot, modify the copy and publish it. Connections are added and removed
+	/// rarely compared to how often they are looked up, and only live connections are kept, so
+	/// the copies are small.
+	/// @tparam T The type of the stored values. Must be default constructible and cheap to copy.
+	template <typename T>
+	class ConnectionRegistry {
+	public:
+		using Map = std::unordered_map<int, T>;
+		using Snapshot = std::shared_ptr<const Map>;
+
+		ConnectionRegistry() :
+			current(std::make_shared<const Map>()) {
+		}
+
+		/// @brief Find the value stored for id
+		/// @return The value or default constructed T if there is no such id
+		T find(int id) const {
+			const Snapshot map = snapshot();
+			const auto it = map->find(id);
+			return it == map->end() ? T() : it->second;
+		}
+
+		/// @brief Get an immutable view of all stored values
+		Snapshot snapshot() const {
+			return std::atomic_load(&current);
+		}
+
+		void insert(int id, T value) {
+			std::lock_guard<std::mutex> lock(writeMutex);
+			auto next = std::make_shared<Map>(*current);
+			(*next)[id] = std::move(value);
+			std::atomic_store(&current, Snapshot(std::move(next)));
+		}
+
+		void erase(int id) {
+			std::lock_guard<std::mutex> lock(writeMutex);
+			if (current->count(id) == 0) {
+				return;
+			}
+			auto next = std::make_shared<Map>(*current);
+			next->erase(id);
+			std::atomic_store(&current, Snapshot(std::move(next)));
+		}
+
+	private:
+		Snapshot current;
+		/// Serializes the writers. Readers do not use it.
+		std::mutex writeMutex;
+	};
+
 	/// @brief Class to manage the lifetime of connections to a specific server
 	///
 	/// Follows closely websocketpp tutorial:
@@ -209,15 +303,29 @@ namespace ViewRay {
 			CannotSendMessage
 		};
 
-		using Client = websocketpp::client<websocketpp::config::asio_client>;
+		/// Offers permessage-deflate if built with PATIENT_LIST_PERMESSAGE_DEFLATE
+		using Client = websocketpp::client<ClientConfig>;
 		using Metadata = WebsocketConnectionMetadata<Client>;
+		using StatusCallback = Metadata::StatusCallback;
 
 		WSConnectionManager();
 
 		~WSConnectionManager();
 		/// @brief Setup the main loop which waits for new commands
 		/// This must be called before any other function
-		void init();
+		///
+		/// Handlers of a single connection are serialized by websocketpp, while different
+		/// connections are served in parallel by the websocket threads. Received messages are
+		/// handed to a separate pool of decode threads, so that processing of large messages
+		/// does not block socket reads. Messages of a single connection are processed in order.
+		/// @param[in] ioThreads Number of threads which run the websocket client. Must be at
+		///		least 1.
+		/// @param[in] decodeThreads Number of threads which process received messages. If 0
+		///		messages are processed on the websocket threads.
+		void init(int ioThreads = 1, int decodeThreads = defaultDecodeThreads());
+
+		/// @brief Number of decode threads used by default, equal to the number of cores
+		static int defaultDecodeThreads();
 
 		/// @brief (Async) Connect to a specific URI
 		/// @tparam The metadata which will handle this connection. Its onMessage function will be
@@ -227,6 +335,19 @@ namespace ViewRay {
 		/// @return Future containing the connection ID.
 		template <typename MetadataT>
 		std::future<WSAsyncResult<int>> connect(std::string const& uri) {
+			return connect<MetadataT>(uri, nullptr);
+		}
+
+		/// @brief (Async) Connect to a specific URI and track the status of the connection
+		/// @tparam The metadata which will handle this connection.
+		/// @param[in] uri Where to connect to
+		/// @param[in] onStatusChange Function called when the connection opens, fails or closes
+		/// @return Future containing the connection ID.
+		template <typename MetadataT>
+		std::future<WSAsyncResult<int>> connect(
+			std::string const& uri,
+			StatusCallback onStatusChange
+		) {
 			websocketpp::lib::error_code ec;
 
 			// Create the connection object. This does not initiate connection, yet.
@@ -236,17 +357,32 @@ namespace ViewRay {
 			if (ec) {
 				std::promise<WSAsyncResult<int>> promise;
 				promise.set_value(WSAsyncResult<int>(
-					EC::ErrorCode(ErrorCode::CannotConnect, "%s\n", ec.message())
+					EC::ErrorCode(ErrorCode::CannotConnect, "%s\n", ec.message().c_str())
 				));
 				return promise.get_future();
 			}
 
-			// We always create and save the metadata for the connection. This way
-			// we keep failed connections too. That's not too bad for small apps and
-			// simplifies the logic a bit.
+			// The metadata is kept in the registry while the connection is alive. Failed and
+			// closed connections are removed from it. The handlers below keep the metadata
+			// alive for websocketpp.
 			int newID = nextMetadataID++;
 			typename MetadataT::Ptr metadataPtr(new MetadataT(newID, connection->get_handle(), uri));
-			metadata[newID] = metadataPtr;
+			auto connectionMetrics = std::make_shared<ConnectionMetrics>(metricsRegistry, newID, uri);
+			metadataPtr->setMetrics(connectionMetrics);
+			metadataPtr->setStatusCallback(
+				[this,
+				 onStatusChange = std::move(onStatusChange),
+				 started = std::chrono::steady_clock::now()](int id, Metadata::Status status) {
+					recordStatus(id, status, started);
+					if (onStatusChange) {
+						onStatusChange(id, status);
+					}
+					if (status == Metadata::Status::Closed || status == Metadata::Status::Failed) {
+						metadata.erase(id);
+					}
+				}
+			);
+			metadata.insert(newID, metadataPtr);
 
 			// std::function cannot have non-copyable objects as params
 			std::shared_ptr<std::promise<WSAsyncResult<int>>>
@@ -262,7 +398,7 @@ namespace ViewRay {
 			));
 
 			connection->set_fail_handler(websocketpp::lib::bind(
-				&MetadataT::onFail,
+				&Metadata::onFail,
 				metadataPtr,
 				&endpoint,
 				promisePtr,
@@ -270,16 +406,35 @@ namespace ViewRay {
 			));
 
 			connection->set_close_handler(websocketpp::lib::bind(
-				&MetadataT::onClose, metadataPtr, &endpoint, websocketpp::lib::placeholders::_1
+				&Metadata::onClose, metadataPtr, &endpoint, websocketpp::lib::placeholders::_1
 			));
 
-			connection->set_message_handler(websocketpp::lib::bind(
-				&MetadataT::onMessage,
-				static_cast<MetadataT*>(metadataPtr.get()),
-				&endpoint,
-				websocketpp::lib::placeholders::_1,
-				websocketpp::lib::placeholders::_2
-			));
+			if (decodePool) {
+				// The websocket thread only hands the message to the decode threads. The strand
+				// keeps the messages of this connection in the order they were received.
+				auto strand = asio::make_strand(decodePool->get_executor());
+				connection->set_message_handler(
+					[this, metadataPtr, connectionMetrics, strand](
+						websocketpp::connection_hdl hdl, Client::message_ptr msg
+					) {
+						recordReceived(*metadataPtr, *connectionMetrics, msg);
+						connectionMetrics->decodeQueueDepth->add(1);
+						asio::post(strand, [this, metadataPtr, connectionMetrics, hdl, msg]() {
+							connectionMetrics->decodeQueueDepth->add(-1);
+							metadataPtr->onMessage(&endpoint, hdl, msg);
+						});
+					}
+				);
+			} else {
+				connection->set_message_handler(
+					[this, metadataPtr, connectionMetrics](
+						websocketpp::connection_hdl hdl, Client::message_ptr msg
+					) {
+						recordReceived(*metadataPtr, *connectionMetrics, msg);
+						metadataPtr->onMessage(&endpoint, hdl, msg);
+					}
+				);
+			}
 
 			endpoint.connect(connection);
 			return promisePtr->get_future();
@@ -315,14 +470,229 @@ namespace ViewRay {
 		/// @param[in] handle A handle representing the connection. It must be
 		///		create by this manager.
 		/// @param[in] message Data to send
+		/// The message is not accounted in the metrics of the connection. If it is compressed,
+		/// its compressed size is added to the next message which is.
 		EC::ErrorCode send(websocketpp::connection_hdl, const std::string& message);
 
+		/// @brief Create an empty text message for a connection
+		///
+		/// The payload can be written directly through message->get_raw_payload() and the
+		/// message sent with the overload of WSConnectionManager::send which takes it. This
+		/// avoids building the payload in a separate string and copying it into a message.
+		/// A message can be sent only once, because websocketpp masks the payload in place.
+		/// @param[in] handle A handle representing the connection
+		/// @param[in] size Number of bytes reserved for the payload
+		/// @return The message or nullptr if the connection does not exist anymore
+		Client::message_ptr createMessage(websocketpp::connection_hdl handle, size_t size);
+
+		/// @brief Send a message created with WSConnectionManager::createMessage
+		/// @param[in] handle A handle representing the connection. It must be
+		///		create by this manager.
+		/// @param[in] message The message to send
+		EC::ErrorCode send(websocketpp::connection_hdl handle, Client::message_ptr message);
+
+		/// @brief Metrics of the connections managed by this manager
+		///
+		/// Besides the per connection metrics (see ConnectionMetrics) it has the handshake time
+		/// and the number of opened, failed, closed and currently open connections. Users of the
+		/// manager can register their own metrics in it.
+		MetricsRegistry& getMetrics();
+
+		/// @brief Get the metadata of a live connection
+		/// @param[in] id ID of the connection inside this manager
+		/// @return The metadata or nullptr if the connection has failed, was closed or the id is
+		///		unknown
 		typename Metadata::Ptr getMetadata(int id);
 
+		/// @brief Call a function on one of the websocket threads after a delay
+		/// Does nothing if the manager is being destroyed. Pending calls are dropped when the
+		/// manager is destroyed.
+		/// @param[in] delayMs Delay in milliseconds
+		/// @param[in] function The function to call
+		void schedule(int delayMs, std::function<void()> function);
+
+		/// @brief Call a function on one of the websocket threads as soon as possible
+		/// Unlike WSConnectionManager::schedule the function is called even if the manager is
+		/// being destroyed, before the destructor returns.
+		/// @param[in] function The function to call
+		void post(std::function<void()> function);
+
+		/// @brief Delay before the next attempt to reopen a lost connection
+		/// The delay grows exponentially with the number of failed attempts up to a limit.
+		/// @param[in] failedAttempts How many attempts have failed so far
+		int getBackoffDelay(int failedAttempts) const;
+
+		/// @brief Set how many connections are kept open to each URI used with acquire
+		/// This must be called before the first call to acquire.
+		/// @param[in] size Number of connections per URI. Must be at least 1.
+		void setPoolSize(int size);
+
+		/// @brief (Async) Get a warm connection to uri from the connection pool
+		///
+		/// The first call for a given URI opens WSConnectionManager::setPoolSize connections to
+		/// it. The connections are kept open and handed out in round-robin fashion, so that
+		/// multiple requests can be multiplexed over them. When a pooled connection closes or
+		/// fails it is reopened in the background with exponential backoff.
+		/// @tparam MetadataT The metadata which will handle the pooled connections. All calls
+		///		for the same URI must use the same type.
+		/// @param[in] uri Where to connect to
+		/// @return Future containing the connection ID. It is ready right away if there is an
+		///		opened connection in the pool.
+		template <typename MetadataT>
+		std::shared_future<WSAsyncResult<int>> acquire(const std::string& uri) {
+			std::lock_guard<std::mutex> lock(poolMutex);
+			return pickPooledConnection(uri, getPool<MetadataT>(uri));
+		}
+
+		/// Receives the ID of a pooled connection or the error
+		using AcquireCallback = std::function<void(const WSAsyncResult<int>&)>;
+
+		/// @brief (Async) Get a warm connection to uri from the connection pool without
+		/// blocking
+		///
+		/// Same as WSConnectionManager::acquire, but the connection is passed to a callback
+		/// instead of a future, so that nothing has to wait for it.
+		/// @tparam MetadataT The metadata which will handle the pooled connections
+		/// @param[in] uri Where to connect to
+		/// @param[in] callback Called on the calling thread if there is an opened connection in
+		///		the pool or all connections are lost. Otherwise called on a websocket thread
+		///		once a connection opens or fails. Never called with a lock of the manager held.
+		template <typename MetadataT>
+		void acquire(const std::string& uri, AcquireCallback callback) {
+			std::unique_lock<std::mutex> lock(poolMutex);
+			WSAsyncResult<int> result;
+			if (!pickPooledConnection(uri, getPool<MetadataT>(uri), callback, result)) {
+				return;
+			}
+			lock.unlock();
+			callback(result);
+		}
+
 	private:
-		std::unordered_map<int, typename Metadata::Ptr> metadata;
-		websocketpp::lib::shared_ptr<websocketpp::lib::thread> thread;
+		enum class PooledState {
+			Connecting,
+			Opened,
+			Backoff
+		};
+
+		/// @brief A connection slot of the pool. When the connection is lost the slot is reused
+		/// for the new connection.
+		struct PooledConnection {
+			std::shared_future<WSAsyncResult<int>> ready;
+			Client::timer_ptr reconnectTimer;
+			PooledState state = PooledState::Connecting;
+			int failedAttempts = 0;
+			/// ID of the connection once it is opened
+			int id = -1;
+			/// Callbacks of WSConnectionManager::acquire waiting for the connection to open
+			std::vector<AcquireCallback> waiters;
+		};
+
+		struct ConnectionPool {
+			/// Type erased call to connect<MetadataT> used to (re)open the pooled connections
+			std::function<std::future<WSAsyncResult<int>>(const std::string&, StatusCallback)>
+				connect;
+			std::vector<PooledConnection> connections;
+			/// Where to start looking for an opened connection, used for round-robin
+			size_t next = 0;
+		};
+
+		/// Get the pool for uri, opening its connections if it is used for the first time.
+		/// poolMutex must be locked.
+		template <typename MetadataT>
+		ConnectionPool& getPool(const std::string& uri) {
+			auto poolIt = pools.find(uri);
+			if (poolIt == pools.end()) {
+				ConnectionPool pool;
+				pool.connect = [this](const std::string& uri, StatusCallback onStatusChange) {
+					return connect<MetadataT>(uri, std::move(onStatusChange));
+				};
+				pool.connections.resize(poolSize);
+				poolIt = pools.emplace(uri, std::move(pool)).first;
+				for (int i = 0; i < poolSize; ++i) {
+					startPooledConnect(poolIt->first, poolIt->second, i);
+				}
+			}
+			return poolIt->second;
+		}
+
+		/// Open the connection in the given slot of the pool. poolMutex must be locked.
+		void startPooledConnect(const std::string& uri, ConnectionPool& pool, int index);
+		/// Index of an opened connection of the pool, advancing the round-robin, or of a
+		/// connecting one if none is opened. -1 if all connections are lost. poolMutex must be
+		/// locked.
+		int findPooledConnection(ConnectionPool& pool);
+		/// Pick an opened connection from the pool. poolMutex must be locked.
+		std::shared_future<WSAsyncResult<int>> pickPooledConnection(
+			const std::string& uri,
+			ConnectionPool& pool
+		);
+		/// Pick an opened connection from the pool or add the callback to the waiters of a
+		/// connecting one. poolMutex must be locked.
+		/// @param[out] result Receives the connection ID or the error, if there is no need to
+		///		wait
+		/// @return false if the callback was added to the waiters
+		bool pickPooledConnection(
+			const std::string& uri,
+			ConnectionPool& pool,
+			const AcquireCallback& callback,
+			WSAsyncResult<int>& result
+		);
+		/// Schedule reopening of a lost pooled connection. poolMutex must be locked.
+		void scheduleReconnect(const std::string& uri, ConnectionPool& pool, int index);
+		/// Status callback of all pooled connections. Called on the websocket threads.
+		void onPooledStatus(const std::string& uri, int index, int id, Metadata::Status status);
+		/// Update the connection metrics when the status of a connection changes
+		/// @param[in] started When the connection was started
+		void recordStatus(
+			int id,
+			Metadata::Status status,
+			std::chrono::steady_clock::time_point started
+		);
+		static void recordReceived(
+			Metadata& connection,
+			ConnectionMetrics& connectionMetrics,
+			const Client::message_ptr& msg
+		) {
+			const size_t bytes = msg->get_payload().size();
+			const size_t compressed = connection.takeDeflateBytesReceived();
+			connectionMetrics.messagesReceived->add();
+			connectionMetrics.bytesReceived->add(bytes);
+			connectionMetrics.wireBytesReceived->add(compressed > 0 ? compressed : bytes);
+		}
+
+		/// Declared first so that it outlives the endpoint, whose handlers update the metrics
+		MetricsRegistry metricsRegistry;
+		/// Time from starting a connection until it is opened
+		std::shared_ptr<Histogram> handshakeSeconds;
+		std::shared_ptr<Counter> connectionsOpened;
+		/// Opened connections on which permessage-deflate was negotiated
+		std::shared_ptr<Counter> connectionsDeflate;
+		std::shared_ptr<Counter> connectionsFailed;
+		std::shared_ptr<Counter> connectionsClosed;
+		std::shared_ptr<Gauge> connectionsOpen;
+
+		/// Connections can be created from the callers of connect/acquire and from the websocket
+		/// threads when the pool reconnects, and looked up from any thread.
+		ConnectionRegistry<typename Metadata::Ptr> metadata;
+		std::unordered_map<std::string, ConnectionPool> pools;
+		/// Timers started by WSConnectionManager::schedule whose handlers have not run yet, by
+		/// ID. Each handler removes its own timer.
+		std::unordered_map<uint64_t, Client::timer_ptr> scheduledTimers;
+		uint64_t nextTimerID;
+		/// Guards pools, scheduledTimers, nextTimerID and stopping
+		std::mutex poolMutex;
+		std::vector<websocketpp::lib::shared_ptr<websocketpp::lib::thread>> threads;
+		/// Threads which process received messages. Null if messages are processed on the
+		/// websocket threads.
+		std::unique_ptr<asio::thread_pool> decodePool;
 		Client endpoint;
-		int nextMetadataID;
+		std::atomic<int> nextMetadataID;
+		int poolSize;
+		/// Delay before the first reconnect attempt, doubled on each failed attempt
+		int initialBackoffMs;
+		int maxBackoffMs;
+		/// Set when the manager is destroyed, so that closing connections are not reopened
+		bool stopping;
 	};
 }  // namespace ViewRay
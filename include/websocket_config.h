@@ -0,0 +1,155 @@
+#pragma once
+#include <websocketpp/config/asio_no_tls_client.hpp>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <utility>
+
+#ifdef PATIENT_LIST_PERMESSAGE_DEFLATE
+#include <websocketpp/extensions/permessage_deflate/enabled.hpp>
+#endif
+
+namespace ViewRay {
+	/// @brief Compressed size of the messages received and sent on one connection
+	///
+	/// Kept by the permessage-deflate extension of the connection, which adds the bytes of
+	/// each frame it inflates or deflates. The connection takes them when it handles or sends
+	/// a message: websocketpp passes a message to the message handler right after inflating
+	/// its last frame, and deflates a message within send, both on the thread of the call.
+	/// Without permessage-deflate the connection has none.
+	class DeflateBytes {
+	public:
+		using Ptr = std::shared_ptr<DeflateBytes>;
+
+		void addReceived(size_t bytes) {
+			received.fetch_add(bytes, std::memory_order_relaxed);
+		}
+
+		void addSent(size_t bytes) {
+			sent.fetch_add(bytes, std::memory_order_relaxed);
+		}
+
+		/// @brief Compressed size of the messages received since the last call
+		size_t takeReceived() {
+			return received.exchange(0, std::memory_order_relaxed);
+		}
+
+		/// @brief Compressed size of the messages sent since the last call
+		size_t takeSent() {
+			return sent.exchange(0, std::memory_order_relaxed);
+		}
+
+		/// @brief Pass the bytes of a connection from its extension to its open handler
+		///
+		/// websocketpp does not tell the extension which connection it belongs to, but it
+		/// negotiates the extension of a client connection and calls the open handler right
+		/// after, on the same thread.
+		static void handOver(Ptr bytes) {
+			negotiated() = std::move(bytes);
+		}
+
+		/// @brief Take the bytes handed over on this thread
+		/// @return nullptr if permessage-deflate was not negotiated for the connection
+		static Ptr takeHandedOver() {
+			return std::exchange(negotiated(), nullptr);
+		}
+
+	private:
+		static Ptr& negotiated() {
+			thread_local Ptr bytes;
+			return bytes;
+		}
+
+		std::atomic<size_t> received{0};
+		std::atomic<size_t> sent{0};
+	};
+
+#ifdef PATIENT_LIST_PERMESSAGE_DEFLATE
+	/// @brief permessage-deflate extension which counts the compressed bytes in DeflateBytes
+	///
+	/// websocketpp calls the extension through the concrete type from the config, so hiding
+	/// negotiate, compress and decompress is enough. Each connection has its own extension,
+	/// so the counters are never shared between connections.
+	template <typename Config>
+	class CountingDeflate : public websocketpp::extensions::permessage_deflate::enabled<Config> {
+	public:
+		using Base = websocketpp::extensions::permessage_deflate::enabled<Config>;
+
+		CountingDeflate() = default;
+		CountingDeflate(const CountingDeflate&) = delete;
+		CountingDeflate& operator=(const CountingDeflate&) = delete;
+
+		auto negotiate(const websocketpp::http::attribute_list& offer) {
+			auto result = Base::negotiate(offer);
+			if (!result.first) {
+				DeflateBytes::handOver(bytes);
+			}
+			return result;
+		}
+
+		/// Counted only if it succeeds, since then the message is always sent
+		websocketpp::lib::error_code compress(const std::string& in, std::string& out) {
+			const size_t before = out.size();
+			const websocketpp::lib::error_code ec = Base::compress(in, out);
+			if (!ec) {
+				bytes->addSent(out.size() - before);
+			}
+			return ec;
+		}
+
+		/// Also called with the 4 byte tail of the deflate stream which is stripped from each
+		/// message, so a compressed message is counted with 4 extra bytes
+		websocketpp::lib::error_code decompress(const uint8_t* buf, size_t len, std::string& out) {
+			bytes->addReceived(len);
+			return Base::decompress(buf, len, out);
+		}
+
+	private:
+		/// Shared with the metadata of the connection, which may outlive the extension
+		const DeflateBytes::Ptr bytes = std::make_shared<DeflateBytes>();
+	};
+
+	/// @brief websocketpp client config which offers permessage-deflate to the server
+	///
+	/// Same as websocketpp::config::asio_client with the extension enabled. The offer is the
+	/// one generated by websocketpp: the client compresses each message on its own, while the
+	/// server can keep its compression context between messages (context takeover), which is
+	/// what makes the repetitive responses small. If the server does not accept the offer,
+	/// the messages are sent and received uncompressed.
+	struct DeflateClientConfig : public websocketpp::config::asio_client {
+		using type = DeflateClientConfig;
+		using base = websocketpp::config::asio_client;
+
+		using concurrency_type = base::concurrency_type;
+		using request_type = base::request_type;
+		using response_type = base::response_type;
+		using message_type = base::message_type;
+		using con_msg_manager_type = base::con_msg_manager_type;
+		using endpoint_msg_manager_type = base::endpoint_msg_manager_type;
+		using alog_type = base::alog_type;
+		using elog_type = base::elog_type;
+		using rng_type = base::rng_type;
+
+		struct transport_config : public base::transport_config {
+			using concurrency_type = type::concurrency_type;
+			using alog_type = type::alog_type;
+			using elog_type = type::elog_type;
+			using request_type = type::request_type;
+			using response_type = type::response_type;
+			using socket_type = websocketpp::transport::asio::basic_socket::endpoint;
+		};
+
+		using transport_type = websocketpp::transport::asio::endpoint<transport_config>;
+
+		struct permessage_deflate_config {};
+		using permessage_deflate_type = CountingDeflate<permessage_deflate_config>;
+	};
+
+	/// Config of the websocket client used by WSConnectionManager
+	using ClientConfig = DeflateClientConfig;
+#else
+	/// Config of the websocket client used by WSConnectionManager
+	using ClientConfig = websocketpp::config::asio_client;
+#endif
+}  // namespace ViewRay
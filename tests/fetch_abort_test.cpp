@@ -0,0 +1,105 @@
+// Tests of aborting ViewRayClient::fetchPatientListAsync against the mock server. A fetch
+// which is cancelled or times out fails with its own error and never requests patients
+// afterwards, also when the abort races with acquiring the connection. Each case uses a new
+// client, so that the fetch starts while the pooled connection is still being opened.
+#include "client.h"
+#include "mock_server.h"
+#include "test_util.h"
+#include <future>
+#include <memory>
+#include <thread>
+
+using namespace ViewRay;
+using namespace ViewRay::Bench;
+using std::chrono::milliseconds;
+
+namespace {
+	constexpr int patients = 20;
+	/// Delay of each response of the server. The aborts come before public:patients arrives.
+	constexpr int latencyMs = 50;
+	constexpr int iterations = 20;
+
+	MockViewRayServer* server = nullptr;
+
+	/// Start a fetch, optionally cancel it right away and wait for its result
+	WSAsyncResult<FetchResult> fetch(ViewRayClient& client, milliseconds timeout, bool cancel) {
+		auto promise = std::make_shared<std::promise<WSAsyncResult<FetchResult>>>();
+		std::future<WSAsyncResult<FetchResult>> result = promise->get_future();
+		FetchOptions options;
+		options.timeout = timeout;
+		const FetchCancellation cancellation = client.fetchPatientListAsync(
+			std::move(options),
+			[promise](WSAsyncResult<FetchResult> fetched) {
+				promise->set_value(std::move(fetched));
+			}
+		);
+		if (cancel) {
+			cancellation.cancel();
+		}
+		return result.get();
+	}
+
+	/// Number of requests received by the server once the responses to a request sent before
+	/// the abort would have arrived
+	size_t requestsAfterAbort() {
+		std::this_thread::sleep_for(milliseconds(3 * latencyMs));
+		return server->takeStats().requests;
+	}
+
+	void testCompletes() {
+		ViewRayClient client(server->getAddress(), 1);
+		CHECK(!client.init().hasError());
+		server->takeStats();
+		const WSAsyncResult<FetchResult> result = fetch(client, milliseconds(0), false);
+		CHECK(!result.hasError());
+		if (!result.hasError()) {
+			CHECK(int(result.getData().patients->size()) == patients);
+			CHECK(result.getData().missing.empty());
+		}
+		CHECK(requestsAfterAbort() == size_t(1 + patients));
+	}
+
+	void testCancelledWhileConnecting() {
+		for (int i = 0; i < iterations; ++i) {
+			ViewRayClient client(server->getAddress(), 1);
+			CHECK(!client.init().hasError());
+			server->takeStats();
+			const WSAsyncResult<FetchResult> result = fetch(client, milliseconds(0), true);
+			CHECK(result.hasError() && result.getError().getStatus() == ViewRayClient::Cancelled);
+			// At most public:patients was requested, by a connection which claimed the fetch
+			// before the cancellation
+			CHECK(requestsAfterAbort() <= 1);
+		}
+	}
+
+	void testTimedOutWhileConnecting() {
+		for (int i = 0; i < iterations; ++i) {
+			ViewRayClient client(server->getAddress(), 1);
+			CHECK(!client.init().hasError());
+			server->takeStats();
+			const WSAsyncResult<FetchResult> result = fetch(client, milliseconds(1), false);
+			CHECK(result.hasError() && result.getError().getStatus() == ViewRayClient::Timeout);
+			CHECK(requestsAfterAbort() <= 1);
+		}
+	}
+}  // namespace
+
+int main() {
+	MockServerOptions options;
+	options.data.patients = patients;
+	options.latencyMs = latencyMs;
+	options.port = 9102;
+	MockViewRayServer mockServer(options);
+	const EC::ErrorCode err = mockServer.start();
+	if (err.hasError()) {
+		std::fprintf(stderr, "%s\n", err.getMessage());
+		return 1;
+	}
+	server = &mockServer;
+
+	Test::run("fetch completes", testCompletes);
+	Test::run("cancelled while connecting", testCancelledWhileConnecting);
+	Test::run("timed out while connecting", testTimedOutWhileConnecting);
+	mockServer.stop();
+	return Test::result();
+}
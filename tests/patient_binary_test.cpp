@@ -0,0 +1,246 @@
+// Tests that PatientBinaryCodec and the stream of PatientBinaryWriter read back what was
+// written and reject truncated and malformed records without allocating for them.
+#include "patient_binary.h"
+#include "test_util.h"
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <string_view>
+
+using namespace ViewRay;
+
+namespace {
+	Patient makePatient(const std::string& id, int diagnoses) {
+		const nlohmann::json plan = {{"type", "Plan"}, {"label", "Plan " + id}};
+		const nlohmann::json prescription = {
+			{"type", "Prescription"},
+			{"description", "Prescription " + id},
+			{"label", "Label"},
+			{"num_fractions", -5},
+			{"plans", {plan, plan}}
+		};
+		const nlohmann::json diagnose = {
+			{"type", "Diagnosis"},
+			{"description", "Diagnose " + id},
+			{"label", "Label"},
+			{"prescriptions", {prescription}}
+		};
+		Patient patient(nlohmann::json{
+			{"id", id},
+			{"mrn", "MRN" + id},
+			{"date_of_birth", "1970-01-01"},
+			{"first_name", "First"},
+			{"middle_name", ""},
+			{"last_name", "Last"},
+			{"sex", "M"},
+			{"fractions_total", 30},
+			{"fractions_completed", 2147483647},
+			{"weight_kg", 70},
+			{"registration_time", -2147483647 - 1},
+			{"ready_for_treatment", true}
+		});
+		nlohmann::json list = nlohmann::json::array();
+		for (int i = 0; i < diagnoses; ++i) {
+			list.push_back(diagnose);
+		}
+		patient.diagnosesFromJson(list);
+		return patient;
+	}
+
+	/// Encode a patient and return the body of its record
+	std::string encodeBody(std::string_view uri, const Patient& patient) {
+		std::string record;
+		PatientBinaryCodec::encode(record, uri, patient);
+		const char* const end = record.data() + record.size();
+		const char* pos = record.data();
+		uint64_t size = 0;
+		CHECK(PatientBinaryCodec::readVarint(pos, end, size));
+		CHECK(size == uint64_t(end - pos));
+		return std::string(pos, end);
+	}
+
+	bool decode(std::string_view body) {
+		std::string uri;
+		Patient patient;
+		return PatientBinaryCodec::decode(body, uri, patient);
+	}
+
+	void checkSame(const Patient& actual, const Patient& expected) {
+		CHECK(actual.hasSameSummary(expected));
+		CHECK(actual.hasSameDiagnoses(expected.getDiagnoses()));
+	}
+
+	void testRoundTrip() {
+		const Patient patients[] = {makePatient("1", 2), makePatient("2", 0), Patient()};
+		for (const Patient& expected : patients) {
+			const std::string body = encodeBody("patient:1", expected);
+			std::string uri;
+			Patient actual;
+			CHECK(PatientBinaryCodec::decode(body, uri, actual));
+			CHECK(uri == "patient:1");
+			checkSame(actual, expected);
+		}
+	}
+
+	void testTruncatedRecord() {
+		const std::string body = encodeBody("patient:1", makePatient("1", 2));
+		for (size_t size = 0; size < body.size(); ++size) {
+			CHECK(!decode(std::string_view(body).substr(0, size)));
+		}
+		// Bytes after the last field are not ignored
+		CHECK(!decode(body + '\0'));
+	}
+
+	void testOversizedCount() {
+		// Without diagnoses the record ends with their count, with one diagnose without
+		// prescriptions it ends with the count of prescriptions
+		Patient noPrescriptions = makePatient("1", 0);
+		Patient::DiagnoseList diagnoses(noPrescriptions.get_allocator());
+		diagnoses.emplace_back().setLabel("Label");
+		noPrescriptions.setDiagnoses(std::move(diagnoses));
+		const std::string bodies[] = {
+			encodeBody("patient:1", makePatient("1", 0)),
+			encodeBody("patient:1", noPrescriptions)
+		};
+		for (const std::string& body : bodies) {
+			CHECK(body.back() == '\0');
+			CHECK(decode(body));
+			for (const uint64_t count : {uint64_t(1), uint64_t(1) << 40, UINT64_MAX}) {
+				std::string oversized = body.substr(0, body.size() - 1);
+				PatientBinaryCodec::writeVarint(oversized, count);
+				CHECK(!decode(oversized));
+			}
+		}
+
+		// A count which would fit if each element took a single byte
+		std::string body = bodies[0].substr(0, bodies[0].size() - 1);
+		PatientBinaryCodec::writeVarint(body, 2);
+		body.append(5, '\0');
+		CHECK(!decode(body));
+	}
+
+	void testInvalidValues() {
+		const std::string body = encodeBody("", Patient());
+		// uri, id, mrn, date of birth, first, middle and last name are empty strings
+		constexpr size_t sex = 7;
+		constexpr size_t readyForTreatment = 12;
+		CHECK(decode(body));
+
+		std::string invalid = body;
+		invalid[sex] = char(uint8_t(Patient::Sex::Unknown) + 1);
+		CHECK(!decode(invalid));
+		invalid = body;
+		invalid[readyForTreatment] = 2;
+		CHECK(!decode(invalid));
+
+		// A number which does not fit into 32 bits
+		invalid = body.substr(0, sex + 1);
+		PatientBinaryCodec::writeVarint(invalid, uint64_t(1) << 32);
+		invalid += body.substr(sex + 2);
+		CHECK(!decode(invalid));
+	}
+
+	void testVarint() {
+		for (const uint64_t value : {uint64_t(0), uint64_t(127), uint64_t(128), UINT64_MAX}) {
+			std::string out;
+			PatientBinaryCodec::writeVarint(out, value);
+			const char* pos = out.data();
+			uint64_t read = 1;
+			CHECK(PatientBinaryCodec::readVarint(pos, out.data() + out.size(), read));
+			CHECK(read == value);
+			CHECK(pos == out.data() + out.size());
+
+			pos = out.data();
+			CHECK(!PatientBinaryCodec::readVarint(pos, out.data() + out.size() - 1, read));
+		}
+		// Longer than 64 bits
+		const std::string tooLong(10, char(0x80));
+		const char* pos = tooLong.data();
+		uint64_t read = 0;
+		CHECK(!PatientBinaryCodec::readVarint(pos, tooLong.data() + tooLong.size(), read));
+	}
+
+	/// Write patients with PatientBinaryWriter and return the stream
+	std::string writeStream(int count) {
+		std::ostringstream out;
+		PatientBinaryWriter writer(out);
+		for (int i = 0; i < count; ++i) {
+			writer.write("patient:" + std::to_string(i), makePatient(std::to_string(i), i % 3));
+		}
+		CHECK(writer.finish());
+		return out.str();
+	}
+
+	/// Read a stream to its end and return the number of patients read
+	int readStream(const std::string& stream, int expectedError) {
+		std::istringstream in(stream);
+		PatientBinaryReader reader(in);
+		std::string uri;
+		Patient patient;
+		int count = 0;
+		while (reader.next(uri, patient)) {
+			CHECK(uri == "patient:" + std::to_string(count));
+			checkSame(patient, makePatient(std::to_string(count), count % 3));
+			++count;
+		}
+		CHECK(reader.getError().getStatus() == expectedError);
+		// Stays at the end
+		CHECK(!reader.next(uri, patient));
+		return count;
+	}
+
+	void testStream() {
+		// Enough patients for the writer to flush several times
+		const std::string stream = writeStream(1000);
+		CHECK(readStream(stream, PatientBinaryReader::Success) == 1000);
+		CHECK(readStream(writeStream(0), PatientBinaryReader::Success) == 0);
+	}
+
+	void testTruncatedStream() {
+		const std::string stream = writeStream(3);
+		// Without the end marker
+		CHECK(readStream(stream.substr(0, stream.size() - 1), PatientBinaryReader::Truncated) == 3);
+		// Inside the last record
+		CHECK(readStream(stream.substr(0, stream.size() - 2), PatientBinaryReader::Truncated) == 2);
+		// Inside the header
+		CHECK(readStream(stream.substr(0, 3), PatientBinaryReader::InvalidHeader) == 0);
+	}
+
+	void testInvalidStream() {
+		const std::string header = writeStream(0).substr(0, 5);
+
+		std::string stream = "XRPB" + header.substr(4);
+		CHECK(readStream(stream, PatientBinaryReader::InvalidHeader) == 0);
+		stream = header.substr(0, 4) + char(PatientBinaryWriter::version + 1);
+		CHECK(readStream(stream, PatientBinaryReader::UnsupportedVersion) == 0);
+
+		// A record which is too large is rejected before anything is allocated for it
+		for (const uint64_t size : {uint64_t(1) << 40, UINT64_MAX}) {
+			stream = header;
+			PatientBinaryCodec::writeVarint(stream, size);
+			CHECK(readStream(stream, PatientBinaryReader::InvalidRecord) == 0);
+		}
+		// A length which never ends
+		stream = header + std::string(12, char(0xff));
+		CHECK(readStream(stream, PatientBinaryReader::InvalidRecord) == 0);
+
+		// A malformed record
+		stream = header;
+		PatientBinaryCodec::writeVarint(stream, 1);
+		stream += char(5);
+		stream += char(0);
+		CHECK(readStream(stream, PatientBinaryReader::InvalidRecord) == 0);
+	}
+}  // namespace
+
+int main() {
+	Test::run("round trip", testRoundTrip);
+	Test::run("truncated record", testTruncatedRecord);
+	Test::run("oversized count", testOversizedCount);
+	Test::run("invalid values", testInvalidValues);
+	Test::run("varint", testVarint);
+	Test::run("stream", testStream);
+	Test::run("truncated stream", testTruncatedStream);
+	Test::run("invalid stream", testInvalidStream);
+	return Test::result();
+}
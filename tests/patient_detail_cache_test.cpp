@@ -0,0 +1,184 @@
+// Tests of PatientDetailCache: expiration, least recently used eviction, invalidation and
+// reconfiguration, and that the diagnoses are copied in and out exactly.
+#include "patient_detail_cache.h"
+#include "test_util.h"
+#include <memory_resource>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace ViewRay;
+using Clock = PatientDetailCache::Clock;
+using std::chrono::milliseconds;
+
+namespace {
+	/// Diagnoses which differ by index. Labels repeat between the plans, like on the server.
+	Patient::DiagnoseList makeDiagnoses(int index) {
+		const std::string suffix = std::to_string(index);
+		nlohmann::json plans = nlohmann::json::array();
+		for (int i = 0; i < 3; ++i) {
+			plans.push_back({{"type", "Plan"}, {"label", "Plan " + std::to_string(i % 2)}});
+		}
+		const nlohmann::json prescription = {
+			{"type", "Prescription"},
+			{"description", "Prescription " + suffix},
+			{"label", "Plan 0"},
+			{"num_fractions", index},
+			{"plans", plans}
+		};
+		const nlohmann::json diagnose = {
+			{"type", "Diagnosis"},
+			{"description", "Diagnose " + suffix},
+			{"label", ""},
+			{"prescriptions", {prescription, prescription}}
+		};
+		Patient::DiagnoseList diagnoses;
+		diagnoses.emplace_back(diagnose);
+		diagnoses.emplace_back(diagnose);
+		return diagnoses;
+	}
+
+	bool contains(PatientDetailCache& cache, const std::string& uri, Clock::time_point now) {
+		Patient::DiagnoseList diagnoses;
+		return cache.find(uri, diagnoses, now);
+	}
+
+	void testRoundTrip() {
+		PatientDetailCache cache(10, milliseconds(1000));
+		const Clock::time_point now = Clock::now();
+		const Patient::DiagnoseList diagnoses = makeDiagnoses(7);
+		cache.insert("a", diagnoses, now);
+		cache.insert("empty", Patient::DiagnoseList(), now);
+
+		// The copy is allocated with the allocator of the output list
+		std::pmr::monotonic_buffer_resource arena;
+		Patient::DiagnoseList found(&arena);
+		CHECK(cache.find("a", found, now));
+		CHECK(found == diagnoses);
+		CHECK(found.get_allocator().resource() == &arena);
+		CHECK(found[0].get_allocator().resource() == &arena);
+
+		CHECK(cache.find("empty", found, now));
+		CHECK(found.empty());
+	}
+
+	void testExpiration() {
+		PatientDetailCache cache(10, milliseconds(100));
+		const Clock::time_point now = Clock::now();
+		cache.insert("a", makeDiagnoses(1), now);
+		CHECK(contains(cache, "a", now + milliseconds(99)));
+		CHECK(!contains(cache, "a", now + milliseconds(100)));
+		// The expired entry is removed when it is found
+		CHECK(cache.size() == 0);
+
+		// Storing again restarts the time to live
+		cache.insert("a", makeDiagnoses(1), now);
+		cache.insert("a", makeDiagnoses(2), now + milliseconds(50));
+		CHECK(cache.size() == 1);
+		Patient::DiagnoseList found;
+		CHECK(cache.find("a", found, now + milliseconds(120)));
+		CHECK(found == makeDiagnoses(2));
+	}
+
+	void testLeastRecentlyUsedEviction() {
+		PatientDetailCache cache(2, milliseconds(1000));
+		const Clock::time_point now = Clock::now();
+		cache.insert("a", makeDiagnoses(1), now);
+		cache.insert("b", makeDiagnoses(2), now);
+		// Finding an entry makes it the most recently used
+		CHECK(contains(cache, "a", now));
+		cache.insert("c", makeDiagnoses(3), now);
+		CHECK(cache.size() == 2);
+		CHECK(!contains(cache, "b", now));
+		CHECK(contains(cache, "a", now));
+		CHECK(contains(cache, "c", now));
+
+		// Replacing an entry makes it the most recently used
+		cache.insert("a", makeDiagnoses(4), now);
+		cache.insert("d", makeDiagnoses(5), now);
+		CHECK(!contains(cache, "c", now));
+		CHECK(contains(cache, "a", now));
+		CHECK(contains(cache, "d", now));
+	}
+
+	void testInvalidateAndClear() {
+		PatientDetailCache cache(10, milliseconds(1000));
+		const Clock::time_point now = Clock::now();
+		cache.insert("a", makeDiagnoses(1), now);
+		cache.insert("b", makeDiagnoses(2), now);
+		cache.invalidate("a");
+		cache.invalidate("unknown");
+		CHECK(!contains(cache, "a", now));
+		CHECK(contains(cache, "b", now));
+		cache.clear();
+		CHECK(cache.size() == 0);
+		// The cache stays usable
+		cache.insert("a", makeDiagnoses(1), now);
+		CHECK(contains(cache, "a", now));
+	}
+
+	void testConfigure() {
+		PatientDetailCache cache(10, milliseconds(1000));
+		const Clock::time_point now = Clock::now();
+		for (int i = 0; i < 5; ++i) {
+			cache.insert(std::to_string(i), makeDiagnoses(i), now);
+		}
+		// Shrinking evicts the least recently used entries
+		cache.configure(2, milliseconds(1000));
+		CHECK(cache.size() == 2);
+		CHECK(contains(cache, "3", now));
+		CHECK(contains(cache, "4", now));
+
+		// A capacity of 0 disables the cache
+		cache.configure(0, milliseconds(1000));
+		CHECK(!cache.isEnabled());
+		CHECK(cache.size() == 0);
+		cache.insert("a", makeDiagnoses(1), now);
+		CHECK(cache.size() == 0);
+
+		// So does a time to live of 0, which also drops the entries
+		cache.configure(10, milliseconds(1000));
+		cache.insert("a", makeDiagnoses(1), now);
+		cache.configure(10, milliseconds(0));
+		CHECK(!cache.isEnabled());
+		CHECK(cache.size() == 0);
+		cache.insert("a", makeDiagnoses(1), now);
+		CHECK(!contains(cache, "a", now));
+	}
+
+	void testConcurrentUse() {
+		constexpr size_t capacity = 16;
+		PatientDetailCache cache(capacity, milliseconds(1000));
+		const Clock::time_point now = Clock::now();
+		std::vector<std::thread> threads;
+		for (int t = 0; t < 4; ++t) {
+			threads.emplace_back([&cache, now, t]() {
+				for (int i = 0; i < 500; ++i) {
+					const std::string uri = std::to_string((i * 7 + t) % 40);
+					Patient::DiagnoseList found;
+					if (cache.find(uri, found, now)) {
+						CHECK(!found.empty());
+					}
+					cache.insert(uri, makeDiagnoses(i), now);
+					if (i % 50 == 0) {
+						cache.invalidate(uri);
+					}
+				}
+			});
+		}
+		for (std::thread& thread : threads) {
+			thread.join();
+		}
+		CHECK(cache.size() <= capacity);
+	}
+}  // namespace
+
+int main() {
+	Test::run("round trip", testRoundTrip);
+	Test::run("expiration", testExpiration);
+	Test::run("least recently used eviction", testLeastRecentlyUsedEviction);
+	Test::run("invalidate and clear", testInvalidateAndClear);
+	Test::run("configure", testConfigure);
+	Test::run("concurrent use", testConcurrentUse);
+	return Test::result();
+}
@@ -0,0 +1,160 @@
+// Tests that parseUpdateSubscriptions and parseUpdateSubscriptionsDom accept and reject the
+// same frames and give the same result, in particular for missing fields and fields of
+// another type.
+#include "patient_parser.h"
+#include "test_util.h"
+#include <string>
+
+using namespace ViewRay;
+
+namespace {
+	struct Results {
+		bool saxOk = false;
+		bool domOk = false;
+		UpdateSubscriptions sax;
+		UpdateSubscriptions dom;
+	};
+
+	/// Parse a frame with both parsers and check that they agree
+	void parseBoth(const std::string& frame, Results& results) {
+		results.saxOk = parseUpdateSubscriptions(frame, results.sax);
+		results.domOk = parseUpdateSubscriptionsDom(frame, results.dom);
+		CHECK(results.saxOk == results.domOk);
+		if (!results.saxOk || !results.domOk) {
+			return;
+		}
+		const UpdateSubscriptions& sax = results.sax;
+		const UpdateSubscriptions& dom = results.dom;
+		CHECK(sax.hasPatientList == dom.hasPatientList);
+		CHECK(sax.patients.size() == dom.patients.size());
+		for (size_t i = 0; i < sax.patients.size() && i < dom.patients.size(); ++i) {
+			CHECK(sax.patients[i].first == dom.patients[i].first);
+			CHECK(sax.patients[i].second.hasSameSummary(dom.patients[i].second));
+		}
+		CHECK(sax.diagnoses.size() == dom.diagnoses.size());
+		for (size_t i = 0; i < sax.diagnoses.size() && i < dom.diagnoses.size(); ++i) {
+			CHECK(sax.diagnoses[i].first == dom.diagnoses[i].first);
+			CHECK(sax.diagnoses[i].second == dom.diagnoses[i].second);
+		}
+	}
+
+	std::string update(const std::string& resources) {
+		return R"({"updateSubscriptions":{)" + resources + "}}";
+	}
+
+	void testCompleteFrame() {
+		Results results;
+		parseBoth(update(R"(
+			"public:patients":{"type":"PatientList","value":[{
+				"uri":"patient:1","id":"1","mrn":"MRN1","date_of_birth":"1970-01-01",
+				"first_name":"A","middle_name":"B","last_name":"C","sex":"F",
+				"fractions_total":30,"fractions_completed":3,"weight_kg":70,
+				"registration_time":12,"ready_for_treatment":true
+			}]},
+			"patient:1":{"type":"Patient","diagnoses":[{
+				"type":"Diagnosis","description":"D","label":"L","prescriptions":[{
+					"type":"Prescription","description":"P","label":"L",
+					"num_fractions":30,"plans":[{"type":"Plan","label":"L"}]
+				}]
+			}]}
+		)"), results);
+		CHECK(results.saxOk);
+		CHECK(results.dom.patients.size() == 1);
+		CHECK(results.dom.patients[0].second.getFractionsCompleted() == 3);
+		CHECK(results.dom.diagnoses.size() == 1);
+	}
+
+	void testMissingFields() {
+		Results results;
+		parseBoth(update(R"(
+			"public:patients":{"value":[{"uri":"patient:1"},{"id":"2"}]},
+			"patient:1":{"diagnoses":[{"prescriptions":[{"plans":[{}]}]}]},
+			"patient:2":{}
+		)"), results);
+		CHECK(results.domOk);
+		CHECK(results.dom.patients.size() == 2);
+		CHECK(results.dom.patients[1].first.empty());
+		CHECK(results.dom.patients[0].second.getSex() == Patient::Sex::Unknown);
+		CHECK(results.dom.diagnoses.size() == 2);
+		CHECK(results.dom.diagnoses[1].second.empty());
+
+		// A list without patients
+		Results empty;
+		parseBoth(update(R"("public:patients":{"type":"PatientList"})"), empty);
+		CHECK(empty.domOk);
+		CHECK(empty.dom.hasPatientList);
+		CHECK(empty.dom.patients.empty());
+	}
+
+	void testFieldsOfAnotherType() {
+		Results results;
+		parseBoth(update(R"(
+			"public:patients":{"type":1,"value":[
+				{"uri":2,"id":["1"],"sex":0,"fractions_total":"30","weight_kg":70.5,
+					"ready_for_treatment":1,"diagnoses":[{}]},
+				3, "patient", null
+			]},
+			"patient:1":{"diagnoses":[1,{"description":2,"prescriptions":{}},[]]},
+			"patient:2":{"diagnoses":"none"},
+			"patient:3":"not an object"
+		)"), results);
+		CHECK(results.domOk);
+		CHECK(results.dom.patients.size() == 1);
+		CHECK(results.dom.patients[0].second.getWeightKg() == 70);
+		CHECK(!results.dom.patients[0].second.isReadyForTreatment());
+		CHECK(results.dom.diagnoses.size() == 2);
+		CHECK(results.dom.diagnoses[0].second.size() == 1);
+	}
+
+	void testNumbersOutOfRange() {
+		Results results;
+		parseBoth(update(R"(
+			"public:patients":{"value":[
+				{"uri":"patient:1","weight_kg":1e20,"fractions_total":3000000000,
+					"fractions_completed":-3000000000,"registration_time":-2147483648.5},
+				{"uri":"patient:2","weight_kg":2147483647,"fractions_total":-2147483648,
+					"fractions_completed":12.9,"registration_time":-1e300}
+			]},
+			"patient:1":{"diagnoses":[{"prescriptions":[{"num_fractions":18446744073709551615}]}]}
+		)"), results);
+		CHECK(results.domOk);
+		CHECK(results.dom.patients.size() == 2);
+		const Patient& outOfRange = results.dom.patients[0].second;
+		CHECK(outOfRange.getWeightKg() == 0);
+		CHECK(outOfRange.getFractionsTotal() == 0);
+		CHECK(outOfRange.getFractionsCompleted() == 0);
+		CHECK(outOfRange.getRegistrationTime() == -2147483647 - 1);
+		const Patient& limits = results.dom.patients[1].second;
+		CHECK(limits.getWeightKg() == 2147483647);
+		CHECK(limits.getFractionsTotal() == -2147483647 - 1);
+		CHECK(limits.getFractionsCompleted() == 12);
+		CHECK(limits.getRegistrationTime() == 0);
+		CHECK(results.dom.diagnoses.size() == 1);
+		CHECK(results.dom.diagnoses[0].second[0].getPrescriptions()[0].getNumFractions() == 0);
+	}
+
+	void testWrongType() {
+		const char* frames[] = {
+			R"("public:patients":{"type":"Patient","value":[]})",
+			R"("patient:1":{"type":"PatientList"})",
+			R"("patient:1":{"diagnoses":[{"type":"Plan"}]})",
+			R"("patient:1":{"diagnoses":[{"prescriptions":[{"type":"Diagnosis"}]}]})",
+			R"("patient:1":{"diagnoses":[{"prescriptions":[{"plans":[{"type":"x"}]}]}]})"
+		};
+		for (const char* frame : frames) {
+			Results results;
+			parseBoth(update(frame), results);
+			CHECK(!results.saxOk);
+			CHECK(!results.domOk);
+		}
+	}
+}  // namespace
+
+int main() {
+	Test::run("complete frame", testCompleteFrame);
+	Test::run("missing fields", testMissingFields);
+	Test::run("fields of another type", testFieldsOfAnotherType);
+	Test::run("numbers out of range", testNumbersOutOfRange);
+	Test::run("wrong type", testWrongType);
+	return Test::result();
+}
@@ -0,0 +1,293 @@
+// Tests that PatientSnapshot loads what it saved and rejects truncated and corrupted files
+// without reading outside of them.
+#include "patient_snapshot.h"
+#include "test_util.h"
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <utility>
+
+using namespace ViewRay;
+
+namespace {
+	using PatientMap = std::map<std::string, Patient>;
+
+	/// Offsets of the fields in the header of the file
+	constexpr size_t headerSize = 64;
+	constexpr size_t patientsField = 24;
+	constexpr size_t diagnosesField = 28;
+	constexpr size_t prescriptionsField = 32;
+	constexpr size_t plansField = 36;
+	constexpr size_t stringsField = 40;
+	constexpr size_t stringBytesField = 48;
+	constexpr size_t fileSizeField = 56;
+
+	/// Columns in file order, named by the index of their first column
+	enum Column {
+		Uri = 0,
+		Sex = 7,
+		ReadyForTreatment = 8,
+		DiagnoseOffsets = 13,
+		PlanLabel = 21
+	};
+
+	Patient makePatient(const std::string& id) {
+		const nlohmann::json plan = {{"type", "Plan"}, {"label", "Plan " + id}};
+		const nlohmann::json prescription = {
+			{"type", "Prescription"},
+			{"description", "Prescription " + id},
+			{"label", "Label"},
+			{"num_fractions", 5},
+			{"plans", {plan, plan}}
+		};
+		const nlohmann::json diagnose = {
+			{"type", "Diagnosis"},
+			{"description", "Diagnose " + id},
+			{"label", "Label"},
+			{"prescriptions", {prescription}}
+		};
+		Patient patient(nlohmann::json{
+			{"id", id},
+			{"mrn", "MRN" + id},
+			{"first_name", "First " + id},
+			{"sex", "F"},
+			{"fractions_total", 30},
+			{"weight_kg", 70},
+			{"ready_for_treatment", true}
+		});
+		patient.diagnosesFromJson(nlohmann::json::array({diagnose}));
+		return patient;
+	}
+
+	PatientMap makePatients(int count) {
+		PatientMap patients;
+		for (int i = 0; i < count; ++i) {
+			patients.emplace("patient:" + std::to_string(i), makePatient(std::to_string(i)));
+		}
+		return patients;
+	}
+
+	std::string testPath(const std::string& name) {
+		return (std::filesystem::temp_directory_path() / ("patient_snapshot_test_" + name))
+			.string();
+	}
+
+	std::string readFile(const std::string& path) {
+		std::ifstream in(path, std::ios::binary);
+		return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+	}
+
+	void writeFile(const std::string& path, const std::string& bytes) {
+		std::ofstream out(path, std::ios::binary | std::ios::trunc);
+		out.write(bytes.data(), std::streamsize(bytes.size()));
+	}
+
+	template <typename T>
+	T get(const std::string& bytes, size_t offset) {
+		T value;
+		std::memcpy(&value, bytes.data() + offset, sizeof(value));
+		return value;
+	}
+
+	template <typename T>
+	void set(std::string& bytes, size_t offset, T value) {
+		std::memcpy(&bytes[offset], &value, sizeof(value));
+	}
+
+	size_t align(size_t position) {
+		return (position + 7) / 8 * 8;
+	}
+
+	/// Position of the end offsets of the strings
+	size_t stringOffsets() {
+		return headerSize;
+	}
+
+	/// Position of the first byte of a column, computed the same way as the file is written
+	size_t columnStart(const std::string& bytes, Column column) {
+		const uint64_t patients = get<uint32_t>(bytes, patientsField);
+		const uint64_t diagnoses = get<uint32_t>(bytes, diagnosesField);
+		const uint64_t prescriptions = get<uint32_t>(bytes, prescriptionsField);
+		const uint64_t plans = get<uint32_t>(bytes, plansField);
+		const uint64_t strings = get<uint32_t>(bytes, stringsField);
+		// Number of values and size of a value of each column
+		const std::pair<uint64_t, size_t> columns[] = {
+			{patients, 4}, {patients, 4}, {patients, 4}, {patients, 4}, {patients, 4},
+			{patients, 4}, {patients, 4}, {patients, 1}, {patients, 1}, {patients, 4},
+			{patients, 4}, {patients, 4}, {patients, 4}, {patients + 1, 4},
+			{diagnoses, 4}, {diagnoses, 4}, {diagnoses + 1, 4},
+			{prescriptions, 4}, {prescriptions, 4}, {prescriptions, 4}, {prescriptions + 1, 4},
+			{plans, 4}
+		};
+		size_t position = align(stringOffsets() + (strings + 1) * sizeof(uint64_t));
+		position += size_t(get<uint64_t>(bytes, stringBytesField));
+		for (int i = 0; i < int(column); ++i) {
+			position = align(position) + size_t(columns[i].first * columns[i].second);
+		}
+		return align(position);
+	}
+
+	/// Save a table with a few patients and return the bytes of the file
+	std::string savedBytes() {
+		const std::string path = testPath("saved");
+		const EC::ErrorCode err = PatientSnapshot::save(PatientTable(makePatients(3)), path);
+		CHECK(!err.hasError());
+		const std::string bytes = readFile(path);
+		std::filesystem::remove(path);
+		return bytes;
+	}
+
+	/// Load a file with the given bytes and check that it is rejected
+	void checkInvalid(const std::string& bytes) {
+		const std::string path = testPath("invalid");
+		writeFile(path, bytes);
+		PatientTable table(makePatients(1));
+		const EC::ErrorCode err = PatientSnapshot::load(path, table);
+		CHECK(err.hasError());
+		CHECK(err.getStatus() == PatientSnapshot::InvalidSnapshot);
+		// The table is left as it was
+		CHECK(table.size() == 1);
+		CHECK(table[0].getId() == "0");
+		std::filesystem::remove(path);
+	}
+
+	void testSaveAndLoad() {
+		const PatientTable table(makePatients(3));
+		const std::string path = testPath("roundtrip");
+		CHECK(!PatientSnapshot::save(table, path).hasError());
+
+		PatientTable loaded;
+		PatientSnapshot::Info info;
+		CHECK(!PatientSnapshot::load(path, loaded, &info).hasError());
+		CHECK(info.patients == 3);
+		CHECK(info.diagnoses == 3);
+		CHECK(info.prescriptions == 3);
+		CHECK(info.plans == 6);
+		CHECK(info.strings == table.getStrings().size());
+		CHECK(loaded.size() == table.size());
+		for (uint32_t row = 0; row < table.size() && row < loaded.size(); ++row) {
+			CHECK(loaded[row].getUri() == table[row].getUri());
+			const Patient expected = table.toPatient(row);
+			const Patient actual = loaded.toPatient(row);
+			CHECK(actual.hasSameSummary(expected));
+			CHECK(actual.hasSameDiagnoses(expected.getDiagnoses()));
+		}
+
+		// The loaded table refers to the mapping, which stays valid after the file is removed
+		std::filesystem::remove(path);
+		CHECK(loaded[2].getFirstName() == "First 2");
+		CHECK(loaded[2].getSex() == Patient::Sex::Female);
+		CHECK(loaded[2].isReadyForTreatment());
+	}
+
+	void testEmptyTable() {
+		const std::string path = testPath("empty");
+		CHECK(!PatientSnapshot::save(PatientTable(), path).hasError());
+		PatientTable loaded(makePatients(1));
+		CHECK(!PatientSnapshot::load(path, loaded).hasError());
+		CHECK(loaded.empty());
+		std::filesystem::remove(path);
+	}
+
+	void testTruncated() {
+		const std::string bytes = savedBytes();
+		for (const size_t size : {size_t(1), headerSize - 1, headerSize, bytes.size() / 2,
+				 bytes.size() - 1}) {
+			checkInvalid(bytes.substr(0, size));
+
+			// Also with a header which matches the size, so that the sections are too short
+			if (size >= headerSize) {
+				std::string truncated = bytes.substr(0, size);
+				set<uint64_t>(truncated, fileSizeField, truncated.size());
+				checkInvalid(truncated);
+			}
+		}
+	}
+
+	void testBadStrings() {
+		const std::string bytes = savedBytes();
+		const uint32_t strings = get<uint32_t>(bytes, stringsField);
+		const uint64_t stringBytes = get<uint64_t>(bytes, stringBytesField);
+
+		// A string ID past the end of the string table
+		std::string corrupted = bytes;
+		set<uint32_t>(corrupted, columnStart(bytes, Uri), strings);
+		checkInvalid(corrupted);
+		corrupted = bytes;
+		set<uint32_t>(corrupted, columnStart(bytes, PlanLabel) + 4, UINT32_MAX);
+		checkInvalid(corrupted);
+
+		// End offsets of the strings which do not start at 0, go back or leave the characters
+		corrupted = bytes;
+		set<uint64_t>(corrupted, stringOffsets(), 1);
+		checkInvalid(corrupted);
+		corrupted = bytes;
+		set<uint64_t>(corrupted, stringOffsets() + 2 * sizeof(uint64_t), 0);
+		set<uint64_t>(corrupted, stringOffsets() + sizeof(uint64_t), 1);
+		checkInvalid(corrupted);
+		corrupted = bytes;
+		set<uint64_t>(corrupted, stringOffsets() + sizeof(uint64_t), stringBytes + 1);
+		checkInvalid(corrupted);
+	}
+
+	void testBadOffsets() {
+		const std::string bytes = savedBytes();
+		const size_t offsets = columnStart(bytes, DiagnoseOffsets);
+		const uint32_t diagnoses = get<uint32_t>(bytes, diagnosesField);
+
+		// Not starting at 0
+		std::string corrupted = bytes;
+		set<uint32_t>(corrupted, offsets, 1);
+		checkInvalid(corrupted);
+		// Not ending at the number of diagnoses
+		corrupted = bytes;
+		set<uint32_t>(corrupted, offsets + 3 * sizeof(uint32_t), diagnoses + 1);
+		checkInvalid(corrupted);
+		// Going back
+		corrupted = bytes;
+		set<uint32_t>(corrupted, offsets + sizeof(uint32_t), diagnoses);
+		set<uint32_t>(corrupted, offsets + 2 * sizeof(uint32_t), 0);
+		checkInvalid(corrupted);
+	}
+
+	void testBadValues() {
+		const std::string bytes = savedBytes();
+		std::string corrupted = bytes;
+		set<uint8_t>(corrupted, columnStart(bytes, Sex), uint8_t(Patient::Sex::Unknown) + 1);
+		checkInvalid(corrupted);
+		corrupted = bytes;
+		set<uint8_t>(corrupted, columnStart(bytes, ReadyForTreatment) + 1, 2);
+		checkInvalid(corrupted);
+
+		// The largest valid values are accepted
+		corrupted = bytes;
+		set<uint8_t>(corrupted, columnStart(bytes, Sex), uint8_t(Patient::Sex::Unknown));
+		const std::string path = testPath("values");
+		writeFile(path, corrupted);
+		PatientTable loaded;
+		CHECK(!PatientSnapshot::load(path, loaded).hasError());
+		CHECK(loaded.size() == 3 && loaded[0].getSex() == Patient::Sex::Unknown);
+		std::filesystem::remove(path);
+	}
+
+	void testNotASnapshot() {
+		std::string bytes = savedBytes();
+		bytes[0] = 'X';
+		checkInvalid(bytes);
+	}
+}  // namespace
+
+int main() {
+	Test::run("save and load", testSaveAndLoad);
+	Test::run("empty table", testEmptyTable);
+	Test::run("truncated", testTruncated);
+	Test::run("bad strings", testBadStrings);
+	Test::run("bad offsets", testBadOffsets);
+	Test::run("bad values", testBadValues);
+	Test::run("not a snapshot", testNotASnapshot);
+	return Test::result();
+}
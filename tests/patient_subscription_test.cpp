@@ -0,0 +1,165 @@
+// Tests of the diffing of a subscribed patient list: the URIs to subscribe and unsubscribe
+// when public:patients is pushed again, and the changes reported by PatientListSubscription
+// to its listeners.
+#include "patient_subscription.h"
+#include "test_util.h"
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace ViewRay;
+
+namespace {
+	using Update = std::vector<std::pair<std::string, Patient>>;
+	using Type = PatientListSubscription::ChangeType;
+	/// The type and the URI of each reported change
+	using Changes = std::vector<std::pair<Type, std::string>>;
+
+	Patient makePatient(const std::string& id, int fractionsCompleted) {
+		return Patient(nlohmann::json{
+			{"id", id},
+			{"mrn", "MRN" + id},
+			{"date_of_birth", "1970-01-01"},
+			{"first_name", "First"},
+			{"middle_name", ""},
+			{"last_name", "Last"},
+			{"sex", "F"},
+			{"fractions_total", 30},
+			{"fractions_completed", fractionsCompleted},
+			{"weight_kg", 70},
+			{"ready_for_treatment", true},
+			{"registration_time", 0}
+		});
+	}
+
+	/// public:patients with the given patient URIs
+	Update makeUpdate(const std::vector<std::string>& uris, int fractionsCompleted = 0) {
+		Update update;
+		for (const std::string& uri : uris) {
+			update.emplace_back(uri, makePatient(uri, fractionsCompleted));
+		}
+		return update;
+	}
+
+	std::vector<std::string> sorted(std::vector<std::string> uris) {
+		std::sort(uris.begin(), uris.end());
+		return uris;
+	}
+
+	void testSubscribedUris() {
+		SubscribedUris subscribed;
+		std::vector<std::string> added;
+		std::vector<std::string> removed;
+		subscribed.apply(makeUpdate({"a", "b", "c"}), added, removed);
+		CHECK(sorted(added) == (std::vector<std::string>{"a", "b", "c"}));
+		CHECK(removed.empty());
+
+		// Patients which left the list are unsubscribed, the new ones subscribed
+		added.clear();
+		subscribed.apply(makeUpdate({"b", "d"}), added, removed);
+		CHECK(added == std::vector<std::string>{"d"});
+		CHECK(sorted(removed) == (std::vector<std::string>{"a", "c"}));
+		CHECK(subscribed.size() == 2);
+		CHECK(subscribed.contains("b"));
+		CHECK(subscribed.contains("d"));
+		CHECK(!subscribed.contains("a"));
+
+		// The same list changes nothing, a patient which comes back is subscribed again
+		added.clear();
+		removed.clear();
+		subscribed.apply(makeUpdate({"d", "b"}), added, removed);
+		CHECK(added.empty());
+		CHECK(removed.empty());
+		subscribed.apply(makeUpdate({"a", "b", "d", "d"}), added, removed);
+		CHECK(added == std::vector<std::string>{"a"});
+		CHECK(removed.empty());
+
+		// An empty list unsubscribes everything
+		added.clear();
+		subscribed.apply(Update(), added, removed);
+		CHECK(added.empty());
+		CHECK(sorted(removed) == (std::vector<std::string>{"a", "b", "d"}));
+		CHECK(subscribed.size() == 0);
+	}
+
+	bool hasChange(const Changes& changes, Type type, const std::string& uri) {
+		return std::find(changes.begin(), changes.end(), std::make_pair(type, uri)) !=
+			changes.end();
+	}
+
+	void testListChanges() {
+		PatientListSubscription subscription;
+		Changes changes;
+		subscription.addListener([&changes](const std::vector<PatientListSubscription::Change>& c) {
+			for (const PatientListSubscription::Change& change : c) {
+				changes.emplace_back(change.type, *change.uri);
+			}
+		});
+		CHECK(!subscription.isSynced());
+
+		subscription.applyPatientList(makeUpdate({"a", "b"}));
+		CHECK(subscription.isSynced());
+		CHECK(changes.size() == 2);
+		CHECK(hasChange(changes, Type::Added, "a"));
+		CHECK(hasChange(changes, Type::Added, "b"));
+
+		// Only the patients which differ are reported
+		changes.clear();
+		Update update = makeUpdate({"a"});
+		update.emplace_back("c", makePatient("c", 0));
+		update.emplace_back("b", makePatient("b", 5));
+		subscription.applyPatientList(std::move(update));
+		CHECK(changes.size() == 2);
+		CHECK(hasChange(changes, Type::Added, "c"));
+		CHECK(hasChange(changes, Type::Updated, "b"));
+
+		changes.clear();
+		subscription.applyPatientList(makeUpdate({"c"}));
+		CHECK(changes.size() == 2);
+		CHECK(hasChange(changes, Type::Removed, "a"));
+		CHECK(hasChange(changes, Type::Removed, "b"));
+		subscription.read([](const PatientListSubscription::PatientList& patients) {
+			CHECK(patients.size() == 1);
+			CHECK(patients.count("c") == 1);
+		});
+
+		// Diagnoses of unknown patients are ignored
+		changes.clear();
+		subscription.applyDiagnoses("a", Patient::DiagnoseList());
+		CHECK(changes.empty());
+	}
+
+	void testReentrantListeners() {
+		PatientListSubscription subscription;
+		int calls = 0;
+		int added = -1;
+		size_t patientsSeen = 0;
+		// A listener which reads the list and replaces itself with another one, which used to
+		// deadlock on the lock of the list
+		int id = -1;
+		id = subscription.addListener([&](const std::vector<PatientListSubscription::Change>&) {
+			++calls;
+			subscription.read([&patientsSeen](const PatientListSubscription::PatientList& list) {
+				patientsSeen = list.size();
+			});
+			subscription.removeListener(id);
+			added = subscription.addListener([&calls](const auto&) { calls += 10; });
+		});
+		subscription.applyPatientList(makeUpdate({"a", "b"}));
+		CHECK(calls == 1);
+		CHECK(patientsSeen == 2);
+		CHECK(added >= 0);
+
+		// Only the listener added by the first one is left
+		subscription.applyPatientList(makeUpdate({"a"}));
+		CHECK(calls == 11);
+	}
+}  // namespace
+
+int main() {
+	Test::run("subscribed URIs", testSubscribedUris);
+	Test::run("list changes", testListChanges);
+	Test::run("listeners change the listeners", testReentrantListeners);
+	return Test::result();
+}
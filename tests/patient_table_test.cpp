@@ -0,0 +1,82 @@
+// Tests that a PatientTable stays usable after its patients were moved to another table.
+#include "patient_table.h"
+#include "test_util.h"
+#include <map>
+#include <string>
+#include <utility>
+
+using namespace ViewRay;
+
+namespace {
+	using PatientMap = std::map<std::string, Patient>;
+
+	Patient makePatient(const std::string& id) {
+		const nlohmann::json plan = {{"type", "Plan"}, {"label", "Plan " + id}};
+		const nlohmann::json prescription = {
+			{"type", "Prescription"},
+			{"description", "Prescription " + id},
+			{"label", "Label"},
+			{"num_fractions", 5},
+			{"plans", {plan, plan}}
+		};
+		const nlohmann::json diagnose = {
+			{"type", "Diagnosis"},
+			{"description", "Diagnose " + id},
+			{"label", "Label"},
+			{"prescriptions", {prescription}}
+		};
+		Patient patient(nlohmann::json{{"id", id}, {"mrn", "MRN" + id}, {"sex", "M"}});
+		patient.diagnosesFromJson(nlohmann::json::array({diagnose}));
+		return patient;
+	}
+
+	PatientMap makePatients(int count) {
+		PatientMap patients;
+		for (int i = 0; i < count; ++i) {
+			patients.emplace("patient:" + std::to_string(i), makePatient(std::to_string(i)));
+		}
+		return patients;
+	}
+
+	/// Check that a table is empty and that patients can be added to it again
+	void checkReusable(PatientTable& table) {
+		CHECK(table.empty());
+		const uint32_t row = table.add("patient:new", makePatient("new"));
+		CHECK(row == 0);
+		CHECK(table.size() == 1);
+		CHECK(table[0].getId() == "new");
+		CHECK(table[0].getDiagnoses().size() == 1);
+		CHECK(table[0].getDiagnoses()[0].getPrescriptions().size() == 1);
+		CHECK(table[0].getDiagnoses()[0].getPrescriptions()[0].getPlans().size() == 2);
+		CHECK(table.toPatient(0).hasSameDiagnoses(makePatient("new").getDiagnoses()));
+	}
+
+	void testMoveConstruct() {
+		PatientTable table(makePatients(3));
+		PatientTable moved(std::move(table));
+		CHECK(moved.size() == 3);
+		CHECK(moved[2].getId() == "2");
+		CHECK(moved[2].getDiagnoses()[0].getDescription() == "Diagnose 2");
+		checkReusable(table);
+	}
+
+	void testMoveAssign() {
+		PatientTable table(makePatients(3));
+		PatientTable target(makePatients(1));
+		target = std::move(table);
+		CHECK(target.size() == 3);
+		CHECK(target[1].getDiagnoses()[0].getPrescriptions()[0].getPlans().size() == 2);
+		checkReusable(table);
+
+		// A table moved to itself keeps its patients
+		PatientTable& self = target;
+		target = std::move(self);
+		CHECK(target.size() == 3);
+	}
+}  // namespace
+
+int main() {
+	Test::run("move construct", testMoveConstruct);
+	Test::run("move assign", testMoveAssign);
+	return Test::result();
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <atomic>
+#include <cstdio>
+
+namespace ViewRay::Test {
+	/// @brief Number of failed checks of the test executable. Checks can fail on any thread.
+	inline std::atomic<int>& failures() {
+		static std::atomic<int> count{0};
+		return count;
+	}
+
+	/// @brief Run one test case and print its name and whether it passed
+	inline void run(const char* name, void (*test)()) {
+		const int before = failures();
+		test();
+		std::printf("%-60s %s\n", name, failures() == before ? "ok" : "FAILED");
+	}
+
+	/// @brief Exit code of the test executable
+	inline int result() {
+		return failures() == 0 ? 0 : 1;
+	}
+}  // namespace ViewRay::Test
+
+/// Report the failed condition and continue with the test case
+#define CHECK(condition)                                                                       \
+	do {                                                                                       \
+		if (!(condition)) {                                                                    \
+			std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+			++ViewRay::Test::failures();                                                       \
+		}                                                                                      \
+	} while (false)